@@ -0,0 +1,402 @@
+// allocationmap.cpp
+#include "allocationmap.h"
+#include "probeengine.h"
+#include "utils.h"
+#include <QByteArray>
+#include <QFileInfo>
+#include <QStringList>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+
+namespace {
+
+using Range = AllocationMap::Range;
+
+// Хвост устройства копируется всегда: резервная копия GPT
+const quint64 TailSize = 1024 * 1024;
+
+// FAT и битовые карты читаются кусками, а не целиком (FAT32 на 2 TB - 2 GB)
+const size_t ReadChunk = 4 * 1024 * 1024;
+
+quint16 le16(const uchar* p) { return static_cast<quint16>(p[0] | (p[1] << 8)); }
+quint32 le32(const uchar* p) { return static_cast<quint32>(le16(p)) | (static_cast<quint32>(le16(p + 2)) << 16); }
+quint64 le64(const uchar* p) { return static_cast<quint64>(le32(p)) | (static_cast<quint64>(le32(p + 4)) << 32); }
+
+bool readAt(int fd, quint64 offset, void* data, size_t length) {
+    size_t done = 0;
+    while (done < length) {
+        ssize_t n = ::pread(fd, static_cast<char*>(data) + done, length - done, static_cast<off_t>(offset + done));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        done += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+// Собирает свободные участки одной ФС по возрастанию смещения,
+// сливая соседние кластеры и отбрасывая слишком короткие пропуски
+class HoleCollector {
+public:
+    HoleCollector(QList<Range>* out, quint64 align, quint64 minSkip)
+        : m_out(out), m_align(qMax<quint64>(align, 1)), m_minSkip(minSkip) {}
+    ~HoleCollector() { flush(); }
+
+    void add(quint64 offset, quint64 length) {
+        if (length == 0) return;
+        if (m_length > 0 && offset == m_start + m_length) {
+            m_length += length;
+            return;
+        }
+        flush();
+        m_start = offset;
+        m_length = length;
+    }
+
+    void flush() {
+        if (m_length == 0) return;
+        const quint64 start = (m_start + m_align - 1) / m_align * m_align;
+        const quint64 end = (m_start + m_length) / m_align * m_align;
+        if (end > start && end - start >= m_minSkip) {
+            m_out->append({start, end - start});
+            m_total += end - start;
+        }
+        m_length = 0;
+    }
+
+    quint64 total() const { return m_total; }
+
+private:
+    QList<Range>* m_out;
+    quint64 m_align;
+    quint64 m_minSkip;
+    quint64 m_start = 0;
+    quint64 m_length = 0;
+    quint64 m_total = 0;
+};
+
+// FAT16/FAT32: свободен кластер с нулевой записью в первой FAT
+bool fatHoles(int fd, quint64 base, quint64 size, HoleCollector& holes) {
+    uchar b[512];
+    if (!readAt(fd, base, b, sizeof(b))) return false;
+
+    const quint32 bps = le16(b + 11);
+    const quint32 spc = b[13];
+    const quint32 reserved = le16(b + 14);
+    const quint32 fats = b[16];
+    const quint32 rootEntries = le16(b + 17);
+    const quint64 totalSectors = le16(b + 19) ? le16(b + 19) : le32(b + 32);
+    const quint64 fatSize = le16(b + 22) ? le16(b + 22) : le32(b + 36);
+    if (bps < 512 || spc == 0 || fats == 0 || fatSize == 0 || totalSectors == 0) return false;
+
+    const quint64 rootDirSectors = (rootEntries * 32 + bps - 1) / bps;
+    const quint64 meta = reserved + fats * fatSize + rootDirSectors;
+    if (meta >= totalSectors) return false;
+    const quint64 clusters = (totalSectors - meta) / spc;
+    const bool fat32 = le16(b + 22) == 0;
+    if (!fat32 && clusters < 4085) return false;       // FAT12: 1.5 байта на запись, не стоит того
+    const quint32 width = fat32 ? 4 : 2;
+
+    const quint64 clusterBytes = static_cast<quint64>(bps) * spc;
+    const quint64 dataStart = base + meta * bps;
+    if (meta * bps + clusters * clusterBytes > size) return false;
+
+    QByteArray chunk;
+    const quint64 fatStart = base + static_cast<quint64>(reserved) * bps;
+    const quint64 entries = clusters + 2;
+    const quint64 perChunk = ReadChunk / width;
+    for (quint64 first = 0; first < entries; first += perChunk) {
+        const quint64 count = qMin(perChunk, entries - first);
+        chunk.resize(static_cast<qsizetype>(count * width));
+        if (!readAt(fd, fatStart + first * width, chunk.data(), static_cast<size_t>(chunk.size()))) return false;
+        const uchar* p = reinterpret_cast<const uchar*>(chunk.constData());
+        for (quint64 i = 0; i < count; ++i) {
+            const quint64 cluster = first + i;
+            if (cluster < 2) continue;
+            const quint32 entry = fat32 ? (le32(p + i * 4) & 0x0FFFFFFF) : le16(p + i * 2);
+            if (entry == 0) holes.add(dataStart + (cluster - 2) * clusterBytes, clusterBytes);
+        }
+    }
+    return true;
+}
+
+// exFAT: свободен кластер с нулевым битом в битовой карте распределения
+bool exfatHoles(int fd, quint64 base, quint64 size, HoleCollector& holes) {
+    uchar b[512];
+    if (!readAt(fd, base, b, sizeof(b))) return false;
+
+    const int sectorShift = b[0x6C];
+    const int clusterShift = sectorShift + b[0x6D];
+    if (sectorShift < 9 || sectorShift > 12 || clusterShift > 25) return false;
+    const quint64 fatStart = base + (static_cast<quint64>(le32(b + 0x50)) << sectorShift);
+    const quint64 heapStart = base + (static_cast<quint64>(le32(b + 0x58)) << sectorShift);
+    const quint64 clusterCount = le32(b + 0x5C);
+    const quint32 rootCluster = le32(b + 0x60);
+    const quint64 clusterBytes = 1ULL << clusterShift;
+    if (heapStart - base + clusterCount * clusterBytes > size) return false;
+
+    auto clusterOffset = [&](quint64 cluster) { return heapStart + (cluster - 2) * clusterBytes; };
+    auto valid = [&](quint64 cluster) { return cluster >= 2 && cluster < clusterCount + 2; };
+    auto next = [&](quint32 cluster) -> quint32 {
+        uchar e[4];
+        if (!readAt(fd, fatStart + static_cast<quint64>(cluster) * 4, e, 4)) return 0;
+        return le32(e);
+    };
+
+    // Запись битовой карты (0x81) ищется в корневом каталоге
+    quint32 bitmapCluster = 0;
+    quint64 bitmapLength = 0;
+    QByteArray dir(static_cast<qsizetype>(clusterBytes), '\0');
+    quint32 cluster = rootCluster;
+    for (int guard = 0; valid(cluster) && guard < 256 && bitmapCluster == 0; ++guard) {
+        if (!readAt(fd, clusterOffset(cluster), dir.data(), static_cast<size_t>(clusterBytes))) return false;
+        const uchar* d = reinterpret_cast<const uchar*>(dir.constData());
+        bool end = false;
+        for (quint64 off = 0; off + 32 <= clusterBytes; off += 32) {
+            if (d[off] == 0x00) {
+                end = true;
+                break;
+            }
+            if (d[off] == 0x81 && (d[off + 1] & 1) == 0) {
+                bitmapCluster = le32(d + off + 20);
+                bitmapLength = le64(d + off + 24);
+                break;
+            }
+        }
+        if (end) break;
+        cluster = next(cluster);
+    }
+    if (!valid(bitmapCluster) || bitmapLength < (clusterCount + 7) / 8) return false;
+
+    quint64 bit = 0;
+    cluster = bitmapCluster;
+    QByteArray bitmap(static_cast<qsizetype>(clusterBytes), '\0');
+    while (bit < clusterCount) {
+        if (!valid(cluster)) return false;
+        if (!readAt(fd, clusterOffset(cluster), bitmap.data(), static_cast<size_t>(clusterBytes))) return false;
+        const uchar* p = reinterpret_cast<const uchar*>(bitmap.constData());
+        for (quint64 i = 0; i < clusterBytes * 8 && bit < clusterCount; ++i, ++bit) {
+            if ((p[i / 8] & (1u << (i % 8))) == 0) holes.add(clusterOffset(bit + 2), clusterBytes);
+        }
+        cluster = next(cluster);
+    }
+    return true;
+}
+
+bool extHasSuper(quint64 group, bool sparse) {
+    if (group <= 1 || !sparse) return true;
+    for (quint64 base : {3ULL, 5ULL, 7ULL}) {
+        quint64 p = base;
+        while (p < group) p *= base;
+        if (p == group) return true;
+    }
+    return false;
+}
+
+// ext2/3/4: свободные блоки по битовым картам групп. Группы BLOCK_UNINIT
+// не имеют карты: заняты в них только метаданные, которые ядро вычисляет
+// так же - суперблок с таблицей дескрипторов и карты/таблицы inode
+bool extHoles(int fd, quint64 base, quint64 size, HoleCollector& holes) {
+    uchar sb[1024];
+    if (!readAt(fd, base + 1024, sb, sizeof(sb))) return false;
+    if (le16(sb + 0x38) != 0xEF53) return false;
+
+    const quint32 compat = le32(sb + 0x5C);
+    const quint32 incompat = le32(sb + 0x60);
+    const quint32 roCompat = le32(sb + 0x64);
+    // meta_bg и sparse_super2 размещают дескрипторы иначе - копируем целиком
+    if ((incompat & 0x0010) || (compat & 0x0200)) return false;
+
+    const bool is64 = incompat & 0x0080;
+    const quint32 logBlock = le32(sb + 0x18);
+    if (logBlock > 6) return false;
+    const quint64 blockSize = 1024ULL << logBlock;
+    quint64 blocksCount = le32(sb + 0x04);
+    if (is64) blocksCount |= static_cast<quint64>(le32(sb + 0x150)) << 32;
+    const quint64 firstDataBlock = le32(sb + 0x14);
+    const quint64 blocksPerGroup = le32(sb + 0x20);
+    const quint64 inodesPerGroup = le32(sb + 0x28);
+    const quint32 inodeSize = le32(sb + 0x4C) >= 1 ? le16(sb + 0x58) : 128;
+    const quint64 reservedGdt = le16(sb + 0xCE);
+    const quint32 descSize = is64 ? qMax<quint32>(le16(sb + 0xFE), 32) : 32;
+    if (blocksPerGroup == 0 || blocksPerGroup > blockSize * 8 || inodeSize == 0) return false;
+    if (blocksCount * blockSize > size || blocksCount <= firstDataBlock) return false;
+
+    const quint64 groups = (blocksCount - firstDataBlock + blocksPerGroup - 1) / blocksPerGroup;
+    const quint64 gdtBlocks = (groups * descSize + blockSize - 1) / blockSize;
+    const quint64 itableBlocks = (inodesPerGroup * inodeSize + blockSize - 1) / blockSize;
+    const bool sparse = roCompat & 0x0001;
+
+    QByteArray gdt(static_cast<qsizetype>(groups * descSize), '\0');
+    if (!readAt(fd, base + (firstDataBlock + 1) * blockSize, gdt.data(), static_cast<size_t>(gdt.size()))) return false;
+    const uchar* gd = reinterpret_cast<const uchar*>(gdt.constData());
+
+    auto descField = [&](quint64 g, int lo, int hi) {
+        quint64 value = le32(gd + g * descSize + lo);
+        if (is64 && descSize >= 64) value |= static_cast<quint64>(le32(gd + g * descSize + hi)) << 32;
+        return value;
+    };
+
+    // Метаданные всех групп (блоки, не байты); при flex_bg лежат в чужих группах
+    QList<Range> meta;
+    for (quint64 g = 0; g < groups; ++g) {
+        const quint64 start = firstDataBlock + g * blocksPerGroup;
+        if (extHasSuper(g, sparse)) meta.append({start, 1 + gdtBlocks + reservedGdt});
+        meta.append({descField(g, 0x00, 0x20), 1});               // битовая карта блоков
+        meta.append({descField(g, 0x04, 0x24), 1});               // битовая карта inode
+        meta.append({descField(g, 0x08, 0x28), itableBlocks});    // таблица inode
+    }
+    std::sort(meta.begin(), meta.end());
+
+    QByteArray bitmap(static_cast<qsizetype>(blockSize), '\0');
+    int metaIndex = 0;
+    for (quint64 g = 0; g < groups; ++g) {
+        const quint64 start = firstDataBlock + g * blocksPerGroup;
+        const quint64 count = qMin(blocksPerGroup, blocksCount - start);
+        const quint16 flags = le16(gd + g * descSize + 0x12);
+
+        if (flags & 0x0002) {   // BLOCK_UNINIT
+            quint64 cursor = start;
+            const quint64 end = start + count;
+            while (metaIndex < meta.size() && meta[metaIndex].first < end) {
+                const quint64 metaStart = meta[metaIndex].first;
+                const quint64 metaEnd = metaStart + meta[metaIndex].second;
+                if (metaEnd <= cursor) {
+                    ++metaIndex;
+                    continue;
+                }
+                if (metaStart > cursor) holes.add(base + cursor * blockSize, (metaStart - cursor) * blockSize);
+                cursor = qMax(cursor, metaEnd);
+                if (metaEnd > end) break;
+                ++metaIndex;
+            }
+            if (cursor < end) holes.add(base + cursor * blockSize, (end - cursor) * blockSize);
+            continue;
+        }
+
+        while (metaIndex < meta.size() && meta[metaIndex].first + meta[metaIndex].second <= start + count) ++metaIndex;
+        const quint64 bitmapBlock = descField(g, 0x00, 0x20);
+        if (bitmapBlock == 0 || bitmapBlock >= blocksCount) return false;
+        if (!readAt(fd, base + bitmapBlock * blockSize, bitmap.data(), static_cast<size_t>(blockSize))) return false;
+        const uchar* p = reinterpret_cast<const uchar*>(bitmap.constData());
+        for (quint64 i = 0; i < count; ++i) {
+            if ((p[i / 8] & (1u << (i % 8))) == 0) holes.add(base + (start + i) * blockSize, blockSize);
+        }
+    }
+    return true;
+}
+
+bool isExtendedPartition(const ProbePartition& part) {
+    const QString code = part.typeCode.toLower();
+    return code == "0x05" || code == "0x0f" || code == "0x85";
+}
+
+} // namespace
+
+AllocationMap AllocationMap::full(quint64 deviceSize) {
+    AllocationMap map;
+    map.m_deviceSize = deviceSize;
+    if (deviceSize > 0) map.m_ranges.append({0, deviceSize});
+    map.m_summary = "копируется целиком";
+    return map;
+}
+
+quint64 AllocationMap::usedBytes() const {
+    quint64 total = 0;
+    for (const Range& range : m_ranges) total += range.second;
+    return total;
+}
+
+AllocationMap AllocationMap::build(const QString& devicePath, quint64 align, quint64 minSkip) {
+    const ProbeResult probe = ProbeEngine::probe(devicePath);
+    if (!probe.ok || probe.deviceSize == 0) {
+        AllocationMap map = full(probe.deviceSize);
+        map.m_summary = QString("копируется целиком: %1").arg(probe.error);
+        return map;
+    }
+    const quint64 size = probe.deviceSize;
+
+    int fd = ::open(devicePath.toLocal8Bit().constData(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return full(size);
+
+    // Все до конца последнего раздела (загрузчики SD-карт живут до первого
+    // раздела, EBR - между логическими) плюс хвост с резервной GPT
+    QList<Range> used;
+    QList<Range> holes;
+    QStringList notes;
+
+    auto parse = [&](const QString& name, const QString& fsType, quint64 start, quint64 length) {
+        HoleCollector collector(&holes, align, minSkip);
+        bool ok = false;
+        if (fsType == "FAT32" || fsType == "FAT16") {
+            ok = fatHoles(fd, start, length, collector);
+        } else if (fsType == "exFAT") {
+            ok = exfatHoles(fd, start, length, collector);
+        } else if (fsType.startsWith("ext")) {
+            ok = extHoles(fd, start, length, collector);
+        }
+        collector.flush();
+        if (ok) {
+            notes << QString("%1 %2: свободно %3").arg(name).arg(fsType).arg(Utils::formatSize(static_cast<qint64>(collector.total())));
+        } else {
+            notes << QString("%1 %2: целиком").arg(name).arg(fsType.isEmpty() ? QString("?") : fsType);
+        }
+    };
+
+    if (probe.partitions.isEmpty()) {
+        used.append({0, size});
+        if (!probe.fsType.isEmpty()) parse(QFileInfo(devicePath).fileName(), probe.fsType, 0, size);
+    } else {
+        QList<ProbePartition> parts;
+        quint64 lastEnd = 0;
+        for (const ProbePartition& part : probe.partitions) {
+            if (isExtendedPartition(part) || part.startBytes >= size) continue;
+            parts.append(part);
+            lastEnd = qMax(lastEnd, qMin(size, part.startBytes + part.sizeBytes));
+        }
+        std::sort(parts.begin(), parts.end(), [](const ProbePartition& a, const ProbePartition& b) {
+            return a.startBytes < b.startBytes;
+        });
+
+        const quint64 tail = size > TailSize ? size - TailSize : 0;
+        if (lastEnd >= tail) {
+            used.append({0, size});
+        } else {
+            used.append({0, lastEnd});
+            used.append({tail, size - tail});
+        }
+        for (const ProbePartition& part : parts) {
+            parse(QString("#%1").arg(part.number), part.fsType, part.startBytes,
+                  qMin(part.sizeBytes, size - part.startBytes));
+        }
+        if (lastEnd < tail) notes << QString("после разделов: %1").arg(Utils::formatSize(static_cast<qint64>(tail - lastEnd)));
+    }
+    ::close(fd);
+
+    std::sort(holes.begin(), holes.end());
+    AllocationMap map;
+    map.m_deviceSize = size;
+    map.m_ranges = subtract(used, holes);
+    map.m_summary = notes.join(", ");
+    return map;
+}
+
+QList<AllocationMap::Range> AllocationMap::subtract(const QList<Range>& used, QList<Range> holes) {
+    QList<Range> result;
+    int h = 0;
+    for (const Range& range : used) {
+        quint64 cursor = range.first;
+        const quint64 end = range.first + range.second;
+        while (h < holes.size() && holes[h].first + holes[h].second <= cursor) ++h;
+        for (int i = h; i < holes.size() && holes[i].first < end; ++i) {
+            const quint64 holeStart = qMax(holes[i].first, cursor);
+            const quint64 holeEnd = qMin(holes[i].first + holes[i].second, end);
+            if (holeEnd <= holeStart) continue;
+            if (holeStart > cursor) result.append({cursor, holeStart - cursor});
+            cursor = holeEnd;
+        }
+        if (cursor < end) result.append({cursor, end - cursor});
+    }
+    return result;
+}
@@ -0,0 +1,34 @@
+// allocationmap.h
+#pragma once
+
+#include <QString>
+#include <QList>
+#include <utility>
+
+// Карта занятого пространства устройства: какие диапазоны нужно копировать.
+// Таблица разделов берется из ProbeEngine, свободные кластеры/блоки - из
+// FAT32/FAT16, exFAT и ext2/3/4. Все, что разобрать не удалось (NTFS,
+// неизвестные ФС, промежутки между разделами с загрузчиками), считается занятым.
+class AllocationMap {
+public:
+    using Range = std::pair<quint64, quint64>;   // (смещение, длина)
+
+    // Полная карта: все устройство занято
+    static AllocationMap full(quint64 deviceSize);
+
+    // Свободные участки короче minSkip не пропускаются, границы
+    // пропусков выравниваются внутрь на align (кратно сектору для O_DIRECT)
+    static AllocationMap build(const QString& devicePath, quint64 align, quint64 minSkip = 1024 * 1024);
+
+    const QList<Range>& ranges() const { return m_ranges; }
+    quint64 deviceSize() const { return m_deviceSize; }
+    quint64 usedBytes() const;
+    QString summary() const { return m_summary; }
+
+private:
+    QList<Range> m_ranges;      // по возрастанию, без пересечений
+    quint64 m_deviceSize = 0;
+    QString m_summary;
+
+    static QList<Range> subtract(const QList<Range>& used, QList<Range> holes);
+};
@@ -0,0 +1,385 @@
+// backupjob.cpp
+#include "backupjob.h"
+#include "bufferpool.h"
+#include "devicemanager.h"
+#include "imagesource.h"
+#include "utils.h"
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QFuture>
+#include <QThreadPool>
+#include <QtConcurrent/QtConcurrent>
+#include <QDebug>
+#include <deque>
+#include <memory>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+#include <zlib.h>
+#include <lzma.h>
+#ifdef CMILE_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+namespace {
+
+const qint64 GzipChunk = 4 * 1024 * 1024;     // окно deflate 32 KB: крупнее нет смысла
+const qint64 LargeChunk = 16 * 1024 * 1024;   // словарь xz -6 (8 MB) и zstd успевают набрать статистику
+const qint64 MemoryBudget = 1024LL * 1024 * 1024;  // буферы в полете, не больше
+
+// Весь блок из нулей: первые 8 байт нулевые и блок совпадает со своим сдвигом на 8
+bool isZero(const char* data, size_t length) {
+    if (length < 8) {
+        for (size_t i = 0; i < length; ++i) if (data[i]) return false;
+        return true;
+    }
+    static const char zeros[8] = {};
+    return memcmp(data, zeros, 8) == 0 && memcmp(data, data + 8, length - 8) == 0;
+}
+
+bool writeAll(int fd, const char* data, size_t length, off_t offset) {
+    size_t done = 0;
+    while (done < length) {
+        ssize_t n = ::pwrite(fd, data + done, length - done, offset + static_cast<off_t>(done));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        done += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+// Буфер пула делят поток чтения и задача сжатия
+using Buffer = std::shared_ptr<BufferPool::Buffer>;
+
+} // namespace
+
+BackupJob::BackupJob(const Config& cfg, QObject* parent)
+: QThread(parent), m_cfg(cfg) {}
+
+void BackupJob::cancel() {
+    m_cancelled.store(true, std::memory_order_release);
+}
+
+BackupJob::Compression BackupJob::compressionFor(const QString& imagePath) {
+    const QString name = imagePath.toLower();
+    if (name.endsWith(".gz")) return Gzip;
+    if (name.endsWith(".xz")) return Xz;
+    if (name.endsWith(".zst")) return Zstd;
+    return None;
+}
+
+bool BackupJob::isSupported(Compression compression) {
+#ifdef CMILE_HAVE_ZSTD
+    Q_UNUSED(compression);
+    return true;
+#else
+    return compression != Zstd;
+#endif
+}
+
+QString BackupJob::compressionName(Compression compression) {
+    switch (compression) {
+        case Auto: return "Авто";
+        case None: return "без сжатия";
+        case Gzip: return "gzip";
+        case Xz: return "xz";
+        case Zstd: return "zstd";
+    }
+    return QString();
+}
+
+void BackupJob::run() {
+    m_cancelled.store(false, std::memory_order_release);
+    emit progress(0, "Проверка устройства...", 0, "-");
+
+    const QString partPath = m_cfg.imagePath + ".part";
+    QString message;
+    if (backup(&message)) {
+        emit finished(true, message);
+        return;
+    }
+    QFile::remove(partPath);
+    if (m_cancelled.load(std::memory_order_acquire)) message = "Операция отменена";
+    emit finished(false, message);
+}
+
+bool BackupJob::backup(QString* message) {
+    Compression compression = m_cfg.compression == Auto ? compressionFor(m_cfg.imagePath) : m_cfg.compression;
+    if (!isSupported(compression)) {
+        *message = QString("Формат %1 недоступен в этой сборке").arg(compressionName(compression));
+        return false;
+    }
+
+    // Согласованный образ снимается только с размонтированного устройства
+    auto [unmountSuccess, unmountMessage] = DeviceManager::unmountAll(m_cfg.devicePath);
+    if (!unmountSuccess) {
+        *message = QString("Ошибка размонтирования:\n%1").arg(unmountMessage);
+        return false;
+    }
+
+    const QByteArray devPath = m_cfg.devicePath.toLocal8Bit();
+    int inputFd = ::open(devPath.constData(), O_RDONLY | O_CLOEXEC | O_DIRECT);
+    if (inputFd < 0 && errno == EINVAL) {
+        inputFd = ::open(devPath.constData(), O_RDONLY | O_CLOEXEC);
+    }
+    if (inputFd < 0) {
+        *message = QString("Ошибка открытия устройства: %1").arg(strerror(errno));
+        return false;
+    }
+
+    quint64 size = 0;
+    struct stat st;
+    if (::ioctl(inputFd, BLKGETSIZE64, &size) != 0 && ::fstat(inputFd, &st) == 0) {
+        size = static_cast<quint64>(st.st_size);
+    }
+    if (size == 0) {
+        ::close(inputFd);
+        *message = "Не удалось определить размер устройства";
+        return false;
+    }
+
+    const QString partPath = m_cfg.imagePath + ".part";
+    int outputFd = ::open(partPath.toLocal8Bit().constData(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (outputFd < 0) {
+        ::close(inputFd);
+        *message = QString("Ошибка создания файла образа: %1").arg(strerror(errno));
+        return false;
+    }
+
+    const DeviceTopology topo = DeviceManager::readTopology(m_cfg.devicePath);
+    const size_t align = qMax<size_t>(topo.alignment(), static_cast<size_t>(sysconf(_SC_PAGESIZE)));
+    qint64 chunkSize = m_cfg.chunkSize > 0 ? m_cfg.chunkSize : (compression == Gzip || compression == None ? GzipChunk : LargeChunk);
+    chunkSize = (chunkSize + static_cast<qint64>(align) - 1) / static_cast<qint64>(align) * static_cast<qint64>(align);
+
+    int level = m_cfg.level;
+    if (level < 0) level = compression == Gzip ? 6 : compression == Xz ? 6 : 3;
+
+    int threads = m_cfg.threads > 0 ? m_cfg.threads : QThread::idealThreadCount();
+    if (compression == Xz) {
+        // Кодер xz -6 занимает ~94 MB: число потоков ограничивается памятью
+        const quint64 perEncoder = qMax<quint64>(lzma_easy_encoder_memusage(static_cast<uint32_t>(level)), 1);
+        const quint64 physical = static_cast<quint64>(sysconf(_SC_PHYS_PAGES)) * static_cast<quint64>(sysconf(_SC_PAGESIZE));
+        threads = qBound(1, static_cast<int>(physical / 4 / perEncoder), threads);
+    }
+    const int maxInFlight = qBound(2, threads * 2, static_cast<int>(MemoryBudget / chunkSize));
+
+    QThreadPool pool;
+    pool.setMaxThreadCount(threads);
+
+    emit progress(1, QString("Снятие образа: %1, блок %2, потоков %3")
+                  .arg(compression == None ? QString("без сжатия, с дырами") : compressionName(compression))
+                  .arg(Utils::formatSize(chunkSize)).arg(threads), 0, "-");
+
+    // Блоки сжимаются параллельно, а пишутся строго по порядку чтения
+    struct Pending {
+        QFuture<QByteArray> future;
+        QByteArray ready;
+        bool hasReady = false;
+    };
+    std::deque<Pending> pending;
+    QByteArray zeroFrame;       // сжатый нулевой блок полного размера
+    qint64 outputOffset = 0;
+    quint64 zeroBytes = 0;
+    bool writeFailed = false;
+
+    auto flushFront = [&]() {
+        Pending& front = pending.front();
+        const QByteArray data = front.hasReady ? front.ready : front.future.result();
+        pending.pop_front();
+        if (writeFailed) return;
+        if (data.isEmpty() || !writeAll(outputFd, data.constData(), static_cast<size_t>(data.size()), outputOffset)) {
+            writeFailed = true;
+            *message = data.isEmpty() ? QString("Ошибка сжатия") : QString("Ошибка записи образа: %1").arg(strerror(errno));
+            return;
+        }
+        outputOffset += data.size();
+    };
+
+    QElapsedTimer timer;
+    timer.start();
+    qint64 lastReport = 0;
+    quint64 done = 0;
+    bool ok = true;
+
+    while (done < size) {
+        if (m_cancelled.load(std::memory_order_acquire) || writeFailed) {
+            ok = false;
+            break;
+        }
+
+        const size_t length = static_cast<size_t>(qMin<quint64>(static_cast<quint64>(chunkSize), size - done));
+        // Бюджет пула занят: сначала дописать готовые блоки - они держат
+        // буферы этого же задания, иначе ожидание было бы вечным
+        BufferPool::Buffer pooled = BufferPool::instance().tryAcquire(chunkSize);
+        while (!pooled && !pending.empty()) {
+            flushFront();
+            pooled = BufferPool::instance().tryAcquire(chunkSize);
+        }
+        if (!pooled) pooled = BufferPool::instance().acquire(chunkSize, &m_cancelled);
+        if (pooled.size() < chunkSize) {
+            if (!m_cancelled.load(std::memory_order_acquire)) *message = "Недостаточно памяти";
+            ok = false;
+            break;
+        }
+        Buffer buffer = std::make_shared<BufferPool::Buffer>(std::move(pooled));
+
+        size_t got = 0;
+        int readErrno = 0;
+        while (got < length) {
+            ssize_t n = ::pread(inputFd, buffer->data() + got, length - got, static_cast<off_t>(done + got));
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) readErrno = errno;
+            if (n <= 0) break;
+            got += static_cast<size_t>(n);
+        }
+        if (got != length) {
+            *message = QString("Ошибка чтения по смещению %1: %2").arg(done + got)
+                .arg(readErrno != 0 ? QString(strerror(readErrno)) : QString("неожиданный конец устройства"));
+            ok = false;
+            break;
+        }
+
+        const bool zero = isZero(buffer->data(), length);
+        if (zero) zeroBytes += length;
+
+        if (compression == None) {
+            // Нули не пишутся: файл получает дыры, размер задается в конце
+            if (!zero && !writeAll(outputFd, buffer->data(), length, static_cast<off_t>(done))) {
+                *message = QString("Ошибка записи образа: %1").arg(strerror(errno));
+                ok = false;
+                break;
+            }
+        } else if (zero && static_cast<qint64>(length) == chunkSize && done > 0) {
+            if (zeroFrame.isEmpty()) zeroFrame = compress(compression, level, buffer->data(), length);
+            Pending item;
+            item.ready = zeroFrame;
+            item.hasReady = true;
+            pending.push_back(item);
+        } else {
+            // Члены gzip независимы, и ISIZE последнего ничего не говорит о
+            // целом: полный размер записывается в заголовок первого
+            const QByteArray extra = compression == Gzip && done == 0 ? ImageSource::gzipSizeExtra(size) : QByteArray();
+            Pending item;
+            item.future = QtConcurrent::run(&pool, [compression, level, buffer, length, extra]() {
+                return compress(compression, level, buffer->data(), length, extra);
+            });
+            pending.push_back(item);
+        }
+
+        while (static_cast<int>(pending.size()) >= maxInFlight) flushFront();
+        done += length;
+
+        const qint64 elapsed = timer.elapsed();
+        if (elapsed - lastReport >= 500) {
+            lastReport = elapsed;
+            reportProgress(done, size, compression == None ? static_cast<qint64>(done - zeroBytes) : outputOffset, elapsed);
+        }
+    }
+
+    // Дописываем готовое даже при ошибке: задачи пула держат буферы
+    while (!pending.empty()) flushFront();
+    pool.waitForDone();
+    ::close(inputFd);
+
+    if (ok && writeFailed) ok = false;
+    if (ok && compression == None && ::ftruncate(outputFd, static_cast<off_t>(size)) != 0) {
+        *message = QString("Ошибка записи образа: %1").arg(strerror(errno));
+        ok = false;
+    }
+    if (ok && ::fdatasync(outputFd) != 0) {
+        *message = QString("Ошибка сохранения образа: %1").arg(strerror(errno));
+        ok = false;
+    }
+    ::close(outputFd);
+    if (!ok) return false;
+
+    if (::rename(partPath.toLocal8Bit().constData(), m_cfg.imagePath.toLocal8Bit().constData()) != 0) {
+        *message = QString("Не удалось переименовать образ: %1").arg(strerror(errno));
+        return false;
+    }
+
+    const qint64 fileSize = compression == None ? static_cast<qint64>(size - zeroBytes) : outputOffset;
+    const double seconds = qMax<qint64>(timer.elapsed(), 1) / 1000.0;
+    *message = QString("Образ сохранен: %1\nУстройство: %2, в файле: %3 (%4%), нулей: %5\n"
+                       "Средняя скорость: %6 МБ/с")
+        .arg(m_cfg.imagePath)
+        .arg(Utils::formatSize(static_cast<qint64>(size)))
+        .arg(Utils::formatSize(fileSize))
+        .arg(fileSize * 100 / static_cast<qint64>(size))
+        .arg(Utils::formatSize(static_cast<qint64>(zeroBytes)))
+        .arg(size / 1024.0 / 1024.0 / seconds, 0, 'f', 1);
+    return true;
+}
+
+QByteArray BackupJob::compress(Compression compression, int level, const char* data, size_t length,
+                               const QByteArray& gzipExtra) {
+    QByteArray out;
+
+    if (compression == Gzip) {
+        z_stream zs;
+        memset(&zs, 0, sizeof(zs));
+        // windowBits 15 + 16: заголовок и CRC gzip, каждый блок - отдельный member
+        if (deflateInit2(&zs, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) return QByteArray();
+        gz_header header;
+        memset(&header, 0, sizeof(header));
+        if (!gzipExtra.isEmpty()) {
+            header.extra = reinterpret_cast<Bytef*>(const_cast<char*>(gzipExtra.constData()));
+            header.extra_len = static_cast<uInt>(gzipExtra.size());
+            header.os = 3;      // Unix, как без заголовка
+            deflateSetHeader(&zs, &header);
+        }
+        out.resize(static_cast<qsizetype>(deflateBound(&zs, static_cast<uLong>(length))));
+        zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+        zs.avail_in = static_cast<uInt>(length);
+        zs.next_out = reinterpret_cast<Bytef*>(out.data());
+        zs.avail_out = static_cast<uInt>(out.size());
+        const int rc = deflate(&zs, Z_FINISH);
+        out.resize(static_cast<qsizetype>(zs.total_out));
+        deflateEnd(&zs);
+        return rc == Z_STREAM_END ? out : QByteArray();
+    }
+
+    if (compression == Xz) {
+        out.resize(static_cast<qsizetype>(lzma_stream_buffer_bound(length)));
+        size_t outPos = 0;
+        if (lzma_easy_buffer_encode(static_cast<uint32_t>(level), LZMA_CHECK_CRC64, nullptr,
+                                    reinterpret_cast<const uint8_t*>(data), length,
+                                    reinterpret_cast<uint8_t*>(out.data()), &outPos,
+                                    static_cast<size_t>(out.size())) != LZMA_OK) {
+            return QByteArray();
+        }
+        out.resize(static_cast<qsizetype>(outPos));
+        return out;
+    }
+
+#ifdef CMILE_HAVE_ZSTD
+    if (compression == Zstd) {
+        out.resize(static_cast<qsizetype>(ZSTD_compressBound(length)));
+        const size_t n = ZSTD_compress(out.data(), static_cast<size_t>(out.size()), data, length, level);
+        if (ZSTD_isError(n)) return QByteArray();
+        out.resize(static_cast<qsizetype>(n));
+        return out;
+    }
+#endif
+
+    return QByteArray();
+}
+
+void BackupJob::reportProgress(quint64 done, quint64 total, qint64 written, qint64 elapsedMs) {
+    const int percent = static_cast<int>(done * 100 / qMax<quint64>(total, 1));
+    const double speed = elapsedMs > 0 ? (done / 1024.0 / 1024.0) / (elapsedMs / 1000.0) : 0;
+    QString timeLeft = "-";
+    if (speed > 0.1) {
+        timeLeft = Utils::formatTimeLeft(static_cast<qint64>((total - done) / (speed * 1024 * 1024)));
+    }
+    emit progress(percent, QString("Прочитано %1 из %2, в образе %3")
+                  .arg(Utils::formatSize(static_cast<qint64>(done)))
+                  .arg(Utils::formatSize(static_cast<qint64>(total)))
+                  .arg(Utils::formatSize(written)), speed, timeLeft);
+}
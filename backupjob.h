@@ -0,0 +1,58 @@
+// backupjob.h
+#pragma once
+
+#include <QThread>
+#include <QString>
+#include <QByteArray>
+#include <atomic>
+
+// Снятие образа с устройства - обратная к ImageWriter операция.
+// Устройство читается крупными выровненными блоками O_DIRECT, блоки
+// сжимаются независимо на всех ядрах (каждый - отдельный gzip member,
+// xz stream или zstd frame; склейка читается штатными gzip/xz/zstd)
+// и пишутся в файл по порядку. Нулевые блоки в несжатом образе
+// становятся дырами, в сжатом - один раз сжатой копией.
+class BackupJob : public QThread {
+    Q_OBJECT
+
+public:
+    enum Compression {
+        Auto,       // по расширению файла образа
+        None,       // .img
+        Gzip,       // .img.gz
+        Xz,         // .img.xz
+        Zstd        // .img.zst (если собрано с libzstd)
+    };
+
+    struct Config {
+        QString devicePath;
+        QString imagePath;
+        Compression compression = Auto;
+        int level = -1;             // -1 - уровень по умолчанию для формата
+        int threads = 0;            // 0 - по числу ядер
+        qint64 chunkSize = 0;       // 0 - по формату (4 MB gzip, 16 MB xz/zstd)
+    };
+
+    explicit BackupJob(const Config& cfg, QObject* parent = nullptr);
+    void cancel();
+
+    static Compression compressionFor(const QString& imagePath);
+    static bool isSupported(Compression compression);
+    static QString compressionName(Compression compression);
+
+signals:
+    void progress(int percent, const QString& status, double speedMBps, const QString& timeLeft);
+    void finished(bool success, const QString& message);
+
+protected:
+    void run() override;
+
+private:
+    Config m_cfg;
+    std::atomic<bool> m_cancelled{false};
+
+    bool backup(QString* message);
+    static QByteArray compress(Compression compression, int level, const char* data, size_t length,
+                               const QByteArray& gzipExtra = QByteArray());
+    void reportProgress(quint64 done, quint64 total, qint64 written, qint64 elapsedMs);
+};
@@ -0,0 +1,164 @@
+// badrangemap.cpp
+#include "badrangemap.h"
+#include "devicemanager.h"
+#include "utils.h"
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QSaveFile>
+#include <QTextStream>
+#include <QStandardPaths>
+#include <QDateTime>
+#include <algorithm>
+
+namespace {
+
+// Размер узла: /sys/block есть только у дисков, /sys/class/block - и у разделов
+quint64 nodeSize(const QString& devicePath) {
+    QFile file("/sys/class/block/" + QFileInfo(devicePath).fileName() + "/size");
+    if (!file.open(QIODevice::ReadOnly)) return 0;
+    bool ok = false;
+    const quint64 sectors = file.readAll().trimmed().toULongLong(&ok);
+    return ok ? sectors * 512 : 0;
+}
+
+} // namespace
+
+void BadRangeMap::add(quint64 offset, quint64 length) {
+    if (length == 0) return;
+    quint64 start = offset;
+    quint64 end = offset + length;
+
+    // Вставка с поглощением всех областей, которые касаются новой
+    auto it = std::lower_bound(m_ranges.begin(), m_ranges.end(), Range(start, 0));
+    if (it != m_ranges.begin()) {
+        auto prev = it - 1;
+        if (prev->first + prev->second >= start) it = prev;
+    }
+    auto last = it;
+    while (last != m_ranges.end() && last->first <= end) {
+        start = qMin(start, last->first);
+        end = qMax(end, last->first + last->second);
+        ++last;
+    }
+    const int index = static_cast<int>(it - m_ranges.begin());
+    m_ranges.erase(it, last);
+    m_ranges.insert(index, Range(start, end - start));
+}
+
+void BadRangeMap::merge(const BadRangeMap& other) {
+    for (const Range& range : other.m_ranges) add(range.first, range.second);
+}
+
+quint64 BadRangeMap::totalBytes() const {
+    quint64 total = 0;
+    for (const Range& range : m_ranges) total += range.second;
+    return total;
+}
+
+BadRangeMap::Range BadRangeMap::firstOverlap(quint64 offset, quint64 length) const {
+    const quint64 end = offset + length;
+    for (const Range& range : m_ranges) {
+        if (range.first >= end) break;
+        if (range.first + range.second > offset) return range;
+    }
+    return Range(0, 0);
+}
+
+QString BadRangeMap::describe(int maxRanges) const {
+    QStringList parts;
+    for (int i = 0; i < m_ranges.size() && i < maxRanges; ++i) {
+        parts << QString("%1+%2").arg(m_ranges[i].first).arg(m_ranges[i].second);
+    }
+    if (m_ranges.size() > maxRanges) parts << "...";
+    return QString("%1 обл., %2: %3")
+        .arg(m_ranges.size())
+        .arg(Utils::formatSize(static_cast<qint64>(totalBytes())))
+        .arg(parts.join(", "));
+}
+
+QString BadRangeMap::storagePath(const QString& devicePath) {
+    const QString key = DeviceManager::mediaKey(devicePath);
+    if (key.isEmpty()) return QString();
+    return QStandardPaths::writableLocation(QStandardPaths::AppDataLocation)
+        + QString("/bad-ranges/%1.txt").arg(key);
+}
+
+BadRangeMap BadRangeMap::load(const QString& devicePath) {
+    BadRangeMap map;
+    const QString path = storagePath(devicePath);
+    if (path.isEmpty()) return map;
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) return map;
+
+    // Для раздела - только его часть диска, от начала раздела
+    const quint64 base = DeviceManager::partitionOffset(devicePath);
+    quint64 limit = nodeSize(devicePath);
+    if (limit == 0) limit = ~0ULL - base;
+
+    QTextStream in(&file);
+    while (!in.atEnd()) {
+        const QString line = in.readLine().trimmed();
+        if (line.isEmpty() || line.startsWith('#')) continue;
+        const QStringList fields = line.split(' ', Qt::SkipEmptyParts);
+        if (fields.size() != 2) continue;
+        bool okOffset = false, okLength = false;
+        const quint64 offset = fields[0].toULongLong(&okOffset);
+        const quint64 length = fields[1].toULongLong(&okLength);
+        if (!okOffset || !okLength) continue;
+
+        const quint64 start = qMax(offset, base);
+        const quint64 end = qMin(offset + length, base + limit);
+        if (start < end) map.add(start - base, end - start);
+    }
+    return map;
+}
+
+bool BadRangeMap::save(const QString& devicePath, QString* error) const {
+    const QString path = storagePath(devicePath);
+    if (path.isEmpty()) {
+        if (error) *error = "Носитель без серийного номера - карту не к чему привязать";
+        return false;
+    }
+
+    // Области других разделов того же диска сохраняются
+    const quint64 base = DeviceManager::partitionOffset(devicePath);
+    BadRangeMap disk;
+    if (base > 0) {
+        const quint64 size = nodeSize(devicePath);
+        const BadRangeMap previous = load("/dev/" + DeviceManager::busLocation(devicePath).disk);
+        // Область, задевающая раздел, обрезается до частей за его пределами
+        for (const Range& range : previous.m_ranges) {
+            const quint64 end = range.first + range.second;
+            if (range.first < base) disk.add(range.first, qMin(end, base) - range.first);
+            if (end > base + size) {
+                const quint64 start = qMax(range.first, base + size);
+                disk.add(start, end - start);
+            }
+        }
+    }
+    for (const Range& range : m_ranges) disk.add(base + range.first, range.second);
+
+    // Пустая карта - носитель проверен и исправен: файл больше не нужен
+    if (disk.isEmpty()) {
+        QFile::remove(path);
+        return true;
+    }
+
+    QDir().mkpath(QFileInfo(path).absolutePath());
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        if (error) *error = file.errorString();
+        return false;
+    }
+    QTextStream out(&file);
+    out << "# Сбойные области: смещение и длина в байтах от начала диска\n";
+    out << "# " << QDateTime::currentDateTime().toString(Qt::ISODate) << "\n";
+    for (const Range& range : disk.m_ranges) out << range.first << ' ' << range.second << '\n';
+    out.flush();
+    if (!file.commit()) {
+        if (error) *error = file.errorString();
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,40 @@
+// badrangemap.h
+#pragma once
+
+#include <QString>
+#include <QList>
+#include <utility>
+
+// Сбойные области носителя по итогам проверки поверхности (SurfaceScanJob).
+// Хранится в данных приложения по серийному номеру и размеру носителя,
+// поэтому переживает перевставку и перезапуск. Смещения в файле - от начала
+// диска; load/save переводят их в координаты переданного узла (раздела).
+// Запись образа и форматирование по карте отказываются работать с носителем,
+// который не держит данные.
+class BadRangeMap {
+public:
+    using Range = std::pair<quint64, quint64>;     // смещение, длина
+
+    // Соседние и пересекающиеся области объединяются
+    void add(quint64 offset, quint64 length);
+    void merge(const BadRangeMap& other);
+
+    const QList<Range>& ranges() const { return m_ranges; }
+    bool isEmpty() const { return m_ranges.isEmpty(); }
+    int count() const { return m_ranges.size(); }
+    quint64 totalBytes() const;
+
+    // Первая область, пересекающая [offset, offset + length); длина 0 - нет такой
+    Range firstOverlap(quint64 offset, quint64 length) const;
+
+    // "N областей, X: смещение+длина, ..." (не больше maxRanges областей)
+    QString describe(int maxRanges = 3) const;
+
+    // Файл карты; пустая строка, если носитель не опознать (нет серийного номера)
+    static QString storagePath(const QString& devicePath);
+    static BadRangeMap load(const QString& devicePath);
+    bool save(const QString& devicePath, QString* error = nullptr) const;
+
+private:
+    QList<Range> m_ranges;      // по возрастанию, не пересекаются
+};
@@ -0,0 +1,303 @@
+// benchmain.cpp
+// Замер записи образа двумя путями: через буфер процесса и переносом ядром
+// (copy_file_range/splice) средствами ImageSource. Цикл записи здесь свой,
+// упрощенный: без повторов, ограничения скорости и топологии устройства -
+// сравнивается только путь копирования. Цель - устройство, файл или модель
+// устройства SimDevice ("sim:...", только через буфер).
+// --writer-check запускает сам ImageWriter на модели устройства со сбоями.
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QTextStream>
+#include <QFileInfo>
+#include <QFile>
+#include <QTemporaryDir>
+#include <QEventLoop>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include "imagesource.h"
+#include "blocktarget.h"
+#include "imagewriter.h"
+
+namespace {
+
+const qint64 BufferSize = 4 * 1024 * 1024;
+const qint64 Alignment = 4096;
+
+struct BenchResult {
+    bool ok = false;
+    QString error;
+    qint64 bytes = 0;
+    qint64 elapsedMs = 0;
+    bool zeroCopyUsed = false;
+};
+
+// Один проход записи буфером 4 MB. Как и в ImageWriter::writeImage, при
+// O_DIRECT перенос ядром идет до последнего целого блока, хвост
+// дополняется нулями через буфер
+BenchResult runOnce(const QString& imagePath, const QString& targetPath, bool zeroCopy, bool direct) {
+    BenchResult result;
+    ImageSource source;
+    if (!source.open(imagePath, ImageSource::KeepCached)) {
+        result.error = source.errorString();
+        return result;
+    }
+
+    struct stat st;
+    const bool isFile = ::stat(targetPath.toLocal8Bit().constData(), &st) != 0 || S_ISREG(st.st_mode);
+    int flags = O_WRONLY | (direct ? O_DIRECT : 0);
+    if (isFile) flags |= O_CREAT | O_TRUNC;
+    BlockTarget target;
+    if (!target.open(targetPath, flags, &result.error)) return result;
+    const int fd = target.fd();     // -1 у модели: только буфер
+
+    void* buffer = nullptr;
+    if (posix_memalign(&buffer, Alignment, BufferSize) != 0) {
+        result.error = "Не удалось выделить буфер";
+        return result;
+    }
+
+    const qint64 totalSize = source.sizeInfo().imageSize;
+    const qint64 zeroCopyEnd = direct ? totalSize / Alignment * Alignment : totalSize;
+
+    QElapsedTimer timer;
+    timer.start();
+    for (;;) {
+        qint64 n = 0;
+        if (zeroCopy && fd >= 0 && result.bytes < zeroCopyEnd) {
+            bool unsupported = false;
+            n = source.transfer(fd, qMin(BufferSize, zeroCopyEnd - result.bytes), &unsupported);
+            if (unsupported) {
+                zeroCopy = false;
+                continue;
+            }
+            if (n > 0) result.zeroCopyUsed = true;
+        } else {
+            n = source.read(static_cast<char*>(buffer), BufferSize);
+            if (n > 0) {
+                qint64 toWrite = n;
+                if (direct && n % Alignment != 0) {
+                    toWrite = (n + Alignment - 1) / Alignment * Alignment;
+                    memset(static_cast<char*>(buffer) + n, 0, static_cast<size_t>(toWrite - n));
+                }
+                if (target.pwrite(static_cast<char*>(buffer), static_cast<size_t>(toWrite),
+                                  static_cast<quint64>(result.bytes)) != toWrite) {
+                    result.error = QString("Ошибка записи: %1").arg(strerror(errno));
+                    break;
+                }
+            }
+        }
+        if (n < 0) {
+            result.error = source.errorString();
+            break;
+        }
+        if (n == 0) {
+            result.ok = true;
+            break;
+        }
+        result.bytes += n;
+    }
+    if (target.fsync() != 0 && result.ok) {
+        result.ok = false;
+        result.error = QString("Ошибка fsync: %1").arg(strerror(errno));
+    }
+    result.elapsedMs = timer.elapsed();
+
+    free(buffer);
+    return result;
+}
+
+// Обратно к Utils::formatTimeLeft: "1 мин 5 сек" -> 65; "-" -> -1
+qint64 secondsOf(const QString& timeLeft) {
+    const QStringList parts = timeLeft.split(' ', Qt::SkipEmptyParts);
+    if (parts.isEmpty() || parts.size() % 2 != 0) return -1;
+    qint64 seconds = 0;
+    for (int i = 0; i < parts.size(); i += 2) {
+        const qint64 value = parts[i].toLongLong();
+        seconds += value * (parts[i + 1] == "ч" ? 3600 : parts[i + 1] == "мин" ? 60 : 1);
+    }
+    return seconds;
+}
+
+bool check(QTextStream& out, bool ok, const QString& what) {
+    out << (ok ? "ok      " : "ОШИБКА  ") << what << "\n";
+    out.flush();
+    return ok;
+}
+
+// Проверка ImageWriter целиком на модели устройства: кэш SLC с падением
+// скорости и два сбоя EIO - разовый (устраняется повтором) и постоянный
+// (блок попадает в карту сбойных областей, запись идет дальше). Окно
+// скорости укорочено, чтобы смена режима была видна за секунды
+int runWriterCheck(QTextStream& out) {
+    const qint64 MB = 1024 * 1024;
+    const qint64 imageSize = 128 * MB;
+    const qint64 slcBytes = 64 * MB;
+    const double fastMBps = 100;
+    const double cliffMBps = 10;
+    const quint64 transientAt = 96 * MB;
+    const quint64 badAt = 112 * MB;
+    const quint64 badLength = 4096;
+
+    QTemporaryDir dir;
+    if (!dir.isValid()) {
+        out << "Не удалось создать временный каталог\n";
+        return 1;
+    }
+    const QString imagePath = dir.filePath("image.img");
+    QFile image(imagePath);
+    if (!image.open(QIODevice::WriteOnly)) {
+        out << "Не удалось создать образ: " << image.errorString() << "\n";
+        return 1;
+    }
+    QByteArray block(MB, Qt::Uninitialized);
+    for (qint64 i = 0; i < imageSize / MB; ++i) {
+        block.fill(static_cast<char>(i));
+        image.write(block);
+    }
+    image.close();
+
+    ImageWriter::Config cfg;
+    cfg.imagePath = imagePath;
+    cfg.devicePath = QString("sim:%1?size=%2&bw=%3&slc=%4&cliff=%5&eio=%6+4K*1,%7+%8")
+        .arg(dir.filePath("device.img")).arg(imageSize * 2).arg(fastMBps).arg(slcBytes).arg(cliffMBps)
+        .arg(transientAt).arg(badAt).arg(badLength);
+    cfg.blockSize = MB;
+    cfg.writeRetries = 1;
+    cfg.rateWindowMs = 500;
+    out << "Модель: " << cfg.devicePath << "\n";
+    out.flush();
+
+    // Прогноз в быстром режиме (последний) и после смены режима (первый)
+    qint64 fastEta = -1;
+    qint64 slowEta = -1;
+    bool regimeChanged = false;
+    double regimeMBps = 0;
+    bool success = true;
+    QString message;
+
+    QEventLoop loop;
+    ImageWriter writer(cfg);
+    QObject::connect(&writer, &ImageWriter::progress, &loop,
+                     [&](int, const QString& status, double speedMBps, const QString& timeLeft) {
+        if (status.startsWith("Скорость записи")) {
+            if (!regimeChanged) regimeMBps = speedMBps;
+            regimeChanged = true;
+            return;
+        }
+        const qint64 eta = secondsOf(timeLeft);
+        if (eta <= 0) return;
+        if (!regimeChanged && speedMBps > fastMBps / 2) fastEta = eta;
+        if (regimeChanged && slowEta < 0) slowEta = eta;
+    });
+    QObject::connect(&writer, &ImageWriter::finished, &loop, [&](bool ok, const QString& text) {
+        success = ok;
+        message = text;
+        loop.quit();
+    });
+    writer.start();
+    loop.exec();
+    writer.wait();
+    out << "Итог записи: " << message << "\n";
+
+    bool ok = true;
+    ok &= check(out, !success, "запись с неустранимым сбоем завершилась ошибкой");
+    ok &= check(out, writer.recoveredRanges() == 1,
+                QString("устранено повтором запросов: %1 (ожидается 1)").arg(writer.recoveredRanges()));
+    const BadRangeMap& bad = writer.writeErrors();
+    ok &= check(out, bad.count() == 1 && bad.ranges().first() == BadRangeMap::Range(badAt, badLength),
+                QString("сбойные области: %1 (ожидается %2+%3)").arg(bad.describe()).arg(badAt).arg(badLength));
+    ok &= check(out, regimeChanged && regimeMBps <= cliffMBps * 2,
+                QString("смена режима после кэша SLC: %1 МБ/с").arg(regimeMBps, 0, 'f', 1));
+    ok &= check(out, fastEta > 0 && slowEta > fastEta,
+                QString("прогноз времени: %1 сек до смены режима, %2 сек после").arg(fastEta).arg(slowEta));
+
+    // Носитель, не принимающий запись на большой области: дробление запроса
+    // ограничено, запись прекращается почти сразу, а не идет по всему образу
+    const quint64 deadAt = 16 * MB;
+    ImageWriter::Config deadCfg = cfg;
+    deadCfg.devicePath = QString("sim:%1?size=%2&bw=%3&eio=%4+%5")
+        .arg(dir.filePath("dead.img")).arg(imageSize * 2).arg(fastMBps).arg(deadAt).arg(96 * MB);
+    out << "Модель: " << deadCfg.devicePath << "\n";
+    out.flush();
+
+    QElapsedTimer deadTimer;
+    deadTimer.start();
+    ImageWriter dead(deadCfg);
+    QObject::connect(&dead, &ImageWriter::finished, &loop, [&](bool done, const QString& text) {
+        success = done;
+        message = text;
+        loop.quit();
+    });
+    dead.start();
+    loop.exec();
+    dead.wait();
+    const qint64 deadMs = deadTimer.elapsed();
+    out << "Итог записи: " << message << "\n";
+
+    const BadRangeMap& deadRanges = dead.writeErrors();
+    ok &= check(out, !success, "запись на неисправный носитель завершилась ошибкой");
+    ok &= check(out, !deadRanges.isEmpty() && deadRanges.ranges().first().first == deadAt &&
+                     deadRanges.totalBytes() <= 2 * MB,
+                QString("запись прекращена в начале сбойной области: %1").arg(deadRanges.describe()));
+    ok &= check(out, deadMs < 10000, QString("время до прекращения: %1 мс").arg(deadMs));
+    return ok ? 0 : 1;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    QCoreApplication app(argc, argv);
+    app.setApplicationName("cmile-bench");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Сравнение записи образа через буфер и переносом ядром");
+    parser.addHelpOption();
+    parser.addPositionalArgument("image", "Образ");
+    parser.addPositionalArgument("target", "Устройство, файл (будет перезаписан!) или модель sim:<файл>?bw=..&slc=..");
+    QCommandLineOption directOption("direct", "Открывать цель с O_DIRECT, как ImageWriter");
+    QCommandLineOption runsOption("runs", "Число повторов каждого пути", "n", "3");
+    QCommandLineOption writerCheckOption("writer-check",
+        "Без образа и цели: запись ImageWriter на модель со сбоями EIO и кэшем SLC, "
+        "проверка повторов, карты сбойных областей и прогноза времени");
+    parser.addOption(directOption);
+    parser.addOption(runsOption);
+    parser.addOption(writerCheckOption);
+    parser.process(app);
+
+    if (parser.isSet(writerCheckOption)) {
+        QTextStream out(stdout);
+        return runWriterCheck(out);
+    }
+
+    const QStringList args = parser.positionalArguments();
+    if (args.size() != 2) parser.showHelp(2);
+    const bool direct = parser.isSet(directOption);
+    const int runs = qMax(1, parser.value(runsOption).toInt());
+
+    QTextStream out(stdout);
+    out << "Образ: " << QFileInfo(args[0]).fileName() << ", цель: " << args[1]
+        << (direct ? " (O_DIRECT)" : "") << "\n";
+    out << "Образ держится в кэше: сравнивается путь копирования, а не скорость диска-источника\n";
+
+    for (int mode = 0; mode < 2; ++mode) {
+        const bool zeroCopy = mode == 1;
+        for (int run = 0; run < runs; ++run) {
+            const BenchResult r = runOnce(args[0], args[1], zeroCopy, direct);
+            if (!r.ok) {
+                out << (zeroCopy ? "перенос ядром" : "буфер") << ": ошибка: " << r.error << "\n";
+                return 1;
+            }
+            const double mbps = r.elapsedMs > 0 ? r.bytes / 1024.0 / 1024.0 / (r.elapsedMs / 1000.0) : 0;
+            out << (zeroCopy ? (r.zeroCopyUsed ? "перенос ядром" : "перенос ядром (недоступен, буфер)") : "буфер")
+                << ": " << r.bytes << " байт за " << r.elapsedMs << " мс, "
+                << QString::number(mbps, 'f', 1) << " МБ/с\n";
+            out.flush();
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,70 @@
+// blocktarget.cpp
+#include "blocktarget.h"
+#include "simdevice.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <cerrno>
+#include <cstring>
+
+BlockTarget::BlockTarget() = default;
+
+BlockTarget::~BlockTarget() {
+    close();
+}
+
+bool BlockTarget::open(const QString& devicePath, int flags, QString* error) {
+    close();
+    if (SimDevice::isSpec(devicePath)) {
+        SimDevice::Config cfg;
+        QString message;
+        std::unique_ptr<SimDevice> sim(new SimDevice);
+        if (!SimDevice::parse(devicePath, &cfg, &message) || !sim->open(cfg, &message)) {
+            if (error) *error = message;
+            errno = ENODEV;
+            return false;
+        }
+        m_sim = std::move(sim);
+        return true;
+    }
+
+    m_fd = ::open(devicePath.toLocal8Bit().constData(), flags | O_CLOEXEC, 0644);
+    if (m_fd < 0) {
+        const int openErrno = errno;
+        if (error) *error = QString("Ошибка открытия устройства: %1").arg(strerror(openErrno));
+        errno = openErrno;
+        return false;
+    }
+    return true;
+}
+
+void BlockTarget::close() {
+    if (m_fd >= 0) ::close(m_fd);
+    m_fd = -1;
+    m_sim.reset();
+}
+
+bool BlockTarget::isOpen() const {
+    return m_fd >= 0 || m_sim != nullptr;
+}
+
+ssize_t BlockTarget::pwrite(const char* data, size_t length, quint64 offset) {
+    if (m_sim) return m_sim->pwrite(data, length, offset);
+    return ::pwrite(m_fd, data, length, static_cast<off_t>(offset));
+}
+
+ssize_t BlockTarget::pread(char* data, size_t length, quint64 offset) {
+    if (m_sim) return m_sim->pread(data, length, offset);
+    return ::pread(m_fd, data, length, static_cast<off_t>(offset));
+}
+
+int BlockTarget::fsync() {
+    if (m_sim) return m_sim->fsync();
+    return ::fsync(m_fd);
+}
+
+bool BlockTarget::flushBuffers() {
+    if (m_sim) return true;
+    return ::ioctl(m_fd, BLKFLSBUF, NULL) == 0;
+}
@@ -0,0 +1,38 @@
+// blocktarget.h
+#pragma once
+
+#include <QString>
+#include <sys/types.h>
+#include <memory>
+
+class SimDevice;
+
+// Устройство, на которое пишет и с которого сверяет ImageWriter: блочное
+// устройство или его модель (SimDevice, путь "sim:..."). У модели нет fd,
+// поэтому перенос ядром и ioctl для нее недоступны - остальной путь записи,
+// повторов и проверки тот же.
+class BlockTarget {
+public:
+    BlockTarget();
+    ~BlockTarget();
+    BlockTarget(const BlockTarget&) = delete;
+    BlockTarget& operator=(const BlockTarget&) = delete;
+
+    // flags - как у open(2); модель всегда открывается на чтение и запись.
+    // При ошибке errno сохраняется (O_DIRECT можно повторить без него)
+    bool open(const QString& devicePath, int flags, QString* error = nullptr);
+    void close();
+    bool isOpen() const;
+    bool isSimulated() const { return m_sim != nullptr; }
+    int fd() const { return m_fd; }     // -1 у модели
+
+    ssize_t pwrite(const char* data, size_t length, quint64 offset);
+    ssize_t pread(char* data, size_t length, quint64 offset);
+    int fsync();
+    // Сброс буферов ядра для устройства (BLKFLSBUF); у модели ничего не делает
+    bool flushBuffers();
+
+private:
+    int m_fd = -1;
+    std::unique_ptr<SimDevice> m_sim;
+};
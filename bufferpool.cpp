@@ -0,0 +1,213 @@
+// bufferpool.cpp
+#include "bufferpool.h"
+#include <sys/mman.h>
+#include <unistd.h>
+#include <cstdint>
+
+namespace {
+
+const qint64 HugePage = 2 * 1024 * 1024;
+const qint64 MinBudget = 64LL * 1024 * 1024;
+const qint64 MaxDefaultBudget = 1024LL * 1024 * 1024;
+const unsigned long WaitStepMs = 200;      // шаг проверки отмены при ожидании
+
+qint64 pageSize() {
+    static const qint64 size = sysconf(_SC_PAGESIZE);
+    return size;
+}
+
+} // namespace
+
+BufferPool::Buffer::Buffer(Buffer&& other) noexcept
+: m_data(other.m_data), m_size(other.m_size) {
+    other.m_data = nullptr;
+    other.m_size = 0;
+}
+
+BufferPool::Buffer& BufferPool::Buffer::operator=(Buffer&& other) noexcept {
+    if (this != &other) {
+        reset();
+        m_data = other.m_data;
+        m_size = other.m_size;
+        other.m_data = nullptr;
+        other.m_size = 0;
+    }
+    return *this;
+}
+
+BufferPool::Buffer::~Buffer() {
+    reset();
+}
+
+void BufferPool::Buffer::reset() {
+    if (!m_data) return;
+    BufferPool::instance().release(m_data);
+    m_data = nullptr;
+    m_size = 0;
+}
+
+BufferPool& BufferPool::instance() {
+    static BufferPool instance;
+    return instance;
+}
+
+BufferPool::BufferPool()
+: m_budget(defaultBudget()) {}
+
+BufferPool::~BufferPool() {
+    QMutexLocker locker(&m_mutex);
+    trimLocked(0);
+}
+
+qint64 BufferPool::defaultBudget() {
+    const qint64 physical = static_cast<qint64>(sysconf(_SC_PHYS_PAGES)) * pageSize();
+    return qBound(MinBudget, physical / 4, MaxDefaultBudget);
+}
+
+void BufferPool::setBudget(qint64 bytes) {
+    QMutexLocker locker(&m_mutex);
+    m_budget = bytes > 0 ? qMax(bytes, MinBudget) : defaultBudget();
+    trimLocked(qMax<qint64>(0, m_budget - m_inUse));
+    m_released.wakeAll();
+}
+
+qint64 BufferPool::budget() const {
+    QMutexLocker locker(&m_mutex);
+    return m_budget;
+}
+
+qint64 BufferPool::inUse() const {
+    QMutexLocker locker(&m_mutex);
+    return m_inUse;
+}
+
+qint64 BufferPool::roundSize(qint64 size) {
+    // Большие буферы кратны huge page, иначе часть буфера будет на
+    // обычных страницах
+    const qint64 granule = size >= HugePage ? HugePage : pageSize();
+    return (qMax<qint64>(size, 1) + granule - 1) / granule * granule;
+}
+
+BufferPool::Buffer BufferPool::acquire(qint64 size, const std::atomic<bool>* cancelled) {
+    std::vector<Buffer> buffers = acquireMany(size, 1, cancelled);
+    return buffers.empty() ? Buffer() : std::move(buffers.front());
+}
+
+BufferPool::Buffer BufferPool::tryAcquire(qint64 size) {
+    QMutexLocker locker(&m_mutex);
+    const qint64 rounded = roundSize(size);
+    if (m_inUse + rounded > m_budget) return Buffer();
+    char* data = takeLocked(rounded);
+    return data ? Buffer(data, rounded) : Buffer();
+}
+
+std::vector<BufferPool::Buffer> BufferPool::acquireMany(qint64 size, int count, const std::atomic<bool>* cancelled) {
+    std::vector<Buffer> result;
+    if (count <= 0) return result;
+
+    QMutexLocker locker(&m_mutex);
+    qint64 rounded = roundSize(size);
+    if (rounded * count > m_budget) {
+        // Больше всего бюджета не будет никогда - уменьшаем буферы
+        const qint64 share = m_budget / count;
+        const qint64 granule = share >= HugePage ? HugePage : pageSize();
+        rounded = qMax(pageSize(), share / granule * granule);
+    }
+
+    while (m_inUse + rounded * count > m_budget) {
+        if (cancelled && cancelled->load(std::memory_order_acquire)) return result;
+        m_released.wait(&m_mutex, WaitStepMs);
+    }
+
+    for (int i = 0; i < count; ++i) {
+        char* data = takeLocked(rounded);
+        if (!data) {
+            // Нехватка памяти в системе: вернуть взятое (после снятия блокировки)
+            locker.unlock();
+            result.clear();
+            return result;
+        }
+        result.push_back(Buffer(data, rounded));
+    }
+    return result;
+}
+
+char* BufferPool::takeLocked(qint64 size) {
+    auto it = m_free.find(size);
+    if (it != m_free.end()) {
+        char* data = it.value();
+        m_free.erase(it);
+        m_cached -= size;
+        m_inUse += size;
+        return data;
+    }
+
+    // Свободные буферы других размеров освобождаются, чтобы уложиться в бюджет
+    trimLocked(qMax<qint64>(0, m_budget - m_inUse - size));
+    char* data = allocate(size);
+    if (!data) return nullptr;
+    m_sizes.insert(data, size);
+    m_inUse += size;
+    return data;
+}
+
+void BufferPool::release(char* data) {
+    QMutexLocker locker(&m_mutex);
+    const qint64 size = m_sizes.value(data, 0);
+    if (size == 0) return;
+    m_inUse -= size;
+
+    // В кэше остается не больше четверти бюджета: после заданий процесс
+    // не должен держать сотни мегабайт на слабой машине
+    if (m_cached + size <= m_budget / 4) {
+        m_free.insert(size, data);
+        m_cached += size;
+    } else {
+        m_sizes.remove(data);
+        deallocate(data, size);
+    }
+    m_released.wakeAll();
+}
+
+void BufferPool::trimLocked(qint64 keep) {
+    while (m_cached > keep && !m_free.isEmpty()) {
+        // Сначала самые большие
+        const qint64 size = m_free.lastKey();
+        auto it = m_free.find(size);
+        char* data = it.value();
+        m_free.erase(it);
+        m_sizes.remove(data);
+        m_cached -= size;
+        deallocate(data, size);
+    }
+}
+
+char* BufferPool::allocate(qint64 size) {
+    const int prot = PROT_READ | PROT_WRITE;
+    const int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+    if (size >= HugePage) {
+        // Явные huge pages есть, только если администратор их зарезервировал
+        void* ptr = ::mmap(nullptr, static_cast<size_t>(size), prot, flags | MAP_HUGETLB, -1, 0);
+        if (ptr != MAP_FAILED) return static_cast<char*>(ptr);
+
+        // Прозрачные huge pages: ядро отдает их только области, выровненной
+        // по 2 MB, поэтому берем с запасом и обрезаем края
+        const size_t length = static_cast<size_t>(size + HugePage);
+        ptr = ::mmap(nullptr, length, prot, flags, -1, 0);
+        if (ptr == MAP_FAILED) return nullptr;
+        const uintptr_t start = reinterpret_cast<uintptr_t>(ptr);
+        const uintptr_t aligned = (start + HugePage - 1) & ~static_cast<uintptr_t>(HugePage - 1);
+        if (aligned > start) ::munmap(ptr, aligned - start);
+        const uintptr_t end = aligned + static_cast<uintptr_t>(size);
+        if (start + length > end) ::munmap(reinterpret_cast<void*>(end), start + length - end);
+        ::madvise(reinterpret_cast<void*>(aligned), static_cast<size_t>(size), MADV_HUGEPAGE);
+        return reinterpret_cast<char*>(aligned);
+    }
+
+    void* ptr = ::mmap(nullptr, static_cast<size_t>(size), prot, flags, -1, 0);
+    return ptr == MAP_FAILED ? nullptr : static_cast<char*>(ptr);
+}
+
+void BufferPool::deallocate(char* data, qint64 size) {
+    ::munmap(data, static_cast<size_t>(size));
+}
@@ -0,0 +1,89 @@
+// bufferpool.h
+#pragma once
+
+#include <QMultiMap>
+#include <QHash>
+#include <QMutex>
+#include <QWaitCondition>
+#include <atomic>
+#include <vector>
+
+// Общий для всех заданий пул выровненных буферов ввода-вывода.
+// Буферы выделяются mmap (выравнивание по странице подходит для O_DIRECT),
+// большие - на huge pages: явных (MAP_HUGETLB), если они зарезервированы,
+// иначе прозрачных (MADV_HUGEPAGE). Все выданные и закэшированные буферы
+// укладываются в общий бюджет памяти: задание, которому не хватает бюджета,
+// ждет освобождения, а не раздувает процесс при записи на несколько
+// носителей сразу.
+class BufferPool {
+public:
+    // Владение буфером; при уничтожении буфер возвращается в пул
+    class Buffer {
+    public:
+        Buffer() = default;
+        Buffer(Buffer&& other) noexcept;
+        Buffer& operator=(Buffer&& other) noexcept;
+        ~Buffer();
+        Buffer(const Buffer&) = delete;
+        Buffer& operator=(const Buffer&) = delete;
+
+        char* data() const { return m_data; }
+        qint64 size() const { return m_size; }
+        bool isNull() const { return m_data == nullptr; }
+        explicit operator bool() const { return m_data != nullptr; }
+        void reset();
+
+    private:
+        friend class BufferPool;
+        Buffer(char* data, qint64 size) : m_data(data), m_size(size) {}
+
+        char* m_data = nullptr;
+        qint64 m_size = 0;
+    };
+
+    static BufferPool& instance();
+
+    // Буфер не меньше size; ждет, пока бюджет позволит. Запрос больше всего
+    // бюджета урезается до бюджета - size() у результата может быть меньше
+    // запрошенного. Пустой буфер - отмена или нехватка памяти
+    Buffer acquire(qint64 size, const std::atomic<bool>* cancelled = nullptr);
+
+    // То же без ожидания: пустой буфер, если бюджет сейчас занят
+    Buffer tryAcquire(qint64 size);
+
+    // count буферов одного размера разом: задание не держит часть буферов,
+    // ожидая остальные (иначе два задания могут ждать друг друга вечно).
+    // Если все не помещаются в бюджет, размер каждого уменьшается.
+    // Вектор, а не QList: буферы только перемещаются
+    std::vector<Buffer> acquireMany(qint64 size, int count, const std::atomic<bool>* cancelled = nullptr);
+
+    // 0 - по умолчанию (четверть ОЗУ, от 64 MB до 1 GB)
+    void setBudget(qint64 bytes);
+    qint64 budget() const;
+    qint64 inUse() const;
+
+    static qint64 defaultBudget();
+
+private:
+    BufferPool();
+    ~BufferPool();
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    void release(char* data);
+    bool reserveLocked(qint64 size, int count);
+    char* takeLocked(qint64 size);
+    void trimLocked(qint64 keep);
+
+    static qint64 roundSize(qint64 size);
+    static char* allocate(qint64 size);
+    static void deallocate(char* data, qint64 size);
+
+    mutable QMutex m_mutex;
+    QWaitCondition m_released;
+    qint64 m_budget = 0;
+    qint64 m_inUse = 0;                 // выдано заданиям
+    qint64 m_cached = 0;                // свободно, но не возвращено системе
+    QMultiMap<qint64, char*> m_free;    // размер -> свободные буферы
+    QHash<char*, qint64> m_sizes;       // все буферы пула
+};
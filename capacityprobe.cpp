@@ -0,0 +1,285 @@
+// capacityprobe.cpp
+#include "capacityprobe.h"
+#include "devicemanager.h"
+#include "bufferpool.h"
+#include "utils.h"
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QSaveFile>
+#include <QTextStream>
+#include <QStandardPaths>
+#include <QRandomGenerator>
+#include <QMap>
+#include <QList>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+
+namespace {
+
+const quint64 TagMagic = 0x45424F5250454C49ULL;    // "ILEPROBE"
+const int GridProbes = 32;                          // равномерная сетка по заявленному размеру
+
+inline quint64 mix64(quint64 x) {
+    x ^= x >> 30;
+    x *= 0xBF58476D1CE4E5B9ULL;
+    x ^= x >> 27;
+    x *= 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+// Метка: сигнатура, зерно запуска, смещение блока; остаток блока выводится
+// из них же - мусор и нули не сойдут за метку
+void fillTag(char* block, size_t size, quint64 nonce, quint64 offset) {
+    quint64* words = reinterpret_cast<quint64*>(block);
+    words[0] = TagMagic;
+    words[1] = nonce;
+    words[2] = offset;
+    for (size_t i = 3; i < size / sizeof(quint64); ++i) words[i] = mix64(nonce ^ (offset + i));
+}
+
+// Смещение, для которого записана метка в блоке; -1 - метки этого запуска нет
+qint64 tagOffset(const char* block, size_t size, quint64 nonce) {
+    const quint64* words = reinterpret_cast<const quint64*>(block);
+    if (words[0] != TagMagic || words[1] != nonce) return -1;
+    const quint64 offset = words[2];
+    for (size_t i = 3; i < size / sizeof(quint64); ++i) {
+        if (words[i] != mix64(nonce ^ (offset + i))) return -1;
+    }
+    return static_cast<qint64>(offset);
+}
+
+bool preadFull(int fd, char* buffer, size_t length, quint64 offset) {
+    size_t done = 0;
+    while (done < length) {
+        ssize_t n = ::pread(fd, buffer + done, length - done, static_cast<off_t>(offset + done));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        done += n;
+    }
+    return true;
+}
+
+bool pwriteFull(int fd, const char* buffer, size_t length, quint64 offset) {
+    size_t done = 0;
+    while (done < length) {
+        ssize_t n = ::pwrite(fd, buffer + done, length - done, static_cast<off_t>(offset + done));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        done += n;
+    }
+    return true;
+}
+
+// Записанное должно уйти с контроллера на флеш-память: fsync шлет FLUSH,
+// BLKFLSBUF сбрасывает кэш ядра (чтение и так идет с O_DIRECT)
+void flushDevice(int fd) {
+    ::fsync(fd);
+    ::ioctl(fd, BLKFLSBUF, 0);
+}
+
+QString capacityIndexPath() {
+    return QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/media-capacity.txt";
+}
+
+QMap<QString, quint64> loadCapacityIndex() {
+    QMap<QString, quint64> index;
+    QFile file(capacityIndexPath());
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) return index;
+    QTextStream in(&file);
+    while (!in.atEnd()) {
+        const QStringList fields = in.readLine().split(' ', Qt::SkipEmptyParts);
+        if (fields.size() != 2) continue;
+        bool ok = false;
+        const quint64 real = fields[1].toULongLong(&ok);
+        if (ok) index.insert(fields[0], real);
+    }
+    return index;
+}
+
+} // namespace
+
+QString CapacityProbe::Result::describe() const {
+    if (!ok) return error;
+    if (genuine()) return QString("емкость подтверждена: %1").arg(Utils::formatSize(static_cast<qint64>(claimedBytes)));
+    return QString("поддельный носитель: реально %1 из заявленных %2 (%3)")
+        .arg(Utils::formatSize(static_cast<qint64>(realBytes)))
+        .arg(Utils::formatSize(static_cast<qint64>(claimedBytes)))
+        .arg(wraps ? "адреса за пределом замкнуты на начало" : "данные за пределом теряются");
+}
+
+CapacityProbe::Result CapacityProbe::run(const QString& devicePath,
+                                         const std::atomic<bool>* cancelled,
+                                         const ProgressCallback& onProgress) {
+    Result result;
+    auto report = [&](int percent, const QString& status) {
+        if (onProgress) onProgress(percent, status);
+    };
+    auto isCancelled = [cancelled]() {
+        return cancelled && cancelled->load(std::memory_order_acquire);
+    };
+
+    const int fd = ::open(devicePath.toLocal8Bit().constData(), O_RDWR | O_CLOEXEC | O_EXCL | O_DIRECT);
+    if (fd < 0) {
+        result.error = QString("Ошибка открытия устройства: %1").arg(strerror(errno));
+        return result;
+    }
+    quint64 size = 0;
+    if (::ioctl(fd, BLKGETSIZE64, &size) != 0 || size == 0) {
+        result.error = QString("Не удалось определить размер устройства: %1").arg(strerror(errno));
+        ::close(fd);
+        return result;
+    }
+    result.claimedBytes = size;
+
+    const DeviceTopology topo = DeviceManager::readTopology(devicePath);
+    const quint64 block = qMax<quint64>(4096, topo.alignment());
+    if (size < block * 4) {
+        ::close(fd);
+        result.ok = true;
+        result.realBytes = size;
+        return result;
+    }
+    const quint64 lastBlock = (size - block) / block * block;
+
+    // Степени двойки ловят замыкание (реальная флеш-память почти всегда 2^n),
+    // сетка - потерю данных в любом месте заявленного размера
+    QList<quint64> offsets = {0, lastBlock};
+    for (quint64 offset = block; offset < size; offset *= 2) offsets << offset;
+    for (int i = 1; i < GridProbes; ++i) offsets << size / GridProbes * i / block * block;
+    std::sort(offsets.begin(), offsets.end());
+    offsets.erase(std::unique(offsets.begin(), offsets.end()), offsets.end());
+    const int count = offsets.size();
+
+    // Исходные данные всех блоков, рабочий блок и копия блока двоичного поиска
+    BufferPool::Buffer buffer = BufferPool::instance().acquire(static_cast<qint64>((count + 2) * block), cancelled);
+    if (static_cast<quint64>(buffer.size()) < (count + 2) * block) {
+        ::close(fd);
+        if (!isCancelled()) result.error = "Не удалось выделить память для проверки емкости";
+        return result;
+    }
+    char* originals = buffer.data();
+    char* work = originals + count * block;
+    char* spare = work + block;
+    const quint64 nonce = QRandomGenerator::global()->generate64();
+
+    report(0, QString("Проверка емкости: %1 контрольных блоков").arg(count));
+    QList<bool> written(count, false);
+    for (int i = 0; i < count; ++i) {
+        // Нечитаемый блок не трогаем, для проверки он уже сбойный
+        written[i] = preadFull(fd, originals + i * block, block, offsets[i]);
+    }
+
+    // Сверху вниз: блок, замкнутый на младший адрес, затирается меткой
+    // младшего и при чтении покажет чужое смещение
+    for (int i = count - 1; i >= 0 && !isCancelled(); --i) {
+        if (!written[i]) continue;
+        fillTag(work, block, nonce, offsets[i]);
+        written[i] = pwriteFull(fd, work, block, offsets[i]);
+    }
+    flushDevice(fd);
+    report(40, "Проверка емкости: чтение меток...");
+
+    quint64 lastGood = 0;
+    quint64 firstBad = size;
+    quint64 wrapSize = size;
+    for (int i = 0; i < count && !isCancelled(); ++i) {
+        bool good = false;
+        if (written[i] && preadFull(fd, work, block, offsets[i])) {
+            const qint64 tag = tagOffset(work, block, nonce);
+            if (tag == static_cast<qint64>(offsets[i])) {
+                good = true;
+            } else if (tag >= 0 && static_cast<quint64>(tag) < offsets[i]) {
+                result.wraps = true;
+                wrapSize = qMin(wrapSize, offsets[i] - static_cast<quint64>(tag));
+            }
+        }
+        if (good && offsets[i] < firstBad) lastGood = offsets[i];
+        if (!good && firstBad == size) firstBad = offsets[i];
+    }
+    result.probes = count;
+
+    quint64 realBytes = firstBad;
+    if (firstBad < size && !isCancelled()) {
+        if (result.wraps) {
+            // Расстояние до адреса, на который замкнут блок, - и есть емкость
+            realBytes = qBound(lastGood + block, wrapSize, firstBad);
+        } else {
+            // Потеря данных: граница между последним целым и первым потерянным
+            // блоком уточняется по одному блоку за шаг
+            quint64 low = lastGood + block;
+            quint64 high = firstBad;
+            while (low < high && !isCancelled()) {
+                const quint64 mid = low + (high - low) / block / 2 * block;
+                bool good = false;
+                if (preadFull(fd, spare, block, mid)) {
+                    fillTag(work, block, nonce, mid);
+                    if (pwriteFull(fd, work, block, mid)) {
+                        flushDevice(fd);
+                        good = preadFull(fd, work, block, mid) &&
+                               tagOffset(work, block, nonce) == static_cast<qint64>(mid);
+                    }
+                    pwriteFull(fd, spare, block, mid);
+                }
+                if (good) low = mid + block;
+                else high = mid;
+                report(60 + static_cast<int>(35 * (1.0 - static_cast<double>(high - low) / (firstBad - lastGood))),
+                       QString("Проверка емкости: граница между %1 и %2")
+                       .arg(Utils::formatSize(static_cast<qint64>(low)))
+                       .arg(Utils::formatSize(static_cast<qint64>(high))));
+            }
+            realBytes = low;
+        }
+    }
+
+    // Возврат данных и при отмене. У замкнутых блоков исходные данные - это
+    // данные младшего адреса, прочитанные до записи, так что порядок не важен
+    int restoreFailures = 0;
+    for (int i = 0; i < count; ++i) {
+        if (written[i] && !pwriteFull(fd, originals + i * block, block, offsets[i])) ++restoreFailures;
+    }
+    flushDevice(fd);
+    ::close(fd);
+    report(100, "Проверка емкости завершена");
+
+    if (isCancelled()) {
+        result.error = "Проверка емкости отменена";
+        return result;
+    }
+    if (restoreFailures > 0) {
+        // Итог проверки верен, но данные части блоков потеряны
+        result.error = QString("Не удалось вернуть данные %1 контрольных блоков").arg(restoreFailures);
+    }
+    result.ok = true;
+    result.realBytes = realBytes;
+    return result;
+}
+
+qint64 CapacityProbe::knownCapacity(const QString& devicePath) {
+    const QString key = DeviceManager::mediaKey(devicePath);
+    if (key.isEmpty()) return -1;
+    const QMap<QString, quint64> index = loadCapacityIndex();
+    auto it = index.find(key);
+    return it == index.end() ? -1 : static_cast<qint64>(it.value());
+}
+
+void CapacityProbe::remember(const QString& devicePath, const Result& result) {
+    const QString key = DeviceManager::mediaKey(devicePath);
+    if (key.isEmpty() || !result.ok) return;
+    QMap<QString, quint64> index = loadCapacityIndex();
+    index.insert(key, result.realBytes);
+
+    const QString path = capacityIndexPath();
+    QDir().mkpath(QFileInfo(path).absolutePath());
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) return;
+    QTextStream out(&file);
+    for (auto it = index.begin(); it != index.end(); ++it) out << it.key() << ' ' << it.value() << '\n';
+    out.flush();
+    file.commit();
+}
@@ -0,0 +1,39 @@
+// capacityprobe.h
+#pragma once
+
+#include <QString>
+#include <atomic>
+#include <functional>
+
+// Быстрая проверка реальной емкости (по образцу f3probe). Поддельный носитель
+// сообщает ядру чужой размер, а адреса за реальной емкостью либо замыкает на
+// начало, либо теряет. Проверка пишет помеченные блоки по всему заявленному
+// размеру (степени двойки и равномерная сетка) сверху вниз, сбрасывает их на
+// носитель и читает в обход кэша: замыкание видно по чужой метке, потеря - по
+// отсутствию своей. Граница потери уточняется двоичным поиском. Данные
+// проверяемых блоков сохраняются и возвращаются на место.
+class CapacityProbe {
+public:
+    struct Result {
+        bool ok = false;            // проверка доведена до конца
+        QString error;
+        quint64 claimedBytes = 0;
+        quint64 realBytes = 0;      // подтвержденная емкость; у настоящего носителя = claimedBytes
+        bool wraps = false;         // адреса за realBytes замкнуты на начало
+        int probes = 0;             // проверенных блоков
+
+        bool genuine() const { return ok && realBytes >= claimedBytes; }
+        QString describe() const;
+    };
+
+    using ProgressCallback = std::function<void(int percent, const QString& status)>;
+
+    // Устройство должно быть размонтировано; открывается с O_EXCL
+    static Result run(const QString& devicePath,
+                      const std::atomic<bool>* cancelled = nullptr,
+                      const ProgressCallback& onProgress = ProgressCallback());
+
+    // Итог прошлой проверки этого носителя: реальная емкость, -1 - не проверялся
+    static qint64 knownCapacity(const QString& devicePath);
+    static void remember(const QString& devicePath, const Result& result);
+};
@@ -0,0 +1,399 @@
+// clonejob.cpp
+#include "clonejob.h"
+#include "allocationmap.h"
+#include "bufferpool.h"
+#include "devicemanager.h"
+#include "utils.h"
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QFileInfo>
+#include <QList>
+#include <QDebug>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+
+namespace {
+
+const qint64 DefaultChunk = 4 * 1024 * 1024;
+const int DefaultDepth = 8;
+
+bool readAll(int fd, char* data, size_t length, quint64 offset) {
+    size_t done = 0;
+    while (done < length) {
+        ssize_t n = ::pread(fd, data + done, length - done, static_cast<off_t>(offset + done));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        done += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+bool writeAll(int fd, const char* data, size_t length, quint64 offset) {
+    size_t done = 0;
+    while (done < length) {
+        ssize_t n = ::pwrite(fd, data + done, length - done, static_cast<off_t>(offset + done));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        done += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+// O_DIRECT, если устройство его принимает
+int openDevice(const QString& devicePath, int flags) {
+    const QByteArray path = devicePath.toLocal8Bit();
+    int fd = ::open(path.constData(), flags | O_CLOEXEC | O_DIRECT);
+    if (fd < 0 && errno == EINVAL) fd = ::open(path.constData(), flags | O_CLOEXEC);
+    return fd;
+}
+
+// Сбросить записанный диапазон на носитель и выбросить его из кэша
+// страниц: иначе проверка прочитала бы собственную запись из памяти
+bool dropCached(int fd, quint64 offset, size_t length) {
+    const unsigned int flags = SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER;
+    if (::sync_file_range(fd, static_cast<off64_t>(offset), static_cast<off64_t>(length), flags) != 0) return false;
+    return ::posix_fadvise(fd, static_cast<off_t>(offset), static_cast<off_t>(length), POSIX_FADV_DONTNEED) == 0;
+}
+
+// Буфер кольца. seq - номер блока в потоке чтения, pending - сколько
+// потоков записи его еще не забрали (0 - буфер свободен для чтения)
+struct Slot {
+    char* data = nullptr;
+    quint64 seq = 0;
+    quint64 offset = 0;
+    size_t length = 0;
+    int pending = 0;
+    bool filled = false;
+};
+
+struct Target {
+    QString path;
+    int fd = -1;
+    char* verifyBuffer = nullptr;
+    int verifyFd = -1;          // чтение при проверке с O_DIRECT, -1 - через fd со сбросом кэша
+    bool verifyCached = false;  // кэш сбросить не удалось: проверка читала память, а не носитель
+    std::atomic<quint64> written{0};
+    QString error;      // пусто - устройство в порядке
+    std::atomic<bool> failed{false};
+};
+
+} // namespace
+
+CloneJob::CloneJob(const Config& cfg, QObject* parent)
+: QThread(parent), m_cfg(cfg) {}
+
+void CloneJob::cancel() {
+    m_cancelled.store(true, std::memory_order_release);
+}
+
+void CloneJob::run() {
+    m_cancelled.store(false, std::memory_order_release);
+    emit progress(0, "Проверка устройств...", 0, "-");
+
+    QString message;
+    const bool ok = clone(&message);
+    if (!ok && m_cancelled.load(std::memory_order_acquire)) message = "Операция отменена";
+    emit finished(ok, message);
+}
+
+bool CloneJob::clone(QString* message) {
+    if (m_cfg.targetPaths.isEmpty()) {
+        *message = "Не выбрано ни одного целевого устройства";
+        return false;
+    }
+    const QString sourceDisk = DeviceManager::busLocation(m_cfg.sourcePath).disk;
+    for (const QString& targetPath : m_cfg.targetPaths) {
+        if (targetPath == m_cfg.sourcePath ||
+            (!sourceDisk.isEmpty() && DeviceManager::busLocation(targetPath).disk == sourceDisk)) {
+            *message = QString("Устройство %1 не может быть одновременно источником и целью").arg(targetPath);
+            return false;
+        }
+    }
+
+    QStringList devices = m_cfg.targetPaths;
+    devices.prepend(m_cfg.sourcePath);
+    for (const QString& devicePath : devices) {
+        auto [unmountSuccess, unmountMessage] = DeviceManager::unmountAll(devicePath);
+        if (!unmountSuccess) {
+            *message = QString("Ошибка размонтирования %1:\n%2").arg(devicePath, unmountMessage);
+            return false;
+        }
+    }
+
+    const DeviceTopology sourceTopo = DeviceManager::readTopology(m_cfg.sourcePath);
+    quint32 align = sourceTopo.alignment();
+    for (const QString& targetPath : m_cfg.targetPaths) {
+        align = qMax(align, DeviceManager::readTopology(targetPath).alignment());
+    }
+
+    int sourceFd = openDevice(m_cfg.sourcePath, O_RDONLY);
+    if (sourceFd < 0) {
+        *message = QString("Ошибка открытия %1: %2").arg(m_cfg.sourcePath, strerror(errno));
+        return false;
+    }
+    quint64 size = 0;
+    if (::ioctl(sourceFd, BLKGETSIZE64, &size) != 0 || size == 0) {
+        *message = QString("Не удалось определить размер %1").arg(m_cfg.sourcePath);
+        ::close(sourceFd);
+        return false;
+    }
+
+    // O_EXCL: целевые устройства не должны использоваться никем другим
+    QList<Target*> targets;
+    auto closeAll = [&]() {
+        for (Target* target : targets) {
+            if (target->fd >= 0) ::close(target->fd);
+            if (target->verifyFd >= 0) ::close(target->verifyFd);
+            delete target;
+        }
+        targets.clear();
+        ::close(sourceFd);
+    };
+    for (const QString& targetPath : m_cfg.targetPaths) {
+        auto target = new Target;
+        target->path = targetPath;
+        targets.append(target);
+        target->fd = openDevice(targetPath, O_RDWR | O_EXCL);
+        if (target->fd < 0) {
+            *message = QString("Ошибка открытия %1: %2").arg(targetPath, strerror(errno));
+            closeAll();
+            return false;
+        }
+        quint64 targetSize = 0;
+        if (::ioctl(target->fd, BLKGETSIZE64, &targetSize) != 0 || targetSize < size) {
+            *message = QString("Устройство %1 меньше исходного (%2 < %3)")
+                .arg(targetPath)
+                .arg(Utils::formatSize(static_cast<qint64>(targetSize)))
+                .arg(Utils::formatSize(static_cast<qint64>(size)));
+            closeAll();
+            return false;
+        }
+        // Проверка читает мимо кэша страниц, даже если запись через него шла
+        if (m_cfg.verify) {
+            target->verifyFd = ::open(targetPath.toLocal8Bit().constData(), O_RDONLY | O_CLOEXEC | O_DIRECT);
+        }
+    }
+
+    emit progress(0, "Анализ занятого пространства...", 0, "-");
+    const AllocationMap map = m_cfg.skipUnused ? AllocationMap::build(m_cfg.sourcePath, align)
+                                               : AllocationMap::full(size);
+    const quint64 total = map.usedBytes();
+
+    quint64 chunk = m_cfg.chunkSize > 0 ? static_cast<quint64>(m_cfg.chunkSize) : DefaultChunk;
+    chunk = qMax<quint64>(chunk / align * align, align);
+    const int depth = m_cfg.queueDepth > 0 ? m_cfg.queueDepth : DefaultDepth;
+
+    // Кольцо и буферы проверки берутся из общего пула разом; при тесном
+    // бюджете пул уменьшает блок
+    const int bufferCount = depth + (m_cfg.verify ? targets.size() : 0);
+    BufferPool& pool = BufferPool::instance();
+    if (pool.inUse() + static_cast<qint64>(chunk) * bufferCount > pool.budget()) {
+        emit progress(0, "Ожидание памяти для буферов...", 0, "-");
+    }
+    std::vector<BufferPool::Buffer> buffers = pool.acquireMany(static_cast<qint64>(chunk), bufferCount, &m_cancelled);
+    if (static_cast<int>(buffers.size()) != bufferCount || static_cast<quint64>(buffers.front().size()) < align) {
+        closeAll();
+        *message = QString("Не удалось выделить %1 выровненной памяти")
+            .arg(Utils::formatSize(static_cast<qint64>(chunk) * bufferCount));
+        return false;
+    }
+    chunk = qMin<quint64>(chunk, static_cast<quint64>(buffers.front().size()) / align * align);
+
+    QList<Slot> ring(depth);
+    for (int i = 0; i < depth; ++i) ring[i].data = buffers[i].data();
+    if (m_cfg.verify) {
+        for (int i = 0; i < targets.size(); ++i) targets[i]->verifyBuffer = buffers[depth + i].data();
+    }
+
+    QMutex mutex;
+    QWaitCondition slotFreed;
+    QWaitCondition slotFilled;
+    quint64 chunksTotal = 0;
+    bool readerDone = false;
+    QString readError;
+
+    auto stopped = [this]() { return m_cancelled.load(std::memory_order_acquire); };
+
+    // Чтение: блок seq попадает в буфер seq % depth, когда все потоки
+    // записи забрали предыдущее содержимое этого буфера
+    QThread* reader = QThread::create([&]() {
+        quint64 seq = 0;
+        for (const AllocationMap::Range& range : map.ranges()) {
+            for (quint64 offset = range.first; offset < range.first + range.second; offset += chunk) {
+                const size_t length = static_cast<size_t>(qMin(chunk, range.first + range.second - offset));
+                Slot& slot = ring[static_cast<int>(seq % depth)];
+                {
+                    QMutexLocker locker(&mutex);
+                    while (slot.pending > 0 && !stopped()) slotFreed.wait(&mutex, 250);
+                    if (stopped()) {
+                        readerDone = true;
+                        slotFilled.wakeAll();
+                        return;
+                    }
+                }
+                if (!readAll(sourceFd, slot.data, length, offset)) {
+                    QMutexLocker locker(&mutex);
+                    readError = QString("Ошибка чтения %1 по смещению %2: %3")
+                        .arg(m_cfg.sourcePath).arg(offset).arg(strerror(errno));
+                    readerDone = true;
+                    slotFilled.wakeAll();
+                    return;
+                }
+                QMutexLocker locker(&mutex);
+                slot.seq = seq;
+                slot.offset = offset;
+                slot.length = length;
+                slot.pending = targets.size();
+                slot.filled = true;
+                ++seq;
+                chunksTotal = seq;
+                slotFilled.wakeAll();
+            }
+        }
+        QMutexLocker locker(&mutex);
+        readerDone = true;
+        slotFilled.wakeAll();
+    });
+
+    // Запись: каждый поток идет по тем же номерам блоков. Сбойное
+    // устройство продолжает отпускать буферы, не записывая их
+    QList<QThread*> writers;
+    for (Target* target : targets) {
+        writers.append(QThread::create([&, target]() {
+            for (quint64 seq = 0;; ++seq) {
+                Slot& slot = ring[static_cast<int>(seq % depth)];
+                {
+                    QMutexLocker locker(&mutex);
+                    while (!(slot.filled && slot.seq == seq && slot.pending > 0) &&
+                           !(readerDone && seq >= chunksTotal)) {
+                        slotFilled.wait(&mutex);
+                    }
+                    if (seq >= chunksTotal && readerDone) return;
+                }
+
+                if (!target->failed && !stopped()) {
+                    if (!writeAll(target->fd, slot.data, slot.length, slot.offset)) {
+                        target->error = QString("ошибка записи по смещению %1: %2").arg(slot.offset).arg(strerror(errno));
+                        target->failed = true;
+                    } else if (target->verifyBuffer) {
+                        int verifyFd = target->verifyFd;
+                        if (verifyFd < 0) {
+                            verifyFd = target->fd;
+                            if (!target->verifyCached && !dropCached(target->fd, slot.offset, slot.length)) {
+                                target->verifyCached = true;
+                            }
+                        }
+                        if (!readAll(verifyFd, target->verifyBuffer, slot.length, slot.offset)) {
+                            target->error = QString("ошибка чтения при проверке по смещению %1: %2")
+                                .arg(slot.offset).arg(strerror(errno));
+                            target->failed = true;
+                        } else if (memcmp(target->verifyBuffer, slot.data, slot.length) != 0) {
+                            target->error = QString("данные не совпадают по смещению %1").arg(slot.offset);
+                            target->failed = true;
+                        }
+                    }
+                    if (!target->failed) target->written.fetch_add(slot.length, std::memory_order_relaxed);
+                }
+
+                QMutexLocker locker(&mutex);
+                if (--slot.pending == 0) {
+                    slot.filled = false;
+                    slotFreed.wakeAll();
+                }
+            }
+        }));
+    }
+
+    reader->start();
+    for (QThread* writer : writers) writer->start();
+
+    // Прогресс - по самому медленному из исправных устройств
+    QElapsedTimer timer;
+    timer.start();
+    auto slowest = [&]() {
+        quint64 done = total;
+        int active = 0;
+        for (Target* target : targets) {
+            if (target->failed) continue;
+            done = qMin(done, target->written.load(std::memory_order_relaxed));
+            ++active;
+        }
+        return std::make_pair(done, active);
+    };
+    for (QThread* writer : writers) {
+        while (!writer->wait(250)) {
+            auto [done, active] = slowest();
+            reportProgress(done, total, timer.elapsed(), active);
+        }
+        delete writer;
+    }
+    reader->wait();
+    delete reader;
+    buffers.clear();
+
+    if (!readError.isEmpty() || stopped()) {
+        *message = readError;
+        closeAll();
+        return false;
+    }
+
+    emit progress(99, "Сброс кэшей устройств...", 0, "-");
+    QStringList done;
+    QStringList failed;
+    QStringList cached;
+    for (Target* target : targets) {
+        if (!target->failed && ::fsync(target->fd) != 0) {
+            target->error = QString("ошибка сброса кэша: %1").arg(strerror(errno));
+            target->failed = true;
+        }
+        if (target->failed) {
+            failed << QString("%1: %2").arg(target->path, target->error);
+            continue;
+        }
+        if (::ioctl(target->fd, BLKRRPART, 0) != 0 && errno != EINVAL) {
+            qWarning() << "BLKRRPART после клонирования" << target->path << strerror(errno);
+        }
+        done << target->path;
+        if (target->verifyCached) cached << target->path;
+    }
+    closeAll();
+
+    QString verifyNote;
+    if (m_cfg.verify) {
+        verifyNote = cached.isEmpty()
+            ? QString("\nЗаписанные данные проверены")
+            : QString("\nЗаписанные данные проверены, кроме %1: кэш страниц не сброшен, "
+                      "проверка читала память, а не носитель").arg(cached.join(", "));
+    }
+
+    const double seconds = qMax<qint64>(timer.elapsed(), 1) / 1000.0;
+    *message = QString("Клонирование %1: скопировано %2 из %3 (%4)\nСредняя скорость: %5 МБ/с%6")
+        .arg(m_cfg.sourcePath)
+        .arg(Utils::formatSize(static_cast<qint64>(total)))
+        .arg(Utils::formatSize(static_cast<qint64>(size)))
+        .arg(map.summary())
+        .arg(total / 1024.0 / 1024.0 / seconds, 0, 'f', 1)
+        .arg(verifyNote);
+    if (!done.isEmpty()) *message += QString("\nГотово: %1").arg(done.join(", "));
+    if (!failed.isEmpty()) *message += QString("\nОшибки:\n%1").arg(failed.join("\n"));
+    return failed.isEmpty();
+}
+
+void CloneJob::reportProgress(quint64 done, quint64 total, qint64 elapsedMs, int targets) {
+    const int percent = static_cast<int>(done * 99 / qMax<quint64>(total, 1));
+    const double speed = elapsedMs > 0 ? (done / 1024.0 / 1024.0) / (elapsedMs / 1000.0) : 0;
+    QString timeLeft = "-";
+    if (speed > 0.1) {
+        timeLeft = Utils::formatTimeLeft(static_cast<qint64>((total - done) / (speed * 1024 * 1024)));
+    }
+    emit progress(percent, QString("Скопировано %1 из %2 на %3 устр.")
+                  .arg(Utils::formatSize(static_cast<qint64>(done)))
+                  .arg(Utils::formatSize(static_cast<qint64>(total)))
+                  .arg(targets), speed, timeLeft);
+}
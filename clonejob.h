@@ -0,0 +1,45 @@
+// clonejob.h
+#pragma once
+
+#include <QThread>
+#include <QString>
+#include <QStringList>
+#include <atomic>
+
+// Клонирование устройства на одно или несколько устройств без
+// промежуточного образа. Чтение и запись идут конвейером: поток чтения
+// заполняет кольцо выровненных буферов, по потоку записи на каждое целевое
+// устройство забирают их по порядку. Неразмеченное и свободное в разобранных
+// ФС пространство пропускается (AllocationMap), записанное может
+// сразу перечитываться и сравниваться. Сбой одного целевого устройства
+// не останавливает остальные.
+class CloneJob : public QThread {
+    Q_OBJECT
+
+public:
+    struct Config {
+        QString sourcePath;
+        QStringList targetPaths;
+        bool skipUnused = true;     // копировать только занятое пространство
+        bool verify = true;         // перечитывать каждый записанный блок с носителя (мимо кэша)
+        qint64 chunkSize = 0;       // 0 - 4 MB
+        int queueDepth = 0;         // буферов в кольце, 0 - 8
+    };
+
+    explicit CloneJob(const Config& cfg, QObject* parent = nullptr);
+    void cancel();
+
+signals:
+    void progress(int percent, const QString& status, double speedMBps, const QString& timeLeft);
+    void finished(bool success, const QString& message);
+
+protected:
+    void run() override;
+
+private:
+    Config m_cfg;
+    std::atomic<bool> m_cancelled{false};
+
+    bool clone(QString* message);
+    void reportProgress(quint64 done, quint64 total, qint64 elapsedMs, int targets);
+};
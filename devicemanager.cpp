@@ -1,13 +1,16 @@
 #include "devicemanager.h"
 #include "utils.h"
+#include "mounttable.h"
 #include <QDir>
 #include <QFile>
+#include <QFileInfo>
 #include <QTextStream>
 #include <QRegularExpression>
 #include <sys/mount.h>
 #include <unistd.h>
 #include <cerrno>
 #include <cstring>
+#include <algorithm>
 
 QList<DeviceInfo> DeviceManager::scanDevices() {
     QList<DeviceInfo> devices;
@@ -17,7 +20,11 @@ QList<DeviceInfo> DeviceManager::scanDevices() {
         // Пропускаем loop, ram, zram
         if (entry.startsWith("loop") || entry.startsWith("ram") || entry.startsWith("zram"))
             continue;
-        if (!entry.startsWith("sd") && !entry.startsWith("mmcblk"))
+        // Оптические и флоппи-приводы не являются целью записи
+        if (entry.startsWith("sr") || entry.startsWith("fd"))
+            continue;
+        // Виртуальные устройства (dm, md, nbd и т.п.) живут в /sys/devices/virtual
+        if (QFileInfo(sysBlock.filePath(entry)).canonicalFilePath().contains("/devices/virtual/"))
             continue;
 
         QString devPath = "/dev/" + entry;
@@ -38,6 +45,10 @@ QList<DeviceInfo> DeviceManager::scanDevices() {
         dev.model = model;
         dev.removable = removable;
         dev.mountPoints = getMountPoints(devPath);
+        dev.serial = getDeviceSerial(entry);
+        dev.diskseq = getDiskSeq(entry);
+        dev.topology = readTopology(devPath);
+        dev.partitions = getPartitions(entry);
 
         devices.append(dev);
     }
@@ -59,18 +70,155 @@ quint64 DeviceManager::getDeviceSizeBytes(const QString& devName) {
     return ok ? sectors * 512 : 0;
 }
 
+static quint64 readSysfsNumber(const QString& path, quint64 fallback = 0) {
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) return fallback;
+    bool ok;
+    quint64 value = file.readAll().trimmed().toULongLong(&ok);
+    return ok ? value : fallback;
+}
+
+DeviceTopology DeviceManager::readTopology(const QString& devicePath) {
+    DeviceTopology topo;
+
+    QString sysDir = QFileInfo("/sys/class/block/" + QFileInfo(devicePath).fileName()).canonicalFilePath();
+    if (sysDir.isEmpty()) return topo;
+    if (QFile::exists(sysDir + "/partition")) {
+        sysDir = QFileInfo(sysDir).path();  // очередь есть только у диска
+    }
+    const QString queue = sysDir + "/queue/";
+
+    topo.logicalBlockSize = static_cast<quint32>(readSysfsNumber(queue + "logical_block_size", 512));
+    topo.physicalBlockSize = static_cast<quint32>(readSysfsNumber(queue + "physical_block_size", topo.logicalBlockSize));
+    topo.optimalIoSize = static_cast<quint32>(readSysfsNumber(queue + "optimal_io_size"));
+    topo.maxSectorsKb = static_cast<quint32>(readSysfsNumber(queue + "max_sectors_kb"));
+    topo.rotational = readSysfsNumber(queue + "rotational") != 0;
+    topo.fua = readSysfsNumber(queue + "fua") != 0;
+    topo.discardGranularity = static_cast<quint32>(readSysfsNumber(queue + "discard_granularity"));
+    topo.discardMaxBytes = readSysfsNumber(queue + "discard_max_bytes");
+    topo.writeZeroesMaxBytes = readSysfsNumber(queue + "write_zeroes_max_bytes");
+
+    QFile cacheFile(queue + "write_cache");
+    if (cacheFile.open(QIODevice::ReadOnly)) {
+        topo.writeBackCache = cacheFile.readAll().trimmed() == "write back";
+    }
+
+    if (topo.logicalBlockSize == 0) topo.logicalBlockSize = 512;
+    if (topo.physicalBlockSize < topo.logicalBlockSize) topo.physicalBlockSize = topo.logicalBlockSize;
+    return topo;
+}
+
+quint64 DeviceManager::partitionOffset(const QString& devicePath) {
+    const QString sysDir = "/sys/class/block/" + QFileInfo(devicePath).fileName();
+    if (!QFile::exists(sysDir + "/partition")) return 0;
+    return readSysfsNumber(sysDir + "/start") * 512;
+}
+
+BusLocation DeviceManager::busLocation(const QString& devicePath) {
+    BusLocation loc;
+
+    // /sys/devices/pci0000:00/0000:00:14.0/usb2/2-1/2-1.3/2-1.3:1.0/host5/.../block/sdb[/sdb1]
+    QString sysDir = QFileInfo("/sys/class/block/" + QFileInfo(devicePath).fileName()).canonicalFilePath();
+    if (sysDir.isEmpty()) return loc;
+    if (QFile::exists(sysDir + "/partition")) {
+        sysDir = QFileInfo(sysDir).path();
+    }
+    loc.disk = QFileInfo(sysDir).fileName();
+    const QStringList parts = sysDir.split('/', Qt::SkipEmptyParts);
+
+    static const QRegularExpression pciAddress("^[0-9a-f]{4}:[0-9a-f]{2}:[0-9a-f]{2}\\.[0-9a-f]$");
+    static const QRegularExpression usbRoot("^usb\\d+$");
+    static const QRegularExpression usbPort("^\\d+-[\\d.]+$");
+
+    QString usbDevice;
+    for (const QString& part : parts) {
+        if (part == "block") break;
+        if (loc.rootHub.isEmpty() && pciAddress.match(part).hasMatch()) {
+            loc.controller = part;       // ближайший к диску PCI-узел до корневого хаба
+        } else if (usbRoot.match(part).hasMatch()) {
+            loc.rootHub = part;
+        } else if (!loc.rootHub.isEmpty() && usbPort.match(part).hasMatch()) {
+            usbDevice = part;            // последний порт в цепочке хабов - сам накопитель
+        }
+    }
+
+    if (loc.isUsb()) {
+        loc.rootHubSpeed = static_cast<int>(readSysfsNumber("/sys/bus/usb/devices/" + loc.rootHub + "/speed"));
+        if (!usbDevice.isEmpty()) {
+            loc.deviceSpeed = static_cast<int>(readSysfsNumber("/sys/bus/usb/devices/" + usbDevice + "/speed"));
+        }
+    }
+    return loc;
+}
+
+QList<PartitionInfo> DeviceManager::getPartitions(const QString& devName) {
+    QList<PartitionInfo> partitions;
+
+    QDir diskDir("/sys/block/" + devName);
+    for (const QString& entry : diskDir.entryList(QDir::Dirs | QDir::NoDotAndDotDot)) {
+        const QString partDir = diskDir.filePath(entry);
+        if (!QFile::exists(partDir + "/partition")) continue;
+
+        PartitionInfo part;
+        part.path = "/dev/" + entry;
+        part.number = static_cast<int>(readSysfsNumber(partDir + "/partition"));
+        part.startBytes = readSysfsNumber(partDir + "/start") * 512;
+        part.sizeBytes = getDeviceSizeBytes(devName + "/" + entry);
+        partitions.append(part);
+    }
+
+    std::sort(partitions.begin(), partitions.end(), [](const PartitionInfo& a, const PartitionInfo& b) {
+        return a.number < b.number;
+    });
+    return partitions;
+}
+
+QString DeviceManager::partitionPath(const QString& devicePath, int number) {
+    // Если имя диска оканчивается цифрой (mmcblk0, nvme0n1, loop0), добавляется 'p'
+    if (!devicePath.isEmpty() && devicePath.back().isDigit()) {
+        return devicePath + "p" + QString::number(number);
+    }
+    return devicePath + QString::number(number);
+}
+
+QString DeviceManager::getDeviceSerial(const QString& devName) {
+    // USB/SATA отдают serial или wwid, SD-карты - cid
+    static const QStringList candidates = {"device/serial", "device/wwid", "device/cid", "wwid"};
+    for (const QString& name : candidates) {
+        QFile file("/sys/block/" + devName + "/" + name);
+        if (file.open(QIODevice::ReadOnly)) {
+            QString value = QString::fromLatin1(file.readAll().trimmed());
+            if (!value.isEmpty()) return value;
+        }
+    }
+    return QString();
+}
+
+QString DeviceManager::mediaKey(const QString& devicePath) {
+    // Путь узла и diskseq меняются при перевставке, серийный номер и размер - нет
+    QString disk = busLocation(devicePath).disk;
+    if (disk.isEmpty()) disk = QFileInfo(devicePath).fileName();
+    QString serial = getDeviceSerial(disk);
+    if (serial.isEmpty()) return QString();
+
+    static const QRegularExpression unsafe("[^A-Za-z0-9._-]");
+    serial.replace(unsafe, "_");
+    return QString("%1-%2").arg(serial).arg(getDeviceSizeBytes(disk));
+}
+
+quint64 DeviceManager::getDiskSeq(const QString& devName) {
+    // Ядро (5.15+) увеличивает diskseq при каждой смене носителя
+    QFile file("/sys/block/" + devName + "/diskseq");
+    if (!file.open(QIODevice::ReadOnly)) return 0;
+    bool ok;
+    quint64 seq = file.readAll().trimmed().toULongLong(&ok);
+    return ok ? seq : 0;
+}
+
 QList<QString> DeviceManager::getMountPoints(const QString& devicePath) {
     QList<QString> mounts;
-    QFile mountsFile("/proc/mounts");
-    if (!mountsFile.open(QIODevice::ReadOnly)) return mounts;
-
-    QTextStream in(&mountsFile);
-    while (!in.atEnd()) {
-        QString line = in.readLine();
-        if (line.startsWith(devicePath + " ")) {
-            QStringList parts = line.split(' ', Qt::SkipEmptyParts);
-            if (parts.size() >= 2) mounts << parts[1];
-        }
+    for (const MountEntry& entry : MountTable::instance().mountsFor(devicePath)) {
+        mounts << entry.mountPoint;
     }
     return mounts;
 }
@@ -78,7 +226,7 @@ QList<QString> DeviceManager::getMountPoints(const QString& devicePath) {
 static bool isValidDevicePath(const QString& path) {
     // Разрешенные префиксы устройств
     static const QStringList allowedPrefixes = {
-        "/dev/sd", "/dev/mmcblk", "/dev/nvme"
+        "/dev/sd", "/dev/mmcblk", "/dev/nvme", "/dev/vd", "/dev/xvd", "/dev/hd"
     };
 
     for (const QString& prefix : allowedPrefixes) {
@@ -108,8 +256,10 @@ std::pair<bool, QString> DeviceManager::unmountPoint(const QString& mountPoint)
 }
 
 QString DeviceManager::getMountInfo(const QString& devicePath) {
-    auto mounts = getMountPoints(devicePath);
+    return describeMounts(devicePath, MountTable::instance().mountsFor(devicePath));
+}
 
+QString DeviceManager::describeMounts(const QString& devicePath, const QList<MountEntry>& mounts) {
     if (mounts.isEmpty()) {
         return "Устройство не смонтировано";
     }
@@ -117,37 +267,35 @@ QString DeviceManager::getMountInfo(const QString& devicePath) {
     QStringList info;
     info << QString("Устройство %1 смонтировано в %2 точках:").arg(devicePath).arg(mounts.size());
 
-    QFile mountsFile("/proc/mounts");
-    if (mountsFile.open(QIODevice::ReadOnly)) {
-        QTextStream in(&mountsFile);
-        while (!in.atEnd()) {
-            QString line = in.readLine();
-            if (line.startsWith(devicePath + " ")) {
-                QStringList parts = line.split(' ', Qt::SkipEmptyParts);
-                if (parts.size() >= 4) {
-                    QString mountInfo = QString("  • %1 (тип: %2, флаги: %3)")
-                    .arg(parts[1])  // точка монтирования
-                    .arg(parts[2])  // тип файловой системы
-                    .arg(parts[3]); // флаги монтирования
-                    info << mountInfo;
-                }
-            }
-        }
-        mountsFile.close();
+    for (const MountEntry& entry : mounts) {
+        info << QString("  • %1 на %2 (тип: %3, флаги: %4)")
+        .arg(entry.source)
+        .arg(entry.mountPoint)
+        .arg(entry.fsType)
+        .arg(entry.options);
     }
 
     return info.join("\n");
 }
 
 std::pair<bool, QString> DeviceManager::unmountAll(const QString& devicePath) {
-    auto mounts = getMountPoints(devicePath);
+    // Одна выборка из кэша таблицы монтирования: и сам диск, и его разделы
+    QList<MountEntry> entries = MountTable::instance().mountsFor(devicePath);
 
-    if (mounts.isEmpty()) {
+    if (entries.isEmpty()) {
         return {true, "Устройство не было смонтировано"};
     }
 
-    QString mountInfo = getMountInfo(devicePath);
-    qDebug() << "Попытка размонтирования:\n" << mountInfo;
+    qDebug() << "Попытка размонтирования:\n" << describeMounts(devicePath, entries);
+
+    // Вложенные точки размонтируем раньше родительских
+    QList<QString> mounts;
+    for (const MountEntry& entry : entries) {
+        if (!mounts.contains(entry.mountPoint)) mounts << entry.mountPoint;
+    }
+    std::sort(mounts.begin(), mounts.end(), [](const QString& a, const QString& b) {
+        return a.size() > b.size();
+    });
 
     QStringList failedMounts;
     QStringList errorMessages;
@@ -5,6 +5,69 @@
 #include <QVariant>
 #include <utility>  // Для std::pair
 
+struct MountEntry;
+
+// Параметры очереди блочного устройства из /sys/block/<dev>/queue
+struct DeviceTopology {
+    quint32 logicalBlockSize = 512;    // logical_block_size
+    quint32 physicalBlockSize = 512;   // physical_block_size
+    quint32 optimalIoSize = 0;         // optimal_io_size (0 = не сообщается)
+    quint32 maxSectorsKb = 0;          // max_sectors_kb - максимальный запрос
+    bool rotational = false;           // rotational
+    bool writeBackCache = false;       // write_cache == "write back"
+    bool fua = false;                  // fua - поддержка Force Unit Access
+    quint32 discardGranularity = 0;    // discard_granularity (0 = нет discard)
+    quint64 discardMaxBytes = 0;       // discard_max_bytes
+    quint64 writeZeroesMaxBytes = 0;   // write_zeroes_max_bytes (0 = нет аппаратного обнуления)
+
+    // Выравнивание буферов и размеров запросов для O_DIRECT
+    quint32 alignment() const {
+        return qMax(logicalBlockSize, physicalBlockSize);
+    }
+
+    // Гранула, кратно которой выгодно писать (optimal_io_size, если известен)
+    quint32 ioGranularity() const {
+        quint32 granule = alignment();
+        if (optimalIoSize > granule && optimalIoSize % granule == 0) granule = optimalIoSize;
+        return granule;
+    }
+
+    bool operator==(const DeviceTopology& other) const {
+        return logicalBlockSize == other.logicalBlockSize &&
+               physicalBlockSize == other.physicalBlockSize &&
+               optimalIoSize == other.optimalIoSize &&
+               maxSectorsKb == other.maxSectorsKb &&
+               rotational == other.rotational &&
+               writeBackCache == other.writeBackCache &&
+               fua == other.fua &&
+               discardGranularity == other.discardGranularity &&
+               discardMaxBytes == other.discardMaxBytes &&
+               writeZeroesMaxBytes == other.writeZeroesMaxBytes;
+    }
+};
+
+// Положение диска в топологии шин по пути в /sys/devices
+struct BusLocation {
+    QString disk;          // имя диска (для раздела - родительский диск)
+    QString controller;    // PCI-адрес хост-контроллера (0000:00:14.0)
+    QString rootHub;       // корневой хаб USB (usb2), пусто для не-USB
+    int rootHubSpeed = 0;  // скорость корневого хаба, Мбит/с
+    int deviceSpeed = 0;   // скорость самого USB-устройства, Мбит/с
+
+    bool isUsb() const { return !rootHub.isEmpty(); }
+};
+
+struct PartitionInfo {
+    QString path;             // /dev/sdb1, /dev/nvme0n1p1
+    int number = 0;           // partition
+    quint64 startBytes = 0;   // start * 512
+    quint64 sizeBytes = 0;
+
+    bool operator==(const PartitionInfo& other) const {
+        return path == other.path && startBytes == other.startBytes && sizeBytes == other.sizeBytes;
+    }
+};
+
 struct DeviceInfo {
     QString path;
     QString sizeStr;      // "14.9G"
@@ -12,10 +75,22 @@ struct DeviceInfo {
     QString model;
     bool removable = false;
     QList<QString> mountPoints;
+    QString serial;       // device/serial, wwid или cid (для mmc)
+    quint64 diskseq = 0;  // /sys/block/<dev>/diskseq, растет при смене носителя
+    DeviceTopology topology;
+    QList<PartitionInfo> partitions;
+
+    // Идентичность носителя: одинаковый ключ = тот же носитель без перевставки
+    QString identityKey() const {
+        return QString("%1|%2|%3|%4").arg(path).arg(serial).arg(diskseq).arg(sizeBytes);
+    }
 
     // Для QVariant
     bool operator==(const DeviceInfo& other) const {
-        return path == other.path && sizeBytes == other.sizeBytes;
+        return path == other.path && sizeBytes == other.sizeBytes &&
+               diskseq == other.diskseq && serial == other.serial &&
+               mountPoints == other.mountPoints && partitions == other.partitions &&
+               topology == other.topology;
     }
 };
 
@@ -28,8 +103,28 @@ public:
     static QList<QString> getMountPoints(const QString& devicePath);
     static bool isRemovable(const QString& devName);
     static quint64 getDeviceSizeBytes(const QString& devName);
+    static QString getDeviceSerial(const QString& devName);
+    static quint64 getDiskSeq(const QString& devName);
     static QString getMountInfo(const QString& devicePath);  // Добавлено
 
+    // Ключ носителя, переживающий перевставку: серийный номер и размер диска
+    // (для раздела - его диска). Пусто, если серийного номера нет
+    static QString mediaKey(const QString& devicePath);
+
+    // Топология очереди; для раздела берется очередь родительского диска
+    static DeviceTopology readTopology(const QString& devicePath);
+    static QList<PartitionInfo> getPartitions(const QString& devName);
+
+    // Смещение раздела от начала диска в байтах (0 для целого диска)
+    static quint64 partitionOffset(const QString& devicePath);
+
+    // Контроллер и корневой хаб, через которые подключено устройство
+    static BusLocation busLocation(const QString& devicePath);
+
+    // Имя узла раздела: sdb + 1 -> sdb1, mmcblk0/nvme0n1 + 1 -> mmcblk0p1/nvme0n1p1
+    static QString partitionPath(const QString& devicePath, int number);
+
 private:
     static std::pair<bool, QString> unmountPoint(const QString& mountPoint);
+    static QString describeMounts(const QString& devicePath, const QList<MountEntry>& mounts);
 };
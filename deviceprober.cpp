@@ -0,0 +1,127 @@
+// deviceprober.cpp
+#include "deviceprober.h"
+#include "mounttable.h"
+#include <QThreadPool>
+#include <QFutureWatcher>
+#include <QTimer>
+#include <QDebug>
+#include <QtConcurrent/QtConcurrent>
+#include <memory>
+
+namespace {
+
+// Зависшее чтение держит поток до ответа устройства; на каждое такое
+// устройство пул получает поток сверх обычных, но не больше этого числа
+const int MaxHungProbes = 8;
+
+} // namespace
+
+DeviceProber::DeviceProber(QObject* parent)
+: QObject(parent), m_pool(new QThreadPool) {
+    // Медленные карты не должны занимать все потоки
+    m_baseThreads = qMax(2, qMin(4, QThread::idealThreadCount()));
+    updatePoolSize();
+}
+
+DeviceProber::~DeviceProber() {
+    m_pool->clear();
+    // Зависшее устройство не должно блокировать выход из программы:
+    // если чтение не завершилось, пул намеренно не удаляется
+    if (m_pool->waitForDone(500)) {
+        delete m_pool;
+    } else {
+        qWarning() << "Проверка устройств не завершилась, пул потоков оставлен";
+    }
+}
+
+bool DeviceProber::cachedFilesystem(const DeviceInfo& dev, QString* fsType) const {
+    auto it = m_cache.constFind(dev.identityKey());
+    if (it == m_cache.constEnd()) return false;
+    if (fsType) *fsType = filesystemOf(dev.path, it.value());
+    return true;
+}
+
+bool DeviceProber::cachedProbe(const DeviceInfo& dev, ProbeResult* result) const {
+    auto it = m_cache.constFind(dev.identityKey());
+    if (it == m_cache.constEnd()) return false;
+    if (result) *result = it.value();
+    return true;
+}
+
+QString DeviceProber::filesystemOf(const QString& devicePath, const ProbeResult& result) {
+    // Для смонтированного устройства тип из таблицы монтирования точнее
+    QList<MountEntry> mounts = MountTable::instance().mountsFor(devicePath, false);
+    if (!mounts.isEmpty()) {
+        return mounts.first().fsType;
+    }
+    return result.summary();
+}
+
+void DeviceProber::request(const DeviceInfo& dev) {
+    const QString key = dev.identityKey();
+    // Запрос к устаревшей проверке выполнится по ее окончании (m_stale)
+    if (m_cache.contains(key) || m_inFlight.contains(key)) return;
+    start(key, dev.path);
+}
+
+void DeviceProber::invalidate(const DeviceInfo& dev) {
+    const QString key = dev.identityKey();
+    m_cache.remove(key);
+    if (m_inFlight.contains(key)) m_stale.insert(key);
+}
+
+void DeviceProber::start(const QString& key, const QString& path) {
+    m_inFlight.insert(key);
+    auto* watcher = new QFutureWatcher<ProbeResult>(this);
+    auto hung = std::make_shared<bool>(false);
+
+    connect(watcher, &QFutureWatcher<ProbeResult>::finished, this, [this, watcher, key, path, hung]() {
+        ProbeResult result = watcher->result();
+        m_inFlight.remove(key);
+        watcher->deleteLater();
+        if (*hung) {
+            --m_hung;
+            updatePoolSize();
+        }
+        if (m_stale.remove(key)) {
+            // Устройство изменилось во время проверки - читаем новое содержимое
+            start(key, path);
+            return;
+        }
+        m_cache.insert(key, result);
+        emit probed(path, filesystemOf(path, result), false);
+    });
+
+    // Таймаут только сообщает интерфейсу; поток дочитает и обновит кэш сам,
+    // а остальные устройства тем временем проверяются на добавленном потоке
+    QTimer::singleShot(m_timeoutMs, watcher, [this, watcher, path, hung]() {
+        if (!watcher->isFinished()) {
+            *hung = true;
+            ++m_hung;
+            updatePoolSize();
+            emit probed(path, QString(), true);
+        }
+    });
+
+    watcher->setFuture(QtConcurrent::run(m_pool, [path]() {
+        return ProbeEngine::probe(path);
+    }));
+}
+
+void DeviceProber::updatePoolSize() {
+    m_pool->setMaxThreadCount(m_baseThreads + qMin(m_hung, MaxHungProbes));
+}
+
+void DeviceProber::retain(const QList<DeviceInfo>& devices) {
+    QSet<QString> alive;
+    for (const DeviceInfo& dev : devices) {
+        alive.insert(dev.identityKey());
+    }
+    for (auto it = m_cache.begin(); it != m_cache.end();) {
+        if (!alive.contains(it.key())) {
+            it = m_cache.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
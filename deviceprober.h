@@ -0,0 +1,60 @@
+// deviceprober.h
+#pragma once
+
+#include <QObject>
+#include <QString>
+#include <QHash>
+#include <QSet>
+
+#include "devicemanager.h"
+#include "probeengine.h"
+
+class QThreadPool;
+
+// Асинхронное определение файловой системы устройств.
+// Чтение с носителя выполняется в отдельном пуле потоков, результат
+// кэшируется по идентичности носителя (serial + diskseq + размер),
+// поэтому неизменившиеся устройства повторно не читаются.
+class DeviceProber : public QObject {
+    Q_OBJECT
+
+public:
+    explicit DeviceProber(QObject* parent = nullptr);
+    ~DeviceProber() override;
+
+    // Результат из кэша (без обращения к устройству)
+    bool cachedFilesystem(const DeviceInfo& dev, QString* fsType) const;
+
+    // Полный результат проверки (таблица разделов, метки, сигнатуры) из кэша
+    bool cachedProbe(const DeviceInfo& dev, ProbeResult* result) const;
+
+    // Поставить устройство в очередь; результат придет сигналом probed()
+    void request(const DeviceInfo& dev);
+
+    // Забыть результат для устройства, содержимое которого изменилось.
+    // Идущая проверка могла прочитать старое содержимое - по ее окончании
+    // устройство проверяется заново
+    void invalidate(const DeviceInfo& dev);
+
+    // Забыть результаты для устройств, которых больше нет в системе
+    void retain(const QList<DeviceInfo>& devices);
+
+    void setTimeout(int msec) { m_timeoutMs = msec; }
+
+signals:
+    // timedOut = устройство не ответило за отведенное время
+    void probed(const QString& devicePath, const QString& fsType, bool timedOut);
+
+private:
+    static QString filesystemOf(const QString& devicePath, const ProbeResult& result);
+    void start(const QString& key, const QString& path);
+    void updatePoolSize();
+
+    QThreadPool* m_pool = nullptr;
+    int m_baseThreads = 2;
+    int m_hung = 0;                      // проверки, не уложившиеся в таймаут
+    QHash<QString, ProbeResult> m_cache;  // identityKey -> результат проверки
+    QSet<QString> m_inFlight;            // identityKey запущенных проверок
+    QSet<QString> m_stale;               // запущенные до invalidate - результат устарел
+    int m_timeoutMs = 3000;
+};
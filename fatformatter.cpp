@@ -0,0 +1,618 @@
+// fatformatter.cpp
+#include "fatformatter.h"
+#include "devicemanager.h"
+#include <QByteArray>
+#include <QRandomGenerator>
+#include <QVector>
+#include <QDebug>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <linux/falloc.h>
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+
+namespace {
+
+const quint64 MinAlignment = 1024 * 1024;        // граница распределения SD/USB
+const quint64 MaxAlignment = 16 * 1024 * 1024;
+const qint64 ZeroChunk = 4 * 1024 * 1024;
+
+void put16(uchar* p, quint16 v) { p[0] = v & 0xFF; p[1] = v >> 8; }
+void put32(uchar* p, quint32 v) { put16(p, v & 0xFFFF); put16(p + 2, v >> 16); }
+void put64(uchar* p, quint64 v) { put32(p, v & 0xFFFFFFFFu); put32(p + 4, v >> 32); }
+
+quint64 alignUp(quint64 value, quint64 align) {
+    return (value + align - 1) / align * align;
+}
+
+bool isPowerOfTwo(quint64 v) {
+    return v != 0 && (v & (v - 1)) == 0;
+}
+
+int log2Of(quint64 v) {
+    int shift = 0;
+    while ((1ULL << shift) < v) ++shift;
+    return shift;
+}
+
+// Выровненный буфер для O_DIRECT
+class AlignedBuffer {
+public:
+    explicit AlignedBuffer(size_t size) : m_size(size) {
+        if (posix_memalign(&m_data, 4096, size) == 0) {
+            memset(m_data, 0, size);
+        } else {
+            m_data = nullptr;
+        }
+    }
+    ~AlignedBuffer() { free(m_data); }
+
+    bool isValid() const { return m_data != nullptr; }
+    uchar* data() { return static_cast<uchar*>(m_data); }
+    size_t size() const { return m_size; }
+
+private:
+    AlignedBuffer(const AlignedBuffer&) = delete;
+    AlignedBuffer& operator=(const AlignedBuffer&) = delete;
+
+    void* m_data = nullptr;
+    size_t m_size = 0;
+};
+
+// Открытое для форматирования устройство (или файл образа)
+class Target {
+public:
+    explicit Target(const QString& path) {
+        QByteArray p = path.toLocal8Bit();
+        struct stat st;
+        if (::stat(p.constData(), &st) != 0) {
+            m_error = QString("Устройство недоступно: %1").arg(strerror(errno));
+            return;
+        }
+        m_block = S_ISBLK(st.st_mode);
+
+        // O_EXCL на блочном устройстве не даст открыть смонтированный раздел
+        int flags = O_RDWR | O_CLOEXEC | (m_block ? O_EXCL : 0);
+        m_fd = ::open(p.constData(), flags | O_DIRECT);
+        if (m_fd < 0 && errno == EINVAL) {
+            m_fd = ::open(p.constData(), flags);
+        }
+        if (m_fd < 0) {
+            m_error = errno == EBUSY ? QString("Устройство занято (смонтировано или используется)")
+                                     : QString("Не удалось открыть устройство: %1").arg(strerror(errno));
+            return;
+        }
+
+        if (m_block) {
+            quint64 size = 0;
+            if (::ioctl(m_fd, BLKGETSIZE64, &size) != 0) {
+                m_error = QString("Не удалось определить размер: %1").arg(strerror(errno));
+                return;
+            }
+            m_size = size;
+            int sector = 0;
+            if (::ioctl(m_fd, BLKSSZGET, &sector) == 0 && sector >= 512) m_sectorSize = sector;
+
+            const DeviceTopology topo = DeviceManager::readTopology(path);
+            m_alignment = qBound<quint64>(MinAlignment, topo.optimalIoSize, MaxAlignment);
+            if (!isPowerOfTwo(m_alignment)) m_alignment = MinAlignment;
+            m_offset = DeviceManager::partitionOffset(path);
+        } else {
+            m_size = static_cast<quint64>(st.st_size);
+            m_alignment = MinAlignment;
+        }
+    }
+
+    ~Target() {
+        if (m_fd >= 0) ::close(m_fd);
+    }
+
+    bool isOpen() const { return m_fd >= 0 && m_size > 0; }
+    QString error() const { return m_error; }
+    quint64 size() const { return m_size; }
+    quint32 sectorSize() const { return m_sectorSize; }
+    quint64 alignment() const { return m_alignment; }
+    quint64 offset() const { return m_offset; }
+
+    // Выравнивание считается от начала диска, а не раздела
+    quint64 alignSectors(quint64 sector) const {
+        const quint64 align = m_alignment / m_sectorSize;
+        const quint64 base = m_offset / m_sectorSize;
+        return alignUp(base + sector, align) - base;
+    }
+
+    bool write(qint64 offset, const uchar* data, size_t length) {
+        size_t done = 0;
+        while (done < length) {
+            ssize_t n = ::pwrite(m_fd, data + done, length - done, offset + done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                m_error = QString("Ошибка записи по смещению %1: %2").arg(offset + done).arg(strerror(errno));
+                return false;
+            }
+            done += n;
+        }
+        return true;
+    }
+
+    // Обнуление служебной области: сначала средствами ядра/устройства,
+    // при отсутствии поддержки - крупными блоками нулей
+    bool zero(qint64 offset, qint64 length, const std::function<bool(qint64)>& onProgress) {
+        if (m_block) {
+            uint64_t range[2] = { static_cast<uint64_t>(offset), static_cast<uint64_t>(length) };
+            if (::ioctl(m_fd, BLKZEROOUT, range) == 0) return true;
+        } else if (::fallocate(m_fd, FALLOC_FL_ZERO_RANGE, offset, length) == 0 ||
+                   ::fallocate(m_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, length) == 0) {
+            return true;
+        }
+
+        AlignedBuffer zeros(static_cast<size_t>(qMin(ZeroChunk, length)));
+        if (!zeros.isValid()) {
+            m_error = "Недостаточно памяти";
+            return false;
+        }
+        for (qint64 done = 0; done < length;) {
+            size_t chunk = static_cast<size_t>(qMin<qint64>(zeros.size(), length - done));
+            if (!write(offset + done, zeros.data(), chunk)) return false;
+            done += chunk;
+            if (onProgress && !onProgress(done)) {
+                m_error = "Операция отменена";
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool sync() {
+        if (::fsync(m_fd) != 0) {
+            m_error = QString("Ошибка синхронизации: %1").arg(strerror(errno));
+            return false;
+        }
+        return true;
+    }
+
+private:
+    int m_fd = -1;
+    bool m_block = false;
+    quint64 m_size = 0;
+    quint32 m_sectorSize = 512;
+    quint64 m_alignment = MinAlignment;
+    quint64 m_offset = 0;
+    QString m_error;
+};
+
+void report(const FatFormatter::ProgressCallback& progress, int percent, const QString& message) {
+    if (progress) progress(percent, message);
+}
+
+bool isCancelled(const std::atomic<bool>* cancelled) {
+    return cancelled && cancelled->load(std::memory_order_acquire);
+}
+
+// Очистка служебной области с прогрессом в диапазоне [from, to]
+bool zeroMetadata(Target& target, qint64 length, int from, int to,
+                  const FatFormatter::ProgressCallback& progress,
+                  const std::atomic<bool>* cancelled) {
+    report(progress, from, "Очистка служебной области...");
+    return target.zero(0, length, [&](qint64 done) {
+        report(progress, from + static_cast<int>((to - from) * done / length), "Очистка служебной области...");
+        return !isCancelled(cancelled);
+    });
+}
+
+// Метка FAT: 11 байт, верхний регистр, только допустимые ASCII-символы
+QByteArray fatLabel(const QString& label) {
+    QByteArray out;
+    for (QChar ch : label.toUpper()) {
+        if (out.size() == 11) break;
+        ushort c = ch.unicode();
+        if (c < 0x20 || c > 0x7E || strchr("\"*+,./:;<=>?[\\]|", static_cast<char>(c))) {
+            out.append('_');
+        } else {
+            out.append(static_cast<char>(c));
+        }
+    }
+    return out;
+}
+
+// Вращающаяся сумма exFAT (загрузочная область и таблица регистра)
+quint32 exfatChecksum(const uchar* data, size_t length, quint32 sum, bool bootRegion) {
+    for (size_t i = 0; i < length; ++i) {
+        if (bootRegion && (i == 106 || i == 107 || i == 112)) continue;
+        sum = ((sum & 1) ? 0x80000000u : 0) + (sum >> 1) + data[i];
+    }
+    return sum;
+}
+
+// Верхний регистр Unicode 5.0 (простое отображение) в пределах BMP, как
+// в рекомендованной таблице спецификации exFAT: символы first..last с
+// шагом step переходят в символ + delta
+struct CaseRange {
+    quint16 first;
+    quint16 last;
+    int delta;
+    int step;
+};
+
+const CaseRange kUpcaseRanges[] = {
+    {0x0061, 0x007A, -32, 1}, {0x00B5, 0x00B5, 743, 1}, {0x00E0, 0x00F6, -32, 1},
+    {0x00F8, 0x00FE, -32, 1}, {0x00FF, 0x00FF, 121, 1}, {0x0101, 0x012F, -1, 2},
+    {0x0131, 0x0131, -232, 1}, {0x0133, 0x0137, -1, 2}, {0x013A, 0x0148, -1, 2},
+    {0x014B, 0x0177, -1, 2}, {0x017A, 0x017E, -1, 2}, {0x017F, 0x017F, -300, 1},
+    {0x0180, 0x0180, 195, 1}, {0x0183, 0x0185, -1, 2}, {0x0188, 0x0188, -1, 1},
+    {0x018C, 0x018C, -1, 1}, {0x0192, 0x0192, -1, 1}, {0x0195, 0x0195, 97, 1},
+    {0x0199, 0x0199, -1, 1}, {0x019A, 0x019A, 163, 1}, {0x019E, 0x019E, 130, 1},
+    {0x01A1, 0x01A5, -1, 2}, {0x01A8, 0x01A8, -1, 1}, {0x01AD, 0x01AD, -1, 1},
+    {0x01B0, 0x01B0, -1, 1}, {0x01B4, 0x01B6, -1, 2}, {0x01B9, 0x01B9, -1, 1},
+    {0x01BD, 0x01BD, -1, 1}, {0x01BF, 0x01BF, 56, 1}, {0x01C5, 0x01C5, -1, 1},
+    {0x01C6, 0x01C6, -2, 1}, {0x01C8, 0x01C8, -1, 1}, {0x01C9, 0x01C9, -2, 1},
+    {0x01CB, 0x01CB, -1, 1}, {0x01CC, 0x01CC, -2, 1}, {0x01CE, 0x01DC, -1, 2},
+    {0x01DD, 0x01DD, -79, 1}, {0x01DF, 0x01EF, -1, 2}, {0x01F2, 0x01F2, -1, 1},
+    {0x01F3, 0x01F3, -2, 1}, {0x01F5, 0x01F5, -1, 1}, {0x01F9, 0x021F, -1, 2},
+    {0x0223, 0x0233, -1, 2}, {0x023C, 0x023C, -1, 1}, {0x0242, 0x0242, -1, 1},
+    {0x0247, 0x024F, -1, 2}, {0x0253, 0x0253, -210, 1}, {0x0254, 0x0254, -206, 1},
+    {0x0256, 0x0257, -205, 1}, {0x0259, 0x0259, -202, 1}, {0x025B, 0x025B, -203, 1},
+    {0x0260, 0x0260, -205, 1}, {0x0263, 0x0263, -207, 1}, {0x0268, 0x0268, -209, 1},
+    {0x0269, 0x0269, -211, 1}, {0x026B, 0x026B, 10743, 1}, {0x026F, 0x026F, -211, 1},
+    {0x0272, 0x0272, -213, 1}, {0x0275, 0x0275, -214, 1}, {0x027D, 0x027D, 10727, 1},
+    {0x0280, 0x0280, -218, 1}, {0x0283, 0x0283, -218, 1}, {0x0288, 0x0288, -218, 1},
+    {0x0289, 0x0289, -69, 1}, {0x028A, 0x028B, -217, 1}, {0x028C, 0x028C, -71, 1},
+    {0x0292, 0x0292, -219, 1}, {0x0345, 0x0345, 84, 1}, {0x037B, 0x037D, 130, 1},
+    {0x03AC, 0x03AC, -38, 1}, {0x03AD, 0x03AF, -37, 1}, {0x03B1, 0x03C1, -32, 1},
+    {0x03C2, 0x03C2, -31, 1}, {0x03C3, 0x03CB, -32, 1}, {0x03CC, 0x03CC, -64, 1},
+    {0x03CD, 0x03CE, -63, 1}, {0x03D0, 0x03D0, -62, 1}, {0x03D1, 0x03D1, -57, 1},
+    {0x03D5, 0x03D5, -47, 1}, {0x03D6, 0x03D6, -54, 1}, {0x03D9, 0x03EF, -1, 2},
+    {0x03F0, 0x03F0, -86, 1}, {0x03F1, 0x03F1, -80, 1}, {0x03F2, 0x03F2, 7, 1},
+    {0x03F5, 0x03F5, -96, 1}, {0x03F8, 0x03F8, -1, 1}, {0x03FB, 0x03FB, -1, 1},
+    {0x0430, 0x044F, -32, 1}, {0x0450, 0x045F, -80, 1}, {0x0461, 0x0481, -1, 2},
+    {0x048B, 0x04BF, -1, 2}, {0x04C2, 0x04CE, -1, 2}, {0x04CF, 0x04CF, -15, 1},
+    {0x04D1, 0x0513, -1, 2}, {0x0561, 0x0586, -48, 1}, {0x1D7D, 0x1D7D, 3814, 1},
+    {0x1E01, 0x1E95, -1, 2}, {0x1E9B, 0x1E9B, -59, 1}, {0x1EA1, 0x1EF9, -1, 2},
+    {0x1F00, 0x1F07, 8, 1}, {0x1F10, 0x1F15, 8, 1}, {0x1F20, 0x1F27, 8, 1}, {0x1F30, 0x1F37, 8, 1},
+    {0x1F40, 0x1F45, 8, 1}, {0x1F51, 0x1F57, 8, 2}, {0x1F60, 0x1F67, 8, 1}, {0x1F70, 0x1F71, 74, 1},
+    {0x1F72, 0x1F75, 86, 1}, {0x1F76, 0x1F77, 100, 1}, {0x1F78, 0x1F79, 128, 1},
+    {0x1F7A, 0x1F7B, 112, 1}, {0x1F7C, 0x1F7D, 126, 1}, {0x1F80, 0x1F87, 8, 1},
+    {0x1F90, 0x1F97, 8, 1}, {0x1FA0, 0x1FA7, 8, 1}, {0x1FB0, 0x1FB1, 8, 1}, {0x1FB3, 0x1FB3, 9, 1},
+    {0x1FBE, 0x1FBE, -7205, 1}, {0x1FC3, 0x1FC3, 9, 1}, {0x1FD0, 0x1FD1, 8, 1},
+    {0x1FE0, 0x1FE1, 8, 1}, {0x1FE5, 0x1FE5, 7, 1}, {0x1FF3, 0x1FF3, 9, 1},
+    {0x214E, 0x214E, -28, 1}, {0x2170, 0x217F, -16, 1}, {0x2184, 0x2184, -1, 1},
+    {0x24D0, 0x24E9, -26, 1}, {0x2C30, 0x2C5E, -48, 1}, {0x2C61, 0x2C61, -1, 1},
+    {0x2C65, 0x2C65, -10795, 1}, {0x2C66, 0x2C66, -10792, 1}, {0x2C68, 0x2C6C, -1, 2},
+    {0x2C76, 0x2C76, -1, 1}, {0x2C81, 0x2CE3, -1, 2}, {0x2D00, 0x2D25, -7264, 1},
+    {0xFF41, 0xFF5A, -32, 1},
+};
+
+// Серии символов, отображаемых сами в себя, от этой длины сжимаются
+const int UpcaseRunMin = 512;
+
+// Сжатая таблица верхнего регистра (спецификация exFAT, 7.2.5.1): серия
+// тождественных символов записывается как 0xFFFF и ее длина. Таблица
+// покрывает всю BMP, иначе Windows сравнивает имена вне Latin-1 с учетом регистра
+QByteArray exfatUpcaseTable() {
+    QVector<quint16> map(0x10000);
+    for (int c = 0; c < 0x10000; ++c) map[c] = static_cast<quint16>(c);
+    for (const CaseRange& range : kUpcaseRanges) {
+        for (int c = range.first; c <= range.last; c += range.step) {
+            map[c] = static_cast<quint16>(c + range.delta);
+        }
+    }
+
+    QByteArray table;
+    auto append = [&table](quint16 v) {
+        table.append(static_cast<char>(v & 0xFF));
+        table.append(static_cast<char>(v >> 8));
+    };
+    for (int c = 0; c < 0x10000;) {
+        int run = 0;
+        while (c + run < 0x10000 && map[c + run] == c + run) ++run;
+        if (run >= UpcaseRunMin) {
+            append(0xFFFF);
+            append(static_cast<quint16>(run));
+            c += run;
+        } else if (run > 0) {
+            for (int i = 0; i < run; ++i) append(static_cast<quint16>(c + i));
+            c += run;
+        } else {
+            append(map[c]);
+            ++c;
+        }
+    }
+    return table;
+}
+
+} // namespace
+
+std::pair<bool, QString> FatFormatter::formatFat32(const QString& devicePath,
+                                                   int clusterSize,
+                                                   const QString& label,
+                                                   const ProgressCallback& progress,
+                                                   const std::atomic<bool>* cancelled) {
+    report(progress, 0, "Расчет разметки FAT32...");
+
+    Target target(devicePath);
+    if (!target.isOpen()) return {false, target.error()};
+
+    const quint64 bps = target.sectorSize();
+    const quint64 totalSectors = target.size() / bps;
+    if (totalSectors > 0xFFFFFFFFULL) {
+        return {false, "Устройство слишком велико для FAT32, используйте exFAT"};
+    }
+
+    // Размер кластера по умолчанию как у Windows
+    quint64 cluster = clusterSize > 0 ? static_cast<quint64>(clusterSize) : 0;
+    if (cluster == 0) {
+        const quint64 gb = 1024ULL * 1024 * 1024;
+        if (target.size() <= 8 * gb) cluster = 4096;
+        else if (target.size() <= 16 * gb) cluster = 8192;
+        else if (target.size() <= 32 * gb) cluster = 16384;
+        else cluster = 32768;
+    }
+    if (!isPowerOfTwo(cluster) || cluster < bps || cluster > 65536) {
+        return {false, QString("Недопустимый размер кластера: %1").arg(cluster)};
+    }
+
+    // Подбираем кластер так, чтобы их число было в допустимом для FAT32 диапазоне
+    quint64 reserved = 0, fatSize = 0, clusters = 0, spc = 0;
+    for (;;) {
+        spc = cluster / bps;
+        // Оценка сверху: FAT покрывает все сектора после зарезервированной области
+        fatSize = ((totalSectors - qMin<quint64>(32, totalSectors)) / spc + 2) * 4;
+        fatSize = (fatSize + bps - 1) / bps;
+        // Зарезервированная область дополняется так, чтобы данные начинались на границе
+        const quint64 dataStart = target.alignSectors(32 + 2 * fatSize);
+        reserved = dataStart - 2 * fatSize;
+        clusters = dataStart < totalSectors ? (totalSectors - dataStart) / spc : 0;
+
+        if (clusters < 65525 && cluster > bps) {
+            cluster /= 2;
+            continue;
+        }
+        if (clusters > 0x0FFFFFF5 && cluster < 65536) {
+            cluster *= 2;
+            continue;
+        }
+        break;
+    }
+    if (clusters < 65525) return {false, "Устройство слишком мало для FAT32"};
+    if (clusters > 0x0FFFFFF5 || reserved > 0xFFFF) return {false, "Не удалось подобрать разметку FAT32"};
+
+    const quint64 dataStart = reserved + 2 * fatSize;
+    const QByteArray volLabel = fatLabel(label);
+    const quint32 volumeId = QRandomGenerator::global()->generate();
+
+    qDebug() << "FAT32:" << devicePath << "кластер" << cluster << "кластеров" << clusters
+             << "FAT" << fatSize << "секторов, данные с сектора" << dataStart;
+
+    // 1. Обнуляем FAT и корневой каталог: старая загрузочная запись
+    //    исчезает первой, валидная появится последней
+    if (!zeroMetadata(target, static_cast<qint64>(dataStart * bps + cluster), 5, 80, progress, cancelled)) {
+        return {false, target.error()};
+    }
+
+    if (isCancelled(cancelled)) return {false, "Операция отменена"};
+
+    // 2. Начало обеих FAT: media, clean-флаги и конец цепочки корня
+    report(progress, 85, "Запись таблиц FAT...");
+    AlignedBuffer sector(bps);
+    if (!sector.isValid()) return {false, "Недостаточно памяти"};
+    put32(sector.data() + 0, 0x0FFFFFF8);
+    put32(sector.data() + 4, 0x0FFFFFFF);
+    put32(sector.data() + 8, 0x0FFFFFFF);
+    for (int fat = 0; fat < 2; ++fat) {
+        if (!target.write(static_cast<qint64>((reserved + fat * fatSize) * bps), sector.data(), bps)) {
+            return {false, target.error()};
+        }
+    }
+
+    // 3. Корневой каталог (кластер 2) с записью метки тома
+    if (!volLabel.isEmpty()) {
+        memset(sector.data(), 0, bps);
+        memset(sector.data(), ' ', 11);
+        memcpy(sector.data(), volLabel.constData(), volLabel.size());
+        sector.data()[11] = 0x08;  // ATTR_VOLUME_ID
+        if (!target.write(static_cast<qint64>(dataStart * bps), sector.data(), bps)) {
+            return {false, target.error()};
+        }
+    }
+
+    // 4. Загрузочная область: сектора 0-1 и их копии в 6-7
+    report(progress, 90, "Запись загрузочной области...");
+    AlignedBuffer boot(8 * bps);
+    if (!boot.isValid()) return {false, "Недостаточно памяти"};
+    uchar* b = boot.data();
+    b[0] = 0xEB; b[1] = 0x58; b[2] = 0x90;
+    memcpy(b + 3, "MSWIN4.1", 8);
+    put16(b + 11, static_cast<quint16>(bps));
+    b[13] = static_cast<uchar>(spc);
+    put16(b + 14, static_cast<quint16>(reserved));
+    b[16] = 2;                                   // число FAT
+    b[21] = 0xF8;                                // media
+    put16(b + 24, 63);                           // секторов на дорожку
+    put16(b + 26, 255);                          // головок
+    put32(b + 28, static_cast<quint32>(target.offset() / bps));
+    put32(b + 32, static_cast<quint32>(totalSectors));
+    put32(b + 36, static_cast<quint32>(fatSize));
+    put32(b + 44, 2);                            // корневой каталог
+    put16(b + 48, 1);                            // FSInfo
+    put16(b + 50, 6);                            // копия загрузочного сектора
+    b[64] = 0x80;
+    b[66] = 0x29;
+    put32(b + 67, volumeId);
+    memset(b + 71, ' ', 11);
+    if (volLabel.isEmpty()) memcpy(b + 71, "NO NAME", 7);
+    else memcpy(b + 71, volLabel.constData(), volLabel.size());
+    memcpy(b + 82, "FAT32   ", 8);
+    memset(b + 90, 0xF4, 510 - 90);              // hlt вместо загрузчика
+    b[510] = 0x55; b[511] = 0xAA;
+
+    uchar* fsinfo = b + bps;
+    put32(fsinfo + 0, 0x41615252);
+    put32(fsinfo + 484, 0x61417272);
+    put32(fsinfo + 488, static_cast<quint32>(clusters - 1));  // свободно (корень занят)
+    put32(fsinfo + 492, 3);                                   // следующий свободный
+    put32(fsinfo + 508, 0xAA550000);
+
+    memcpy(b + 6 * bps, b, 2 * bps);
+    if (!target.write(0, b, boot.size())) return {false, target.error()};
+
+    report(progress, 95, "Синхронизация...");
+    if (!target.sync()) return {false, target.error()};
+
+    report(progress, 100, "Форматирование FAT32 завершено");
+    return {true, QString("FAT32: %1 кластеров по %2 байт").arg(clusters).arg(cluster)};
+}
+
+std::pair<bool, QString> FatFormatter::formatExfat(const QString& devicePath,
+                                                   int clusterSize,
+                                                   const QString& label,
+                                                   const ProgressCallback& progress,
+                                                   const std::atomic<bool>* cancelled) {
+    report(progress, 0, "Расчет разметки exFAT...");
+
+    Target target(devicePath);
+    if (!target.isOpen()) return {false, target.error()};
+
+    const quint64 bps = target.sectorSize();
+    const quint64 totalSectors = target.size() / bps;
+    const quint64 gb = 1024ULL * 1024 * 1024;
+
+    quint64 cluster = clusterSize > 0 ? static_cast<quint64>(clusterSize) : 0;
+    if (cluster == 0) {
+        if (target.size() <= gb / 4) cluster = 4096;
+        else if (target.size() <= 32 * gb) cluster = 32768;
+        else cluster = 131072;
+    }
+    if (!isPowerOfTwo(cluster) || cluster < bps || cluster > 32 * 1024 * 1024) {
+        return {false, QString("Недопустимый размер кластера: %1").arg(cluster)};
+    }
+    const quint64 spc = cluster / bps;
+
+    // FAT и куча кластеров начинаются на границах выравнивания
+    const quint64 fatOffset = target.alignSectors(24);
+    if (fatOffset >= totalSectors) return {false, "Устройство слишком мало для exFAT"};
+    const quint64 maxClusters = (totalSectors - fatOffset) / spc;
+    const quint64 fatLength = ((maxClusters + 2) * 4 + bps - 1) / bps;
+    const quint64 heapOffset = target.alignSectors(fatOffset + fatLength);
+    if (heapOffset >= totalSectors) return {false, "Устройство слишком мало для exFAT"};
+    const quint64 clusters = (totalSectors - heapOffset) / spc;
+    if (clusters < 16 || clusters > 0xFFFFFFF5 || heapOffset > 0xFFFFFFFFULL) {
+        return {false, "Не удалось подобрать разметку exFAT"};
+    }
+
+    // Служебные кластеры: битовая карта, таблица регистра, корневой каталог
+    const QByteArray upcase = exfatUpcaseTable();
+    const quint64 bitmapBytes = (clusters + 7) / 8;
+    const quint64 bitmapClusters = (bitmapBytes + cluster - 1) / cluster;
+    const quint64 upcaseClusters = (static_cast<quint64>(upcase.size()) + cluster - 1) / cluster;
+    const quint64 usedClusters = bitmapClusters + upcaseClusters + 1;
+    const quint32 bitmapCluster = 2;
+    const quint32 upcaseCluster = static_cast<quint32>(bitmapCluster + bitmapClusters);
+    const quint32 rootCluster = static_cast<quint32>(upcaseCluster + upcaseClusters);
+    if (usedClusters >= clusters) return {false, "Устройство слишком мало для exFAT"};
+
+    qDebug() << "exFAT:" << devicePath << "кластер" << cluster << "кластеров" << clusters
+             << "FAT с сектора" << fatOffset << "куча с сектора" << heapOffset;
+
+    const quint64 heapBytes = usedClusters * cluster;
+    if (!zeroMetadata(target, static_cast<qint64>(heapOffset * bps + heapBytes), 5, 70, progress, cancelled)) {
+        return {false, target.error()};
+    }
+
+    if (isCancelled(cancelled)) return {false, "Операция отменена"};
+
+    // FAT: цепочки служебных кластеров
+    report(progress, 75, "Запись FAT...");
+    const quint64 fatBytes = alignUp((2 + usedClusters) * 4, bps);
+    AlignedBuffer fat(fatBytes);
+    if (!fat.isValid()) return {false, "Недостаточно памяти"};
+    put32(fat.data() + 0, 0xFFFFFFF8);
+    put32(fat.data() + 4, 0xFFFFFFFF);
+    auto chain = [&](quint32 first, quint64 count) {
+        for (quint64 i = 0; i < count; ++i) {
+            quint32 next = i + 1 < count ? static_cast<quint32>(first + i + 1) : 0xFFFFFFFF;
+            put32(fat.data() + (first + i) * 4, next);
+        }
+    };
+    chain(bitmapCluster, bitmapClusters);
+    chain(upcaseCluster, upcaseClusters);
+    chain(rootCluster, 1);
+    if (!target.write(static_cast<qint64>(fatOffset * bps), fat.data(), fat.size())) {
+        return {false, target.error()};
+    }
+
+    // Битовая карта, таблица регистра и корневой каталог идут подряд
+    report(progress, 80, "Запись битовой карты и корневого каталога...");
+    AlignedBuffer heap(heapBytes);
+    if (!heap.isValid()) return {false, "Недостаточно памяти"};
+    uchar* bitmap = heap.data();
+    for (quint64 i = 0; i < usedClusters; ++i) {
+        bitmap[i / 8] |= static_cast<uchar>(1 << (i % 8));
+    }
+    memcpy(heap.data() + (upcaseCluster - 2) * cluster, upcase.constData(), upcase.size());
+
+    uchar* dir = heap.data() + (rootCluster - 2) * cluster;
+    if (!label.isEmpty()) {
+        const QString name = label.left(11);
+        dir[0] = 0x83;
+        dir[1] = static_cast<uchar>(name.size());
+        for (int i = 0; i < name.size(); ++i) put16(dir + 2 + i * 2, name.at(i).unicode());
+        dir += 32;
+    }
+    dir[0] = 0x81;                                   // битовая карта
+    put32(dir + 20, bitmapCluster);
+    put64(dir + 24, bitmapBytes);
+    dir += 32;
+    dir[0] = 0x82;                                   // таблица регистра
+    put32(dir + 4, exfatChecksum(reinterpret_cast<const uchar*>(upcase.constData()), upcase.size(), 0, false));
+    put32(dir + 20, upcaseCluster);
+    put64(dir + 24, static_cast<quint64>(upcase.size()));
+
+    if (!target.write(static_cast<qint64>(heapOffset * bps), heap.data(), heap.size())) {
+        return {false, target.error()};
+    }
+
+    // Основная (0-11) и резервная (12-23) загрузочные области
+    report(progress, 90, "Запись загрузочной области...");
+    AlignedBuffer boot(24 * bps);
+    if (!boot.isValid()) return {false, "Недостаточно памяти"};
+    uchar* b = boot.data();
+    b[0] = 0xEB; b[1] = 0x76; b[2] = 0x90;
+    memcpy(b + 3, "EXFAT   ", 8);
+    put64(b + 64, target.offset() / bps);
+    put64(b + 72, totalSectors);
+    put32(b + 80, static_cast<quint32>(fatOffset));
+    put32(b + 84, static_cast<quint32>(fatLength));
+    put32(b + 88, static_cast<quint32>(heapOffset));
+    put32(b + 92, static_cast<quint32>(clusters));
+    put32(b + 96, rootCluster);
+    put32(b + 100, QRandomGenerator::global()->generate());
+    put16(b + 104, 0x0100);                          // ревизия 1.00
+    b[108] = static_cast<uchar>(log2Of(bps));
+    b[109] = static_cast<uchar>(log2Of(spc));
+    b[110] = 1;                                      // одна FAT
+    b[111] = 0x80;
+    b[112] = static_cast<uchar>(usedClusters * 100 / clusters);
+    memset(b + 120, 0xF4, 510 - 120);
+    b[510] = 0x55; b[511] = 0xAA;
+
+    // Расширенные загрузочные сектора 1-8 заканчиваются сигнатурой AA550000
+    for (int s = 1; s <= 8; ++s) {
+        put32(b + s * bps + bps - 4, 0xAA550000);
+    }
+    const quint32 sum = exfatChecksum(b, 11 * bps, 0, true);
+    for (quint64 i = 0; i < bps; i += 4) {
+        put32(b + 11 * bps + i, sum);
+    }
+    memcpy(b + 12 * bps, b, 12 * bps);
+    if (!target.write(0, b, boot.size())) return {false, target.error()};
+
+    report(progress, 95, "Синхронизация...");
+    if (!target.sync()) return {false, target.error()};
+
+    report(progress, 100, "Форматирование exFAT завершено");
+    return {true, QString("exFAT: %1 кластеров по %2 байт").arg(clusters).arg(cluster)};
+}
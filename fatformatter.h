@@ -0,0 +1,37 @@
+// fatformatter.h
+#pragma once
+
+#include <QString>
+#include <functional>
+#include <atomic>
+#include <utility>
+
+// Встроенное быстрое форматирование в FAT32 и exFAT без mkfs.
+// Разметка считается по топологии устройства: начало области данных
+// выравнивается на optimal I/O (не меньше 1 MB, как у SD-карт), на
+// носитель пишутся только загрузочная область, FAT/битовая карта и
+// корневой каталог несколькими крупными выровненными запросами.
+class FatFormatter {
+public:
+    // percent 0..100, message - текущий этап
+    using ProgressCallback = std::function<void(int percent, const QString& message)>;
+
+    // clusterSize = 0 - выбрать автоматически; cancelled проверяется между
+    // этапами и во время очистки служебной области
+    static std::pair<bool, QString> formatFat32(const QString& devicePath,
+                                                int clusterSize,
+                                                const QString& label,
+                                                const ProgressCallback& progress = ProgressCallback(),
+                                                const std::atomic<bool>* cancelled = nullptr);
+
+    static std::pair<bool, QString> formatExfat(const QString& devicePath,
+                                                int clusterSize,
+                                                const QString& label,
+                                                const ProgressCallback& progress = ProgressCallback(),
+                                                const std::atomic<bool>* cancelled = nullptr);
+
+    // Поддерживается ли файловая система встроенным форматером
+    static bool supports(const QString& filesystem) {
+        return filesystem == "FAT32" || filesystem == "exFAT";
+    }
+};
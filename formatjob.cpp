@@ -0,0 +1,295 @@
+// formatjob.cpp
+#include "formatjob.h"
+#include "formatmanager.h"
+#include "fatformatter.h"
+#include "devicemanager.h"
+#include "utils.h"
+#include "badrangemap.h"
+#include <QProcess>
+#include <QProcessEnvironment>
+#include <QRegularExpression>
+#include <QTimer>
+#include <QtConcurrent/QtConcurrent>
+#include <QDebug>
+
+namespace {
+
+const int KillDelayMs = 3000;     // после terminate mkfs получает время на выход
+const int UnmountPercent = 5;     // доля размонтирования в общем прогрессе
+const int TailLines = 5;
+
+// Этапы вывода mkfs и их доля в общем прогрессе утилиты
+struct Stage {
+    const char* family;     // "ext" или "NTFS"
+    const char* marker;     // текст, с которого утилита начинает этап
+    int from;
+    int to;
+    const char* status;
+};
+
+const Stage kStages[] = {
+    { "ext",  "Discarding device blocks",        0,  10, "Освобождение блоков" },
+    { "ext",  "Allocating group tables",        10,  25, "Размещение таблиц групп" },
+    { "ext",  "Writing inode tables",           25,  75, "Запись таблиц inode" },
+    { "ext",  "Creating journal",               75,  85, "Создание журнала" },
+    { "ext",  "Writing superblocks",            85, 100, "Запись суперблоков" },
+    { "NTFS", "Initializing device with zeroes", 0,  90, "Заполнение нулями" },
+    { "NTFS", "Creating NTFS volume structures", 90,  98, "Создание структур NTFS" },
+    { "NTFS", "mkntfs completed successfully", 100, 100, "Завершение" },
+};
+
+bool sameFamily(const Stage& stage, const QString& filesystem) {
+    return filesystem.startsWith(QLatin1String(stage.family));
+}
+
+const Stage* findStage(const QString& filesystem, const QString& marker) {
+    for (const Stage& stage : kStages) {
+        if (sameFamily(stage, filesystem) && marker == QLatin1String(stage.marker)) return &stage;
+    }
+    return nullptr;
+}
+
+} // namespace
+
+FormatJob::FormatJob(const Config& cfg, QObject* parent)
+    : QObject(parent), m_cfg(cfg) {}
+
+FormatJob::~FormatJob() {
+    m_cancelled.store(true, std::memory_order_release);
+    // Задача в пуле обращается к флагу отмены этого объекта
+    if (m_watcher) m_watcher->waitForFinished();
+    if (m_process && m_process->state() != QProcess::NotRunning) {
+        m_process->kill();
+        m_process->waitForFinished(1000);
+    }
+}
+
+void FormatJob::start() {
+    if (m_running) return;
+    m_running = true;
+    m_timer.start();
+
+    const QString devicePath = m_cfg.devicePath;
+    report(0, "Размонтирование устройства...");
+    runInPool([devicePath]() -> Result {
+        auto result = DeviceManager::unmountAll(devicePath);
+        // Ошибка важна, только если что-то осталось смонтированным
+        if (!result.first && DeviceManager::getMountPoints(devicePath).isEmpty()) {
+            result.first = true;
+        }
+        return result;
+    }, &FormatJob::onUnmounted);
+}
+
+void FormatJob::cancel() {
+    if (!m_running) return;
+    m_cancelled.store(true, std::memory_order_release);
+    // Встроенный форматер и размонтирование проверяют флаг сами
+    if (m_process) stopProcess();
+}
+
+void FormatJob::runInPool(const std::function<Result()>& task, void (FormatJob::*next)(const Result&)) {
+    m_watcher = new QFutureWatcher<Result>(this);
+    connect(m_watcher, &QFutureWatcher<Result>::finished, this, [this, next]() {
+        const Result result = m_watcher->result();
+        m_watcher->deleteLater();
+        m_watcher = nullptr;
+        (this->*next)(result);
+    });
+    m_watcher->setFuture(QtConcurrent::run(task));
+}
+
+void FormatJob::onUnmounted(const Result& result) {
+    if (m_cancelled.load(std::memory_order_acquire)) {
+        finish(false, "Форматирование отменено");
+        return;
+    }
+    if (!result.first) {
+        finish(false, QString("Не удалось размонтировать устройство: %1").arg(result.second));
+        return;
+    }
+
+    // Форматеры не помечают сбойные кластеры: файловая система легла бы
+    // на области, которые проверка поверхности признала негодными
+    const BadRangeMap bad = BadRangeMap::load(m_cfg.devicePath);
+    if (!bad.isEmpty()) {
+        finish(false, QString("На носителе известны сбойные области (%1). "
+                              "Повторная проверка поверхности обновит карту").arg(bad.describe()));
+        return;
+    }
+
+    if (FatFormatter::supports(m_cfg.filesystem)) {
+        report(UnmountPercent, "Начало форматирования...");
+        const Config cfg = m_cfg;
+        runInPool([this, cfg]() -> Result {
+            auto onProgress = [this](int percent, const QString& message) {
+                QMetaObject::invokeMethod(this, [this, percent, message]() {
+                    report(UnmountPercent + percent * (100 - UnmountPercent) / 100, message);
+                }, Qt::QueuedConnection);
+            };
+            return cfg.filesystem == "FAT32"
+                ? FatFormatter::formatFat32(cfg.devicePath, cfg.clusterSize, cfg.label, onProgress, &m_cancelled)
+                : FatFormatter::formatExfat(cfg.devicePath, cfg.clusterSize, cfg.label, onProgress, &m_cancelled);
+        }, &FormatJob::onBuiltinFinished);
+        return;
+    }
+
+    QString program;
+    QStringList arguments;
+    if (!FormatManager::instance().formatCommand(m_cfg.devicePath, m_cfg.filesystem, m_cfg.clusterSize,
+                                                 m_cfg.label, m_cfg.quickFormat, &program, &arguments)) {
+        finish(false, QString("Неподдерживаемая файловая система: %1").arg(m_cfg.filesystem));
+        return;
+    }
+    startProcess(program, arguments);
+}
+
+void FormatJob::onBuiltinFinished(const Result& result) {
+    if (!result.first && m_cancelled.load(std::memory_order_acquire)) {
+        finish(false, "Форматирование отменено, файловая система на устройстве повреждена");
+        return;
+    }
+    finish(result.first, result.second);
+}
+
+void FormatJob::startProcess(const QString& program, const QStringList& arguments) {
+    m_process = new QProcess(this);
+    m_process->setProcessChannelMode(QProcess::MergedChannels);
+
+    // Этапы распознаются по английскому выводу утилит
+    QProcessEnvironment env = QProcessEnvironment::systemEnvironment();
+    env.insert("LC_ALL", "C");
+    m_process->setProcessEnvironment(env);
+
+    connect(m_process, &QProcess::readyRead, this, &FormatJob::readOutput);
+    connect(m_process, &QProcess::errorOccurred, this, [this](QProcess::ProcessError error) {
+        if (error == QProcess::FailedToStart) {
+            finish(false, QString("Не удалось запустить %1: %2").arg(m_process->program()).arg(m_process->errorString()));
+        }
+    });
+    connect(m_process, &QProcess::finished, this,
+            [this](int exitCode, QProcess::ExitStatus status) {
+        onProcessFinished(exitCode, status == QProcess::CrashExit);
+    });
+
+    // Таймаут по размеру устройства: полное форматирование больших дисков идет часами
+    const int timeoutMs = FormatManager::formatTimeoutMs(m_cfg.devicePath, m_cfg.filesystem,
+                                                         m_cfg.sizeBytes, m_cfg.quickFormat);
+    m_timeout = new QTimer(this);
+    m_timeout->setSingleShot(true);
+    connect(m_timeout, &QTimer::timeout, this, [this]() {
+        qWarning() << "Таймаут форматирования" << m_cfg.devicePath;
+        m_timedOut = true;
+        stopProcess();
+    });
+    m_timeout->start(timeoutMs);
+
+    qDebug() << "Форматирование:" << program << arguments << "таймаут" << timeoutMs / 1000 << "с";
+    report(UnmountPercent, QString("Запуск %1...").arg(program));
+    m_process->start(program, arguments);
+}
+
+void FormatJob::readOutput() {
+    m_pending += QString::fromLocal8Bit(m_process->readAll());
+
+    // mke2fs и mkntfs перерисовывают счетчик через \b и \r, без перевода строки
+    static const QRegularExpression separators("[\\x08\\r\\n]");
+    QStringList parts = m_pending.split(separators);
+    m_pending = parts.takeLast();
+
+    for (const QString& part : parts) handleOutput(part);
+}
+
+void FormatJob::handleOutput(const QString& part) {
+    const QString text = part.trimmed();
+    if (text.isEmpty()) return;
+
+    const int percent = parseProgress(m_cfg.filesystem, text, &m_stage);
+    if (percent < 0) {
+        // Строки без прогресса - предупреждения и ошибки утилиты
+        m_tail << text;
+        while (m_tail.size() > TailLines) m_tail.removeFirst();
+        return;
+    }
+    const Stage* stage = findStage(m_cfg.filesystem, m_stage);
+    report(UnmountPercent + percent * (100 - UnmountPercent) / 100,
+           stage ? QString("%1...").arg(stage->status) : QString("Форматирование..."));
+}
+
+int FormatJob::parseProgress(const QString& filesystem, const QString& text, QString* stage) {
+    bool started = false;
+    for (const Stage& s : kStages) {
+        if (sameFamily(s, filesystem) && text.contains(QLatin1String(s.marker))) {
+            *stage = QLatin1String(s.marker);
+            started = true;
+        }
+    }
+
+    const Stage* current = findStage(filesystem, *stage);
+    if (!current) return -1;
+    const int span = current->to - current->from;
+
+    // "Writing inode tables:  123/1024"
+    static const QRegularExpression counter("(\\d+)/(\\d+)\\s*$");
+    QRegularExpressionMatch match = counter.match(text);
+    if (match.hasMatch()) {
+        const qint64 done = match.captured(1).toLongLong();
+        const qint64 total = match.captured(2).toLongLong();
+        if (total > 0) return current->from + static_cast<int>(span * qMin(done, total) / total);
+    }
+
+    // "Initializing device with zeroes:  45%"
+    static const QRegularExpression percent("(\\d+(?:\\.\\d+)?)%\\s*$");
+    match = percent.match(text);
+    if (match.hasMatch()) {
+        const double value = qBound(0.0, match.captured(1).toDouble(), 100.0);
+        return current->from + static_cast<int>(span * value / 100.0);
+    }
+
+    if (text.endsWith("done")) return current->to;
+    return started ? current->from : -1;
+}
+
+void FormatJob::onProcessFinished(int exitCode, bool crashed) {
+    if (m_timeout) m_timeout->stop();
+    readOutput();
+    handleOutput(m_pending);
+    m_pending.clear();
+
+    if (m_timedOut) {
+        finish(false, "Превышено время форматирования, процесс остановлен");
+    } else if (m_cancelled.load(std::memory_order_acquire)) {
+        finish(false, "Форматирование отменено, файловая система на устройстве повреждена");
+    } else if (crashed || exitCode != 0) {
+        finish(false, QString("%1 завершился с ошибкой (код %2):\n%3")
+                          .arg(m_process->program()).arg(exitCode).arg(m_tail.join('\n')));
+    } else {
+        finish(true, QString("%1 на %2").arg(m_cfg.filesystem).arg(m_cfg.devicePath));
+    }
+}
+
+void FormatJob::stopProcess() {
+    if (!m_process || m_process->state() == QProcess::NotRunning) return;
+    m_process->terminate();
+    QTimer::singleShot(KillDelayMs, m_process, [process = m_process]() {
+        if (process->state() != QProcess::NotRunning) process->kill();
+    });
+}
+
+void FormatJob::report(int percent, const QString& status) {
+    QString timeLeft = "-";
+    const qint64 elapsedMs = m_timer.elapsed();
+    // Оценка по доле выполненной работы: скорость записи mkfs не сообщает
+    if (percent > UnmountPercent && percent < 100 && elapsedMs > 2000) {
+        timeLeft = Utils::formatTimeLeft(elapsedMs * (100 - percent) / percent / 1000);
+    }
+    emit progress(percent, status, 0.0, timeLeft);
+}
+
+void FormatJob::finish(bool success, const QString& message) {
+    if (!m_running) return;
+    m_running = false;
+    if (m_timeout) m_timeout->stop();
+    if (success) report(100, "Форматирование завершено");
+    emit finished(success, message);
+}
@@ -0,0 +1,73 @@
+// formatjob.h
+#pragma once
+
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QElapsedTimer>
+#include <QFutureWatcher>
+#include <atomic>
+#include <functional>
+#include <utility>
+
+class QProcess;
+class QTimer;
+
+// Асинхронное форматирование без блокирующих ожиданий.
+// FAT32/exFAT выполняются встроенным форматером в пуле потоков,
+// остальные ФС - через mkfs в QProcess: прогресс берется из вывода
+// утилиты, отмена и таймаут завершают процесс (terminate, затем kill).
+class FormatJob : public QObject {
+    Q_OBJECT
+
+public:
+    struct Config {
+        QString devicePath;
+        qint64 sizeBytes = 0;       // для таймаута; 0 - определить по устройству
+        QString filesystem;
+        int clusterSize = 0;
+        QString label;
+        bool quickFormat = true;
+    };
+
+    explicit FormatJob(const Config& cfg, QObject* parent = nullptr);
+    ~FormatJob();
+
+    void start();
+    void cancel();
+    bool isRunning() const { return m_running; }
+
+    // Разбор фрагмента вывода mkfs. stage - текущий этап (вход и выход),
+    // возвращает общий процент 0..100 или -1, если прогресса во фрагменте нет
+    static int parseProgress(const QString& filesystem, const QString& text, QString* stage);
+
+signals:
+    void progress(int percent, const QString& status, double speedMBps, const QString& timeLeft);
+    void finished(bool success, const QString& message);
+
+private:
+    using Result = std::pair<bool, QString>;
+
+    Config m_cfg;
+    bool m_running = false;
+    bool m_timedOut = false;
+    std::atomic<bool> m_cancelled{false};
+    QFutureWatcher<Result>* m_watcher = nullptr;
+    QProcess* m_process = nullptr;
+    QTimer* m_timeout = nullptr;
+    QString m_pending;      // незавершенный фрагмент вывода mkfs
+    QStringList m_tail;     // последние строки вывода для сообщения об ошибке
+    QString m_stage;
+    QElapsedTimer m_timer;
+
+    void runInPool(const std::function<Result()>& task, void (FormatJob::*next)(const Result&));
+    void onUnmounted(const Result& result);
+    void onBuiltinFinished(const Result& result);
+    void startProcess(const QString& program, const QStringList& arguments);
+    void onProcessFinished(int exitCode, bool crashed);
+    void readOutput();
+    void handleOutput(const QString& part);
+    void stopProcess();
+    void report(int percent, const QString& status);
+    void finish(bool success, const QString& message);
+};
@@ -1,5 +1,6 @@
 // formatmanager.cpp
 #include "formatmanager.h"
+#include "partitiontable.h"
 #include "utils.h"
 #include "devicemanager.h"
 #include <QProcess>
@@ -12,6 +13,24 @@
 #include <linux/fs.h>
 #include <cstring>
 #include <cerrno>
+#include <limits>
+
+namespace {
+
+// Размер блочного устройства или файла образа
+quint64 deviceSize(const QString& devicePath) {
+    int fd = ::open(devicePath.toLocal8Bit().constData(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return 0;
+    quint64 size = 0;
+    struct stat st;
+    if (::ioctl(fd, BLKGETSIZE64, &size) != 0 && ::fstat(fd, &st) == 0) {
+        size = static_cast<quint64>(st.st_size);
+    }
+    ::close(fd);
+    return size;
+}
+
+} // namespace
 
 FormatManager& FormatManager::instance() {
     static FormatManager instance;
@@ -236,7 +255,8 @@ FormatRecommendation FormatManager::getRecommendation(const QString& devicePath,
                                                                                        const QString& filesystem,
                                                                                        int clusterSize,
                                                                                        const QString& label,
-                                                                                       bool quickFormat) const {
+                                                                                       bool quickFormat,
+                                                                                       const FatFormatter::ProgressCallback& progress) const {
                                                                                            // Проверяем, что устройство не смонтировано
                                                                                            QStringList mountPoints = DeviceManager::getMountPoints(devicePath);
                                                                                            if (!mountPoints.isEmpty()) {
@@ -244,56 +264,22 @@ FormatRecommendation FormatManager::getRecommendation(const QString& devicePath,
                                                                                                return false;
                                                                                            }
 
-                                                                                           // Определяем команды форматирования в зависимости от файловой системы
-                                                                                           QString program;
-                                                                                           QStringList arguments;
-
-                                                                                           if (filesystem == "FAT32") {
-                                                                                               program = "mkfs.fat";
-                                                                                               arguments << "-F" << "32";
-                                                                                               if (clusterSize > 0) {
-                                                                                                   arguments << "-S" << QString::number(clusterSize);
-                                                                                               }
-                                                                                               if (!label.isEmpty()) {
-                                                                                                   arguments << "-n" << label.left(11); // FAT32 ограничение 11 символов
-                                                                                               }
-                                                                                               arguments << devicePath;
-                                                                                           }
-                                                                                           else if (filesystem == "exFAT") {
-                                                                                               program = "mkfs.exfat";
-                                                                                               if (!label.isEmpty()) {
-                                                                                                   arguments << "-n" << label.left(15); // exFAT ограничение 15 символов
+                                                                                           // FAT32 и exFAT размечаются встроенным форматером без запуска mkfs
+                                                                                           if (FatFormatter::supports(filesystem)) {
+                                                                                               auto [ok, message] = filesystem == "FAT32"
+                                                                                                   ? FatFormatter::formatFat32(devicePath, clusterSize, label, progress)
+                                                                                                   : FatFormatter::formatExfat(devicePath, clusterSize, label, progress);
+                                                                                               if (!ok) {
+                                                                                                   qWarning() << "Ошибка форматирования:" << message;
+                                                                                                   return false;
                                                                                                }
-                                                                                               arguments << devicePath;
+                                                                                               qDebug() << "Форматирование успешно завершено:" << message;
+                                                                                               return true;
                                                                                            }
-                                                                                           else if (filesystem == "NTFS") {
-                                                                                               program = "mkfs.ntfs";
-                                                                                               arguments << "-f"; // Быстрое форматирование
-                                                                                               if (clusterSize > 0) {
-                                                                                                   arguments << "-c" << QString::number(clusterSize);
-                                                                                               }
-                                                                                               if (!label.isEmpty()) {
-                                                                                                   arguments << "-L" << label.left(32); // NTFS ограничение 32 символа
-                                                                                               }
-                                                                                               if (quickFormat) {
-                                                                                                   arguments << "-Q";
-                                                                                               }
-                                                                                               arguments << devicePath;
-                                                                                           }
-                                                                                           else if (filesystem.startsWith("ext")) {
-                                                                                               program = QString("mkfs.%1").arg(filesystem);
-                                                                                               if (clusterSize > 0) {
-                                                                                                   arguments << "-b" << QString::number(clusterSize);
-                                                                                               }
-                                                                                               if (!label.isEmpty()) {
-                                                                                                   arguments << "-L" << label.left(16); // ext ограничение 16 символов
-                                                                                               }
-                                                                                               if (quickFormat) {
-                                                                                                   arguments << "-E" << "lazy_itable_init=1,lazy_journal_init=1";
-                                                                                               }
-                                                                                               arguments << devicePath;
-                                                                                           }
-                                                                                           else {
+
+                                                                                           QString program;
+                                                                                           QStringList arguments;
+                                                                                           if (!formatCommand(devicePath, filesystem, clusterSize, label, quickFormat, &program, &arguments)) {
                                                                                                qWarning() << "Неподдерживаемая файловая система:" << filesystem;
                                                                                                return false;
                                                                                            }
@@ -302,6 +288,7 @@ FormatRecommendation FormatManager::getRecommendation(const QString& devicePath,
                                                                                            QProcess process;
                                                                                            process.setProcessChannelMode(QProcess::MergedChannels);
 
+                                                                                           const int timeoutMs = formatTimeoutMs(devicePath, filesystem, 0, quickFormat);
                                                                                            qDebug() << "Форматирование:" << program << arguments;
 
                                                                                            process.start(program, arguments);
@@ -311,15 +298,15 @@ FormatRecommendation FormatManager::getRecommendation(const QString& devicePath,
                                                                                                return false;
                                                                                            }
 
-                                                                                           // Ждем завершения с таймаутом
-                                                                                           if (!process.waitForFinished(30000)) { // 30 секунд
+                                                                                           // Ждем завершения с таймаутом по размеру устройства
+                                                                                           if (!process.waitForFinished(timeoutMs)) {
                                                                                                qWarning() << "Таймаут форматирования";
                                                                                                process.kill();
                                                                                                return false;
                                                                                            }
 
-                                                                                           if (process.exitCode() != 0) {
-                                                                                               qWarning() << "Ошибка форматирования:" << process.readAllStandardError();
+                                                                                           if (process.exitStatus() != QProcess::NormalExit || process.exitCode() != 0) {
+                                                                                               qWarning() << "Ошибка форматирования:" << process.readAll();
                                                                                                return false;
                                                                                            }
 
@@ -327,36 +314,89 @@ FormatRecommendation FormatManager::getRecommendation(const QString& devicePath,
                                                                                            return true;
                                                                                        }
 
+                                                                                       bool FormatManager::formatCommand(const QString& devicePath,
+                                                                                                                         const QString& filesystem,
+                                                                                                                         int clusterSize,
+                                                                                                                         const QString& label,
+                                                                                                                         bool quickFormat,
+                                                                                                                         QString* program,
+                                                                                                                         QStringList* arguments) const {
+                                                                                           if (filesystem == "NTFS") {
+                                                                                               *program = "mkfs.ntfs";
+                                                                                               *arguments << "-F"; // Разрешить форматирование всего диска
+                                                                                               if (clusterSize > 0) {
+                                                                                                   *arguments << "-c" << QString::number(clusterSize);
+                                                                                               }
+                                                                                               if (!label.isEmpty()) {
+                                                                                                   *arguments << "-L" << label.left(32); // NTFS ограничение 32 символа
+                                                                                               }
+                                                                                               if (quickFormat) {
+                                                                                                   *arguments << "-Q"; // без заполнения нулями
+                                                                                               }
+                                                                                               *arguments << devicePath;
+                                                                                               return true;
+                                                                                           }
+                                                                                           if (filesystem.startsWith("ext")) {
+                                                                                               *program = QString("mkfs.%1").arg(filesystem);
+                                                                                               *arguments << "-F"; // без интерактивных вопросов
+                                                                                               if (clusterSize > 0) {
+                                                                                                   *arguments << "-b" << QString::number(clusterSize);
+                                                                                               }
+                                                                                               if (!label.isEmpty()) {
+                                                                                                   *arguments << "-L" << label.left(16); // ext ограничение 16 символов
+                                                                                               }
+                                                                                               if (quickFormat) {
+                                                                                                   *arguments << "-E" << "lazy_itable_init=1,lazy_journal_init=1";
+                                                                                               } else {
+                                                                                                   *arguments << "-E" << "lazy_itable_init=0,lazy_journal_init=0";
+                                                                                               }
+                                                                                               *arguments << devicePath;
+                                                                                               return true;
+                                                                                           }
+                                                                                           return false;
+                                                                                       }
+
+                                                                                       int FormatManager::formatTimeoutMs(const QString& devicePath,
+                                                                                                                          const QString& filesystem,
+                                                                                                                          qint64 sizeBytes,
+                                                                                                                          bool quickFormat) {
+                                                                                           if (sizeBytes <= 0) {
+                                                                                               sizeBytes = static_cast<qint64>(deviceSize(devicePath));
+                                                                                           }
+                                                                                           const qint64 gib = qMax<qint64>(1, sizeBytes / (1024 * 1024 * 1024LL));
+
+                                                                                           // Быстрое форматирование пишет только метаданные: время растет
+                                                                                           // с числом групп блоков/MFT, а не с объемом данных
+                                                                                           qint64 seconds = 60 + gib * 2;
+                                                                                           if (!quickFormat) {
+                                                                                               // Полное пишет весь носитель; расчет на медленную флешку ~5 MB/s
+                                                                                               seconds = 120 + sizeBytes / (5 * 1024 * 1024);
+                                                                                           } else if (filesystem.startsWith("ext")) {
+                                                                                               // mke2fs и с lazy_itable_init пишет битовые карты всех групп
+                                                                                               seconds += gib;
+                                                                                           }
+                                                                                           return static_cast<int>(qMin<qint64>(seconds * 1000, std::numeric_limits<int>::max()));
+                                                                                       }
+
                                                                                        bool FormatManager::createPartition(const QString& devicePath,
                                                                                                                            qint64 sizeBytes,
                                                                                                                            const QString& filesystem,
                                                                                                                            const QString& label) const {
-                                                                                                                               // Используем parted для создания разделов
-                                                                                                                               QProcess process;
-
                                                                                                                                // Создаем таблицу разделов GPT для больших дисков, MBR для маленьких
-                                                                                                                               QString partitionTable = (sizeBytes > 2 * 1024 * 1024 * 1024LL) ? "gpt" : "msdos";
-
-                                                                                                                               // Создаем таблицу разделов
-                                                                                                                               process.start("parted", QStringList() << devicePath << "mklabel" << partitionTable);
-                                                                                                                               process.waitForFinished();
-
-                                                                                                                               if (process.exitCode() != 0) {
-                                                                                                                                   qWarning() << "Ошибка создания таблицы разделов:" << process.readAllStandardError();
-                                                                                                                                   return false;
-                                                                                                                               }
+                                                                                                                               PartitionTable::Scheme scheme = (sizeBytes > 2 * 1024 * 1024 * 1024LL) ? PartitionTable::Gpt : PartitionTable::Mbr;
 
-                                                                                                                               // Создаем раздел на всем устройстве
-                                                                                                                               process.start("parted", QStringList() << devicePath << "mkpart" << "primary"
-                                                                                                                               << filesystem << "0%" << "100%");
-                                                                                                                               process.waitForFinished();
+                                                                                                                               PartitionSpec spec;
+                                                                                                                               spec.filesystem = filesystem;
+                                                                                                                               spec.name = label;
 
-                                                                                                                               if (process.exitCode() != 0) {
-                                                                                                                                   qWarning() << "Ошибка создания раздела:" << process.readAllStandardError();
+                                                                                                                               // Узел раздела ожидается по uevent: имя зависит от диска (sdb1, mmcblk0p1)
+                                                                                                                               QStringList nodes;
+                                                                                                                               auto [ok, message] = PartitionTable::write(devicePath, scheme, {spec}, &nodes);
+                                                                                                                               if (!ok || nodes.isEmpty()) {
+                                                                                                                                   qWarning() << "Ошибка создания таблицы разделов:" << message;
                                                                                                                                    return false;
                                                                                                                                }
 
                                                                                                                                // Форматируем раздел
-                                                                                                                               QString partitionPath = devicePath + "1"; // Первый раздел
-                                                                                                                               return formatDevice(partitionPath, filesystem, 0, label, true);
+                                                                                                                               return formatDevice(nodes.first(), filesystem, 0, label, true);
                                                                                                                            }
@@ -3,8 +3,11 @@
 
 #include <QString>
 #include <QList>
+#include <QStringList>
 #include <QMap>
 
+#include "fatformatter.h"
+
 // Структура для информации о файловой системе
 struct FilesystemInfo {
     QString name;           // Название (FAT32, NTFS, etc.)
@@ -53,7 +56,23 @@ public:
                                                              const QString& filesystem,
                                                              int clusterSize = 0,
                                                              const QString& label = "",
-                                                             bool quickFormat = true) const;
+                                                             bool quickFormat = true,
+                                                             const FatFormatter::ProgressCallback& progress = FatFormatter::ProgressCallback()) const;
+
+                                                             // Команда mkfs для ФС без встроенного форматера; false - ФС не поддерживается
+                                                             bool formatCommand(const QString& devicePath,
+                                                                                const QString& filesystem,
+                                                                                int clusterSize,
+                                                                                const QString& label,
+                                                                                bool quickFormat,
+                                                                                QString* program,
+                                                                                QStringList* arguments) const;
+
+                                                             // Допустимое время работы mkfs; sizeBytes = 0 - определить по устройству
+                                                             static int formatTimeoutMs(const QString& devicePath,
+                                                                                        const QString& filesystem,
+                                                                                        qint64 sizeBytes,
+                                                                                        bool quickFormat);
 
                                                              // Создать разделы на устройстве
                                                              bool createPartition(const QString& devicePath,
@@ -0,0 +1,236 @@
+// imagecache.cpp
+#include "imagecache.h"
+#include <QFile>
+#include <QFileInfo>
+#include <QByteArray>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <cerrno>
+#include <cstring>
+
+namespace {
+
+// Кэш не занимает больше половины доступной памяти: иначе вытеснение
+// страничного кэша и своп съедят выигрыш
+const int AvailableShare = 2;
+
+} // namespace
+
+ImageCache::Fill::~Fill() {
+    if (!m_committed) ImageCache::instance().finishFill(this, false);
+    ::close(m_fd);
+}
+
+bool ImageCache::Fill::append(const char* data, qint64 size) {
+    if (m_failed || m_committed) return false;
+    if (m_size + size > m_reserved) {
+        // Размер образа был оценкой (gzip) и оказался больше резерва
+        m_failed = true;
+        return false;
+    }
+    qint64 done = 0;
+    while (done < size) {
+        ssize_t n = ::write(m_fd, data + done, static_cast<size_t>(size - done));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            qWarning() << "Кэш образов: ошибка записи в memfd:" << strerror(errno);
+            m_failed = true;
+            return false;
+        }
+        done += n;
+    }
+    m_size += size;
+    return true;
+}
+
+bool ImageCache::Fill::commit() {
+    if (m_failed || m_committed) return false;
+    m_committed = ImageCache::instance().finishFill(this, true);
+    return m_committed;
+}
+
+ImageCache& ImageCache::instance() {
+    static ImageCache instance;
+    return instance;
+}
+
+ImageCache::~ImageCache() {
+    QMutexLocker locker(&m_mutex);
+    for (const Entry& entry : m_entries) ::close(entry.fd);
+}
+
+void ImageCache::setBudget(qint64 bytes) {
+    QMutexLocker locker(&m_mutex);
+    m_budget = qMax<qint64>(0, bytes);
+    if (m_budget == 0) {
+        for (const QString& key : m_entries.keys()) evictLocked(key);
+        return;
+    }
+    makeRoomLocked(0);
+}
+
+qint64 ImageCache::budget() const {
+    QMutexLocker locker(&m_mutex);
+    return m_budget;
+}
+
+qint64 ImageCache::used() const {
+    QMutexLocker locker(&m_mutex);
+    return m_used;
+}
+
+int ImageCache::count() const {
+    QMutexLocker locker(&m_mutex);
+    int ready = 0;
+    for (const Entry& entry : m_entries) {
+        if (entry.ready) ++ready;
+    }
+    return ready;
+}
+
+QString ImageCache::keyOf(const QString& path) {
+    const QString canonical = QFileInfo(path).canonicalFilePath();
+    return canonical.isEmpty() ? path : canonical;
+}
+
+bool ImageCache::identify(const QString& path, Identity* identity) {
+    struct stat st;
+    if (::stat(path.toLocal8Bit().constData(), &st) != 0) return false;
+    identity->fileSize = st.st_size;
+    identity->mtimeNs = static_cast<qint64>(st.st_mtim.tv_sec) * 1000000000LL + st.st_mtim.tv_nsec;
+    identity->inode = st.st_ino;
+    return true;
+}
+
+qint64 ImageCache::availableMemory() {
+    QFile file("/proc/meminfo");
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) return -1;
+    for (;;) {
+        const QByteArray line = file.readLine();
+        if (line.isEmpty()) break;
+        if (line.startsWith("MemAvailable:")) {
+            return line.mid(13).trimmed().split(' ').value(0).toLongLong() * 1024;
+        }
+    }
+    return -1;
+}
+
+int ImageCache::open(const QString& path, qint64* size) {
+    QMutexLocker locker(&m_mutex);
+    if (m_entries.isEmpty()) return -1;
+    const QString key = keyOf(path);
+    auto it = m_entries.find(key);
+    if (it == m_entries.end() || !it->ready) return -1;
+
+    Identity identity;
+    if (!identify(path, &identity) || !(identity == it->identity)) {
+        // Файл образа заменен - в кэше старое содержимое
+        evictLocked(key);
+        return -1;
+    }
+
+    // Через /proc - новое открытие со своей позицией чтения (dup делил бы ее
+    // между заданиями); запись запечатана, только чтение
+    const int fd = ::open(QString("/proc/self/fd/%1").arg(it->fd).toLocal8Bit().constData(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    it->lastUsed = ++m_clock;
+    *size = it->size;
+    return fd;
+}
+
+std::unique_ptr<ImageCache::Fill> ImageCache::beginFill(const QString& path, qint64 expectedSize) {
+    QMutexLocker locker(&m_mutex);
+    if (m_budget <= 0 || expectedSize <= 0 || expectedSize > m_budget) return nullptr;
+    const QString key = keyOf(path);
+    auto it = m_entries.find(key);
+    if (it != m_entries.end()) {
+        Identity identity;
+        if (!it->ready || (identify(path, &identity) && identity == it->identity)) return nullptr;
+        evictLocked(key);
+    }
+
+    Identity identity;
+    if (!identify(path, &identity)) return nullptr;
+    const qint64 available = availableMemory();
+    if (available >= 0 && expectedSize > available / AvailableShare) return nullptr;
+    if (!makeRoomLocked(expectedSize)) return nullptr;
+
+    const int fd = ::memfd_create("cmile-image", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0) {
+        qWarning() << "Кэш образов: memfd_create:" << strerror(errno);
+        return nullptr;
+    }
+    const int fillFd = ::fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    if (fillFd < 0) {
+        ::close(fd);
+        return nullptr;
+    }
+
+    Entry entry;
+    entry.identity = identity;
+    entry.fd = fd;
+    entry.size = expectedSize;
+    entry.fillId = ++m_clock;
+    entry.lastUsed = entry.fillId;
+    m_entries.insert(key, entry);
+    m_used += expectedSize;
+    return std::unique_ptr<Fill>(new Fill(key, entry.fillId, fillFd, expectedSize));
+}
+
+bool ImageCache::finishFill(Fill* fill, bool commit) {
+    QMutexLocker locker(&m_mutex);
+    auto it = m_entries.find(fill->m_key);
+    // Запись вытеснена (clear, смена бюджета) или уже начата заново
+    if (it == m_entries.end() || it->ready || it->fillId != fill->m_id) return false;
+
+    Identity identity;
+    if (!commit || !identify(fill->m_key, &identity) || !(identity == it->identity)) {
+        evictLocked(fill->m_key);
+        return false;
+    }
+
+    // Запечатать: задания читают образ, никто не может его изменить
+    ::fcntl(it->fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+    m_used += fill->m_size - it->size;     // резерв -> фактический размер
+    it->size = fill->m_size;
+    it->ready = true;
+    return true;
+}
+
+void ImageCache::evict(const QString& path) {
+    QMutexLocker locker(&m_mutex);
+    evictLocked(keyOf(path));
+}
+
+void ImageCache::clear() {
+    QMutexLocker locker(&m_mutex);
+    for (const QString& key : m_entries.keys()) evictLocked(key);
+}
+
+void ImageCache::evictLocked(const QString& key) {
+    auto it = m_entries.find(key);
+    if (it == m_entries.end()) return;
+    // Память memfd освобождается, когда его закроют и задания, открывшие образ
+    ::close(it->fd);
+    m_used -= it->size;
+    m_entries.erase(it);
+}
+
+bool ImageCache::makeRoomLocked(qint64 size) {
+    // Давно не использованные готовые образы - первыми; наполняемые не трогаем
+    while (m_used + size > m_budget) {
+        QString oldest;
+        quint64 oldestUse = ~0ULL;
+        for (auto it = m_entries.begin(); it != m_entries.end(); ++it) {
+            if (it->ready && it->lastUsed < oldestUse) {
+                oldest = it.key();
+                oldestUse = it->lastUsed;
+            }
+        }
+        if (oldest.isEmpty()) return false;
+        evictLocked(oldest);
+    }
+    return true;
+}
@@ -0,0 +1,102 @@
+// imagecache.h
+#pragma once
+
+#include <QString>
+#include <QHash>
+#include <QMutex>
+#include <memory>
+
+// Кэш распакованных образов в памяти, общий для всех заданий сеанса. При
+// записи одного образа на сотни носителей подряд каждое задание иначе заново
+// читает (и распаковывает) файл с диска или NFS. Образ лежит в memfd: задания
+// читают его как обычный несжатый файл, включая перенос ядром (splice).
+// Наполняется по ходу первого полного чтения образа (ImageSource), затем
+// запечатывается. Все образы укладываются в бюджет; не помещающийся вытесняет
+// давно не использованные. Запись удаляется, если файл образа изменился.
+// Вытесненная запись остается у заданий, которые ее уже открыли.
+class ImageCache {
+public:
+    // Наполнение записи; без commit() запись отбрасывается
+    class Fill {
+    public:
+        ~Fill();
+        Fill(const Fill&) = delete;
+        Fill& operator=(const Fill&) = delete;
+
+        // false - образ не уместился в резерв или ошибка memfd: наполнение отменено
+        bool append(const char* data, qint64 size);
+        // Образ прочитан целиком; запись становится доступной
+        bool commit();
+
+    private:
+        friend class ImageCache;
+        Fill(const QString& key, quint64 id, int fd, qint64 reserved)
+        : m_key(key), m_id(id), m_fd(fd), m_reserved(reserved) {}
+
+        QString m_key;
+        quint64 m_id;               // запись могли вытеснить и начать заново
+        int m_fd;                   // свой дескриптор memfd
+        qint64 m_reserved;
+        qint64 m_size = 0;
+        bool m_failed = false;
+        bool m_committed = false;
+    };
+
+    static ImageCache& instance();
+
+    // 0 - кэш выключен (по умолчанию), все записи вытесняются
+    void setBudget(qint64 bytes);
+    qint64 budget() const;
+    qint64 used() const;
+    int count() const;
+
+    // Новый дескриптор только для чтения со своей позицией; -1 - образа нет
+    // в кэше. *size - размер распакованного образа
+    int open(const QString& path, qint64* size);
+
+    // Начать наполнение для образа размером около expectedSize; nullptr -
+    // кэш выключен, образ уже есть или наполняется, не помещается в бюджет
+    std::unique_ptr<Fill> beginFill(const QString& path, qint64 expectedSize);
+
+    void evict(const QString& path);
+    void clear();
+
+private:
+    ImageCache() = default;
+    ~ImageCache();
+    ImageCache(const ImageCache&) = delete;
+    ImageCache& operator=(const ImageCache&) = delete;
+
+    // Образ опознается по пути, размеру, времени изменения и inode файла
+    struct Identity {
+        qint64 fileSize = 0;
+        qint64 mtimeNs = 0;
+        quint64 inode = 0;
+        bool operator==(const Identity& other) const {
+            return fileSize == other.fileSize && mtimeNs == other.mtimeNs && inode == other.inode;
+        }
+    };
+
+    struct Entry {
+        Identity identity;
+        int fd = -1;
+        qint64 size = 0;            // наполненные - размер образа, наполняемые - резерв
+        bool ready = false;
+        quint64 fillId = 0;
+        quint64 lastUsed = 0;
+    };
+
+    static QString keyOf(const QString& path);
+    static bool identify(const QString& path, Identity* identity);
+    static qint64 availableMemory();
+
+    bool finishFill(Fill* fill, bool commit);
+    void evictLocked(const QString& key);
+    bool makeRoomLocked(qint64 size);
+
+    mutable QMutex m_mutex;
+    QHash<QString, Entry> m_entries;
+    qint64 m_budget = 0;
+    qint64 m_used = 0;
+    quint64 m_clock = 0;
+};
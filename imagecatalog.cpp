@@ -0,0 +1,536 @@
+// imagecatalog.cpp
+#include "imagecatalog.h"
+#include "imagesource.h"
+#include "probeengine.h"
+#include "utils.h"
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFileInfo>
+#include <QFileSystemWatcher>
+#include <QFutureWatcher>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QThreadPool>
+#include <QTimer>
+#include <QtConcurrent/QtConcurrent>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <algorithm>
+#include <functional>
+#include <zlib.h>
+
+namespace {
+
+const int IndexVersion = 1;
+const int MaxDepth = 8;                        // вложенность папок каталога
+const int RescanIntervalMs = 5 * 60 * 1000;    // сетевые папки, где inotify не работает
+const qint64 DigestBuffer = 1024 * 1024;
+
+const QStringList ImageSuffixes = {
+    "img", "iso", "raw", "dd", "bin", "gz", "xz", "zst", "bz2", "zip", "7z", "dmg"
+};
+
+bool isCompressedType(const QString& fileType) {
+    return fileType.contains("Compressed") || fileType.contains("Archive");
+}
+
+QString normalizedPath(const QString& path) {
+    return QDir::cleanPath(QFileInfo(path).absoluteFilePath());
+}
+
+} // namespace
+
+ImageInfo CatalogEntry::toImageInfo() const {
+    ImageInfo info;
+    info.path = path;
+    info.size = fileSize;
+    info.fileType = fileType;
+    return info;
+}
+
+// Результат обхода папок: найденные файлы (только путь, размер и mtime),
+// все папки для наблюдения и недоступные корни (их записи не удаляются)
+struct ImageCatalog::ScanResult {
+    QList<CatalogEntry> files;
+    QStringList dirs;
+    QStringList offline;
+};
+
+ImageCatalog::ImageCatalog(const QString& indexPath, QObject* parent)
+: QObject(parent),
+  m_indexPath(indexPath.isEmpty() ? defaultIndexPath() : indexPath),
+  m_watcher(new QFileSystemWatcher(this)),
+  m_pool(new QThreadPool),
+  m_saveTimer(new QTimer(this)),
+  m_notifyTimer(new QTimer(this)),
+  m_rescanTimer(new QTimer(this)),
+  m_cancelled(std::make_shared<std::atomic<bool>>(false)) {
+    // Образы часто лежат на одном сетевом диске: параллельное чтение
+    // нескольких файлов только мешает друг другу
+    m_pool->setMaxThreadCount(2);
+
+    m_saveTimer->setSingleShot(true);
+    m_saveTimer->setInterval(1000);
+    connect(m_saveTimer, &QTimer::timeout, this, &ImageCatalog::save);
+
+    m_notifyTimer->setSingleShot(true);
+    m_notifyTimer->setInterval(200);
+    connect(m_notifyTimer, &QTimer::timeout, this, &ImageCatalog::changed);
+
+    m_rescanTimer->setInterval(RescanIntervalMs);
+    connect(m_rescanTimer, &QTimer::timeout, this, &ImageCatalog::rescan);
+    m_rescanTimer->start();
+
+    // Изменение в папке - пересмотр (stat), файлы с новым mtime переиндексируются
+    connect(m_watcher, &QFileSystemWatcher::directoryChanged, this, [this]() { rescan(); });
+
+    load();
+    rescan();
+}
+
+ImageCatalog::~ImageCatalog() {
+    m_cancelled->store(true, std::memory_order_release);
+    if (m_saveTimer->isActive()) save();
+    m_pool->clear();
+    // Чтение с зависшего сетевого диска не должно блокировать выход
+    if (m_pool->waitForDone(1000)) {
+        delete m_pool;
+    } else {
+        qWarning() << "Индексация образов не завершилась, пул потоков оставлен";
+    }
+}
+
+QString ImageCatalog::defaultIndexPath() {
+    return QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/image-index.json";
+}
+
+bool ImageCatalog::isImageFile(const QString& fileName) {
+    const QString name = fileName.toLower();
+    if (name.endsWith(".part")) return false;     // недописанный образ BackupJob
+    return ImageSuffixes.contains(QFileInfo(name).suffix());
+}
+
+void ImageCatalog::addDirectory(const QString& path) {
+    const QString dir = normalizedPath(path);
+    if (m_directories.contains(dir)) return;
+    m_directories.append(dir);
+    touch();
+    rescan();
+}
+
+void ImageCatalog::removeDirectory(const QString& path) {
+    if (!m_directories.removeOne(normalizedPath(path))) return;
+    touch();
+    rescan();
+}
+
+QList<CatalogEntry> ImageCatalog::entries() const {
+    QList<CatalogEntry> result = m_entries.values();
+    std::sort(result.begin(), result.end(), [](const CatalogEntry& a, const CatalogEntry& b) {
+        if (a.lastUsed != b.lastUsed) return a.lastUsed > b.lastUsed;
+        return QFileInfo(a.path).fileName().compare(QFileInfo(b.path).fileName(), Qt::CaseInsensitive) < 0;
+    });
+    return result;
+}
+
+bool ImageCatalog::entry(const QString& path, CatalogEntry* result) const {
+    auto it = m_entries.constFind(path);
+    if (it == m_entries.constEnd()) return false;
+    if (result) *result = it.value();
+    return true;
+}
+
+CatalogEntry ImageCatalog::addFile(const QString& path) {
+    const QString file = normalizedPath(path);
+    const QFileInfo fi(file);
+    CatalogEntry stamp;
+    stamp.path = file;
+    stamp.fileSize = fi.size();
+    stamp.modified = fi.lastModified().toMSecsSinceEpoch();
+
+    auto it = m_entries.find(file);
+    if (it == m_entries.end() || !it->sameFile(stamp)) {
+        // Тип по заголовку - 16 байт; остальное досчитается в фоне
+        stamp.fileType = Utils::detectFileType(file);
+        if (it != m_entries.end()) {
+            stamp.lastUsed = it->lastUsed;
+            stamp.pinned = it->pinned;
+        }
+        it = m_entries.insert(file, stamp);
+        index(file);
+    }
+    if (!isCovered(file)) it->pinned = true;
+    touch();
+    return it.value();
+}
+
+void ImageCatalog::markUsed(const QString& path) {
+    auto it = m_entries.find(path);
+    if (it == m_entries.end()) return;
+    it->lastUsed = QDateTime::currentMSecsSinceEpoch();
+    touch();
+}
+
+void ImageCatalog::markVerified(const QString& path, bool success) {
+    auto it = m_entries.find(path);
+    if (it == m_entries.end()) return;
+    it->verifyState = success ? CatalogEntry::Verified : CatalogEntry::VerifyFailed;
+    it->verifiedAt = QDateTime::currentMSecsSinceEpoch();
+    touch();
+}
+
+void ImageCatalog::rescan() {
+    if (m_scanning) {
+        m_rescanPending = true;
+        return;
+    }
+    m_scanning = true;
+
+    const QStringList roots = m_directories;
+    QStringList pinned;
+    for (const CatalogEntry& e : m_entries) {
+        if (e.pinned && !isCovered(e.path)) pinned << e.path;
+    }
+
+    auto* watcher = new QFutureWatcher<ScanResult>(this);
+    connect(watcher, &QFutureWatcher<ScanResult>::finished, this, [this, watcher]() {
+        applyScan(watcher->result());
+        watcher->deleteLater();
+        m_scanning = false;
+        if (m_rescanPending) {
+            m_rescanPending = false;
+            rescan();
+        }
+    });
+
+    // Обход идет вне пула индексации: stat не должен ждать хэширования
+    watcher->setFuture(QtConcurrent::run([roots, pinned]() {
+        ScanResult scan;
+        std::function<void(const QString&, int)> walk = [&](const QString& dir, int depth) {
+            scan.dirs << dir;
+            const QFileInfoList list = QDir(dir).entryInfoList(QDir::Files | QDir::Dirs | QDir::NoDotAndDotDot);
+            for (const QFileInfo& fi : list) {
+                if (fi.isDir()) {
+                    if (depth < MaxDepth && !fi.isSymLink()) walk(fi.absoluteFilePath(), depth + 1);
+                } else if (isImageFile(fi.fileName())) {
+                    CatalogEntry e;
+                    e.path = normalizedPath(fi.absoluteFilePath());
+                    e.fileSize = fi.size();
+                    e.modified = fi.lastModified().toMSecsSinceEpoch();
+                    scan.files << e;
+                }
+            }
+        };
+        for (const QString& root : roots) {
+            if (QFileInfo(root).isDir() && QFileInfo(root).isReadable()) {
+                walk(root, 0);
+            } else {
+                scan.offline << root;
+            }
+        }
+        for (const QString& path : pinned) {
+            const QFileInfo fi(path);
+            if (fi.isFile()) {
+                CatalogEntry e;
+                e.path = path;
+                e.fileSize = fi.size();
+                e.modified = fi.lastModified().toMSecsSinceEpoch();
+                e.pinned = true;
+                scan.files << e;
+            } else if (!fi.absoluteDir().exists()) {
+                scan.offline << fi.absolutePath();      // отключенный диск, а не удаленный файл
+            }
+        }
+        return scan;
+    }));
+}
+
+void ImageCatalog::applyScan(const ScanResult& scan) {
+    bool modified = false;
+    QSet<QString> seen;
+
+    for (const CatalogEntry& stamp : scan.files) {
+        seen.insert(stamp.path);
+        auto it = m_entries.find(stamp.path);
+        if (it == m_entries.end()) {
+            m_entries.insert(stamp.path, stamp);
+            index(stamp.path);
+            modified = true;
+        } else if (!it->sameFile(stamp)) {
+            CatalogEntry updated = stamp;
+            updated.lastUsed = it->lastUsed;
+            updated.pinned = it->pinned;
+            *it = updated;
+            index(stamp.path);
+            modified = true;
+        } else if (it->fileType.isEmpty()) {
+            index(stamp.path);
+        } else if (it->digest.isEmpty()) {
+            digest(stamp.path);
+        }
+    }
+
+    for (auto it = m_entries.begin(); it != m_entries.end();) {
+        bool offline = false;
+        for (const QString& dir : scan.offline) {
+            if (it.key().startsWith(dir + '/')) offline = true;
+        }
+        if (seen.contains(it.key()) || offline) {
+            ++it;
+        } else {
+            it = m_entries.erase(it);
+            modified = true;
+        }
+    }
+
+    // Наблюдение за всеми папками: inotify не рекурсивен
+    const QStringList watched = m_watcher->directories();
+    QStringList removed;
+    for (const QString& dir : watched) {
+        if (!scan.dirs.contains(dir)) removed << dir;
+    }
+    if (!removed.isEmpty()) m_watcher->removePaths(removed);
+    QStringList added;
+    for (const QString& dir : scan.dirs) {
+        if (!watched.contains(dir)) added << dir;
+    }
+    if (!added.isEmpty()) m_watcher->addPaths(added);
+
+    if (modified) touch();
+}
+
+void ImageCatalog::index(const QString& path) {
+    if (m_inFlight.contains(path)) return;
+    m_inFlight.insert(path);
+
+    auto* watcher = new QFutureWatcher<CatalogEntry>(this);
+    connect(watcher, &QFutureWatcher<CatalogEntry>::finished, this, [this, watcher, path]() {
+        const CatalogEntry info = watcher->result();
+        watcher->deleteLater();
+        m_inFlight.remove(path);
+
+        auto it = m_entries.find(path);
+        if (it == m_entries.end() || info.fileSize < 0) return;
+        CatalogEntry updated = info;
+        updated.lastUsed = it->lastUsed;
+        updated.pinned = it->pinned;
+        if (it->sameFile(info)) {
+            updated.digest = it->digest;
+            updated.verifyState = it->verifyState;
+            updated.verifiedAt = it->verifiedAt;
+            if (updated.imageSize < 0) updated.imageSize = it->imageSize;
+        }
+        *it = updated;
+        touch();
+        if (updated.digest.isEmpty()) digest(path);
+    });
+
+    const auto cancelled = m_cancelled;
+    watcher->setFuture(QtConcurrent::run(m_pool, [path, cancelled]() {
+        if (cancelled->load(std::memory_order_acquire)) {
+            CatalogEntry skipped;
+            skipped.fileSize = -1;
+            return skipped;
+        }
+        return quickInfo(path);
+    }));
+}
+
+void ImageCatalog::digest(const QString& path) {
+    if (m_inFlight.contains(path)) return;
+    m_inFlight.insert(path);
+
+    using DigestResult = std::pair<bool, CatalogEntry>;
+    auto* watcher = new QFutureWatcher<DigestResult>(this);
+    connect(watcher, &QFutureWatcher<DigestResult>::finished, this, [this, watcher, path]() {
+        const DigestResult result = watcher->result();
+        watcher->deleteLater();
+        m_inFlight.remove(path);
+
+        auto it = m_entries.find(path);
+        if (!result.first || it == m_entries.end()) return;
+        // Файл мог измениться во время хэширования - тогда его ждет index()
+        if (!it->sameFile(result.second)) return;
+        it->digest = result.second.digest;
+        if (result.second.imageSize >= 0) it->imageSize = result.second.imageSize;
+        touch();
+    });
+
+    CatalogEntry stamp = m_entries.value(path);
+    const auto cancelled = m_cancelled;
+    watcher->setFuture(QtConcurrent::run(m_pool, [path, stamp, cancelled]() {
+        CatalogEntry result = stamp;
+        const bool ok = computeDigest(path, &result, cancelled.get());
+        return DigestResult(ok, result);
+    }));
+}
+
+bool ImageCatalog::isCovered(const QString& path) const {
+    for (const QString& dir : m_directories) {
+        if (path.startsWith(dir + '/')) return true;
+    }
+    return false;
+}
+
+CatalogEntry ImageCatalog::quickInfo(const QString& path) {
+    CatalogEntry e;
+    e.path = path;
+    const QFileInfo fi(path);
+    if (!fi.isFile()) {
+        e.fileSize = -1;
+        return e;
+    }
+    e.fileSize = fi.size();
+    e.modified = fi.lastModified().toMSecsSinceEpoch();
+    e.fileType = Utils::detectFileType(path);
+
+    if (!isCompressedType(e.fileType)) {
+        e.imageSize = e.fileSize;
+        const ProbeResult probe = ProbeEngine::probe(path);
+        if (probe.ok) e.layout = probe.summary();
+        return e;
+    }
+
+    // gzip здесь не распаковывается, а оценка ISIZE не сохраняется: точный
+    // размер даст проход computeDigest, который все равно читает весь файл
+    const ImageSource::SizeInfo size = ImageSource::discoverSize(path, ImageSource::QuickScan);
+    if (size.exact) e.imageSize = size.imageSize;
+    return e;
+}
+
+bool ImageCatalog::computeDigest(const QString& path, CatalogEntry* entry, const std::atomic<bool>* cancelled) {
+    int fd = ::open(path.toLocal8Bit().constData(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    // Файл читается один раз: подсказка ядру читать вперед и не держать в кэше
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    QCryptographicHash hash(QCryptographicHash::Sha256);
+    QByteArray buffer(DigestBuffer, Qt::Uninitialized);
+
+    // gzip: распаковка в никуда ради размера; многочленный файл - по члену за раз
+    const bool gzip = entry->fileType == "GZIP Compressed";
+    z_stream zs = {};
+    const bool zInit = gzip && inflateInit2(&zs, 15 + 16) == Z_OK;
+    bool inflating = zInit;
+    QByteArray sink(inflating ? DigestBuffer : 0, Qt::Uninitialized);
+    quint64 unpacked = 0;
+    bool gzipOk = inflating;
+    bool streamEnd = false;         // последний член дочитан до конца (обрезанный .gz - нет)
+
+    qint64 offset = 0;
+    bool ok = true;
+    for (;;) {
+        if (cancelled && cancelled->load(std::memory_order_acquire)) {
+            ok = false;
+            break;
+        }
+        ssize_t n = ::read(fd, buffer.data(), static_cast<size_t>(buffer.size()));
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            ok = false;
+            break;
+        }
+        if (n == 0) break;
+        hash.addData(n == buffer.size() ? buffer : buffer.left(n));
+        posix_fadvise(fd, offset, n, POSIX_FADV_DONTNEED);
+        offset += n;
+
+        if (!inflating) continue;
+        zs.next_in = reinterpret_cast<Bytef*>(buffer.data());
+        zs.avail_in = static_cast<uInt>(n);
+        while (zs.avail_in > 0 && inflating) {
+            zs.next_out = reinterpret_cast<Bytef*>(sink.data());
+            zs.avail_out = static_cast<uInt>(sink.size());
+            const int rc = inflate(&zs, Z_NO_FLUSH);
+            unpacked += static_cast<quint64>(sink.size()) - zs.avail_out;
+            if (rc == Z_STREAM_END) {
+                // Следующий член или нули в хвосте
+                streamEnd = true;
+                if (zs.avail_in > 0 && zs.next_in[0] == 0x1F) {
+                    inflateReset(&zs);
+                    streamEnd = false;
+                } else {
+                    inflating = false;
+                }
+            } else if (rc != Z_OK && rc != Z_BUF_ERROR) {
+                inflating = false;
+                gzipOk = false;
+            }
+        }
+    }
+    ::close(fd);
+    if (zInit) inflateEnd(&zs);
+    if (!ok) return false;
+
+    entry->digest = Utils::hashToHex(hash.result()).toLower();
+    if (gzip) entry->imageSize = gzipOk && streamEnd ? static_cast<qint64>(unpacked) : -1;
+    return true;
+}
+
+void ImageCatalog::touch() {
+    if (!m_saveTimer->isActive()) m_saveTimer->start();
+    if (!m_notifyTimer->isActive()) m_notifyTimer->start();
+}
+
+void ImageCatalog::load() {
+    QFile file(m_indexPath);
+    if (!file.open(QIODevice::ReadOnly)) return;
+    const QJsonObject root = QJsonDocument::fromJson(file.readAll()).object();
+    if (root.value("version").toInt() != IndexVersion) return;
+
+    for (const QJsonValue& dir : root.value("directories").toArray()) {
+        m_directories << dir.toString();
+    }
+    for (const QJsonValue& value : root.value("images").toArray()) {
+        const QJsonObject o = value.toObject();
+        CatalogEntry e;
+        e.path = o.value("path").toString();
+        if (e.path.isEmpty()) continue;
+        e.fileSize = static_cast<qint64>(o.value("fileSize").toDouble());
+        e.modified = static_cast<qint64>(o.value("modified").toDouble());
+        e.fileType = o.value("fileType").toString();
+        e.imageSize = static_cast<qint64>(o.value("imageSize").toDouble(-1));
+        e.layout = o.value("layout").toString();
+        e.digest = o.value("sha256").toString();
+        e.verifyState = static_cast<CatalogEntry::VerifyState>(o.value("verifyState").toInt());
+        e.verifiedAt = static_cast<qint64>(o.value("verifiedAt").toDouble());
+        e.lastUsed = static_cast<qint64>(o.value("lastUsed").toDouble());
+        e.pinned = o.value("pinned").toBool();
+        m_entries.insert(e.path, e);
+    }
+}
+
+void ImageCatalog::save() {
+    QJsonArray images;
+    for (const CatalogEntry& e : m_entries) {
+        QJsonObject o;
+        o["path"] = e.path;
+        o["fileSize"] = static_cast<double>(e.fileSize);
+        o["modified"] = static_cast<double>(e.modified);
+        o["fileType"] = e.fileType;
+        o["imageSize"] = static_cast<double>(e.imageSize);
+        o["layout"] = e.layout;
+        o["sha256"] = e.digest;
+        o["verifyState"] = static_cast<int>(e.verifyState);
+        o["verifiedAt"] = static_cast<double>(e.verifiedAt);
+        o["lastUsed"] = static_cast<double>(e.lastUsed);
+        o["pinned"] = e.pinned;
+        images.append(o);
+    }
+    QJsonObject root;
+    root["version"] = IndexVersion;
+    root["directories"] = QJsonArray::fromStringList(m_directories);
+    root["images"] = images;
+
+    QDir().mkpath(QFileInfo(m_indexPath).absolutePath());
+    QSaveFile file(m_indexPath);
+    if (!file.open(QIODevice::WriteOnly) ||
+        file.write(QJsonDocument(root).toJson(QJsonDocument::Compact)) < 0 || !file.commit()) {
+        qWarning() << "Не удалось сохранить индекс образов" << m_indexPath << file.errorString();
+    }
+}
@@ -0,0 +1,116 @@
+// imagecatalog.h
+#pragma once
+
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QHash>
+#include <QSet>
+#include <QList>
+#include <atomic>
+#include <memory>
+
+#include "imagewriter.h"
+
+class QFileSystemWatcher;
+class QThreadPool;
+class QTimer;
+
+// Сведения об образе в каталоге. Все, кроме пути, размера и времени
+// изменения, вычисляется в фоне и хранится в индексе между запусками.
+struct CatalogEntry {
+    enum VerifyState {
+        NotVerified,
+        Verified,       // последняя запись с проверкой прошла
+        VerifyFailed    // последняя запись с проверкой не прошла
+    };
+
+    QString path;
+    qint64 fileSize = 0;          // размер файла (сжатый)
+    qint64 modified = 0;          // mtime, мс от эпохи
+    QString fileType;             // Utils::detectFileType
+    qint64 imageSize = -1;        // после распаковки, -1 - неизвестен
+    QString layout;               // ProbeResult::summary() для несжатых образов
+    QString digest;               // SHA-256 файла (hex), пусто - еще не посчитан
+    VerifyState verifyState = NotVerified;
+    qint64 verifiedAt = 0;        // мс от эпохи
+    qint64 lastUsed = 0;          // мс от эпохи, 0 - не использовался
+    bool pinned = false;          // выбран вручную, вне папок каталога
+
+    bool sameFile(const CatalogEntry& other) const {
+        return fileSize == other.fileSize && modified == other.modified;
+    }
+
+    ImageInfo toImageInfo() const;
+};
+
+// Каталог образов: папки, за которыми следит QFileSystemWatcher (inotify),
+// и постоянный JSON-индекс с метаданными. Индекс загружается при запуске,
+// поэтому список доступен сразу; изменившиеся файлы (размер или mtime)
+// переиндексируются в фоне: сначала быстрые сведения, затем SHA-256.
+// Сетевые папки inotify не видит - для них есть периодический пересмотр.
+class ImageCatalog : public QObject {
+    Q_OBJECT
+
+public:
+    explicit ImageCatalog(const QString& indexPath = QString(), QObject* parent = nullptr);
+    ~ImageCatalog() override;
+
+    QStringList directories() const { return m_directories; }
+    void addDirectory(const QString& path);
+    void removeDirectory(const QString& path);
+
+    // Недавние первыми, затем по имени
+    QList<CatalogEntry> entries() const;
+    bool entry(const QString& path, CatalogEntry* result) const;
+
+    // Образ, выбранный вручную: запомнить и проиндексировать.
+    // Возвращает известные сведения (из индекса, если файл не менялся)
+    CatalogEntry addFile(const QString& path);
+
+    void markUsed(const QString& path);
+    void markVerified(const QString& path, bool success);
+
+    // Пересмотр папок и закрепленных файлов (в фоне)
+    void rescan();
+
+    static QString defaultIndexPath();
+    static bool isImageFile(const QString& fileName);
+
+    // Быстрые сведения: тип, размер после распаковки (ImageSource::discoverSize),
+    // разметка несжатого образа. Читает заголовки и индексы, не весь файл
+    static CatalogEntry quickInfo(const QString& path);
+
+    // SHA-256 файла за один проход; для gzip заодно считается размер
+    // после распаковки (ISIZE ненадежен для образов > 4 GB и многочленных)
+    static bool computeDigest(const QString& path, CatalogEntry* entry, const std::atomic<bool>* cancelled);
+
+signals:
+    // Список или сведения изменились (сигналы объединяются)
+    void changed();
+
+private:
+    struct ScanResult;
+
+    QString m_indexPath;
+    QStringList m_directories;
+    QHash<QString, CatalogEntry> m_entries;
+    QSet<QString> m_inFlight;
+    bool m_scanning = false;
+    bool m_rescanPending = false;
+
+    QFileSystemWatcher* m_watcher = nullptr;
+    QThreadPool* m_pool = nullptr;
+    QTimer* m_saveTimer = nullptr;
+    QTimer* m_notifyTimer = nullptr;
+    QTimer* m_rescanTimer = nullptr;
+    std::shared_ptr<std::atomic<bool>> m_cancelled;
+
+    void load();
+    void save();
+    void touch();
+    void applyScan(const ScanResult& scan);
+    void index(const QString& path);
+    void digest(const QString& path);
+    bool isCovered(const QString& path) const;
+};
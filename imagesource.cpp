@@ -0,0 +1,850 @@
+// imagesource.cpp
+#include "imagesource.h"
+#include "imagecache.h"
+#include <QByteArray>
+#include <QFileInfo>
+#include <QDebug>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <cerrno>
+#include <cstring>
+#include <zlib.h>
+#include <lzma.h>
+#ifdef CMILE_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+namespace {
+
+const qint64 InputBuffer = 1024 * 1024;
+const qint64 DropChunk = 8 * 1024 * 1024;      // вытеснение прочитанного порциями
+const int PipeSize = 1024 * 1024;              // канал для splice (по умолчанию 64 KB)
+
+// Ошибки, означающие "так переносить нельзя" (не тот тип файла, старое
+// ядро, O_DIRECT без выравнивания), а не сбой ввода-вывода
+bool transferUnsupported(int error) {
+    return error == EINVAL || error == EXDEV || error == ENOSYS || error == EOPNOTSUPP;
+}
+
+quint16 le16(const uchar* p) { return static_cast<quint16>(p[0] | (p[1] << 8)); }
+quint32 le32(const uchar* p) { return static_cast<quint32>(le16(p)) | (static_cast<quint32>(le16(p + 2)) << 16); }
+quint64 le64(const uchar* p) { return static_cast<quint64>(le32(p)) | (static_cast<quint64>(le32(p + 4)) << 32); }
+
+bool readAt(int fd, qint64 offset, void* data, size_t length) {
+    size_t done = 0;
+    while (done < length) {
+        ssize_t n = ::pread(fd, static_cast<char*>(data) + done, length - done, static_cast<off_t>(offset + done));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        done += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+// gzip: распаковка в никуда - только для многочленных файлов и > 4 GB
+qint64 gzipCountSize(int fd) {
+    z_stream zs = {};
+    if (inflateInit2(&zs, 15 + 16) != Z_OK) return -1;
+    QByteArray input(InputBuffer, '\0');
+    QByteArray sink(InputBuffer, '\0');
+    quint64 total = 0;
+    qint64 offset = 0;
+    bool ended = false;
+    bool ok = true;
+    while (ok && !ended) {
+        ssize_t n = ::pread(fd, input.data(), static_cast<size_t>(input.size()), offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            ok = false;
+            break;
+        }
+        offset += n;
+        zs.next_in = reinterpret_cast<Bytef*>(input.data());
+        zs.avail_in = static_cast<uInt>(n);
+        while (zs.avail_in > 0) {
+            zs.next_out = reinterpret_cast<Bytef*>(sink.data());
+            zs.avail_out = static_cast<uInt>(sink.size());
+            const int rc = inflate(&zs, Z_NO_FLUSH);
+            total += static_cast<quint64>(sink.size()) - zs.avail_out;
+            if (rc == Z_STREAM_END) {
+                if (zs.avail_in > 0 && zs.next_in[0] == 0x1F) {
+                    inflateReset(&zs);
+                    continue;
+                }
+                ended = true;       // нули в хвосте игнорируются, как в gzip -d
+                break;
+            }
+            if (rc != Z_OK && rc != Z_BUF_ERROR) {
+                ok = false;
+                break;
+            }
+        }
+    }
+    inflateEnd(&zs);
+    return ok ? static_cast<qint64>(total) : -1;
+}
+
+// Полный размер из подполя "CM" в FEXTRA первого члена (ImageSource::gzipSizeExtra)
+bool gzipExtraSize(int fd, qint64 fileSize, quint64* size) {
+    uchar header[12];
+    if (fileSize < 18 || !readAt(fd, 0, header, sizeof(header))) return false;
+    if (header[0] != 0x1F || header[1] != 0x8B || header[2] != 8 || !(header[3] & 0x04)) return false;
+
+    const int extraLength = le16(header + 10);
+    if (12 + extraLength > fileSize) return false;
+    QByteArray extra(extraLength, '\0');
+    if (!readAt(fd, 12, extra.data(), static_cast<size_t>(extraLength))) return false;
+
+    const uchar* p = reinterpret_cast<const uchar*>(extra.constData());
+    for (int pos = 0; pos + 4 <= extraLength;) {
+        const int length = le16(p + pos + 2);
+        if (pos + 4 + length > extraLength) break;
+        if (p[pos] == 'C' && p[pos + 1] == 'M' && length == 8) {
+            *size = le64(p + pos + 4);
+            return true;
+        }
+        pos += 4 + length;
+    }
+    return false;
+}
+
+// ISIZE (размер по модулю 2^32) последнего члена. Deflate раздувает
+// несжимаемые данные максимум на 5 байт из 64 KB, поэтому ISIZE меньше
+// сжатого размера означает несколько членов или образ > 4 GB. Небольшие
+// файлы дешевле и надежнее посчитать распаковкой; без count распаковки нет,
+// и такой размер остается неизвестным
+void gzipSize(int fd, ImageSource::SizeInfo* info, bool count) {
+    uchar trailer[4];
+    if (info->fileSize < 18 || !readAt(fd, info->fileSize - 4, trailer, 4)) return;
+    const qint64 isize = le32(trailer);
+
+    // Записанный размер не меньше последнего члена - иначе заголовок чужой
+    quint64 recorded = 0;
+    if (gzipExtraSize(fd, info->fileSize, &recorded) && recorded >= static_cast<quint64>(isize)) {
+        info->imageSize = static_cast<qint64>(recorded);
+        info->exact = true;
+        info->method = "заголовок gzip";
+        return;
+    }
+
+    const qint64 minimum = (info->fileSize - 18) / 65540 * 65535;
+    if (isize >= minimum && (info->fileSize > 64LL * 1024 * 1024 || !count)) {
+        info->imageSize = isize;
+        info->exact = false;
+        info->method = "ISIZE gzip";
+        return;
+    }
+    if (!count) return;
+    info->imageSize = gzipCountSize(fd);
+    info->exact = info->imageSize >= 0;
+    info->method = "подсчет распаковкой";
+}
+
+// xz: потоки читаются с конца по индексам, как xz --list.
+// Склейка потоков (BackupJob пишет поток на блок) тоже поддерживается
+qint64 xzSize(int fd, qint64 fileSize) {
+    qint64 pos = fileSize;
+    quint64 total = 0;
+    while (pos > 0) {
+        // Stream Padding - нули кратно 4 байтам
+        uchar pad[4];
+        while (pos >= 4 && readAt(fd, pos - 4, pad, 4) && le32(pad) == 0) pos -= 4;
+        if (pos < 2 * LZMA_STREAM_HEADER_SIZE) return -1;
+
+        uchar footer[LZMA_STREAM_HEADER_SIZE];
+        lzma_stream_flags flags;
+        if (!readAt(fd, pos - LZMA_STREAM_HEADER_SIZE, footer, sizeof(footer)) ||
+            lzma_stream_footer_decode(&flags, footer) != LZMA_OK) return -1;
+        const qint64 indexSize = static_cast<qint64>(flags.backward_size);
+        if (indexSize > pos - 2 * LZMA_STREAM_HEADER_SIZE || indexSize > 64 * 1024 * 1024) return -1;
+
+        QByteArray index(indexSize, '\0');
+        if (!readAt(fd, pos - LZMA_STREAM_HEADER_SIZE - indexSize, index.data(), static_cast<size_t>(indexSize))) return -1;
+        lzma_index* idx = nullptr;
+        uint64_t memlimit = UINT64_MAX;
+        size_t inPos = 0;
+        if (lzma_index_buffer_decode(&idx, &memlimit, nullptr, reinterpret_cast<const uint8_t*>(index.constData()),
+                                     &inPos, static_cast<size_t>(indexSize)) != LZMA_OK) return -1;
+        total += lzma_index_uncompressed_size(idx);
+        const qint64 streamSize = static_cast<qint64>(lzma_index_file_size(idx));
+        lzma_index_end(idx, nullptr);
+        if (streamSize <= 0 || streamSize > pos) return -1;
+        pos -= streamSize;
+    }
+    return static_cast<qint64>(total);
+}
+
+// zstd: Frame_Content_Size из заголовков кадров; кадры проходятся по
+// заголовкам блоков без распаковки. Кадр без размера (сжатие из канала) -
+// размер неизвестен
+qint64 zstdSize(int fd, qint64 fileSize) {
+    qint64 pos = 0;
+    quint64 total = 0;
+    while (pos < fileSize) {
+        uchar h[18];
+        const size_t headerRead = static_cast<size_t>(qMin<qint64>(sizeof(h), fileSize - pos));
+        if (headerRead < 8 || !readAt(fd, pos, h, headerRead)) return -1;
+        const quint32 magic = le32(h);
+
+        if ((magic & 0xFFFFFFF0u) == 0x184D2A50u) {     // пропускаемый кадр
+            pos += 8 + le32(h + 4);
+            continue;
+        }
+        if (magic != 0xFD2FB528u) return -1;
+
+        const uchar fhd = h[4];
+        const int fcsFlag = fhd >> 6;
+        const bool singleSegment = fhd & 0x20;
+        const bool checksum = fhd & 0x04;
+        static const int dictSizes[4] = {0, 1, 2, 4};
+        const int dictSize = dictSizes[fhd & 3];
+        const int fcsSize = fcsFlag == 0 ? (singleSegment ? 1 : 0) : (1 << fcsFlag);
+        if (fcsSize == 0) return -1;
+
+        const int fcsOffset = 5 + (singleSegment ? 0 : 1) + dictSize;
+        if (static_cast<size_t>(fcsOffset + fcsSize) > headerRead) return -1;
+        quint64 content = 0;
+        for (int i = fcsSize - 1; i >= 0; --i) content = (content << 8) | h[fcsOffset + i];
+        if (fcsSize == 2) content += 256;
+        total += content;
+
+        pos += fcsOffset + fcsSize;
+        for (;;) {
+            uchar b[3];
+            if (!readAt(fd, pos, b, 3)) return -1;
+            const quint32 header = b[0] | (b[1] << 8) | (b[2] << 16);
+            const quint32 type = (header >> 1) & 3;
+            const quint32 size = header >> 3;
+            if (type == 3) return -1;
+            pos += 3 + (type == 1 ? 1 : size);          // RLE-блок хранит один байт
+            if (header & 1) break;
+        }
+        if (checksum) pos += 4;
+    }
+    return pos == fileSize ? static_cast<qint64>(total) : -1;
+}
+
+struct ZipEntry {
+    quint64 compressedSize = 0;
+    quint64 uncompressedSize = 0;
+    quint64 localOffset = 0;
+    quint16 method = 0;
+};
+
+// Образ в zip - самый большой файл архива (рядом бывают README и .sha256)
+bool zipEntry(int fd, qint64 fileSize, ZipEntry* entry) {
+    // End of Central Directory: последние 22 байта + комментарий до 64 KB
+    const qint64 tail = qMin<qint64>(fileSize, 22 + 65535 + 20);
+    QByteArray buf(tail, '\0');
+    if (tail < 22 || !readAt(fd, fileSize - tail, buf.data(), static_cast<size_t>(tail))) return false;
+    const uchar* b = reinterpret_cast<const uchar*>(buf.constData());
+    qint64 eocd = -1;
+    for (qint64 i = tail - 22; i >= 0; --i) {
+        if (le32(b + i) == 0x06054B50) {
+            eocd = i;
+            break;
+        }
+    }
+    if (eocd < 0) return false;
+
+    quint64 count = le16(b + eocd + 10);
+    quint64 cdSize = le32(b + eocd + 12);
+    quint64 cdOffset = le32(b + eocd + 16);
+
+    // ZIP64: локатор перед EOCD указывает на запись ZIP64 EOCD
+    if (eocd >= 20 && le32(b + eocd - 20) == 0x07064B50) {
+        uchar z[56];
+        if (!readAt(fd, static_cast<qint64>(le64(b + eocd - 20 + 8)), z, sizeof(z)) || le32(z) != 0x06064B50) return false;
+        count = le64(z + 32);
+        cdSize = le64(z + 40);
+        cdOffset = le64(z + 48);
+    }
+    if (cdSize > 64ULL * 1024 * 1024 || cdOffset + cdSize > static_cast<quint64>(fileSize)) return false;
+
+    QByteArray cd(static_cast<qint64>(cdSize), '\0');
+    if (!readAt(fd, static_cast<qint64>(cdOffset), cd.data(), static_cast<size_t>(cdSize))) return false;
+    const uchar* p = reinterpret_cast<const uchar*>(cd.constData());
+    const uchar* end = p + cdSize;
+
+    bool found = false;
+    for (quint64 i = 0; i < count && p + 46 <= end && le32(p) == 0x02014B50; ++i) {
+        ZipEntry e;
+        e.method = le16(p + 10);
+        e.compressedSize = le32(p + 20);
+        e.uncompressedSize = le32(p + 24);
+        e.localOffset = le32(p + 42);
+        const quint16 nameLength = le16(p + 28);
+        const quint16 extraLength = le16(p + 30);
+        const quint16 commentLength = le16(p + 32);
+        if (p + 46 + nameLength + extraLength > end) break;
+
+        // Поля 0xFFFFFFFF берутся из extra-поля ZIP64 (0x0001) в том же порядке
+        const uchar* extra = p + 46 + nameLength;
+        for (quint16 off = 0; off + 4 <= extraLength;) {
+            const quint16 id = le16(extra + off);
+            const quint16 size = le16(extra + off + 2);
+            if (id == 0x0001) {
+                const uchar* z = extra + off + 4;
+                const uchar* zEnd = z + size;
+                if (e.uncompressedSize == 0xFFFFFFFF && z + 8 <= zEnd) { e.uncompressedSize = le64(z); z += 8; }
+                if (e.compressedSize == 0xFFFFFFFF && z + 8 <= zEnd) { e.compressedSize = le64(z); z += 8; }
+                if (e.localOffset == 0xFFFFFFFF && z + 8 <= zEnd) { e.localOffset = le64(z); }
+            }
+            off += 4 + size;
+        }
+
+        const bool directory = nameLength > 0 && p[46 + nameLength - 1] == '/';
+        if (!directory && (!found || e.uncompressedSize > entry->uncompressedSize)) {
+            *entry = e;
+            found = true;
+        }
+        p += 46 + nameLength + extraLength + commentLength;
+    }
+    return found;
+}
+
+} // namespace
+
+struct ImageSource::Private {
+    int fd = -1;
+    SizeInfo info;
+    QString error;
+
+    QByteArray input;
+    qint64 inPos = 0;
+    qint64 inLength = 0;
+    bool inputEnd = false;
+    bool finished = false;
+    qint64 consumed = 0;
+    qint64 remaining = -1;      // zip: сжатых байт записи до конца, -1 - до конца файла
+    qint64 base = 0;            // смещение данных в файле (zip - начало записи)
+    CachePolicy policy = DropBehind;
+    qint64 advisedEnd = 0;      // до куда запрошено упреждающее чтение
+    qint64 droppedEnd = 0;      // до куда кэш уже вытеснен
+    bool stored = false;        // zip без сжатия
+
+    enum ZeroCopy { Untried, CopyFileRange, TrySplice, Splice, NoZeroCopy };
+    ZeroCopy zeroCopy = Untried;
+    int pipe[2] = {-1, -1};
+
+    // Наполнение кэша образов по ходу чтения; пока оно идет, перенос ядром
+    // не используется - данные должны пройти через read()
+    std::unique_ptr<ImageCache::Fill> cacheFill;
+
+    z_stream zs = {};
+    bool zInit = false;
+    lzma_stream xz = LZMA_STREAM_INIT;
+    bool xzInit = false;
+#ifdef CMILE_HAVE_ZSTD
+    ZSTD_DStream* zstd = nullptr;
+    bool zstdFrameEnd = false;  // последний вызов завершил кадр
+#endif
+
+    bool fill() {
+        inPos = 0;
+        inLength = 0;
+        if (inputEnd) return true;
+        qint64 want = input.size();
+        if (remaining >= 0) want = qMin(want, remaining);
+        while (want > 0) {
+            ssize_t n = ::read(fd, input.data(), static_cast<size_t>(want));
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) {
+                error = QString("Ошибка чтения файла образа: %1").arg(strerror(errno));
+                return false;
+            }
+            inLength = n;
+            break;
+        }
+        if (inLength == 0) inputEnd = true;
+        consumed += inLength;
+        if (remaining >= 0) remaining -= inLength;
+        advance();
+        return true;
+    }
+
+    // Подсказки ядру после чтения: держать окно упреждающего чтения
+    // впереди позиции и вытеснять прочитанное
+    void advance() {
+        const qint64 pos = base + consumed;
+        if (pos + ReadaheadWindow / 2 > advisedEnd && advisedEnd < info.fileSize) {
+            const qint64 from = qMax(advisedEnd, pos);
+            const qint64 to = qMin(pos + ReadaheadWindow, info.fileSize);
+            posix_fadvise(fd, from, to - from, POSIX_FADV_WILLNEED);
+            advisedEnd = to;
+        }
+        if (policy == DropBehind && pos - droppedEnd >= DropChunk) {
+            posix_fadvise(fd, droppedEnd, pos - droppedEnd, POSIX_FADV_DONTNEED);
+            droppedEnd = pos;
+        }
+    }
+
+    bool inputExhausted() const { return inPos == inLength && inputEnd; }
+
+    // Прочитанное - в кэш образов; конец образа делает запись кэша доступной
+    void tee(const char* data, qint64 size) {
+        if (!cacheFill) return;
+        if (size > 0 && !cacheFill->append(data, size)) {
+            cacheFill.reset();
+            return;
+        }
+        if (finished) {
+            cacheFill->commit();
+            cacheFill.reset();
+        }
+    }
+};
+
+ImageSource::ImageSource() = default;
+
+ImageSource::~ImageSource() {
+    close();
+}
+
+ImageSource::Format ImageSource::detectFormat(const QString& path) {
+    const QString name = QFileInfo(path).fileName().toLower();
+    // Архив tar - набор файлов, а не образ диска
+    if (name.contains(".tar.") || name.endsWith(".tgz")) return Unsupported;
+
+    int fd = ::open(path.toLocal8Bit().constData(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return Raw;
+    uchar m[6] = {};
+    const bool ok = readAt(fd, 0, m, sizeof(m));
+    ::close(fd);
+    if (!ok) return Raw;
+
+    if (m[0] == 0x1F && m[1] == 0x8B) return Gzip;
+    if (memcmp(m, "\xFD" "7zXZ\0", 6) == 0) return Xz;
+    if (le32(m) == 0xFD2FB528u) {
+#ifdef CMILE_HAVE_ZSTD
+        return Zstd;
+#else
+        return Unsupported;
+#endif
+    }
+    if (memcmp(m, "PK\x03\x04", 4) == 0) return Zip;
+    if (memcmp(m, "BZh", 3) == 0 || memcmp(m, "7z\xBC\xAF\x27\x1C", 6) == 0) return Unsupported;
+    return Raw;
+}
+
+QString ImageSource::formatName(Format format) {
+    switch (format) {
+        case Raw: return "без сжатия";
+        case Gzip: return "gzip";
+        case Xz: return "xz";
+        case Zstd: return "zstd";
+        case Zip: return "zip";
+        case Unsupported: return "не поддерживается";
+    }
+    return QString();
+}
+
+QByteArray ImageSource::gzipSizeExtra(quint64 imageSize) {
+    QByteArray extra(12, '\0');
+    extra[0] = 'C';
+    extra[1] = 'M';
+    extra[2] = 8;
+    for (int i = 0; i < 8; ++i) extra[4 + i] = static_cast<char>((imageSize >> (8 * i)) & 0xFF);
+    return extra;
+}
+
+ImageSource::SizeInfo ImageSource::discoverSize(const QString& path, SizeScan scan) {
+    SizeInfo info;
+    info.format = detectFormat(path);
+
+    int fd = ::open(path.toLocal8Bit().constData(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return info;
+    struct stat st;
+    if (::fstat(fd, &st) == 0) info.fileSize = st.st_size;
+
+    switch (info.format) {
+        case Raw:
+            info.imageSize = info.fileSize;
+            info.exact = true;
+            info.method = "размер файла";
+            break;
+        case Gzip:
+            gzipSize(fd, &info, scan == FullScan);
+            break;
+        case Xz:
+            info.imageSize = xzSize(fd, info.fileSize);
+            info.exact = info.imageSize >= 0;
+            info.method = "индекс xz";
+            break;
+        case Zstd:
+            info.imageSize = zstdSize(fd, info.fileSize);
+            info.exact = info.imageSize >= 0;
+            info.method = "заголовки кадров zstd";
+            break;
+        case Zip: {
+            ZipEntry entry;
+            if (zipEntry(fd, info.fileSize, &entry)) {
+                info.imageSize = static_cast<qint64>(entry.uncompressedSize);
+                info.exact = true;
+                info.method = "центральный каталог zip";
+            }
+            break;
+        }
+        case Unsupported:
+            break;
+    }
+    ::close(fd);
+    return info;
+}
+
+bool ImageSource::open(const QString& path, CachePolicy policy, const SizeInfo* known) {
+    close();
+    d.reset(new Private);
+    d->policy = policy;
+
+    // Образ уже распакован в память другим заданием - читается как несжатый
+    qint64 cachedSize = 0;
+    const int cachedFd = ImageCache::instance().open(path, &cachedSize);
+    if (cachedFd >= 0) {
+        d->fd = cachedFd;
+        d->policy = KeepCached;     // вытеснять из memfd нечего
+        d->info.format = Raw;
+        d->info.fileSize = cachedSize;
+        d->info.imageSize = cachedSize;
+        d->info.exact = true;
+        d->info.method = "кэш образов в памяти";
+        return true;
+    }
+
+    d->fd = ::open(path.toLocal8Bit().constData(), O_RDONLY | O_CLOEXEC);
+    if (d->fd < 0) {
+        d->error = QString("Ошибка открытия файла образа: %1").arg(strerror(errno));
+        return false;
+    }
+    // Размер, определенный заданием, годен, пока файл того же размера
+    struct stat st;
+    const bool reuse = known && known->fileSize > 0 && ::fstat(d->fd, &st) == 0 && st.st_size == known->fileSize;
+    d->info = reuse ? *known : discoverSize(path);
+    if (d->info.format == Unsupported) {
+        d->error = QString("Формат образа не поддерживается: %1").arg(QFileInfo(path).fileName());
+        return false;
+    }
+    posix_fadvise(d->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    if (d->info.exact) d->cacheFill = ImageCache::instance().beginFill(path, d->info.imageSize);
+    if (d->info.format == Raw) {
+        d->advance();
+        return true;
+    }
+
+    d->input = QByteArray(InputBuffer, '\0');
+    switch (d->info.format) {
+        case Gzip:
+            d->zInit = inflateInit2(&d->zs, 15 + 16) == Z_OK;
+            break;
+        case Xz:
+            d->xzInit = lzma_stream_decoder(&d->xz, UINT64_MAX, LZMA_CONCATENATED) == LZMA_OK;
+            break;
+        case Zstd:
+#ifdef CMILE_HAVE_ZSTD
+            d->zstd = ZSTD_createDStream();
+#endif
+            break;
+        case Zip: {
+            ZipEntry entry;
+            uchar local[30];
+            if (!zipEntry(d->fd, d->info.fileSize, &entry) ||
+                !readAt(d->fd, static_cast<qint64>(entry.localOffset), local, sizeof(local)) ||
+                le32(local) != 0x04034B50) {
+                d->error = "Не удалось прочитать каталог zip";
+                return false;
+            }
+            if (entry.method != 0 && entry.method != 8) {
+                d->error = QString("Метод сжатия zip %1 не поддерживается").arg(entry.method);
+                return false;
+            }
+            const qint64 dataStart = static_cast<qint64>(entry.localOffset) + 30 + le16(local + 26) + le16(local + 28);
+            ::lseek(d->fd, dataStart, SEEK_SET);
+            d->base = dataStart;
+            d->advisedEnd = dataStart;
+            d->droppedEnd = dataStart;
+            d->remaining = static_cast<qint64>(entry.compressedSize);
+            d->stored = entry.method == 0;
+            d->zInit = d->stored || inflateInit2(&d->zs, -15) == Z_OK;
+            break;
+        }
+        default:
+            break;
+    }
+
+    bool ready = d->zInit || d->xzInit;
+#ifdef CMILE_HAVE_ZSTD
+    ready = ready || d->zstd;
+#endif
+    if (!ready) {
+        d->error = "Не удалось инициализировать распаковку";
+        return false;
+    }
+    d->advance();
+    return true;
+}
+
+void ImageSource::close() {
+    if (!d) return;
+    if (d->fd >= 0) {
+        if (d->policy == DropBehind) posix_fadvise(d->fd, d->droppedEnd, 0, POSIX_FADV_DONTNEED);
+        ::close(d->fd);
+    }
+    if (d->zInit && !d->stored) inflateEnd(&d->zs);
+    if (d->xzInit) lzma_end(&d->xz);
+#ifdef CMILE_HAVE_ZSTD
+    if (d->zstd) ZSTD_freeDStream(d->zstd);
+#endif
+    if (d->pipe[0] >= 0) {
+        ::close(d->pipe[0]);
+        ::close(d->pipe[1]);
+    }
+    d.reset();
+}
+
+bool ImageSource::rewind(qint64 offset) {
+    if (!d || d->fd < 0 || d->info.format != Raw) return false;
+    if (::lseek(d->fd, d->base + offset, SEEK_SET) < 0) {
+        d->error = QString("Ошибка позиционирования в образе: %1").arg(strerror(errno));
+        return false;
+    }
+    if (d->pipe[0] >= 0) {
+        ::close(d->pipe[0]);
+        ::close(d->pipe[1]);
+        d->pipe[0] = d->pipe[1] = -1;
+    }
+    d->zeroCopy = Private::NoZeroCopy;
+    d->cacheFill.reset();       // в кэше получился бы пропуск
+    d->consumed = offset;
+    d->finished = false;
+    return true;
+}
+
+qint64 ImageSource::transfer(int fd, qint64 maxSize, bool* unsupported) {
+    *unsupported = false;
+    if (!d || d->fd < 0) return -1;
+    if (d->info.format != Raw || d->zeroCopy == Private::NoZeroCopy || d->cacheFill) {
+        *unsupported = true;
+        return 0;
+    }
+    if (d->finished || maxSize <= 0) return 0;
+
+    qint64 moved = 0;
+    if (d->zeroCopy == Private::Untried || d->zeroCopy == Private::CopyFileRange) {
+        // Блочное устройство copy_file_range обычно не принимает (EINVAL) -
+        // тогда splice
+        while (moved < maxSize) {
+            ssize_t n = ::copy_file_range(d->fd, nullptr, fd, nullptr, static_cast<size_t>(maxSize - moved), 0);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) {
+                if (d->zeroCopy == Private::Untried && transferUnsupported(errno)) {
+                    d->zeroCopy = Private::TrySplice;
+                    break;
+                }
+                d->error = QString("Ошибка переноса данных: %1").arg(strerror(errno));
+                return -1;
+            }
+            d->zeroCopy = Private::CopyFileRange;
+            if (n == 0) {
+                d->finished = true;
+                break;
+            }
+            moved += n;
+        }
+        if (d->zeroCopy == Private::CopyFileRange) {
+            d->consumed += moved;
+            d->advance();
+            return moved;
+        }
+    }
+
+    if (d->pipe[0] < 0) {
+        if (::pipe2(d->pipe, O_CLOEXEC) != 0) {
+            d->zeroCopy = Private::NoZeroCopy;
+            *unsupported = true;
+            return 0;
+        }
+        fcntl(d->pipe[1], F_SETPIPE_SZ, PipeSize);
+    }
+
+    // Файл -> канал (ссылки на страницы кэша) -> устройство
+    while (moved < maxSize) {
+        ssize_t n = ::splice(d->fd, nullptr, d->pipe[1], nullptr,
+                             static_cast<size_t>(qMin<qint64>(maxSize - moved, PipeSize)), SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            if (d->zeroCopy == Private::TrySplice && transferUnsupported(errno)) {
+                d->zeroCopy = Private::NoZeroCopy;
+                *unsupported = true;
+                return 0;
+            }
+            d->error = QString("Ошибка чтения файла образа: %1").arg(strerror(errno));
+            return -1;
+        }
+        if (n == 0) {
+            d->finished = true;
+            break;
+        }
+
+        ssize_t left = n;
+        while (left > 0) {
+            ssize_t w = ::splice(d->pipe[0], nullptr, fd, nullptr, static_cast<size_t>(left), SPLICE_F_MOVE | SPLICE_F_MORE);
+            if (w < 0 && errno == EINTR) continue;
+            if (w <= 0) {
+                const int err = w < 0 ? errno : EIO;
+                if (d->zeroCopy == Private::TrySplice && transferUnsupported(err)) {
+                    // Первый же перенос не принят устройством: вернуть файл
+                    // к непереданным данным и сбросить канал
+                    ::lseek(d->fd, -left, SEEK_CUR);
+                    ::close(d->pipe[0]);
+                    ::close(d->pipe[1]);
+                    d->pipe[0] = d->pipe[1] = -1;
+                    d->zeroCopy = Private::NoZeroCopy;
+                    *unsupported = true;
+                    return 0;
+                }
+                d->error = QString("Ошибка записи на устройство: %1").arg(strerror(err));
+                return -1;
+            }
+            d->zeroCopy = Private::Splice;
+            left -= w;
+            moved += w;
+        }
+    }
+    d->consumed += moved;
+    d->advance();
+    return moved;
+}
+
+qint64 ImageSource::read(char* data, qint64 maxSize) {
+    if (!d || d->fd < 0) return -1;
+    if (d->finished || maxSize <= 0) return 0;
+
+    qint64 produced = 0;
+    if (d->info.format == Raw) {
+        while (produced < maxSize) {
+            ssize_t n = ::read(d->fd, data + produced, static_cast<size_t>(maxSize - produced));
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) {
+                d->error = QString("Ошибка чтения файла образа: %1").arg(strerror(errno));
+                return -1;
+            }
+            if (n == 0) {
+                d->finished = true;
+                break;
+            }
+            produced += n;
+            d->consumed += n;
+        }
+        d->advance();
+        d->tee(data, produced);
+        return produced;
+    }
+
+    while (produced < maxSize && !d->finished) {
+        if (d->inPos == d->inLength && !d->inputEnd && !d->fill()) return -1;
+        char* in = d->input.data() + d->inPos;
+        const qint64 inAvail = d->inLength - d->inPos;
+        const qint64 outAvail = maxSize - produced;
+
+        switch (d->info.format) {
+            case Zip:
+                if (d->stored) {
+                    const qint64 n = qMin(inAvail, outAvail);
+                    memcpy(data + produced, in, static_cast<size_t>(n));
+                    d->inPos += n;
+                    produced += n;
+                    if (d->inputExhausted()) d->finished = true;
+                    break;
+                }
+                // fallthrough: deflate без заголовка gzip
+            case Gzip: {
+                d->zs.next_in = reinterpret_cast<Bytef*>(in);
+                d->zs.avail_in = static_cast<uInt>(inAvail);
+                d->zs.next_out = reinterpret_cast<Bytef*>(data + produced);
+                d->zs.avail_out = static_cast<uInt>(qMin<qint64>(outAvail, 1 << 30));
+                const uInt outBefore = d->zs.avail_out;
+                const int rc = inflate(&d->zs, Z_NO_FLUSH);
+                d->inPos += inAvail - d->zs.avail_in;
+                produced += outBefore - d->zs.avail_out;
+
+                if (rc == Z_STREAM_END) {
+                    if (d->info.format == Gzip) {
+                        // Следующий член gzip или конец (нули в хвосте игнорируются)
+                        if (d->inPos == d->inLength && !d->inputEnd && !d->fill()) return -1;
+                        if (d->inPos < d->inLength && static_cast<uchar>(d->input[d->inPos]) == 0x1F) {
+                            inflateReset(&d->zs);
+                            break;
+                        }
+                    }
+                    d->finished = true;
+                } else if (rc == Z_BUF_ERROR && d->inputExhausted()) {
+                    d->error = "Образ обрезан: неожиданный конец сжатых данных";
+                    return -1;
+                } else if (rc != Z_OK && rc != Z_BUF_ERROR) {
+                    d->error = QString("Ошибка распаковки: %1").arg(d->zs.msg ? d->zs.msg : "поврежденные данные");
+                    return -1;
+                }
+                break;
+            }
+            case Xz: {
+                d->xz.next_in = reinterpret_cast<const uint8_t*>(in);
+                d->xz.avail_in = static_cast<size_t>(inAvail);
+                d->xz.next_out = reinterpret_cast<uint8_t*>(data + produced);
+                d->xz.avail_out = static_cast<size_t>(outAvail);
+                const lzma_ret rc = lzma_code(&d->xz, d->inputExhausted() ? LZMA_FINISH : LZMA_RUN);
+                d->inPos += inAvail - static_cast<qint64>(d->xz.avail_in);
+                produced += outAvail - static_cast<qint64>(d->xz.avail_out);
+                if (rc == LZMA_STREAM_END) {
+                    d->finished = true;
+                } else if (rc != LZMA_OK) {
+                    d->error = rc == LZMA_BUF_ERROR ? QString("Образ обрезан: неожиданный конец сжатых данных")
+                                                    : QString("Ошибка распаковки xz (код %1)").arg(static_cast<int>(rc));
+                    return -1;
+                }
+                break;
+            }
+            case Zstd: {
+#ifdef CMILE_HAVE_ZSTD
+                ZSTD_inBuffer zin = {in, static_cast<size_t>(inAvail), 0};
+                ZSTD_outBuffer zout = {data + produced, static_cast<size_t>(outAvail), 0};
+                const size_t rc = ZSTD_decompressStream(d->zstd, &zout, &zin);
+                if (ZSTD_isError(rc)) {
+                    d->error = QString("Ошибка распаковки zstd: %1").arg(ZSTD_getErrorName(rc));
+                    return -1;
+                }
+                d->inPos += static_cast<qint64>(zin.pos);
+                produced += static_cast<qint64>(zout.pos);
+                // Пустой вызов после конца кадра ждет заголовок следующего,
+                // поэтому конец потока определяется по предыдущему вызову
+                if (zin.pos > 0 || zout.pos > 0) d->zstdFrameEnd = rc == 0;
+                if (d->inputExhausted() && zout.pos == 0) {
+                    if (!d->zstdFrameEnd) {
+                        d->error = "Образ обрезан: неожиданный конец сжатых данных";
+                        return -1;
+                    }
+                    d->finished = true;
+                }
+#endif
+                break;
+            }
+            default:
+                return -1;
+        }
+    }
+    d->tee(data, produced);
+    return produced;
+}
+
+QString ImageSource::errorString() const {
+    return d ? d->error : QString();
+}
+
+const ImageSource::SizeInfo& ImageSource::sizeInfo() const {
+    static const SizeInfo empty;
+    return d ? d->info : empty;
+}
+
+qint64 ImageSource::consumed() const {
+    return d ? d->consumed : 0;
+}
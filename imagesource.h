@@ -0,0 +1,97 @@
+// imagesource.h
+#pragma once
+
+#include <QString>
+#include <memory>
+
+// Содержимое образа после распаковки: несжатый файл, gzip (в том числе
+// многочленный), xz (в том числе склейка потоков), zstd (если собрано
+// с libzstd) и zip (самый большой файл архива, store или deflate).
+// Размер после распаковки определяется без распаковки - по служебным
+// структурам формата; для записи образ распаковывается потоком.
+class ImageSource {
+public:
+    enum Format {
+        Raw,
+        Gzip,
+        Xz,
+        Zstd,
+        Zip,
+        Unsupported     // bzip2, 7z, tar.* - не образ диска или нет декодера
+    };
+
+    // Страничный кэш для прочитанного файла образа
+    enum CachePolicy {
+        DropBehind,     // прочитанное сразу вытесняется: образ в десятки GB не
+                        // выталкивает из кэша все остальное
+        KeepCached      // оставить в кэше: образ скоро прочитают снова
+    };
+
+    // Окно упреждающего чтения (POSIX_FADV_WILLNEED) впереди позиции чтения:
+    // стандартного окна ядра не хватает медленным источникам вроде NFS
+    static constexpr qint64 ReadaheadWindow = 64 * 1024 * 1024;
+
+    struct SizeInfo {
+        Format format = Raw;
+        qint64 fileSize = 0;
+        qint64 imageSize = -1;      // после распаковки, -1 - неизвестен
+        bool exact = false;         // false - оценка (ISIZE gzip хранится по модулю 4 GB)
+        QString method;             // откуда взят размер
+
+        // Для прогресса и проверки размера: неизвестный считается равным файлу
+        qint64 effectiveSize() const { return imageSize >= 0 ? imageSize : fileSize; }
+    };
+
+    ImageSource();
+    ~ImageSource();
+    ImageSource(const ImageSource&) = delete;
+    ImageSource& operator=(const ImageSource&) = delete;
+
+    static Format detectFormat(const QString& path);
+    static QString formatName(Format format);
+
+    enum SizeScan {
+        QuickScan,      // только служебные структуры - для потока интерфейса
+        FullScan        // gzip с неправдоподобным ISIZE считается распаковкой
+    };
+
+    // gzip: полный размер из подполя FEXTRA первого члена (так пишет
+    // BackupJob), иначе ISIZE последнего члена; если он меньше возможного для сжатого
+    // файла (несколько членов или переполнение 4 GB) - подсчет распаковкой
+    // (FullScan) или размер неизвестен (QuickScan). Правдоподобный ISIZE -
+    // все равно оценка: образ > 4 GB может совпасть с ним по модулю.
+    // xz: индексы потоков, zstd: Frame_Content_Size кадров, zip: центральный
+    // каталог (включая ZIP64)
+    static SizeInfo discoverSize(const QString& path, SizeScan scan = FullScan);
+
+    // Поле FEXTRA заголовка gzip с полным размером образа: подполе "CM",
+    // 8 байт little-endian. Пишется в первый член многочленного файла
+    static QByteArray gzipSizeExtra(quint64 imageSize);
+
+    // known - уже определенный размер (задание, каталог): открытие не
+    // определяет его заново, если файл образа с тех пор не изменился
+    bool open(const QString& path, CachePolicy policy = DropBehind, const SizeInfo* known = nullptr);
+    void close();
+
+    // Заполняет буфер целиком, кроме конца образа; 0 - конец, -1 - ошибка
+    qint64 read(char* data, qint64 maxSize);
+
+    // Только для несжатого образа: перенос до maxSize байт в fd средствами
+    // ядра (copy_file_range, иначе splice через канал), без копирования через
+    // память процесса. Результат как у read(). Если ядро не умеет переносить
+    // в этот fd, *unsupported = true и ничего не перенесено - читать read()
+    qint64 transfer(int fd, qint64 maxSize, bool* unsupported);
+
+    // Только для несжатого образа: продолжить чтение с offset (после сбоя
+    // transfer часть данных могла застрять в канале). Перенос ядром после
+    // этого отключается - дальше только read()
+    bool rewind(qint64 offset);
+
+    QString errorString() const;
+    const SizeInfo& sizeInfo() const;
+    qint64 consumed() const;        // прочитано из файла (сжатых байт)
+
+private:
+    struct Private;
+    std::unique_ptr<Private> d;
+};
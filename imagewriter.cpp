@@ -2,10 +2,18 @@
 #include "imagewriter.h"
 #include "devicemanager.h"
 #include "utils.h"
+#include "bufferpool.h"
+#include "badrangemap.h"
+#include "capacityprobe.h"
+#include "probeengine.h"
+#include "throughputestimator.h"
+#include "blocktarget.h"
+#include "simdevice.h"
 #include <QFile>
 #include <QFileInfo>
 #include <QDateTime>
 #include <QElapsedTimer>
+#include <QRandomGenerator>
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/stat.h>
@@ -14,9 +22,41 @@
 #include <linux/fs.h>
 #include <cstring>
 #include <cerrno>
+#include <cmath>
+#include <vector>
+
+namespace {
+
+// Запись с продолжением после короткой записи и EINTR. Результат - сколько
+// байт записано подряд от offset; *error - errno, на котором запись встала
+size_t pwriteSome(BlockTarget& target, const char* data, size_t length, quint64 offset, int* error) {
+    size_t done = 0;
+    while (done < length) {
+        ssize_t n = target.pwrite(data + done, length - done, offset + done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            *error = n < 0 ? errno : ENOSPC;    // 0 - конец устройства
+            break;
+        }
+        done += n;
+    }
+    return done;
+}
+
+// Пауза после закрытия устройства, входит в оценку оставшегося времени
+const int DeviceSettleMs = 1000;
+
+// Ни повтор, ни дробление запроса не помогут: устройство отключено,
+// запись за концом устройства, неверный запрос
+bool isPermanentWriteError(int error) {
+    return error == ENODEV || error == ENXIO || error == ENOSPC || error == EBADF ||
+           error == EINVAL || error == EROFS || error == EFBIG;
+}
+
+} // namespace
 
 ImageWriter::ImageWriter(const Config& cfg, QObject* parent)
-: QThread(parent), m_cfg(cfg) {}
+: QThread(parent), m_cfg(cfg), m_bandwidth(cfg.rateLimit) {}
 
 void ImageWriter::cancel() {
     m_cancelled.store(true, std::memory_order_release);
@@ -27,18 +67,63 @@ void ImageWriter::run() {
 
     emit progress(0, "Проверка файла и устройства...", 0, "-");
 
+    // Приоритет задается потоку задания: фоновая проверка в классе idle
+    // не отнимает диск у записи, идущей рядом
+    if (!m_cfg.ioPriority.isDefault()) {
+        QString priorityError;
+        if (m_cfg.ioPriority.apply(&priorityError)) {
+            emit progress(0, QString("Приоритет ввода-вывода: %1").arg(m_cfg.ioPriority.describe()), 0, "-");
+        } else {
+            emit progress(0, QString("Предупреждение: %1").arg(priorityError), 0, "-");
+        }
+    }
+
     QFileInfo imgInfo(m_cfg.imagePath);
     if (!imgInfo.exists()) {
         emit finished(false, "Файл образа не найден: " + m_cfg.imagePath);
         return;
     }
 
-    if (!QFile::exists(m_cfg.devicePath)) {
+    // Модель устройства (SimDevice) не монтируется и не видна в sysfs:
+    // проверки носителя к ней неприменимы, размер она проверяет сама
+    const bool simulated = SimDevice::isSpec(m_cfg.devicePath);
+    if (!simulated && !QFile::exists(m_cfg.devicePath)) {
         emit finished(false, "Устройство не найдено: " + m_cfg.devicePath);
         return;
     }
 
-    emit progress(5, QString("Размер образа: %1").arg(Utils::formatSize(imgInfo.size())), 0, "-");
+    // Размер после распаковки определяется один раз: gzip > 4 GB считается
+    // полной распаковкой, повторять ее в каждой проверке и чтении дорого
+    if (m_cfg.sizeInfo.fileSize > 0 && m_cfg.sizeInfo.fileSize == imgInfo.size()) {
+        m_sizeInfo = m_cfg.sizeInfo;
+    } else {
+        m_sizeInfo = ImageSource::discoverSize(m_cfg.imagePath);
+    }
+    const ImageSource::SizeInfo& sizeInfo = m_sizeInfo;
+    if (sizeInfo.format == ImageSource::Unsupported) {
+        emit finished(false, "Формат образа не поддерживается: " + imgInfo.fileName());
+        return;
+    }
+    if (sizeInfo.format == ImageSource::Raw) {
+        emit progress(5, QString("Размер образа: %1").arg(Utils::formatSize(sizeInfo.fileSize)), 0, "-");
+    } else {
+        const QString unpacked = sizeInfo.imageSize < 0 ? QString("неизвестен")
+            : QString("%1%2").arg(sizeInfo.exact ? "" : "~").arg(Utils::formatSize(sizeInfo.imageSize));
+        emit progress(5, QString("Размер образа: %1 (%2), после распаковки: %3")
+            .arg(Utils::formatSize(sizeInfo.fileSize), ImageSource::formatName(sizeInfo.format), unpacked), 0, "-");
+    }
+
+    if (m_cfg.verifyOnly) {
+        const bool match = verifyImage();
+        if (!m_cancelled.load(std::memory_order_acquire)) emit verified(match);
+        if (!match) {
+            emit finished(false, m_cancelled.load(std::memory_order_acquire) ? "Операция отменена" : "Проверка не пройдена");
+            return;
+        }
+        emit finished(true, m_verifySummary.isEmpty() ? QString("Содержимое устройства совпадает с образом")
+                                                      : m_verifySummary);
+        return;
+    }
 
     // --- ПРОВЕРКИ ДО НАЧАЛА ЗАПИСИ ---
     // Проверка свободного места для временных файлов
@@ -69,7 +154,8 @@ void ImageWriter::run() {
 
     emit progress(10, "Размонтирование устройства...", 0, "-");
 
-    auto [unmountSuccess, unmountMessage] = DeviceManager::unmountAll(m_cfg.devicePath);
+    auto [unmountSuccess, unmountMessage] = simulated ? std::pair<bool, QString>(true, "Модель устройства")
+                                                      : DeviceManager::unmountAll(m_cfg.devicePath);
 
     if (!unmountSuccess) {
         QString errorMsg = QString("Ошибка размонтирования:\n%1").arg(unmountMessage);
@@ -92,12 +178,55 @@ void ImageWriter::run() {
     }
 
     // Проверка размера образа
-    if (!Utils::checkImageFitsDevice(m_cfg.imagePath, m_cfg.devicePath)) {
+    if (!simulated && !Utils::checkImageFitsDevice(sizeInfo, m_cfg.devicePath)) {
         if (!m_cfg.force) {
             emit finished(false, "Размер образа превышает размер устройства!");
             return;
         }
         emit progress(15, "Предупреждение: образ больше устройства", 0, "-");
+    } else if (!simulated && !sizeInfo.exact) {
+        emit progress(15, "Размер после распаковки неизвестен точно: поместится ли образ, выяснится при записи", 0, "-");
+    }
+
+    // sysfs сообщает заявленный размер, и поддельный носитель проходит
+    // проверку выше. Реальная емкость нового носителя проверяется пробной
+    // записью, итог запоминается для следующих записей
+    if (m_cfg.checkCapacity && !simulated) {
+        qint64 realBytes = CapacityProbe::knownCapacity(m_cfg.devicePath);
+        if (realBytes < 0) {
+            emit progress(14, "Проверка реальной емкости носителя...", 0, "-");
+            const CapacityProbe::Result capacity = CapacityProbe::run(m_cfg.devicePath, &m_cancelled);
+            if (!capacity.ok) {
+                emit finished(false, m_cancelled.load(std::memory_order_acquire) ? "Операция отменена" : capacity.error);
+                return;
+            }
+            CapacityProbe::remember(m_cfg.devicePath, capacity);
+            emit progress(14, QString("Проверка емкости: %1").arg(capacity.describe()), 0, "-");
+            realBytes = static_cast<qint64>(capacity.realBytes);
+        }
+        if (sizeInfo.effectiveSize() > realBytes) {
+            const QString message = QString("Образ больше реальной емкости носителя (%1)")
+                .arg(Utils::formatSize(realBytes));
+            if (!m_cfg.force) {
+                emit finished(false, message);
+                return;
+            }
+            emit progress(15, "Предупреждение: " + message, 0, "-");
+        }
+    }
+
+    // Образ пишется подряд и не может обойти сбойные области, найденные
+    // проверкой поверхности: записанное туда не прочитается
+    const BadRangeMap::Range badRange = BadRangeMap::load(m_cfg.devicePath)
+        .firstOverlap(0, static_cast<quint64>(qMax<qint64>(0, sizeInfo.effectiveSize())));
+    if (badRange.second > 0) {
+        const QString where = QString("смещение %1, %2").arg(badRange.first)
+            .arg(Utils::formatSize(static_cast<qint64>(badRange.second)));
+        if (!m_cfg.force) {
+            emit finished(false, QString("Образ попадает на сбойную область носителя (%1)").arg(where));
+            return;
+        }
+        emit progress(15, QString("Предупреждение: образ попадает на сбойную область (%1)").arg(where), 0, "-");
     }
 
     if (m_cancelled.load(std::memory_order_acquire)) {
@@ -107,7 +236,13 @@ void ImageWriter::run() {
 
     emit progress(20, "Запись образа...", 0, "-");
     if (!writeImage()) {
-        emit finished(false, "Ошибка записи");
+        if (m_cancelled.load(std::memory_order_acquire)) {
+            emit finished(false, "Операция отменена");
+        } else if (!m_writeErrors.isEmpty()) {
+            emit finished(false, QString("Ошибка записи: не записаны области %1").arg(m_writeErrors.describe()));
+        } else {
+            emit finished(false, "Ошибка записи");
+        }
         return;
     }
 
@@ -118,169 +253,266 @@ void ImageWriter::run() {
 
     if (m_cfg.verify) {
         emit progress(95, "Проверка целостности...", 0, "-");
-        if (!verifyImage()) {
+        const bool match = verifyImage();
+        if (!m_cancelled.load(std::memory_order_acquire)) emit verified(match);
+        if (!match) {
             emit finished(false, "Проверка не пройдена");
             return;
         }
     }
 
-    emit finished(true, "Запись успешно завершена!");
+    emit finished(true, m_verifySummary.isEmpty() ? QString("Запись успешно завершена!")
+                                                  : "Запись успешно завершена!\n" + m_verifySummary);
 }
 
-QByteArray ImageWriter::computeHash(const QString& path, qint64 maxSize) {
-    int fd = open(path.toLocal8Bit().constData(), O_RDONLY);
-    if (fd < 0) {
-        qWarning() << "Ошибка открытия файла для хэширования:" << path << ":" << strerror(errno);
+QByteArray ImageWriter::computeHash(const QString& path, qint64* length) {
+    // Хэш содержимого после распаковки - именно оно записано на устройство
+    ImageSource source;
+    if (!source.open(path, sourceCachePolicy(), &m_sizeInfo)) {
+        qWarning() << "Ошибка открытия файла для хэширования:" << path << ":" << source.errorString();
         return QByteArray();
     }
 
     QCryptographicHash hash(QCryptographicHash::Sha256);
     qint64 total = 0;
-    const qint64 bufferSize = 64 * 1024; // 64KB
-
-    std::unique_ptr<char[]> buffer(new char[bufferSize]);
+    BufferPool::Buffer buffer = acquireBuffer(HashBufferSize);
+    if (!buffer) return QByteArray();
 
-    while (maxSize < 0 || total < maxSize) {
+    for (;;) {
         // Проверка отмены при вычислении хэша
-        if (m_cancelled.load(std::memory_order_acquire)) {
-            close(fd);
-            return QByteArray();
-        }
-
-        qint64 toRead = (maxSize < 0) ? bufferSize : qMin<qint64>(bufferSize, maxSize - total);
-        ssize_t nRead = read(fd, buffer.get(), toRead);
+        if (m_cancelled.load(std::memory_order_acquire)) return QByteArray();
 
-        if (nRead <= 0) {
-            break; // Конец файла или ошибка
+        const qint64 nRead = source.read(buffer.data(), buffer.size());
+        if (nRead < 0) {
+            qWarning() << "Ошибка чтения образа при хэшировании:" << source.errorString();
+            return QByteArray();
         }
-
-        QByteArray chunk(buffer.get(), nRead);
-        hash.addData(chunk);
+        if (nRead == 0) break;
+        hash.addData(QByteArray::fromRawData(buffer.data(), static_cast<qsizetype>(nRead)));
         total += nRead;
     }
 
-    close(fd);
+    if (length) *length = total;
     return hash.result();
 }
 
 bool ImageWriter::writeImage() {
-    // Используем прямой ввод/вывод (O_DIRECT) для максимальной скорости
-    int inputFd = open(m_cfg.imagePath.toLocal8Bit().constData(), O_RDONLY);
-    if (inputFd < 0) {
-        emit progress(-1, QString("Ошибка открытия файла образа: %1").arg(strerror(errno)), 0, "-");
+    // Сжатый образ распаковывается потоком прямо в буфер записи
+    ImageSource source;
+    if (!source.open(m_cfg.imagePath, sourceCachePolicy(), &m_sizeInfo)) {
+        emit progress(-1, source.errorString(), 0, "-");
         return false;
     }
 
+    // Параметры очереди устройства определяют выравнивание, размер запроса
+    // и стратегию сброса кэша
+    const DeviceTopology topo = DeviceManager::readTopology(m_cfg.devicePath);
+
+    // Кэш записи без FUA: синхронная запись каждого блока означала бы полный
+    // сброс кэша устройства, поэтому сбрасываем один раз в конце (fsync).
+    // С FUA O_DSYNC превращается в дешевые FUA-запросы.
+    // Кэш write through: данные и так долговременны после завершения запроса.
+    int syncFlag = 0;
+    QString flushMode = "сброс кэша в конце записи";
+    if (topo.writeBackCache && topo.fua) {
+        syncFlag = O_DSYNC;
+        flushMode = "FUA-запись";
+    } else if (!topo.writeBackCache) {
+        flushMode = "кэш устройства write through";
+    }
+
     // Для устройства используем прямой доступ и отключаем кеширование
-    int outputFd = open(m_cfg.devicePath.toLocal8Bit().constData(), O_WRONLY | O_SYNC | O_DIRECT);
-    if (outputFd < 0) {
+    bool directIo = true;
+    BlockTarget output;
+    QString openError;
+    if (!output.open(m_cfg.devicePath, O_WRONLY | O_DIRECT | syncFlag, &openError)) {
         // Если O_DIRECT не поддерживается, пробуем без него
-        outputFd = open(m_cfg.devicePath.toLocal8Bit().constData(), O_WRONLY | O_SYNC);
-        if (outputFd < 0) {
-            close(inputFd);
-            emit progress(-1, QString("Ошибка открытия устройства: %1").arg(strerror(errno)), 0, "-");
+        directIo = false;
+        if (!output.open(m_cfg.devicePath, O_WRONLY | O_SYNC, &openError)) {
+            emit progress(-1, openError, 0, "-");
             return false;
         }
         emit progress(22, "Используется буферизированная запись", 0, "-");
+    } else if (output.isSimulated()) {
+        emit progress(22, "Запись на модель устройства", 0, "-");
     } else {
-        emit progress(22, "Используется прямой доступ к устройству", 0, "-");
-    }
-
-    struct stat st;
-    if (fstat(inputFd, &st) != 0) {
-        close(inputFd); close(outputFd);
-        emit progress(-1, QString("Ошибка получения размера файла: %1").arg(strerror(errno)), 0, "-");
-        return false;
+        emit progress(22, QString("Используется прямой доступ к устройству (%1)").arg(flushMode), 0, "-");
     }
-    qint64 totalSize = st.st_size;
 
-    emit progress(25, QString("Используется размер буфера: %1").arg(Utils::formatSize(m_cfg.blockSize)), 0, "-");
+    // Прогресс считается по распакованным байтам; если размер после
+    // распаковки неизвестен (zstd из канала) - по прочитанной части файла
+    const ImageSource::SizeInfo& sizeInfo = source.sizeInfo();
+    const qint64 totalSize = sizeInfo.imageSize;
 
     qint64 written = 0;
 
-    // Используем размер буфера из настроек, выровненный по 512 байтам для O_DIRECT
+    // Размер запроса кратен optimal_io_size (или физическому блоку)
+    const size_t granule = topo.ioGranularity();
     size_t bufferSize = static_cast<size_t>(m_cfg.blockSize);
-    if (bufferSize > totalSize) {
-        bufferSize = totalSize;
+    if (m_cfg.blockSize <= 0) {
+        // Авто: несколько максимальных запросов очереди за один вызов write
+        size_t maxRequest = topo.maxSectorsKb > 0 ? topo.maxSectorsKb * 1024u : 512u * 1024u;
+        bufferSize = qBound<size_t>(4 * 1024 * 1024, maxRequest * 16, 64 * 1024 * 1024);
     }
-
-    // Выравниваем буфер для O_DIRECT
-    #ifdef _POSIX_C_SOURCE
-    long pageSize = sysconf(_SC_PAGESIZE);
-    if (pageSize > 0) {
-        bufferSize = ((bufferSize + pageSize - 1) / pageSize) * pageSize;
+    bufferSize = ((bufferSize + granule - 1) / granule) * granule;
+    if (totalSize > 0 && bufferSize > static_cast<size_t>(totalSize)) {
+        bufferSize = ((static_cast<size_t>(totalSize) + granule - 1) / granule) * granule;
+    }
+    if (m_bandwidth.isLimited()) {
+        // При ограничении скорости запрос не больше четверти секунды трафика:
+        // иначе ожидание после каждого write растягивается на секунды,
+        // а прогресс и отмена идут рывками
+        const size_t cap = qMax(granule, static_cast<size_t>(m_bandwidth.rate() / 4) / granule * granule);
+        bufferSize = qMin(bufferSize, cap);
     }
-    #endif
 
-    // Выделяем выровненную память для O_DIRECT
-    void* alignedBuffer = nullptr;
-    if (posix_memalign(&alignedBuffer, 512, bufferSize) != 0) {
-        // Если не удалось выделить выровненную память, используем обычную
-        alignedBuffer = malloc(bufferSize);
-        emit progress(26, "Используется обычная память (без выравнивания)", 0, "-");
+    // Буфер из общего пула (выровнен по странице - годится для O_DIRECT).
+    // При нехватке бюджета пул может дать меньше - размер остается кратным granule
+    BufferPool::Buffer buffer = acquireBuffer(static_cast<qint64>(bufferSize));
+    if (!buffer || static_cast<size_t>(buffer.size()) < granule) {
+        output.close();
+        if (!m_cancelled.load(std::memory_order_acquire)) {
+            emit progress(-1, QString("Не удалось выделить %1 выровненной памяти").arg(Utils::formatSize(bufferSize)), 0, "-");
+        }
+        return false;
     }
+    bufferSize = qMin(bufferSize, static_cast<size_t>(buffer.size()) / granule * granule);
+    char* alignedBuffer = buffer.data();
+
+    emit progress(25, QString("Используется размер буфера: %1 (выравнивание %2 Б)")
+    .arg(Utils::formatSize(bufferSize)).arg(topo.alignment()), 0, "-");
 
     QElapsedTimer timer;
     timer.start();
     int lastPercent = 25;
 
-    qint64 lastWritten = 0;
     qint64 lastTime = 0;
-    double avgSpeed = 0;
 
-    while (written < totalSize) {
+    // Скорость по окну, а не от начала: после заполнения кэша носителя
+    // прогноз сразу строится по новой скорости. Оставшееся время включает
+    // сброс того, что устройство еще не записало
+    ThroughputEstimator rate(m_cfg.rateWindowMs);
+    rate.start();
+    WriteBacklog backlog(m_cfg.devicePath);
+
+    // Время в чтении (с распаковкой) и в записи отдельно: по нему видно,
+    // кто ограничивает скорость - источник или устройство
+    QElapsedTimer ioTimer;
+    qint64 sourceNs = 0;
+    qint64 deviceNs = 0;
+
+    // Несжатый образ без преобразований переносится ядром из кэша файла
+    // в устройство (copy_file_range/splice), минуя буфер процесса. O_DIRECT
+    // принимает только целые логические блоки - хвост идет через буфер
+    bool zeroCopy = m_cfg.zeroCopy && sizeInfo.format == ImageSource::Raw && output.fd() >= 0;
+    const qint64 zeroCopyEnd = directIo ? totalSize / topo.logicalBlockSize * topo.logicalBlockSize : totalSize;
+
+    bool reachedEnd = false;
+    for (;;) {
         // Проверка отмены - атомарное чтение
         if (m_cancelled.load(std::memory_order_acquire)) {
-            free(alignedBuffer);
-            close(inputFd); close(outputFd);
+            output.close();
             return false;
         }
 
-        ssize_t toRead = qMin<ssize_t>(bufferSize, totalSize - written);
-        ssize_t nRead = read(inputFd, alignedBuffer, toRead);
-        if (nRead <= 0) {
-            emit progress(-1, QString("Ошибка чтения файла: %1").arg(strerror(errno)), 0, "-");
-            break;
-        }
+        qint64 nRead = 0;
+        if (zeroCopy && written < zeroCopyEnd) {
+            // Чтение и запись здесь - один вызов ядра, время идет на устройство
+            bool unsupported = false;
+            ioTimer.start();
+            nRead = source.transfer(output.fd(), qMin<qint64>(bufferSize, zeroCopyEnd - written), &unsupported);
+            deviceNs += ioTimer.nsecsElapsed();
+            if (unsupported) {
+                zeroCopy = false;
+                emit progress(lastPercent, "Перенос ядром недоступен, используется буфер", 0, "-");
+                continue;
+            }
+            if (nRead < 0) {
+                // Сколько перенесено до сбоя, неизвестно (часть могла остаться
+                // в канале): область с позиции written переписывается через
+                // буфер, где есть повтор и дробление запроса
+                emit progress(-1, QString("%1, повтор через буфер").arg(source.errorString()), 0, "-");
+                if (!source.rewind(written)) {
+                    emit progress(-1, source.errorString(), 0, "-");
+                    break;
+                }
+                zeroCopy = false;
+                continue;
+            }
+            if (nRead == 0) {
+                reachedEnd = true;
+                break;
+            }
+            m_bandwidth.consume(nRead, &m_cancelled);
+        } else {
+            ioTimer.start();
+            nRead = source.read(alignedBuffer, static_cast<qint64>(bufferSize));
+            sourceNs += ioTimer.nsecsElapsed();
+            if (nRead < 0) {
+                emit progress(-1, source.errorString(), 0, "-");
+                break;
+            }
+            if (nRead == 0) {
+                reachedEnd = true;
+                break;
+            }
 
-        ssize_t nWritten = write(outputFd, alignedBuffer, nRead);
-        if (nWritten != nRead) {
-            emit progress(-1, QString("Ошибка записи на устройство: %1").arg(strerror(errno)), 0, "-");
-            break;
+            // O_DIRECT требует длину кратную логическому блоку: хвост образа
+            // дополняется нулями до границы блока
+            ssize_t toWrite = static_cast<ssize_t>(nRead);
+            if (directIo && nRead % topo.logicalBlockSize != 0) {
+                toWrite = ((nRead + topo.logicalBlockSize - 1) / topo.logicalBlockSize) * topo.logicalBlockSize;
+                memset(alignedBuffer + nRead, 0, toWrite - nRead);
+            }
+
+            // Запись по абсолютному смещению: после сбоя и повтора позиция
+            // fd не имеет значения
+            ioTimer.start();
+            m_failedPieces = 0;
+            writeRange(output, alignedBuffer, static_cast<size_t>(toWrite), static_cast<quint64>(written),
+                       static_cast<size_t>(topo.logicalBlockSize), m_cfg.writeRetries);
+            deviceNs += ioTimer.nsecsElapsed();
+            if (m_writeFatalErrno != 0) {
+                emit progress(-1, QString("Ошибка записи на устройство: %1").arg(strerror(m_writeFatalErrno)), 0, "-");
+                break;
+            }
+            if (writeErrorLimitReached()) {
+                emit progress(-1, QString("Носитель не принимает запись (%1), запись прекращена")
+                              .arg(m_writeErrors.describe()), 0, "-");
+                break;
+            }
+            m_bandwidth.consume(toWrite, &m_cancelled);
         }
 
-        written += nWritten;
-        double progressRatio = static_cast<double>(written) / totalSize;
+        written += nRead;
+        double progressRatio = totalSize > 0
+            ? static_cast<double>(written) / totalSize
+            : static_cast<double>(source.consumed()) / qMax<qint64>(1, sizeInfo.fileSize);
+        progressRatio = qMin(progressRatio, 1.0);   // оценка размера могла оказаться меньше
         int percent = 25 + static_cast<int>(progressRatio * 70);  // От 25% до 95%
 
-        // Рассчитываем скорость и оставшееся время
         qint64 elapsed = timer.elapsed();
-
-        // Рассчитываем мгновенную и среднюю скорость
-        if (elapsed > 0) {
-            avgSpeed = (written / 1024.0 / 1024.0) / (elapsed / 1000.0);
-        }
-
-        // Рассчитываем оставшееся время
-        QString timeLeft = "-";
-        if (avgSpeed > 0.1) {  // Если скорость более-менее определена
-            qint64 remainingBytes = totalSize - written;
-            int remainingSec = static_cast<int>(remainingBytes / (avgSpeed * 1024 * 1024));
-
-            if (remainingSec < 60) {
-                timeLeft = QString("%1 сек").arg(remainingSec);
-            } else if (remainingSec < 3600) {
-                timeLeft = QString("%1 мин %2 сек").arg(remainingSec / 60).arg(remainingSec % 60);
-            } else {
-                int hours = remainingSec / 3600;
-                int minutes = (remainingSec % 3600) / 60;
-                int seconds = remainingSec % 60;
-                timeLeft = QString("%1 ч %2 мин %3 сек").arg(hours).arg(minutes).arg(seconds);
-            }
+        rate.update(written);
+
+        qint64 atBytes = 0;
+        double fromMBps = 0, toMBps = 0;
+        if (rate.takeRegimeChange(&atBytes, &fromMBps, &toMBps)) {
+            emit progress(percent, QString("Скорость записи %1: %2 -> %3 МБ/с после %4%5")
+                          .arg(toMBps < fromMBps ? "упала" : "выросла")
+                          .arg(fromMBps, 0, 'f', 1).arg(toMBps, 0, 'f', 1)
+                          .arg(Utils::formatSize(atBytes))
+                          .arg(toMBps < fromMBps ? " (заполнен кэш носителя)" : ""), toMBps, "-");
         }
 
         // Отправляем обновление каждые 1% или каждые 500 мс
         if (percent > lastPercent || elapsed - lastTime > 500) {
+            // Оставшееся время: запись остатка и сброс незавершенного по текущей скорости
+            QString timeLeft = "-";
+            const qint64 remainingBytes = totalSize > 0 ? qMax<qint64>(0, totalSize - written)
+                : static_cast<qint64>(written * (1.0 - progressRatio) / qMax(progressRatio, 0.001));
+            const qint64 remainingSec = rate.secondsLeft(remainingBytes, backlog.pendingBytes(written));
+            if (remainingSec >= 0) timeLeft = Utils::formatTimeLeft(remainingSec + DeviceSettleMs / 1000);
+
             QString status;
             if (elapsed < 2000) {  // Первые 2 секунды
                 status = QString("Начало записи... %1%").arg(percent);
@@ -288,45 +520,149 @@ bool ImageWriter::writeImage() {
                 status = QString("Прогресс: %1%").arg(percent);
             }
 
-            emit progress(percent, status, avgSpeed, timeLeft);
+            emit progress(percent, status, rate.rateMBps(), timeLeft);
+            emit throughput(sourceNs > 0 ? written / 1024.0 / 1024.0 / (sourceNs / 1e9) : 0,
+                            deviceNs > 0 ? written / 1024.0 / 1024.0 / (deviceNs / 1e9) : 0);
 
             lastPercent = percent;
-            lastWritten = written;
             lastTime = elapsed;
         }
     }
 
-    // Синхронизируем данные с устройством
-    fsync(outputFd);
+    // Синхронизируем данные с устройством. fsync идет в своем потоке, здесь -
+    // остаток по счетчикам устройства: сброс кэша бывает долгим, и без этого
+    // прогресс стоял бы на "0 сек"
+    // Без O_DSYNC долговечность записи зависит только от этого сброса:
+    // его ошибка - ошибка записи
+    int flushErrno = 0;
+    QThread* flusher = QThread::create([&output, &flushErrno]() {
+        if (output.fsync() != 0) flushErrno = errno;
+    });
+    flusher->start();
+    while (!flusher->wait(250)) {
+        const qint64 pending = backlog.pendingBytes(written);
+        const qint64 flushSec = rate.secondsLeft(0, pending);
+        emit progress(95, QString("Сброс кэша устройства: осталось %1").arg(Utils::formatSize(pending)),
+                      rate.rateMBps(), flushSec >= 0 ? Utils::formatTimeLeft(flushSec + DeviceSettleMs / 1000) : "-");
+    }
+    delete flusher;
 
     #ifdef __linux__
     // Очищаем буферы устройства
-    if (ioctl(outputFd, BLKFLSBUF, NULL) != 0) {
+    if (!output.flushBuffers()) {
         qWarning() << "Предупреждение: не удалось очистить буферы устройства:" << strerror(errno);
     }
     #endif
 
-    free(alignedBuffer);
-    close(inputFd);
-    close(outputFd);
+    buffer.reset();
+    output.close();
 
     // Даем время устройству завершить операции
-    QThread::msleep(1000);
+    QThread::msleep(DeviceSettleMs);
+
+    // Незаписанные блоки - в карту сбойных областей носителя: следующая
+    // запись на этот носитель о них предупредит
+    if (!m_writeErrors.isEmpty() && !SimDevice::isSpec(m_cfg.devicePath)) {
+        BadRangeMap known = BadRangeMap::load(m_cfg.devicePath);
+        known.merge(m_writeErrors);
+        QString saveError;
+        if (!known.save(m_cfg.devicePath, &saveError)) {
+            qWarning() << "Карта сбойных областей не сохранена:" << saveError;
+        }
+    }
+    if (m_recoveredRanges > 0) {
+        emit progress(-1, QString("Сбои записи устранены повтором: %1 запросов").arg(m_recoveredRanges), 0, "-");
+    }
 
-    bool success = (written == totalSize);
-    if (!success) {
+    // Точный размер, не совпавший с распакованным, означает поврежденный образ
+    const bool complete = reachedEnd && (!sizeInfo.exact || written == totalSize) && m_writeErrors.isEmpty();
+    const bool success = complete && flushErrno == 0;
+    if (success) m_writtenLength = written;
+    if (!complete) {
         emit progress(-1, QString("Запись прервана. Записано: %1 из %2")
         .arg(Utils::formatSize(written))
-        .arg(Utils::formatSize(totalSize)), 0, "-");
+        .arg(totalSize >= 0 ? Utils::formatSize(totalSize) : QString("?")), 0, "-");
+    } else if (!success) {
+        emit progress(-1, QString("Ошибка синхронизации: %1").arg(strerror(flushErrno)), 0, "-");
     } else {
-        emit progress(95, "Запись завершена, синхронизация...", avgSpeed, "0 сек");
+        emit progress(95, "Запись завершена, синхронизация...", rate.averageMBps(), "0 сек");
     }
     return success;
 }
 
+bool ImageWriter::writeRange(BlockTarget& target, const char* data, size_t length, quint64 offset, size_t unit, int retries) {
+    int error = 0;
+    size_t done = pwriteSome(target, data, length, offset, &error);
+    if (done == length) return true;
+    ++m_failedPieces;
+
+    // Кратковременный сбой (переподключение USB, занятый контроллер):
+    // остаток повторяется с паузой 100 мс, 200 мс, 400 мс...
+    if (retries > 0 && !isPermanentWriteError(error)) {
+        emit progress(-1, QString("Сбой записи (смещение %1): %2, повтор...")
+                      .arg(offset + done).arg(strerror(error)), 0, "-");
+    }
+    for (int attempt = 0; attempt < retries && done < length && !isPermanentWriteError(error); ++attempt) {
+        for (int waited = 0; waited < (100 << attempt); waited += 50) {
+            if (m_cancelled.load(std::memory_order_acquire)) return false;
+            QThread::msleep(50);
+        }
+        done += pwriteSome(target, data + done, length - done, offset + done, &error);
+    }
+    if (isPermanentWriteError(error)) {
+        m_writeFatalErrno = error;
+        return false;
+    }
+
+    // Сбой держится - остаток пишется частями по 1/8: исправные части
+    // записываются, сбойная дробится дальше, до логического блока
+    bool ok = true;
+    const size_t remaining = length - done;
+    if (remaining > 0 && remaining <= unit) {
+        m_writeErrors.add(offset + done, remaining);
+        ok = false;
+    } else if (remaining > 0) {
+        const size_t piece = qMax(unit, (remaining / 8 + unit - 1) / unit * unit);
+        for (size_t pos = done; pos < length; pos += piece) {
+            if (m_cancelled.load(std::memory_order_acquire) || m_writeFatalErrno != 0 ||
+                writeErrorLimitReached()) return false;
+            const size_t n = qMin(piece, length - pos);
+            if (!writeRange(target, data + pos, n, offset + pos, unit, 0)) ok = false;
+        }
+    }
+    if (ok && retries > 0) ++m_recoveredRanges;
+    return ok;
+}
+
+bool ImageWriter::writeErrorLimitReached() const {
+    return m_failedPieces > MaxFailedPieces || m_writeErrors.count() > MaxWriteErrorRanges ||
+           m_writeErrors.totalBytes() > MaxWriteErrorBytes;
+}
+
+BufferPool::Buffer ImageWriter::acquireBuffer(qint64 size) {
+    BufferPool::Buffer buffer = BufferPool::instance().tryAcquire(size);
+    if (buffer) return buffer;
+    // Бюджет памяти занят другими заданиями - ждем их буферы
+    emit progress(-1, "Ожидание памяти для буферов...", 0, "-");
+    return BufferPool::instance().acquire(size, &m_cancelled);
+}
+
+ImageSource::CachePolicy ImageWriter::sourceCachePolicy() const {
+    return m_cfg.keepSourceCached ? ImageSource::KeepCached : ImageSource::DropBehind;
+}
+
 bool ImageWriter::verifyImage() {
-    QFileInfo imgInfo(m_cfg.imagePath);
+    m_verifySummary.clear();
+    if (m_cfg.verifySample > 0 && m_cfg.verifySample < 1) {
+        const qint64 length = m_writtenLength >= 0 ? m_writtenLength : (m_sizeInfo.exact ? m_sizeInfo.imageSize : -1);
+        if (length > 0) return verifySampled(length);
+        // Без точного размера выборку не построить
+        emit progress(96, "Размер образа после распаковки неизвестен, выполняется полная проверка", 0, "-");
+    }
+    return verifyFull();
+}
 
+bool ImageWriter::verifyFull() {
     emit progress(96, "Подготовка к проверке...", 0, "-");
 
     // Проверка отмены перед началом верификации
@@ -338,7 +674,8 @@ bool ImageWriter::verifyImage() {
     QThread::msleep(2000);
 
     emit progress(97, "Вычисление хэша образа...", 0, "-");
-    QByteArray imgHash = computeHash(m_cfg.imagePath);
+    qint64 imageLength = 0;
+    QByteArray imgHash = computeHash(m_cfg.imagePath, &imageLength);
 
     if (imgHash.isEmpty()) {
         emit progress(-1, "Ошибка вычисления хэша файла образа", 0, "-");
@@ -353,50 +690,47 @@ bool ImageWriter::verifyImage() {
     emit progress(98, "Вычисление хэша устройства...", 0, "-");
 
     // Открываем устройство для чтения
-    int deviceFd = open(m_cfg.devicePath.toLocal8Bit().constData(), O_RDONLY);
-    if (deviceFd < 0) {
-        emit progress(-1, QString("Ошибка открытия устройства: %1").arg(strerror(errno)), 0, "-");
+    BlockTarget device;
+    QString openError;
+    if (!device.open(m_cfg.devicePath, O_RDONLY, &openError)) {
+        emit progress(-1, openError, 0, "-");
         return false;
     }
 
     // Вычисляем хэш устройства
     QCryptographicHash deviceHash(QCryptographicHash::Sha256);
     qint64 total = 0;
-    const qint64 bufferSize = 64 * 1024; // 64KB буфер
-
-    std::unique_ptr<char[]> buffer(new char[bufferSize]);
+    BufferPool::Buffer buffer = acquireBuffer(HashBufferSize);
+    if (!buffer) return false;
+    const qint64 bufferSize = buffer.size();
 
     QElapsedTimer verifyTimer;
     verifyTimer.start();
 
-    while (total < imgInfo.size()) {
+    while (total < imageLength) {
         // Проверка отмены
-        if (m_cancelled.load(std::memory_order_acquire)) {
-            close(deviceFd);
-            return false;
-        }
+        if (m_cancelled.load(std::memory_order_acquire)) return false;
 
-        qint64 toRead = qMin<qint64>(bufferSize, imgInfo.size() - total);
-        ssize_t nRead = read(deviceFd, buffer.get(), toRead);
+        qint64 toRead = qMin<qint64>(bufferSize, imageLength - total);
+        ssize_t nRead = device.pread(buffer.data(), static_cast<size_t>(toRead), static_cast<quint64>(total));
 
         if (nRead <= 0) {
             emit progress(-1, QString("Ошибка чтения устройства при проверке: %1").arg(strerror(errno)), 0, "-");
-            close(deviceFd);
             return false;
         }
 
-        QByteArray chunk(buffer.get(), nRead);
-        deviceHash.addData(chunk);
+        deviceHash.addData(QByteArray::fromRawData(buffer.data(), static_cast<qsizetype>(nRead)));
         total += nRead;
+        m_bandwidth.consume(nRead, &m_cancelled);
 
         // Обновляем прогресс проверки
-        int percent = 98 + static_cast<int>((static_cast<double>(total) / imgInfo.size()) * 2);
+        int percent = 98 + static_cast<int>((static_cast<double>(total) / imageLength) * 2);
         emit progress(percent, QString("Проверка: %1 / %2")
         .arg(Utils::formatSize(total))
-        .arg(Utils::formatSize(imgInfo.size())), 0, "-");
+        .arg(Utils::formatSize(imageLength)), 0, "-");
     }
 
-    close(deviceFd);
+    device.close();
 
     QByteArray devHash = deviceHash.result();
 
@@ -423,6 +757,139 @@ bool ImageWriter::verifyImage() {
     }
 }
 
+bool ImageWriter::verifySampled(qint64 imageLength) {
+    emit progress(96, "Подготовка к выборочной проверке...", 0, "-");
+    if (m_cancelled.load(std::memory_order_acquire)) return false;
+
+    const qint64 blockCount = (imageLength + SampleBlockSize - 1) / SampleBlockSize;
+    std::vector<bool> chosen(static_cast<size_t>(blockCount), false);
+    auto choose = [&](qint64 offset) {
+        if (offset >= 0 && offset < imageLength) chosen[static_cast<size_t>(offset / SampleBlockSize)] = true;
+    };
+
+    // Всегда: начало и конец образа (MBR, GPT и ее копия, загрузчики),
+    // начало каждого раздела и найденные сигнатуры ФС. Разделы читаются
+    // с устройства: таблица на нем сверяется первым же блоком
+    choose(0);
+    choose(imageLength - 1);
+    if (!SimDevice::isSpec(m_cfg.devicePath)) {
+        const ProbeResult probe = ProbeEngine::probe(m_cfg.devicePath);
+        for (const ProbePartition& part : probe.partitions) choose(static_cast<qint64>(part.startBytes));
+        for (const ProbeSignature& sig : probe.signatures) choose(sig.offset);
+    }
+    qint64 fixedCount = 0;
+    for (bool value : chosen) fixedCount += value ? 1 : 0;
+
+    // Случайные блоки без повторов
+    const qint64 randomTarget = qMin(blockCount - fixedCount,
+                                     static_cast<qint64>(std::ceil(blockCount * m_cfg.verifySample)));
+    QRandomGenerator* random = QRandomGenerator::global();
+    for (qint64 picked = 0; picked < randomTarget;) {
+        const size_t index = static_cast<size_t>(random->generate64() % static_cast<quint64>(blockCount));
+        if (chosen[index]) continue;
+        chosen[index] = true;
+        ++picked;
+    }
+    const qint64 sampleCount = fixedCount + randomTarget;
+
+    // Чтение устройства в обход кэша: сверяется носитель, а не память
+    const DeviceTopology topo = DeviceManager::readTopology(m_cfg.devicePath);
+    const qint64 logicalBlock = qMax<qint64>(512, topo.logicalBlockSize);
+    BlockTarget device;
+    QString openError;
+    if (!device.open(m_cfg.devicePath, O_RDONLY | O_DIRECT, &openError) &&
+        (errno != EINVAL || !device.open(m_cfg.devicePath, O_RDONLY, &openError))) {
+        emit progress(-1, openError, 0, "-");
+        return false;
+    }
+
+    // Несжатый образ читается только в выбранных местах, сжатый приходится
+    // распаковывать целиком - пропущенные блоки просто не сверяются
+    const bool raw = ImageSource::detectFormat(m_cfg.imagePath) == ImageSource::Raw;
+    ImageSource source;
+    int imageFd = -1;
+    if (raw) {
+        imageFd = ::open(m_cfg.imagePath.toLocal8Bit().constData(), O_RDONLY | O_CLOEXEC);
+    } else if (!source.open(m_cfg.imagePath, sourceCachePolicy(), &m_sizeInfo)) {
+        emit progress(-1, source.errorString(), 0, "-");
+        return false;
+    }
+    if (raw && imageFd < 0) {
+        emit progress(-1, QString("Ошибка открытия образа: %1").arg(strerror(errno)), 0, "-");
+        return false;
+    }
+
+    std::vector<BufferPool::Buffer> buffers = BufferPool::instance().acquireMany(SampleBlockSize, 2, &m_cancelled);
+    if (buffers.size() != 2 || buffers.front().size() < SampleBlockSize) {
+        if (imageFd >= 0) ::close(imageFd);
+        return false;
+    }
+    char* deviceData = buffers[0].data();
+    char* imageData = buffers[1].data();
+
+    qint64 checked = 0;
+    qint64 mismatches = 0;
+    qint64 firstMismatch = -1;
+    QString error;
+    for (qint64 index = 0; index < blockCount && error.isEmpty(); ++index) {
+        if (m_cancelled.load(std::memory_order_acquire)) break;
+        const qint64 offset = index * SampleBlockSize;
+        const qint64 length = qMin(SampleBlockSize, imageLength - offset);
+
+        if (!raw) {
+            const qint64 n = source.read(imageData, length);
+            if (n != length) {
+                error = n < 0 ? source.errorString() : QString("Образ короче ожидаемого");
+                break;
+            }
+        }
+        if (!chosen[static_cast<size_t>(index)]) continue;
+        if (raw && ::pread(imageFd, imageData, static_cast<size_t>(length), offset) != length) {
+            error = QString("Ошибка чтения образа: %1").arg(strerror(errno));
+            break;
+        }
+
+        // Хвост образа дочитывается до целого логического блока
+        const qint64 toRead = (length + logicalBlock - 1) / logicalBlock * logicalBlock;
+        if (device.pread(deviceData, static_cast<size_t>(toRead), static_cast<quint64>(offset)) < length) {
+            error = QString("Ошибка чтения устройства при проверке: %1").arg(strerror(errno));
+            break;
+        }
+        m_bandwidth.consume(toRead, &m_cancelled);
+
+        if (memcmp(deviceData, imageData, static_cast<size_t>(length)) != 0) {
+            if (firstMismatch < 0) firstMismatch = offset;
+            ++mismatches;
+        }
+        ++checked;
+        emit progress(98 + static_cast<int>(2.0 * checked / sampleCount),
+                      QString("Выборочная проверка: %1 из %2 блоков").arg(checked).arg(sampleCount), 0, "-");
+    }
+    device.close();
+    if (imageFd >= 0) ::close(imageFd);
+
+    if (m_cancelled.load(std::memory_order_acquire)) return false;
+    if (!error.isEmpty()) {
+        emit progress(-1, error, 0, "-");
+        return false;
+    }
+    if (mismatches > 0) {
+        emit progress(-1, QString("Выборочная проверка: расхождения в %1 из %2 блоков, первое по смещению %3")
+                      .arg(mismatches).arg(checked).arg(firstMismatch), 0, "-");
+        return false;
+    }
+
+    // Ни одного расхождения в n случайных блоках: с достоверностью 95%
+    // доля испорченных блоков не выше 1 - 0.05^(1/n) (около 3/n)
+    const double bound = randomTarget > 0 ? 1.0 - std::pow(0.05, 1.0 / randomTarget) : 1.0;
+    m_verifySummary = QString("Выборочная проверка: совпали %1 из %2 блоков по %3; с достоверностью 95% "
+                              "испорчено не больше %4% блоков")
+        .arg(checked).arg(blockCount).arg(Utils::formatSize(SampleBlockSize))
+        .arg(bound * 100, 0, 'f', 2);
+    emit progress(100, m_verifySummary, 0, "0 сек");
+    return true;
+}
+
 void ImageWriter::logDeviceStatus(const QString& level, const QString& message) {
     qInfo().noquote() << QString("[%1] %2: %3")
     .arg(QDateTime::currentDateTime().toString("yyyy-MM-dd HH:mm:ss"))
@@ -7,6 +7,13 @@
 #include <QVariant>
 #include <atomic>
 
+#include "imagesource.h"
+#include "bufferpool.h"
+#include "iothrottle.h"
+#include "badrangemap.h"
+
+class BlockTarget;
+
 struct ImageInfo {
     QString path;
     qint64 size = 0;
@@ -27,27 +34,79 @@ public:
         QString imagePath;
         QString devicePath;
         bool verify = false;
+        bool verifyOnly = false;              // только сверить устройство с образом
+        double verifySample = 0;              // доля случайных блоков для выборочной проверки; 0 - полная
         bool force = false;
-        qint64 blockSize = 64 * 1024 * 1024;  // 64MB по умолчанию
+        bool checkCapacity = false;           // неизвестный носитель: проверить реальную емкость пробной записью
+        qint64 blockSize = 0;                 // 0 - по топологии устройства
         qint64 clusterSize = 32 * 1024;       // 32KB по умолчанию
+        bool keepSourceCached = false;        // образ нужен следующим заданиям - не вытеснять из кэша
+        bool zeroCopy = true;                 // несжатый образ: перенос ядром (splice), если возможно
+        qint64 rateLimit = 0;                 // байт/с на устройство (запись и проверка), 0 - без ограничения
+        IoPriority ioPriority;                // класс ioprio потока задания
+        int writeRetries = 5;                 // повторов сбойной записи (пауза с 100 мс, удваивается) до дробления запроса
+        ImageSource::SizeInfo sizeInfo;       // размер образа, если уже известен (каталог); fileSize 0 - определить в задании
+        qint64 rateWindowMs = 5000;           // окно скорости для прогноза времени (ThroughputEstimator)
     };
 
     explicit ImageWriter(const Config& cfg, QObject* parent = nullptr);
     void cancel();
 
+    // Итоги записи; читать после завершения потока
+    int recoveredRanges() const { return m_recoveredRanges; }
+    const BadRangeMap& writeErrors() const { return m_writeErrors; }
+
 signals:
     void progress(int percent, const QString& status, double speedMBps, const QString& timeLeft);
     void finished(bool success, const QString& message);
+    // Скорость чтения образа (с распаковкой) и записи на устройство, МБ/с
+    // распакованных данных - по времени, проведенному в каждой стороне
+    void throughput(double sourceMBps, double deviceMBps);
+    // Проверка записанного выполнена (не отменена): итог сверки с образом.
+    // Не приходит, если до проверки не дошло (ошибка записи, отмена)
+    void verified(bool match);
 
 protected:
     void run() override;
 
 private:
     Config m_cfg;
+    ImageSource::SizeInfo m_sizeInfo;     // определяется один раз за задание
     std::atomic<bool> m_cancelled{false};
+    TokenBucket m_bandwidth;
 
-    QByteArray computeHash(const QString& path, qint64 maxSize = -1);
+    // SHA-256 образа после распаковки; length - его размер
+    QByteArray computeHash(const QString& path, qint64* length = nullptr);
+    static constexpr qint64 HashBufferSize = 1024 * 1024;
+    static constexpr qint64 SampleBlockSize = 1024 * 1024;
+    qint64 m_writtenLength = -1;          // размер образа после распаковки, если запись дошла до конца
+    QString m_verifySummary;
+
+    BufferPool::Buffer acquireBuffer(qint64 size);
+    ImageSource::CachePolicy sourceCachePolicy() const;
     bool writeImage();
+
+    // Запись [offset, offset + length) с восстановлением: короткая запись
+    // дописывается с места остановки, сбой повторяется retries раз с
+    // нарастающей паузой, затем область пишется частями все меньше, до unit.
+    // Неустранимые блоки попадают в m_writeErrors, запись идет дальше;
+    // false без m_writeFatalErrno - часть области не записана
+    bool writeRange(BlockTarget& target, const char* data, size_t length, quint64 offset, size_t unit, int retries);
+    // Пределы, после которых носитель считается неисправным и запись
+    // прекращается: сплошная сбойная область сливается в одну, поэтому
+    // число областей само по себе дробление не ограничивает
+    static constexpr int MaxWriteErrorRanges = 64;
+    static constexpr int MaxFailedPieces = 64;        // неудачных частей одного запроса
+    static constexpr quint64 MaxWriteErrorBytes = 1024 * 1024;
+    bool writeErrorLimitReached() const;
+    BadRangeMap m_writeErrors;
+    int m_failedPieces = 0;               // неудачных частей текущего запроса
+    int m_recoveredRanges = 0;            // запросы, записанные после повтора или по частям
+    int m_writeFatalErrno = 0;            // повтор бесполезен (устройство отключено, конец устройства)
     bool verifyImage();
+    bool verifyFull();
+    // Выборка блоков по 1 MB: verifySample случайных плюс начало, конец
+    // и области таблиц разделов и ФС. Итог с оценкой достоверности - в m_verifySummary
+    bool verifySampled(qint64 imageLength);
     void logDeviceStatus(const QString& level, const QString& message);
 };
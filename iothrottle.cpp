@@ -0,0 +1,77 @@
+// iothrottle.cpp
+#include "iothrottle.h"
+#include <QThread>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+namespace {
+
+// linux/ioprio.h есть не во всех заголовках ядра
+const int IoprioWhoProcess = 1;     // для who = 0 - вызывающий поток
+const int IoprioClassShift = 13;
+
+const qint64 MinBurst = 1024 * 1024;
+const qint64 MaxSleepMs = 100;      // шаг ожидания: отмена срабатывает быстро
+
+} // namespace
+
+QString IoPriority::describe() const {
+    switch (ioClass) {
+        case Default: return "обычный";
+        case RealTime: return QString("реального времени, уровень %1").arg(level);
+        case BestEffort: return QString("best-effort, уровень %1").arg(level);
+        case Idle: return "фоновый (idle)";
+    }
+    return QString();
+}
+
+bool IoPriority::apply(QString* error) const {
+    int ioprioClass = 0;
+    switch (ioClass) {
+        case Default: return true;
+        case RealTime: ioprioClass = 1; break;
+        case BestEffort: ioprioClass = 2; break;
+        case Idle: ioprioClass = 3; break;
+    }
+    const int data = ioClass == Idle ? 0 : qBound(0, level, 7);
+    const int value = (ioprioClass << IoprioClassShift) | data;
+    if (::syscall(SYS_ioprio_set, IoprioWhoProcess, 0, value) != 0) {
+        if (error) *error = QString("Не удалось установить приоритет ввода-вывода: %1").arg(strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+TokenBucket::TokenBucket(qint64 bytesPerSecond, qint64 burst)
+: m_rate(qMax<qint64>(0, bytesPerSecond)) {
+    // По умолчанию четверть секунды трафика: короткие паузы не копят
+    // большой запас, который потом выплеснется пиком
+    m_burst = burst > 0 ? burst : qMax(MinBurst, m_rate / 4);
+    m_tokens = static_cast<double>(m_burst);
+    m_clock.start();
+}
+
+bool TokenBucket::consume(qint64 bytes, const std::atomic<bool>* cancelled) {
+    if (m_rate <= 0 || bytes <= 0) return true;
+
+    qint64 waitMs = 0;
+    {
+        QMutexLocker locker(&m_mutex);
+        const qint64 elapsedNs = m_clock.nsecsElapsed();
+        m_clock.restart();
+        m_tokens = qMin(static_cast<double>(m_burst), m_tokens + elapsedNs * 1e-9 * m_rate);
+        m_tokens -= static_cast<double>(bytes);
+        if (m_tokens < 0) waitMs = static_cast<qint64>(-m_tokens * 1000.0 / m_rate);
+    }
+
+    // Долг гасится временем, за которое ведро снова наполнится до нуля
+    QElapsedTimer waited;
+    waited.start();
+    while (waited.elapsed() < waitMs) {
+        if (cancelled && cancelled->load(std::memory_order_acquire)) return false;
+        QThread::msleep(static_cast<unsigned long>(qMin(MaxSleepMs, waitMs - waited.elapsed())));
+    }
+    return true;
+}
@@ -0,0 +1,52 @@
+// iothrottle.h
+#pragma once
+
+#include <QString>
+#include <QMutex>
+#include <QElapsedTimer>
+#include <atomic>
+
+// Приоритет ввода-вывода потока (ioprio_set). Учитывается планировщиками
+// BFQ и mq-deadline; с планировщиком none не действует. Относится к запросам,
+// которые поток отправляет сам (O_DIRECT, splice), а не к фоновому сбросу
+// страничного кэша.
+struct IoPriority {
+    enum Class {
+        Default,        // унаследованный (best-effort по nice процесса)
+        RealTime,       // раньше всех остальных, нужен CAP_SYS_ADMIN
+        BestEffort,     // обычный, с уровнем 0-7
+        Idle            // только когда диск больше никому не нужен
+    };
+
+    Class ioClass = Default;
+    int level = 4;      // 0 - высший, 7 - низший (RealTime и BestEffort)
+
+    bool isDefault() const { return ioClass == Default; }
+    QString describe() const;
+
+    // Для вызывающего потока
+    bool apply(QString* error = nullptr) const;
+};
+
+// Ограничение скорости ведром токенов: токены копятся со скоростью rate
+// до burst байт, каждая операция списывает свой размер. Крупный запрос
+// уводит ведро в минус, и следующий ждет, пока долг не погасится, -
+// средняя скорость держится на rate при любом размере запросов.
+// Потокобезопасно: одно ведро могут делить потоки задания.
+class TokenBucket {
+public:
+    explicit TokenBucket(qint64 bytesPerSecond = 0, qint64 burst = 0);
+
+    bool isLimited() const { return m_rate > 0; }
+    qint64 rate() const { return m_rate; }
+
+    // Списать bytes, при необходимости подождав. false - отмена во время ожидания
+    bool consume(qint64 bytes, const std::atomic<bool>* cancelled = nullptr);
+
+private:
+    QMutex m_mutex;
+    qint64 m_rate = 0;
+    qint64 m_burst = 0;
+    double m_tokens = 0;
+    QElapsedTimer m_clock;
+};
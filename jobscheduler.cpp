@@ -0,0 +1,412 @@
+// jobscheduler.cpp
+#include "jobscheduler.h"
+#include <QFileInfo>
+#include <QHash>
+#include <QDebug>
+
+bool ScheduledJob::usesBandwidth() const {
+    switch (type) {
+    case Write:
+    case Verify:
+        return true;
+    case Format:
+        // Быстрое форматирование пишет только метаданные
+        return !format.quickFormat;
+    case Wipe:
+        return wipe.mode != WipeJob::Signatures && wipe.mode != WipeJob::Discard &&
+               wipe.mode != WipeJob::SecureDiscard;
+    case Scan:
+        // Проверка емкости - несколько десятков блоков
+        return scan.mode != SurfaceScanJob::Capacity;
+    }
+    return true;
+}
+
+QString ScheduledJob::typeName() const {
+    switch (type) {
+    case Write:  return "Запись";
+    case Verify: return "Проверка";
+    case Format: return QString("Форматирование (%1)").arg(format.filesystem);
+    case Wipe:   return QString("Очистка (%1)").arg(WipeJob::modeName(wipe.mode));
+    case Scan:
+        if (scan.mode == SurfaceScanJob::Capacity) return "Проверка емкости";
+        return QString("Проверка поверхности (%1)").arg(SurfaceScanJob::modeName(scan.mode));
+    }
+    return QString();
+}
+
+QString ScheduledJob::stateName() const {
+    switch (state) {
+    case Queued:    return "В очереди";
+    case Running:   return "Выполняется";
+    case Succeeded: return "Готово";
+    case Failed:    return "Ошибка";
+    case Cancelled: return "Отменено";
+    }
+    return QString();
+}
+
+JobScheduler::JobScheduler(QObject* parent)
+    : QObject(parent) {}
+
+JobScheduler::~JobScheduler() {
+    for (ScheduledJob& job : m_jobs) {
+        if (job.state != ScheduledJob::Running) continue;
+        disconnect(job.worker, nullptr, this, nullptr);
+        if (auto writer = qobject_cast<ImageWriter*>(job.worker)) {
+            writer->cancel();
+        } else if (auto wipe = qobject_cast<WipeJob*>(job.worker)) {
+            wipe->cancel();
+        } else if (auto scan = qobject_cast<SurfaceScanJob*>(job.worker)) {
+            scan->cancel();
+        } else if (auto format = qobject_cast<FormatJob*>(job.worker)) {
+            format->cancel();
+        }
+        releaseWorker(job);
+    }
+}
+
+int JobScheduler::enqueueWrite(const ImageWriter::Config& cfg) {
+    ScheduledJob job;
+    job.type = ScheduledJob::Write;
+    job.devicePath = cfg.devicePath;
+    job.write = cfg;
+    job.write.verifyOnly = false;
+    return enqueue(job);
+}
+
+int JobScheduler::enqueueVerify(const ImageWriter::Config& cfg) {
+    ScheduledJob job;
+    job.type = ScheduledJob::Verify;
+    job.devicePath = cfg.devicePath;
+    job.write = cfg;
+    job.write.verifyOnly = true;
+    return enqueue(job);
+}
+
+int JobScheduler::enqueueFormat(const FormatJob::Config& cfg) {
+    ScheduledJob job;
+    job.type = ScheduledJob::Format;
+    job.devicePath = cfg.devicePath;
+    job.format = cfg;
+    return enqueue(job);
+}
+
+int JobScheduler::enqueueWipe(const WipeJob::Config& cfg) {
+    ScheduledJob job;
+    job.type = ScheduledJob::Wipe;
+    job.devicePath = cfg.devicePath;
+    job.wipe = cfg;
+    return enqueue(job);
+}
+
+int JobScheduler::enqueueScan(const SurfaceScanJob::Config& cfg) {
+    ScheduledJob job;
+    job.type = ScheduledJob::Scan;
+    job.devicePath = cfg.devicePath;
+    job.scan = cfg;
+    return enqueue(job);
+}
+
+int JobScheduler::enqueue(ScheduledJob job) {
+    job.id = m_nextId++;
+    job.bus = DeviceManager::busLocation(job.devicePath);
+    if (job.bus.disk.isEmpty()) job.bus.disk = QFileInfo(job.devicePath).fileName();
+    job.status = "Ожидание";
+    m_jobs.append(job);
+
+    emit jobChanged(job.id);
+    schedule();
+    return job.id;
+}
+
+void JobScheduler::cancel(int id) {
+    const int index = indexOf(id);
+    if (index < 0) return;
+    ScheduledJob& job = m_jobs[index];
+
+    if (job.state == ScheduledJob::Queued) {
+        job.state = ScheduledJob::Cancelled;
+        job.message = "Отменено до запуска";
+        emit jobChanged(id);
+        emit jobFinished(id, false, job.message);
+        schedule();
+        return;
+    }
+    if (job.state != ScheduledJob::Running) return;
+
+    // Итог придет сигналом finished работника
+    job.status = "Отмена...";
+    m_cancelRequested.insert(id);
+    if (auto writer = qobject_cast<ImageWriter*>(job.worker)) {
+        writer->cancel();
+    } else if (auto wipe = qobject_cast<WipeJob*>(job.worker)) {
+        wipe->cancel();
+    } else if (auto scan = qobject_cast<SurfaceScanJob*>(job.worker)) {
+        scan->cancel();
+    } else if (auto format = qobject_cast<FormatJob*>(job.worker)) {
+        format->cancel();
+    }
+    emit jobChanged(id);
+}
+
+void JobScheduler::cancelAll() {
+    // Сначала очередь, чтобы освободившиеся слоты не запустили ожидающие задания
+    for (int i = m_jobs.size() - 1; i >= 0; --i) {
+        if (m_jobs[i].state == ScheduledJob::Queued) cancel(m_jobs[i].id);
+    }
+    for (int i = 0; i < m_jobs.size(); ++i) {
+        if (m_jobs[i].state == ScheduledJob::Running) cancel(m_jobs[i].id);
+    }
+}
+
+void JobScheduler::clearFinished() {
+    for (int i = m_jobs.size() - 1; i >= 0; --i) {
+        if (m_jobs[i].isFinished()) {
+            const int id = m_jobs[i].id;
+            m_jobs.removeAt(i);
+            emit jobChanged(id);
+        }
+    }
+}
+
+ScheduledJob JobScheduler::job(int id) const {
+    const int index = indexOf(id);
+    return index >= 0 ? m_jobs[index] : ScheduledJob();
+}
+
+bool JobScheduler::hasPendingJobs() const {
+    for (const ScheduledJob& job : m_jobs) {
+        if (!job.isFinished()) return true;
+    }
+    return false;
+}
+
+bool JobScheduler::isDeviceBusy(const QString& devicePath) const {
+    const QString disk = diskKey(devicePath);
+    for (const ScheduledJob& job : m_jobs) {
+        if (!job.isFinished() && job.bus.disk == disk) return true;
+    }
+    return false;
+}
+
+void JobScheduler::setReserved(const QString& devicePath, bool reserved) {
+    const QString disk = diskKey(devicePath);
+    if (reserved) {
+        m_reserved.insert(disk);
+    } else {
+        m_reserved.remove(disk);
+        schedule();
+    }
+}
+
+void JobScheduler::setLimits(const Limits& limits) {
+    m_limits = limits;
+    schedule();
+}
+
+int JobScheduler::rootHubLimit(const BusLocation& bus) const {
+    if (m_limits.perRootHub > 0) return m_limits.perRootHub;
+    if (!bus.isUsb()) return m_limits.perController;
+
+    // Реальная полоса: USB 2.0 ~35 MB/s на хаб, 5 Гбит/с ~400 MB/s
+    if (bus.rootHubSpeed <= 480) return 2;
+    if (bus.rootHubSpeed <= 5000) return 3;
+    return 4;
+}
+
+void JobScheduler::schedule() {
+    QSet<QString> busyDisks = m_reserved;
+    QHash<QString, int> hubLoad;
+    QHash<QString, int> controllerLoad;
+    int totalLoad = 0;
+
+    for (const ScheduledJob& job : m_jobs) {
+        if (job.state != ScheduledJob::Running) continue;
+        busyDisks.insert(job.bus.disk);
+        if (!job.usesBandwidth()) continue;
+        ++totalLoad;
+        if (job.bus.isUsb()) ++hubLoad[job.bus.rootHub];
+        if (!job.bus.controller.isEmpty()) ++controllerLoad[job.bus.controller];
+    }
+
+    for (ScheduledJob& job : m_jobs) {
+        if (job.state != ScheduledJob::Queued) continue;
+
+        // Следующие задания этого диска ждут текущее, даже если оно не запустилось
+        const bool diskBusy = busyDisks.contains(job.bus.disk);
+        busyDisks.insert(job.bus.disk);
+        if (diskBusy) continue;
+
+        if (job.usesBandwidth()) {
+            if (m_limits.total > 0 && totalLoad >= m_limits.total) continue;
+            if (job.bus.isUsb() && hubLoad.value(job.bus.rootHub) >= rootHubLimit(job.bus)) continue;
+            if (!job.bus.controller.isEmpty() && m_limits.perController > 0 &&
+                controllerLoad.value(job.bus.controller) >= m_limits.perController) continue;
+
+            ++totalLoad;
+            if (job.bus.isUsb()) ++hubLoad[job.bus.rootHub];
+            if (!job.bus.controller.isEmpty()) ++controllerLoad[job.bus.controller];
+        }
+        startJob(job);
+    }
+}
+
+void JobScheduler::startJob(ScheduledJob& job) {
+    const int id = job.id;
+    job.state = ScheduledJob::Running;
+    job.status = "Запуск...";
+
+    auto onProgress = [this, id](int percent, const QString& status, double speedMBps, const QString& timeLeft) {
+        this->onProgress(id, percent, status, speedMBps, timeLeft);
+    };
+    auto onFinished = [this, id](bool success, const QString& message) {
+        this->onFinished(id, success, message);
+    };
+
+    switch (job.type) {
+    case ScheduledJob::Write:
+    case ScheduledJob::Verify: {
+        // Тот же образ ждут другие задания - пусть он остается в кэше
+        job.write.keepSourceCached = imageNeededLater(job);
+        // Первое устройство серии и далее каждое n-е проверяются полностью:
+        // систематическая ошибка видна сразу, а не через n устройств
+        const bool verifies = job.type == ScheduledJob::Verify || job.write.verify;
+        if (verifies && job.write.verifySample > 0 && m_fullVerifyEvery > 0 &&
+            m_sampledVerifies++ % m_fullVerifyEvery == 0) {
+            job.write.verifySample = 0;
+        }
+        auto writer = new ImageWriter(job.write, this);
+        connect(writer, &ImageWriter::progress, this, onProgress);
+        connect(writer, &ImageWriter::finished, this, onFinished);
+        connect(writer, &ImageWriter::throughput, this, [this, id](double sourceMBps, double deviceMBps) {
+            const int index = indexOf(id);
+            if (index < 0) return;
+            m_jobs[index].sourceMBps = sourceMBps;
+            m_jobs[index].deviceMBps = deviceMBps;
+        });
+        connect(writer, &ImageWriter::verified, this, [this, id](bool match) {
+            const int index = indexOf(id);
+            if (index < 0) return;
+            m_jobs[index].verifyRan = true;
+            m_jobs[index].verifyPassed = match;
+        });
+        job.worker = writer;
+        writer->start();
+        break;
+    }
+    case ScheduledJob::Format: {
+        auto format = new FormatJob(job.format, this);
+        connect(format, &FormatJob::progress, this, onProgress);
+        connect(format, &FormatJob::finished, this, onFinished);
+        job.worker = format;
+        format->start();
+        break;
+    }
+    case ScheduledJob::Wipe: {
+        auto wipe = new WipeJob(job.wipe, this);
+        connect(wipe, &WipeJob::progress, this, onProgress);
+        connect(wipe, &WipeJob::finished, this, onFinished);
+        job.worker = wipe;
+        wipe->start();
+        break;
+    }
+    case ScheduledJob::Scan: {
+        auto scan = new SurfaceScanJob(job.scan, this);
+        connect(scan, &SurfaceScanJob::progress, this, onProgress);
+        connect(scan, &SurfaceScanJob::finished, this, onFinished);
+        job.worker = scan;
+        scan->start();
+        break;
+    }
+    }
+
+    qDebug() << "Задание" << id << job.typeName() << job.devicePath
+             << "контроллер" << job.bus.controller << "хаб" << job.bus.rootHub;
+    emit jobChanged(id);
+}
+
+bool JobScheduler::imageNeededLater(const ScheduledJob& job) const {
+    for (const ScheduledJob& other : m_jobs) {
+        if (other.id == job.id || other.isFinished()) continue;
+        if ((other.type == ScheduledJob::Write || other.type == ScheduledJob::Verify) &&
+            other.write.imagePath == job.write.imagePath) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void JobScheduler::onProgress(int id, int percent, const QString& status, double speedMBps, const QString& timeLeft) {
+    const int index = indexOf(id);
+    if (index < 0) return;
+    ScheduledJob& job = m_jobs[index];
+    if (percent >= 0) job.percent = percent;
+    job.status = status;
+    job.speedMBps = speedMBps;
+    job.timeLeft = timeLeft;
+    emit jobChanged(id);
+}
+
+void JobScheduler::onFinished(int id, bool success, const QString& message) {
+    const int index = indexOf(id);
+    if (index < 0) return;
+    ScheduledJob& job = m_jobs[index];
+    if (job.state != ScheduledJob::Running) return;
+
+    const bool cancelled = m_cancelRequested.remove(id);
+    job.state = success ? ScheduledJob::Succeeded
+                        : (cancelled ? ScheduledJob::Cancelled : ScheduledJob::Failed);
+    job.message = message;
+    job.status = message;
+    if (success) job.percent = 100;
+    job.speedMBps = 0;
+    job.sourceMBps = 0;
+    job.deviceMBps = 0;
+    job.timeLeft.clear();
+    releaseWorker(job);
+
+    // Запись, проверка и т.п. после неудачи на том же носителе бессмысленны
+    const QString disk = job.bus.disk;
+    const QString skipMessage = "Пропущено: предыдущее задание на устройстве не выполнено";
+    QList<int> skipped;
+    if (!success) {
+        for (ScheduledJob& next : m_jobs) {
+            if (next.state == ScheduledJob::Queued && next.bus.disk == disk) {
+                next.state = ScheduledJob::Cancelled;
+                next.message = skipMessage;
+                skipped << next.id;
+            }
+        }
+    }
+
+    emit jobChanged(id);
+    emit jobFinished(id, success, message);
+    for (int skippedId : skipped) {
+        emit jobChanged(skippedId);
+        emit jobFinished(skippedId, false, skipMessage);
+    }
+    schedule();
+}
+
+void JobScheduler::releaseWorker(ScheduledJob& job) {
+    if (!job.worker) return;
+    // finished() потоков испускается из run(): поток нужно дождать
+    if (auto thread = qobject_cast<QThread*>(job.worker)) {
+        thread->wait();
+    }
+    job.worker->deleteLater();
+    job.worker = nullptr;
+}
+
+int JobScheduler::indexOf(int id) const {
+    for (int i = 0; i < m_jobs.size(); ++i) {
+        if (m_jobs[i].id == id) return i;
+    }
+    return -1;
+}
+
+QString JobScheduler::diskKey(const QString& devicePath) {
+    const QString disk = DeviceManager::busLocation(devicePath).disk;
+    return disk.isEmpty() ? QFileInfo(devicePath).fileName() : disk;
+}
@@ -0,0 +1,121 @@
+// jobscheduler.h
+#pragma once
+
+#include <QObject>
+#include <QString>
+#include <QList>
+#include <QSet>
+
+#include "devicemanager.h"
+#include "imagewriter.h"
+#include "formatjob.h"
+#include "wipejob.h"
+#include "surfacescan.h"
+
+// Задание в очереди планировщика
+struct ScheduledJob {
+    enum Type { Write, Verify, Format, Wipe, Scan };
+    enum State { Queued, Running, Succeeded, Failed, Cancelled };
+
+    int id = 0;
+    Type type = Write;
+    QString devicePath;
+    BusLocation bus;
+
+    ImageWriter::Config write;      // Write, Verify
+    FormatJob::Config format;       // Format
+    WipeJob::Config wipe;           // Wipe
+    SurfaceScanJob::Config scan;    // Scan
+
+    State state = Queued;
+    int percent = 0;
+    QString status;
+    double speedMBps = 0;
+    double sourceMBps = 0;          // Write: чтение образа и запись на устройство
+    double deviceMBps = 0;          // по отдельности (ImageWriter::throughput)
+    QString timeLeft;
+    QString message;                // итог выполнения
+    bool verifyRan = false;         // Write, Verify: сверка с образом выполнена
+    bool verifyPassed = false;      // и ее итог (ImageWriter::verified)
+
+    QObject* worker = nullptr;
+
+    bool isFinished() const { return state == Succeeded || state == Failed || state == Cancelled; }
+
+    // Нагружает ли задание шину потоком данных (ограничивается лимитами)
+    bool usesBandwidth() const;
+
+    QString typeName() const;
+    QString stateName() const;
+};
+
+// Очередь заданий для нескольких устройств. Задания одного диска выполняются
+// по порядку постановки, разные диски - параллельно в пределах лимитов на
+// корневой хаб USB, хост-контроллер и общего числа потоков данных, чтобы
+// носители на общей шине делили полосу, а не отнимали ее друг у друга.
+class JobScheduler : public QObject {
+    Q_OBJECT
+
+public:
+    struct Limits {
+        int perRootHub = 0;        // 0 - по скорости хаба (USB 2.0: 2, 5 Гбит/с: 3, быстрее: 4)
+        int perController = 4;    // на один PCI хост-контроллер
+        int total = 8;            // всего заданий с потоком данных
+    };
+
+    explicit JobScheduler(QObject* parent = nullptr);
+    ~JobScheduler();
+
+    int enqueueWrite(const ImageWriter::Config& cfg);
+    int enqueueVerify(const ImageWriter::Config& cfg);
+    int enqueueFormat(const FormatJob::Config& cfg);
+    int enqueueWipe(const WipeJob::Config& cfg);
+    int enqueueScan(const SurfaceScanJob::Config& cfg);
+
+    void cancel(int id);
+    void cancelAll();
+    void clearFinished();
+
+    QList<ScheduledJob> jobs() const { return m_jobs; }
+    ScheduledJob job(int id) const;
+    bool hasPendingJobs() const;
+
+    // Диск занят заданием очереди (выполняется или ждет)
+    bool isDeviceBusy(const QString& devicePath) const;
+
+    // Диск занят операцией вне очереди: задания для него ждут
+    void setReserved(const QString& devicePath, bool reserved);
+
+    // Выборочная проверка записи: каждое n-е устройство сверяется полностью
+    // (0 - выборка у всех)
+    void setFullVerifyEvery(int n) { m_fullVerifyEvery = qMax(0, n); }
+
+    void setLimits(const Limits& limits);
+    Limits limits() const { return m_limits; }
+
+    // Допустимое число одновременных заданий на корневом хабе
+    int rootHubLimit(const BusLocation& bus) const;
+
+signals:
+    void jobChanged(int id);
+    void jobFinished(int id, bool success, const QString& message);
+
+private:
+    QList<ScheduledJob> m_jobs;
+    QSet<QString> m_reserved;      // имена дисков
+    QSet<int> m_cancelRequested;
+    Limits m_limits;
+    int m_nextId = 1;
+    int m_fullVerifyEvery = 0;
+    int m_sampledVerifies = 0;     // начатых заданий с выборочной проверкой
+
+    int enqueue(ScheduledJob job);
+    void schedule();
+    void startJob(ScheduledJob& job);
+    void onProgress(int id, int percent, const QString& status, double speedMBps, const QString& timeLeft);
+    void onFinished(int id, bool success, const QString& message);
+    void releaseWorker(ScheduledJob& job);
+    bool imageNeededLater(const ScheduledJob& job) const;
+    int indexOf(int id) const;
+    static QString diskKey(const QString& devicePath);
+};
@@ -4,6 +4,7 @@
 #include <QDebug>
 #include <QCommandLineParser>
 #include "mainwindow.h"
+#include "bufferpool.h"
 
 int main(int argc, char *argv[]) {
     // Создаем QApplication ПЕРВЫМ делом
@@ -22,8 +23,25 @@ int main(int argc, char *argv[]) {
                                          "Запуск без проверки прав root (только для отладки)");
     parser.addOption(noRootCheckOption);
 
+    // Бюджет памяти буферов ввода-вывода на все задания сразу
+    QCommandLineOption bufferMemoryOption("buffer-memory",
+                                          "Память под буферы всех заданий, МБ (по умолчанию четверть ОЗУ, до 1024)",
+                                          "МБ");
+    parser.addOption(bufferMemoryOption);
+
     parser.process(app);
 
+    if (parser.isSet(bufferMemoryOption)) {
+        bool ok = false;
+        const qint64 megabytes = parser.value(bufferMemoryOption).toLongLong(&ok);
+        if (ok && megabytes > 0) {
+            BufferPool::instance().setBudget(megabytes * 1024 * 1024);
+        } else {
+            qWarning() << "Неверное значение --buffer-memory:" << parser.value(bufferMemoryOption);
+        }
+    }
+    qDebug() << "Бюджет памяти буферов:" << BufferPool::instance().budget() / (1024 * 1024) << "МБ";
+
     // Проверка root (если не указана опция no-root-check)
     if (!parser.isSet(noRootCheckOption) && geteuid() != 0) {
         QMessageBox::critical(nullptr,
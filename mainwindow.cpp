@@ -2,6 +2,7 @@
 #include "mainwindow.h"
 #include "devicemanager.h"
 #include "imagewriter.h"
+#include "imagecache.h"
 #include "formatmanager.h"
 #include "utils.h"
 #include <QApplication>
@@ -20,6 +21,10 @@
 #include <QDialog>
 #include <QFormLayout>
 #include <QDialogButtonBox>
+#include <QInputDialog>
+#include <QHeaderView>
+#include <QDir>
+#include <QRegularExpression>
 
 MainWindow::MainWindow(QWidget *parent)
     : QMainWindow(parent),
@@ -29,24 +34,47 @@ MainWindow::MainWindow(QWidget *parent)
       m_clusterSizeCombo(new QComboBox),
       m_verifyCheckbox(new QCheckBox("Проверить запись")),
       m_forceCheckbox(new QCheckBox("Принудительная запись")),
+      m_capacityCheckbox(new QCheckBox("Проверять емкость новых носителей")),
+      m_verifyModeCombo(new QComboBox),
+      m_imageCacheCombo(new QComboBox),
       m_progressBar(new QProgressBar),
       m_logView(new QTextEdit),
       m_writeBtn(new QPushButton("Записать образ")),
       m_cancelBtn(new QPushButton("Отмена")),
       m_refreshBtn(new QPushButton("Обновить")),
       m_browseBtn(new QPushButton("Обзор...")),
+      m_catalogBtn(new QPushButton("Каталог...")),
       m_formatBtn(new QPushButton("Форматировать")),
+      m_wipeBtn(new QPushButton("Очистить")),
+      m_backupBtn(new QPushButton("Создать образ...")),
+      m_cloneBtn(new QPushButton("Клонировать...")),
+      m_jobTable(new QTableWidget),
+      m_enqueueBtn(new QPushButton("В очередь...")),
+      m_cancelJobBtn(new QPushButton("Отменить задание")),
+      m_clearJobsBtn(new QPushButton("Убрать завершенные")),
       m_writeTimer(new QElapsedTimer),
       m_speedLabel(new QLabel),
       m_timeLeftLabel(new QLabel),
       m_formatManager(&FormatManager::instance())
 {
+    m_prober = new DeviceProber(this);
+    connect(m_prober, &DeviceProber::probed, this, &MainWindow::onDeviceProbed);
+
+    m_scheduler = new JobScheduler(this);
+    connect(m_scheduler, &JobScheduler::jobChanged, this, &MainWindow::onJobChanged);
+    connect(m_scheduler, &JobScheduler::jobFinished, this, &MainWindow::onJobFinished);
+
+    // Индекс образов загружается сразу, изменения в папках догружаются в фоне
+    m_catalog = new ImageCatalog(QString(), this);
+    connect(m_catalog, &ImageCatalog::changed, this, &MainWindow::populateImages);
+
     setWindowTitle("C-mile v0.9.5");
-    resize(450, 700);  // Увеличили размер для новых элементов
+    resize(560, 860);  // Увеличили размер для очереди заданий
     
     setupUi();
     setupConnections();
     
+    populateImages();
     refreshDevices();
     
     // Автообновление устройств каждые 5 сек
@@ -76,6 +104,7 @@ void MainWindow::setupUi() {
     imgTop->addWidget(new QLabel("Образ:"));
     imgTop->addWidget(m_imageCombo, 1);
     imgTop->addWidget(m_browseBtn);
+    imgTop->addWidget(m_catalogBtn);
     
     m_imageInfoLabel = new QLabel("Выберите файл образа (IMG, ISO, GZ, XZ, BZ2, ZIP, etc.)");
     m_imageInfoLabel->setWordWrap(true);
@@ -97,6 +126,9 @@ void MainWindow::setupUi() {
     // Кнопки для устройства
     devButtons->addWidget(m_refreshBtn);
     devButtons->addWidget(m_formatBtn);
+    devButtons->addWidget(m_wipeBtn);
+    devButtons->addWidget(m_backupBtn);
+    devButtons->addWidget(m_cloneBtn);
     devButtons->addStretch();
     
     m_deviceInfoLabel = new QLabel("Выберите устройство");
@@ -118,11 +150,11 @@ void MainWindow::setupUi() {
     
     // Добавляем варианты размеров буферов (оптимальные для записи)
     m_blockSizeCombo->addItems({
-        "64 KB", "128 KB", "256 KB", "512 KB", 
+        "Авто", "64 KB", "128 KB", "256 KB", "512 KB", 
         "1 MB", "2 MB", "4 MB", "8 MB",
         "16 MB", "32 MB", "64 MB", "128 MB", "256 MB"
     });
-    m_blockSizeCombo->setCurrentText("64 MB");  // Оптимальный для USB 3.0
+    m_blockSizeCombo->setCurrentText("Авто");  // По параметрам очереди устройства
     
     blockSizeLayout->addWidget(m_blockSizeCombo);
     blockSizeLayout->addStretch();
@@ -142,11 +174,47 @@ void MainWindow::setupUi() {
     clusterSizeLayout->addStretch();
     
     m_verifyCheckbox->setChecked(true);
+    m_capacityCheckbox->setToolTip("Перед записью на носитель, который еще не проверялся, "
+                                   "убедиться пробной записью, что его заявленная емкость настоящая");
     
     settingsLay->addLayout(blockSizeLayout);
+    // Полная проверка удваивает время записи; выборка читает 2% блоков
+    // (плюс начало, конец и таблицы разделов) и сообщает достоверность
+    auto verifyLayout = new QHBoxLayout;
+    verifyLayout->addWidget(m_verifyCheckbox);
+    m_verifyModeCombo->addItems({
+        "Полная", "Выборочная (2%)", "Выборочная (2%), каждое 10-е устройство полностью"
+    });
+    m_verifyModeCombo->setToolTip("Каждое 10-е устройство считается по заданиям очереди");
+    verifyLayout->addWidget(m_verifyModeCombo);
+    verifyLayout->addStretch();
+    connect(m_verifyModeCombo, &QComboBox::currentIndexChanged, this, [this](int index) {
+        m_scheduler->setFullVerifyEvery(index == 2 ? 10 : 0);
+    });
+
+    // Серия записей одного образа: распакованный образ держится в памяти,
+    // и следующие задания не читают файл с диска или NFS заново
+    auto imageCacheLayout = new QHBoxLayout;
+    imageCacheLayout->addWidget(new QLabel("Кэш образов в памяти:"));
+    m_imageCacheCombo->addItems({"Выключен", "2 GB", "4 GB", "8 GB", "16 GB"});
+    m_imageCacheCombo->setToolTip("Образ попадает в кэш при первом полном чтении; "
+                                  "давно не использованные образы вытесняются");
+    imageCacheLayout->addWidget(m_imageCacheCombo);
+    auto releaseCacheBtn = new QPushButton("Освободить");
+    imageCacheLayout->addWidget(releaseCacheBtn);
+    imageCacheLayout->addStretch();
+    connect(m_imageCacheCombo, &QComboBox::currentIndexChanged, this, [](int index) {
+        ImageCache::instance().setBudget(index > 0 ? (1LL << index) * 1024 * 1024 * 1024 : 0);
+    });
+    connect(releaseCacheBtn, &QPushButton::clicked, this, []() {
+        ImageCache::instance().clear();
+    });
+
     settingsLay->addLayout(clusterSizeLayout);
-    settingsLay->addWidget(m_verifyCheckbox);
+    settingsLay->addLayout(verifyLayout);
+    settingsLay->addLayout(imageCacheLayout);
     settingsLay->addWidget(m_forceCheckbox);
+    settingsLay->addWidget(m_capacityCheckbox);
     settingsGroup->setLayout(settingsLay);
     
     // Добавляем группы в основной layout
@@ -154,6 +222,26 @@ void MainWindow::setupUi() {
     mainLayout->addWidget(devGroup);
     mainLayout->addWidget(settingsGroup);
     
+    // Очередь заданий для нескольких устройств
+    auto queueGroup = new QGroupBox("Очередь заданий");
+    auto queueLay = new QVBoxLayout;
+    m_jobTable->setColumnCount(6);
+    m_jobTable->setHorizontalHeaderLabels({"№", "Операция", "Устройство", "Шина", "Состояние", "Прогресс"});
+    m_jobTable->verticalHeader()->setVisible(false);
+    m_jobTable->horizontalHeader()->setStretchLastSection(true);
+    m_jobTable->setSelectionBehavior(QAbstractItemView::SelectRows);
+    m_jobTable->setEditTriggers(QAbstractItemView::NoEditTriggers);
+    m_jobTable->setMaximumHeight(160);
+    auto queueButtons = new QHBoxLayout;
+    queueButtons->addWidget(m_enqueueBtn);
+    queueButtons->addWidget(m_cancelJobBtn);
+    queueButtons->addStretch();
+    queueButtons->addWidget(m_clearJobsBtn);
+    queueLay->addWidget(m_jobTable);
+    queueLay->addLayout(queueButtons);
+    queueGroup->setLayout(queueLay);
+    mainLayout->addWidget(queueGroup);
+    
     // Прогресс
     m_progressBar->setVisible(false);
     m_progressBar->setTextVisible(true);
@@ -200,11 +288,18 @@ void MainWindow::setupConnections() {
     connect(m_cancelBtn, &QPushButton::clicked, this, &MainWindow::onCancelWrite);
     connect(m_refreshBtn, &QPushButton::clicked, this, &MainWindow::refreshDevices);
     connect(m_browseBtn, &QPushButton::clicked, this, &MainWindow::browseImage);
+    connect(m_catalogBtn, &QPushButton::clicked, this, &MainWindow::onManageCatalog);
     connect(m_formatBtn, &QPushButton::clicked, this, &MainWindow::onShowFormatDialog);
+    connect(m_wipeBtn, &QPushButton::clicked, this, &MainWindow::onStartWipe);
+    connect(m_backupBtn, &QPushButton::clicked, this, &MainWindow::onStartBackup);
+    connect(m_cloneBtn, &QPushButton::clicked, this, &MainWindow::onStartClone);
+    connect(m_enqueueBtn, &QPushButton::clicked, this, &MainWindow::onEnqueueJob);
+    connect(m_cancelJobBtn, &QPushButton::clicked, this, &MainWindow::onCancelJob);
+    connect(m_clearJobsBtn, &QPushButton::clicked, m_scheduler, &JobScheduler::clearFinished);
 }
 
 void MainWindow::refreshDevices() {
-    // Получаем список устройств
+    // Получаем список устройств (только sysfs, без чтения с носителей)
     auto newDevices = DeviceManager::scanDevices();
     
     // Если список не изменился, не обновляем UI
@@ -213,80 +308,165 @@ void MainWindow::refreshDevices() {
     }
     
     m_devices = newDevices;
-    
-    // Сохраняем текущий выбор
-    QString currentDevicePath;
-    if (m_deviceCombo->currentIndex() >= 0) {
-        QVariant var = m_deviceCombo->currentData();
-        if (var.isValid()) {
-            DeviceInfo currentDevice = var.value<DeviceInfo>();
-            currentDevicePath = currentDevice.path;
+    m_prober->retain(m_devices);
+    
+    // Удаляем пропавшие устройства, не трогая остальные элементы
+    for (int i = m_deviceCombo->count() - 1; i >= 0; --i) {
+        QString path = m_deviceCombo->itemData(i).value<DeviceInfo>().path;
+        bool present = false;
+        for (const auto& dev : m_devices) {
+            if (dev.path == path) {
+                present = true;
+                break;
+            }
+        }
+        if (!present) {
+            m_deviceCombo->removeItem(i);
+            m_probeTimeouts.remove(path);
         }
     }
     
-    m_deviceCombo->clear();
-    
-    int selectIndex = -1;
-    for (int i = 0; i < m_devices.size(); ++i) {
-        const auto& dev = m_devices[i];
-        
-        // Получаем информацию о файловой системе
-        QString fsType = Utils::getFilesystemType(dev.path);
-        
-        QString displayText;
-        if (fsType != "unknown" && fsType != "empty") {
-            displayText = QString("%1 (%2, %3)").arg(dev.path).arg(dev.sizeStr).arg(fsType);
-        } else {
-            displayText = dev.path + " (" + dev.sizeStr + ")";
+    // Добавляем новые и обновляем изменившиеся
+    for (const auto& dev : m_devices) {
+        int index = findDeviceIndex(dev.path);
+        if (index < 0) {
+            m_deviceCombo->addItem(deviceDisplayText(dev), QVariant::fromValue(dev));
+        } else if (!(m_deviceCombo->itemData(index).value<DeviceInfo>() == dev)) {
+            m_probeTimeouts.remove(dev.path);
+            m_deviceCombo->setItemData(index, QVariant::fromValue(dev));
+            m_deviceCombo->setItemText(index, deviceDisplayText(dev));
+            if (index == m_deviceCombo->currentIndex()) {
+                onDeviceSelected(index);
+            }
         }
         
-        m_deviceCombo->addItem(displayText, QVariant::fromValue(dev));
-        
-        if (dev.path == currentDevicePath) {
-            selectIndex = i;
-        }
+        // Файловая система определяется в фоне, ответ придет в onDeviceProbed
+        m_prober->request(dev);
     }
     
-    if (selectIndex >= 0) {
-        m_deviceCombo->setCurrentIndex(selectIndex);
-    } else if (!m_devices.isEmpty()) {
+    if (m_deviceCombo->currentIndex() < 0 && !m_devices.isEmpty()) {
         m_deviceCombo->setCurrentIndex(0);
     }
     
     logMessage("INFO", QString("Найдено устройств: %1").arg(m_devices.size()));
 }
 
+void MainWindow::onDeviceProbed(const QString& devicePath, const QString& fsType, bool timedOut) {
+    Q_UNUSED(fsType);
+    if (timedOut) {
+        m_probeTimeouts.insert(devicePath);
+        logMessage("WARNING", QString("Устройство %1 не отвечает при чтении").arg(devicePath));
+    } else {
+        m_probeTimeouts.remove(devicePath);
+    }
+    
+    int index = findDeviceIndex(devicePath);
+    if (index < 0) return;
+    
+    DeviceInfo dev = m_deviceCombo->itemData(index).value<DeviceInfo>();
+    m_deviceCombo->setItemText(index, deviceDisplayText(dev));
+    if (index == m_deviceCombo->currentIndex()) {
+        onDeviceSelected(index);
+    }
+}
+
+int MainWindow::findDeviceIndex(const QString& devicePath) const {
+    for (int i = 0; i < m_deviceCombo->count(); ++i) {
+        if (m_deviceCombo->itemData(i).value<DeviceInfo>().path == devicePath) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+QString MainWindow::deviceFilesystem(const DeviceInfo& dev) const {
+    QString fsType;
+    if (m_prober->cachedFilesystem(dev, &fsType)) {
+        return fsType;
+    }
+    return m_probeTimeouts.contains(dev.path) ? "нет ответа" : "определяется...";
+}
+
+QString MainWindow::deviceDisplayText(const DeviceInfo& dev) const {
+    QString fsType = deviceFilesystem(dev);
+    if (fsType != "unknown" && fsType != "empty") {
+        return QString("%1 (%2, %3)").arg(dev.path).arg(dev.sizeStr).arg(fsType);
+    }
+    return dev.path + " (" + dev.sizeStr + ")";
+}
+
 void MainWindow::browseImage() {
+    const QStringList dirs = m_catalog->directories();
     QString path = QFileDialog::getOpenFileName(this, 
         "Выберите образ", 
-        QDir::homePath() + "/Загрузки",
-        "Все поддерживаемые образы (*.img *.iso *.gz *.xz *.bz2 *.zip *.raw *.dd *.bin *.7z *.tar.gz *.tar.xz *.tar.bz2);;"
+        dirs.isEmpty() ? QDir::homePath() + "/Загрузки" : dirs.first(),
+        "Все поддерживаемые образы (*.img *.iso *.gz *.xz *.zst *.bz2 *.zip *.raw *.dd *.bin *.7z *.tar.gz *.tar.xz *.tar.bz2);;"
         "Все файлы (*)");
     
     if (!path.isEmpty()) {
-        // Проверяем, есть ли уже этот образ в списке
+        // Известный файл берется из индекса, новый запоминается и индексируется в фоне
+        const CatalogEntry entry = m_catalog->addFile(path);
+        populateImages();
         for (int i = 0; i < m_imageCombo->count(); ++i) {
-            if (m_imageCombo->itemData(i).value<ImageInfo>().path == path) {
+            if (m_imageCombo->itemData(i).value<ImageInfo>().path == entry.path) {
                 m_imageCombo->setCurrentIndex(i);
                 return;
             }
         }
-        
-        // Добавляем новый образ
-        ImageInfo img;
-        img.path = path;
-        img.size = QFileInfo(path).size();
-        img.fileType = Utils::detectFileType(path);
-        
-        QString displayName = QFileInfo(path).fileName() + " (" + Utils::formatSize(img.size) + ")";
-        m_imageCombo->insertItem(0, displayName, QVariant::fromValue(img));
-        m_imageCombo->setCurrentIndex(0);
+    }
+}
+
+void MainWindow::populateImages() {
+    const QString current = m_selectedImage.path;
+    const QList<CatalogEntry> entries = m_catalog->entries();
+
+    m_imageCombo->blockSignals(true);
+    m_imageCombo->clear();
+    int currentIndex = -1;
+    for (const CatalogEntry& entry : entries) {
+        const qint64 size = entry.imageSize >= 0 ? entry.imageSize : entry.fileSize;
+        m_imageCombo->addItem(QFileInfo(entry.path).fileName() + " (" + Utils::formatSize(size) + ")",
+                              QVariant::fromValue(entry.toImageInfo()));
+        m_imageCombo->setItemData(m_imageCombo->count() - 1, entry.path, Qt::ToolTipRole);
+        if (entry.path == current) currentIndex = m_imageCombo->count() - 1;
+    }
+    m_imageCombo->setCurrentIndex(currentIndex);
+    m_imageCombo->blockSignals(false);
+
+    // Сведения выбранного образа могли досчитаться
+    onImageSelected(currentIndex);
+}
+
+void MainWindow::onManageCatalog() {
+    const QString addItem = "Добавить папку...";
+    QStringList items = m_catalog->directories();
+    items << addItem;
+
+    bool ok = false;
+    const QString choice = QInputDialog::getItem(this, "Каталог образов",
+        QString("Папки каталога (%1 образов).\nВыбор папки - удалить ее из каталога:")
+            .arg(m_catalog->entries().size()),
+        items, items.size() - 1, false, &ok);
+    if (!ok) return;
+
+    if (choice == addItem) {
+        const QString dir = QFileDialog::getExistingDirectory(this, "Папка с образами", QDir::homePath());
+        if (dir.isEmpty()) return;
+        m_catalog->addDirectory(dir);
+        logMessage("INFO", QString("Папка добавлена в каталог: %1").arg(dir));
+        return;
+    }
+    if (QMessageBox::question(this, "Каталог образов",
+                              QString("Убрать папку %1 из каталога?").arg(choice),
+                              QMessageBox::Yes | QMessageBox::No) == QMessageBox::Yes) {
+        m_catalog->removeDirectory(choice);
+        logMessage("INFO", QString("Папка убрана из каталога: %1").arg(choice));
     }
 }
 
 qint64 MainWindow::parseBlockSize(const QString& sizeStr) {
     QStringList parts = sizeStr.split(' ');
-    if (parts.size() != 2) return 64 * 1024 * 1024;  // 64MB по умолчанию
+    if (parts.size() != 2) return 0;  // Авто: размер выбирает ImageWriter
     
     qint64 size = parts[0].toLongLong();
     QString unit = parts[1].toUpper();
@@ -312,12 +492,26 @@ void MainWindow::onImageSelected(int index) {
     m_selectedImage = var.value<ImageInfo>();
     
     QString name = QFileInfo(m_selectedImage.path).fileName();
-    m_imageInfoLabel->setText(
-        QString("<b>%1</b><br>Размер: %2<br>Тип: %3")
+    QString text = QString("<b>%1</b><br>Размер: %2<br>Тип: %3")
         .arg(name)
         .arg(Utils::formatSize(m_selectedImage.size))
-        .arg(m_selectedImage.fileType)
-    );
+        .arg(m_selectedImage.fileType);
+
+    // Сведения из индекса каталога: файл повторно не читается
+    CatalogEntry entry;
+    if (m_catalog->entry(m_selectedImage.path, &entry)) {
+        if (entry.imageSize >= 0 && entry.imageSize != entry.fileSize) {
+            text += QString("<br>После распаковки: %1").arg(Utils::formatSize(entry.imageSize));
+        }
+        if (!entry.layout.isEmpty()) text += QString("<br>Разметка: %1").arg(entry.layout);
+        text += QString("<br>SHA-256: %1").arg(entry.digest.isEmpty() ? QString("вычисляется...") : entry.digest.left(16) + "...");
+        if (entry.verifyState != CatalogEntry::NotVerified) {
+            text += QString("<br>Последняя проверка записи: %1 (%2)")
+                .arg(entry.verifyState == CatalogEntry::Verified ? "успешно" : "ошибка")
+                .arg(QDateTime::fromMSecsSinceEpoch(entry.verifiedAt).toString("dd.MM.yyyy hh:mm"));
+        }
+    }
+    m_imageInfoLabel->setText(text);
     checkReadyState();
 }
 
@@ -334,18 +528,48 @@ void MainWindow::onDeviceSelected(int index) {
     
     m_selectedDevice = var.value<DeviceInfo>();
     
-    // Получаем информацию о файловой системе
-    QString fsType = Utils::getFilesystemType(m_selectedDevice.path);
+    // Информация о файловой системе берется из кэша фоновой проверки
+    QString fsType = deviceFilesystem(m_selectedDevice);
     QString mounts = m_selectedDevice.mountPoints.isEmpty() ? 
         "Не смонтировано" : 
         "Смонтировано: " + m_selectedDevice.mountPoints.join(", ");
     
+    const DeviceTopology& topo = m_selectedDevice.topology;
+    QString queue = QString("Блок: %1/%2 Б, запрос до %3 KB%4%5")
+        .arg(topo.logicalBlockSize)
+        .arg(topo.physicalBlockSize)
+        .arg(topo.maxSectorsKb)
+        .arg(topo.optimalIoSize ? QString(", optimal I/O %1").arg(Utils::formatSize(topo.optimalIoSize)) : QString())
+        .arg(topo.writeBackCache ? (topo.fua ? ", кэш write back + FUA" : ", кэш write back") : QString());
+    
+    // Разметка из результата проверки: тип таблицы и ФС каждого раздела
+    QString layout = QString::number(m_selectedDevice.partitions.size());
+    ProbeResult probe;
+    if (m_prober->cachedProbe(m_selectedDevice, &probe) && !probe.partitions.isEmpty()) {
+        QStringList parts;
+        for (const ProbePartition& part : probe.partitions) {
+            if (part.typeName == "Extended") continue;
+            QString desc = QString("%1: %2 %3")
+                .arg(part.number)
+                .arg(part.fsType.isEmpty() ? part.typeName : part.fsType)
+                .arg(Utils::formatSize(part.sizeBytes));
+            if (!part.label.isEmpty()) desc += QString(" \"%1\"").arg(part.label.toHtmlEscaped());
+            parts << desc;
+        }
+        layout = QString("%1 (%2)<br>&nbsp;&nbsp;%3")
+            .arg(parts.size())
+            .arg(probe.tableType == "gpt" ? "GPT" : "MBR")
+            .arg(parts.join("<br>&nbsp;&nbsp;"));
+    }
+
     m_deviceInfoLabel->setText(
-        QString("<b>%1</b><br>Размер: %2<br>Модель: %3<br>Файловая система: %4<br>%5")
+        QString("<b>%1</b><br>Размер: %2<br>Модель: %3<br>Файловая система: %4<br>Разделов: %5<br>%6<br>%7")
         .arg(m_selectedDevice.path)
         .arg(m_selectedDevice.sizeStr)
         .arg(m_selectedDevice.model)
         .arg(fsType)
+        .arg(layout)
+        .arg(queue)
         .arg(mounts)
     );
     checkReadyState();
@@ -366,6 +590,7 @@ void MainWindow::onStartWrite() {
         logMessage("ERROR", "Не выбран образ или устройство!");
         return;
     }
+    if (isDeviceQueued(m_selectedDevice.path)) return;
 
     // Предварительная проверка
     if (!validateWriteSettings()) {
@@ -407,16 +632,31 @@ void MainWindow::onStartWrite() {
     cfg.devicePath = m_selectedDevice.path;
     cfg.verify = m_verifyCheckbox->isChecked();
     cfg.force = m_forceCheckbox->isChecked();
+    cfg.checkCapacity = m_capacityCheckbox->isChecked();
+    cfg.verifySample = m_verifyModeCombo->currentIndex() > 0 ? 0.02 : 0;
     cfg.blockSize = parseBlockSize(m_blockSizeCombo->currentText());
     cfg.clusterSize = parseBlockSize(m_clusterSizeCombo->currentText());
 
-    // Сохраняем размер образа для расчета скорости
-    m_totalImageSize = QFileInfo(m_selectedImage.path).size();
+    // Сохраняем размер образа для расчета скорости (после распаковки). Без
+    // распаковки в потоке интерфейса; неточный размер задание уточнит само
+    const ImageSource::SizeInfo sizeInfo = imageSizeInfo(m_selectedImage.path);
+    if (sizeInfo.exact) cfg.sizeInfo = sizeInfo;
+    m_totalImageSize = sizeInfo.effectiveSize();
+    m_sourceMBps = 0;
+    m_deviceMBps = 0;
+    m_speedLabel->setToolTip(QString());
     m_writeTimer->restart();
 
+    m_catalog->markUsed(cfg.imagePath);
+
+    setActiveDevice(cfg.devicePath);
     m_writer = new ImageWriter(cfg, this);
     connect(m_writer, &ImageWriter::progress, this, &MainWindow::onWriteProgress);
     connect(m_writer, &ImageWriter::finished, this, &MainWindow::onWriteFinished);
+    connect(m_writer, &ImageWriter::throughput, this, &MainWindow::onWriteThroughput);
+    connect(m_writer, &ImageWriter::verified, this, [this, path = cfg.imagePath](bool match) {
+        m_catalog->markVerified(path, match);
+    });
     m_writer->start();
 
     logMessage("INFO", QString("Начало записи образа: %1 на %2")
@@ -425,6 +665,28 @@ void MainWindow::onStartWrite() {
 }
 
 void MainWindow::onCancelWrite() {
+    if (m_cloneJob) {
+        logMessage("WARNING", "Отмена клонирования...");
+        m_cancelBtn->setEnabled(false);
+        m_cloneJob->cancel();
+        return;
+    }
+
+    if (m_backupJob) {
+        logMessage("WARNING", "Отмена создания образа...");
+        m_cancelBtn->setEnabled(false);
+        m_backupJob->cancel();
+        return;
+    }
+
+    if (m_wipeJob) {
+        // Очистка завершается сама на ближайшей границе блока
+        logMessage("WARNING", "Отмена очистки...");
+        m_cancelBtn->setEnabled(false);
+        m_wipeJob->cancel();
+        return;
+    }
+
     if (m_writer) {
         logMessage("WARNING", "Отмена операции...");
         m_cancelBtn->setEnabled(false);
@@ -440,6 +702,7 @@ void MainWindow::onCancelWrite() {
         
         m_writer->deleteLater();
         m_writer = nullptr;
+        setActiveDevice(QString());
         m_cancelled = false;
         m_writeBtn->setEnabled(true);
         m_progressBar->setVisible(false);
@@ -449,6 +712,510 @@ void MainWindow::onCancelWrite() {
     }
 }
 
+void MainWindow::onStartWipe() {
+    if (m_selectedDevice.path.isEmpty() || m_writer || m_wipeJob || m_backupJob || m_cloneJob) return;
+    if (isDeviceQueued(m_selectedDevice.path)) return;
+
+    const WipeJob::Mode autoMode = WipeJob::resolveMode(m_selectedDevice.topology);
+    const QList<WipeJob::Mode> modes = {
+        WipeJob::Auto, WipeJob::Signatures, WipeJob::ZeroOut, WipeJob::Discard,
+        WipeJob::SecureDiscard, WipeJob::Overwrite
+    };
+    QStringList items;
+    for (WipeJob::Mode mode : modes) {
+        items << (mode == WipeJob::Auto
+                  ? QString("%1 (%2)").arg(WipeJob::modeName(mode)).arg(WipeJob::modeName(autoMode))
+                  : WipeJob::modeName(mode));
+    }
+
+    bool ok = false;
+    QString choice = QInputDialog::getItem(this, "Очистка устройства", "Режим очистки:", items, 0, false, &ok);
+    if (!ok) return;
+    WipeJob::Mode mode = modes.value(items.indexOf(choice), WipeJob::Auto);
+
+    QString msg = QString(
+        "<b>ВНИМАНИЕ! Все данные на %1 будут уничтожены!</b><br><br>"
+        "Режим: <b>%2</b><br><br>"
+        "Продолжить?")
+    .arg(m_selectedDevice.path)
+    .arg(choice);
+    if (QMessageBox::warning(this, "Подтверждение", msg, QMessageBox::Yes | QMessageBox::No) != QMessageBox::Yes) {
+        return;
+    }
+
+    WipeJob::Config cfg;
+    cfg.devicePath = m_selectedDevice.path;
+    cfg.mode = mode;
+
+    m_writeBtn->setEnabled(false);
+    m_wipeBtn->setEnabled(false);
+    m_cancelBtn->setEnabled(true);
+    m_progressBar->setVisible(true);
+    m_progressBar->setValue(0);
+    m_speedLabel->setVisible(true);
+    m_timeLeftLabel->setVisible(true);
+
+    setActiveDevice(cfg.devicePath);
+    m_wipeJob = new WipeJob(cfg, this);
+    connect(m_wipeJob, &WipeJob::progress, this, &MainWindow::onWriteProgress);
+    connect(m_wipeJob, &WipeJob::finished, this, &MainWindow::onWipeFinished);
+    m_wipeJob->start();
+
+    logMessage("INFO", QString("Начало очистки %1: %2").arg(m_selectedDevice.path).arg(choice));
+}
+
+void MainWindow::onWipeFinished(bool success, const QString& message) {
+    if (m_wipeJob) {
+        m_wipeJob->wait();
+        m_wipeJob->deleteLater();
+        m_wipeJob = nullptr;
+    }
+    setActiveDevice(QString());
+
+    m_progressBar->setValue(success ? 100 : 0);
+    m_wipeBtn->setEnabled(true);
+    m_cancelBtn->setEnabled(false);
+    checkReadyState();
+
+    logMessage(success ? "SUCCESS" : "ERROR", message);
+    // Содержимое носителя изменилось: повторная проверка ФС
+    m_prober->invalidate(m_selectedDevice);
+    m_prober->request(m_selectedDevice);
+}
+
+void MainWindow::onStartBackup() {
+    if (m_selectedDevice.path.isEmpty() || m_writer || m_wipeJob || m_backupJob || m_cloneJob) return;
+    if (isDeviceQueued(m_selectedDevice.path)) return;
+
+    QStringList filters = {"Образ zstd (*.img.zst)", "Образ gzip (*.img.gz)", "Образ xz (*.img.xz)",
+                           "Образ без сжатия (*.img)"};
+    if (!BackupJob::isSupported(BackupJob::Zstd)) filters.removeFirst();
+    QString filter = filters.first();
+    const QString defaultName = QString("%1/%2%3").arg(QDir::homePath())
+        .arg(QFileInfo(m_selectedDevice.path).fileName())
+        .arg(BackupJob::isSupported(BackupJob::Zstd) ? ".img.zst" : ".img.gz");
+    QString path = QFileDialog::getSaveFileName(this, "Создать образ устройства", defaultName,
+                                                filters.join(";;"), &filter);
+    if (path.isEmpty()) return;
+
+    // Расширение по выбранному фильтру, если пользователь его не указал
+    static const QRegularExpression suffix("\\((\\*[^)]+)\\)");
+    const QString ext = suffix.match(filter).captured(1).mid(1);
+    if (!ext.isEmpty() && !path.endsWith(ext, Qt::CaseInsensitive) &&
+        BackupJob::compressionFor(path) == BackupJob::None) {
+        path += ext.mid(path.endsWith(".img", Qt::CaseInsensitive) ? 4 : 0);
+    }
+
+    BackupJob::Config cfg;
+    cfg.devicePath = m_selectedDevice.path;
+    cfg.imagePath = path;
+
+    m_writeBtn->setEnabled(false);
+    m_backupBtn->setEnabled(false);
+    m_cancelBtn->setEnabled(true);
+    m_progressBar->setVisible(true);
+    m_progressBar->setValue(0);
+    m_speedLabel->setVisible(true);
+    m_timeLeftLabel->setVisible(true);
+
+    setActiveDevice(cfg.devicePath);
+    m_backupJob = new BackupJob(cfg, this);
+    connect(m_backupJob, &BackupJob::progress, this, &MainWindow::onWriteProgress);
+    connect(m_backupJob, &BackupJob::finished, this, &MainWindow::onBackupFinished);
+    m_backupJob->start();
+
+    logMessage("INFO", QString("Создание образа %1 -> %2").arg(cfg.devicePath).arg(path));
+}
+
+void MainWindow::onBackupFinished(bool success, const QString& message) {
+    if (m_backupJob) {
+        m_backupJob->wait();
+        m_backupJob->deleteLater();
+        m_backupJob = nullptr;
+    }
+    setActiveDevice(QString());
+
+    m_progressBar->setValue(success ? 100 : 0);
+    m_backupBtn->setEnabled(true);
+    m_cancelBtn->setEnabled(false);
+    m_speedLabel->setVisible(false);
+    m_timeLeftLabel->setVisible(false);
+    checkReadyState();
+
+    logMessage(success ? "SUCCESS" : "ERROR", message);
+    if (success) {
+        QMessageBox::information(this, "Успех", message);
+    } else {
+        QMessageBox::critical(this, "Ошибка", "Не удалось создать образ:\n" + message);
+    }
+}
+
+void MainWindow::onStartClone() {
+    if (m_selectedDevice.path.isEmpty() || m_writer || m_wipeJob || m_backupJob || m_cloneJob) return;
+    if (isDeviceQueued(m_selectedDevice.path)) return;
+
+    // Цели - остальные съемные устройства не меньше исходного
+    QList<DeviceInfo> candidates;
+    for (const DeviceInfo& dev : m_devices) {
+        if (dev.path == m_selectedDevice.path || !dev.removable) continue;
+        if (dev.sizeBytes < m_selectedDevice.sizeBytes) continue;
+        candidates << dev;
+    }
+    if (candidates.isEmpty()) {
+        logMessage("ERROR", QString("Нет съемных устройств объемом от %1 для клонирования")
+                   .arg(Utils::formatSize(static_cast<qint64>(m_selectedDevice.sizeBytes))));
+        return;
+    }
+
+    QDialog dialog(this);
+    dialog.setWindowTitle("Клонирование устройства");
+    auto layout = new QVBoxLayout(&dialog);
+    layout->addWidget(new QLabel(QString("Источник: <b>%1</b><br>Копировать на:")
+                                 .arg(deviceDisplayText(m_selectedDevice))));
+    QList<QCheckBox*> boxes;
+    for (const DeviceInfo& dev : candidates) {
+        auto box = new QCheckBox(deviceDisplayText(dev));
+        box->setChecked(candidates.size() == 1);
+        layout->addWidget(box);
+        boxes << box;
+    }
+    auto skipBox = new QCheckBox("Пропускать свободное место (FAT, exFAT, ext2/3/4)");
+    skipBox->setChecked(true);
+    auto verifyBox = new QCheckBox("Проверять записанное");
+    verifyBox->setChecked(m_verifyCheckbox->isChecked());
+    layout->addWidget(skipBox);
+    layout->addWidget(verifyBox);
+    auto buttons = new QDialogButtonBox(QDialogButtonBox::Ok | QDialogButtonBox::Cancel);
+    connect(buttons, &QDialogButtonBox::accepted, &dialog, &QDialog::accept);
+    connect(buttons, &QDialogButtonBox::rejected, &dialog, &QDialog::reject);
+    layout->addWidget(buttons);
+    if (dialog.exec() != QDialog::Accepted) return;
+
+    CloneJob::Config cfg;
+    cfg.sourcePath = m_selectedDevice.path;
+    cfg.skipUnused = skipBox->isChecked();
+    cfg.verify = verifyBox->isChecked();
+    for (int i = 0; i < candidates.size(); ++i) {
+        if (!boxes[i]->isChecked()) continue;
+        if (isDeviceQueued(candidates[i].path)) return;
+        cfg.targetPaths << candidates[i].path;
+    }
+    if (cfg.targetPaths.isEmpty()) return;
+
+    QString msg = QString(
+        "<b>ВНИМАНИЕ! Все данные на %1 будут уничтожены!</b><br><br>"
+        "Источник: <b>%2</b><br><br>"
+        "Продолжить?")
+    .arg(cfg.targetPaths.join(", "))
+    .arg(cfg.sourcePath);
+    if (QMessageBox::warning(this, "Подтверждение", msg, QMessageBox::Yes | QMessageBox::No) != QMessageBox::Yes) {
+        return;
+    }
+
+    m_writeBtn->setEnabled(false);
+    m_cloneBtn->setEnabled(false);
+    m_cancelBtn->setEnabled(true);
+    m_progressBar->setVisible(true);
+    m_progressBar->setValue(0);
+    m_speedLabel->setVisible(true);
+    m_timeLeftLabel->setVisible(true);
+
+    setActiveDevices(QStringList(cfg.targetPaths) << cfg.sourcePath);
+    m_cloneJob = new CloneJob(cfg, this);
+    connect(m_cloneJob, &CloneJob::progress, this, &MainWindow::onWriteProgress);
+    connect(m_cloneJob, &CloneJob::finished, this, &MainWindow::onCloneFinished);
+    m_cloneJob->start();
+
+    logMessage("INFO", QString("Клонирование %1 -> %2").arg(cfg.sourcePath).arg(cfg.targetPaths.join(", ")));
+}
+
+void MainWindow::onCloneFinished(bool success, const QString& message) {
+    if (m_cloneJob) {
+        m_cloneJob->wait();
+        m_cloneJob->deleteLater();
+        m_cloneJob = nullptr;
+    }
+    // Целевые носители переписаны (источник проверится заново без вреда)
+    reprobeDevices(m_activeDevices);
+    setActiveDevice(QString());
+
+    m_progressBar->setValue(success ? 100 : 0);
+    m_cloneBtn->setEnabled(true);
+    m_cancelBtn->setEnabled(false);
+    m_speedLabel->setVisible(false);
+    m_timeLeftLabel->setVisible(false);
+    checkReadyState();
+
+    logMessage(success ? "SUCCESS" : "ERROR", message);
+    // Таблицы разделов целевых устройств изменились
+    refreshDevices();
+    if (success) {
+        QMessageBox::information(this, "Успех", message);
+    } else {
+        QMessageBox::critical(this, "Ошибка", "Клонирование не выполнено:\n" + message);
+    }
+}
+
+bool MainWindow::isDeviceQueued(const QString& devicePath) {
+    if (!m_scheduler->isDeviceBusy(devicePath)) return false;
+    logMessage("WARNING", QString("%1 занято заданием очереди").arg(devicePath));
+    return true;
+}
+
+ImageSource::SizeInfo MainWindow::imageSizeInfo(const QString& imagePath) const {
+    // Точный размер из каталога (для gzip его считает проход SHA-256),
+    // иначе только то, что видно без распаковки
+    // Запись каталога верна, только пока файл не менялся (размер и mtime)
+    CatalogEntry entry;
+    CatalogEntry current;
+    const QFileInfo fi(imagePath);
+    current.fileSize = fi.size();
+    current.modified = fi.lastModified().toMSecsSinceEpoch();
+    if (m_catalog->entry(imagePath, &entry) && entry.imageSize >= 0 && entry.sameFile(current)) {
+        ImageSource::SizeInfo info;
+        info.format = ImageSource::detectFormat(imagePath);
+        info.fileSize = entry.fileSize;
+        info.imageSize = entry.imageSize;
+        info.exact = true;
+        info.method = "каталог образов";
+        return info;
+    }
+    return ImageSource::discoverSize(imagePath, ImageSource::QuickScan);
+}
+
+void MainWindow::reprobeDevices(const QStringList& devicePaths) {
+    for (const QString& path : devicePaths) {
+        const int index = findDeviceIndex(path);
+        if (index < 0) continue;
+        m_prober->invalidate(m_devices[index]);
+        m_prober->request(m_devices[index]);
+    }
+}
+
+void MainWindow::setActiveDevice(const QString& devicePath) {
+    setActiveDevices(devicePath.isEmpty() ? QStringList() : QStringList{devicePath});
+}
+
+void MainWindow::setActiveDevices(const QStringList& devicePaths) {
+    // Задания очереди для устройств ждут завершения операции вне очереди
+    for (const QString& path : m_activeDevices) m_scheduler->setReserved(path, false);
+    m_activeDevices = devicePaths;
+    for (const QString& path : m_activeDevices) m_scheduler->setReserved(path, true);
+}
+
+void MainWindow::onEnqueueJob() {
+    if (m_selectedDevice.path.isEmpty()) {
+        logMessage("ERROR", "Не выбрано устройство!");
+        return;
+    }
+
+    const QStringList operations = {
+        "Запись образа", "Проверка образа", "Быстрое форматирование", "Очистка (авто)",
+        "Проверка поверхности (с сохранением данных)", "Проверка поверхности (с уничтожением данных)",
+        "Проверка емкости (быстрая)"
+    };
+    bool ok = false;
+    const QString operation = QInputDialog::getItem(this, "Очередь заданий", "Операция:",
+                                                    operations, 0, false, &ok);
+    if (!ok) return;
+    const int type = operations.indexOf(operation);
+    if (type <= 1 && m_selectedImage.path.isEmpty()) {
+        logMessage("ERROR", "Не выбран образ!");
+        return;
+    }
+
+    // Одно задание на все съемные носители - основной сценарий тиражирования
+    QList<DeviceInfo> removable;
+    for (const DeviceInfo& dev : m_devices) {
+        if (dev.removable) removable << dev;
+    }
+    QList<DeviceInfo> targets = {m_selectedDevice};
+    if (removable.size() > 1) {
+        const QStringList scopes = {
+            QString("Выбранное устройство (%1)").arg(m_selectedDevice.path),
+            QString("Все съемные устройства (%1)").arg(removable.size())
+        };
+        const QString scope = QInputDialog::getItem(this, "Очередь заданий", "Устройства:",
+                                                    scopes, 0, false, &ok);
+        if (!ok) return;
+        if (scope == scopes.last()) targets = removable;
+    }
+
+    // Приоритет и скорость задания: проверку можно пустить в фоне, не мешая
+    // записи на соседние носители той же шины
+    IoPriority ioPriority;
+    qint64 rateLimit = 0;
+    if (type <= 1) {
+        const QStringList priorities = {
+            "Обычный", "Высокий", "Низкий", "Фоновый (только при простое диска)"
+        };
+        const QString priority = QInputDialog::getItem(this, "Очередь заданий", "Приоритет ввода-вывода:",
+                                                       priorities, type == 1 ? 3 : 0, false, &ok);
+        if (!ok) return;
+        switch (priorities.indexOf(priority)) {
+            case 1: ioPriority.ioClass = IoPriority::BestEffort; ioPriority.level = 0; break;
+            case 2: ioPriority.ioClass = IoPriority::BestEffort; ioPriority.level = 7; break;
+            case 3: ioPriority.ioClass = IoPriority::Idle; break;
+            default: break;
+        }
+
+        const int limitMBps = QInputDialog::getInt(this, "Очередь заданий",
+                                                   "Ограничение скорости, МБ/с (0 - без ограничения):",
+                                                   0, 0, 10000, 5, &ok);
+        if (!ok) return;
+        rateLimit = static_cast<qint64>(limitMBps) * 1024 * 1024;
+    }
+
+    QStringList paths;
+    for (const DeviceInfo& dev : targets) paths << dev.path;
+    // Проверки с сохранением данных возвращают каждый блок на место
+    if (type != 1 && type != 4 && type != 6) {
+        QString msg = QString(
+            "<b>ВНИМАНИЕ! Все данные на устройствах будут уничтожены!</b><br><br>"
+            "Операция: <b>%1</b><br>"
+            "Устройства: <b>%2</b><br><br>"
+            "Продолжить?")
+        .arg(operation)
+        .arg(paths.join(", "));
+        if (QMessageBox::warning(this, "Подтверждение", msg, QMessageBox::Yes | QMessageBox::No) != QMessageBox::Yes) {
+            return;
+        }
+    }
+
+    // Размер образа один на все задания серии - из каталога, без распаковки
+    ImageSource::SizeInfo imageSize;
+    if (type <= 1) imageSize = imageSizeInfo(m_selectedImage.path);
+
+    for (const DeviceInfo& dev : targets) {
+        if (m_activeDevices.contains(dev.path)) {
+            logMessage("WARNING", QString("%1: задание начнется после текущей операции").arg(dev.path));
+        }
+        if (type <= 1) {
+            ImageWriter::Config cfg;
+            cfg.imagePath = m_selectedImage.path;
+            cfg.devicePath = dev.path;
+            cfg.verify = m_verifyCheckbox->isChecked();
+            cfg.force = m_forceCheckbox->isChecked();
+            cfg.checkCapacity = m_capacityCheckbox->isChecked();
+            cfg.verifySample = m_verifyModeCombo->currentIndex() > 0 ? 0.02 : 0;
+            cfg.blockSize = parseBlockSize(m_blockSizeCombo->currentText());
+            cfg.clusterSize = parseBlockSize(m_clusterSizeCombo->currentText());
+            cfg.ioPriority = ioPriority;
+            cfg.rateLimit = rateLimit;
+            if (imageSize.exact) cfg.sizeInfo = imageSize;
+            if (type == 0) {
+                m_scheduler->enqueueWrite(cfg);
+            } else {
+                m_scheduler->enqueueVerify(cfg);
+            }
+        } else if (type == 2) {
+            const FormatRecommendation rec = m_formatManager->getRecommendation(dev.path, dev.sizeBytes);
+            FormatJob::Config cfg;
+            cfg.devicePath = dev.path;
+            cfg.sizeBytes = dev.sizeBytes;
+            cfg.filesystem = rec.filesystem;
+            cfg.clusterSize = rec.clusterSize;
+            m_scheduler->enqueueFormat(cfg);
+        } else if (type == 3) {
+            WipeJob::Config cfg;
+            cfg.devicePath = dev.path;
+            m_scheduler->enqueueWipe(cfg);
+        } else {
+            SurfaceScanJob::Config cfg;
+            cfg.devicePath = dev.path;
+            cfg.mode = type == 4 ? SurfaceScanJob::NonDestructive
+                     : type == 5 ? SurfaceScanJob::Destructive : SurfaceScanJob::Capacity;
+            m_scheduler->enqueueScan(cfg);
+        }
+    }
+    logMessage("INFO", QString("В очередь: %1 - %2").arg(operation).arg(paths.join(", ")));
+}
+
+void MainWindow::onCancelJob() {
+    const QList<QTableWidgetItem*> selected = m_jobTable->selectedItems();
+    if (selected.isEmpty()) {
+        m_scheduler->cancelAll();
+        return;
+    }
+    QSet<int> ids;
+    for (QTableWidgetItem* item : selected) {
+        ids.insert(m_jobTable->item(item->row(), 0)->data(Qt::UserRole).toInt());
+    }
+    for (int id : ids) m_scheduler->cancel(id);
+}
+
+void MainWindow::onJobChanged(int id) {
+    int row = -1;
+    for (int i = 0; i < m_jobTable->rowCount(); ++i) {
+        if (m_jobTable->item(i, 0)->data(Qt::UserRole).toInt() == id) {
+            row = i;
+            break;
+        }
+    }
+
+    const ScheduledJob job = m_scheduler->job(id);
+    if (job.id == 0) {
+        if (row >= 0) m_jobTable->removeRow(row);
+        return;
+    }
+    if (row < 0) {
+        row = m_jobTable->rowCount();
+        m_jobTable->insertRow(row);
+        for (int column = 0; column < m_jobTable->columnCount(); ++column) {
+            m_jobTable->setItem(row, column, new QTableWidgetItem);
+        }
+        m_jobTable->item(row, 0)->setData(Qt::UserRole, id);
+    }
+
+    QString bus = job.bus.controller.isEmpty() ? QString("-") : job.bus.controller;
+    if (job.bus.isUsb()) {
+        const int speed = job.bus.deviceSpeed > 0 ? job.bus.deviceSpeed : job.bus.rootHubSpeed;
+        bus = QString("%1, %2 Мбит/с").arg(job.bus.rootHub).arg(speed);
+    }
+
+    QString progress = job.message;
+    if (job.state == ScheduledJob::Running) {
+        progress = QString("%1% %2").arg(job.percent).arg(job.status);
+        if (job.speedMBps > 0) {
+            progress += QString(", %1 МБ/с, осталось %2").arg(job.speedMBps, 0, 'f', 1).arg(job.timeLeft);
+        }
+        if (job.sourceMBps > 0 && job.deviceMBps > 0) {
+            progress += QString(" (чтение %1, запись %2 МБ/с)")
+                .arg(job.sourceMBps, 0, 'f', 1).arg(job.deviceMBps, 0, 'f', 1);
+        }
+    } else if (job.state == ScheduledJob::Queued) {
+        progress = job.status;
+    }
+
+    m_jobTable->item(row, 0)->setText(QString::number(id));
+    m_jobTable->item(row, 1)->setText(job.typeName());
+    m_jobTable->item(row, 2)->setText(job.devicePath);
+    m_jobTable->item(row, 3)->setText(bus);
+    m_jobTable->item(row, 4)->setText(job.stateName());
+    m_jobTable->item(row, 5)->setText(progress);
+}
+
+void MainWindow::onJobFinished(int id, bool success, const QString& message) {
+    const ScheduledJob job = m_scheduler->job(id);
+    logMessage(success ? "SUCCESS" : "ERROR",
+               QString("Задание %1 (%2, %3): %4").arg(id).arg(job.typeName()).arg(job.devicePath).arg(message));
+
+    // Итог проверки - только если сверка выполнялась (не ошибка записи и не отмена)
+    if (job.verifyRan) {
+        m_catalog->markVerified(job.write.imagePath, job.verifyPassed);
+    }
+
+    // Содержимое носителя изменилось: повторная проверка ФС
+    const int index = findDeviceIndex(job.devicePath);
+    if (index >= 0 && job.type != ScheduledJob::Verify) {
+        m_prober->invalidate(m_devices[index]);
+        m_prober->request(m_devices[index]);
+    }
+    if (!m_scheduler->hasPendingJobs()) {
+        logMessage("INFO", "Очередь заданий выполнена");
+    }
+}
+
 void MainWindow::onWriteProgress(int percent, const QString& status, double speedMBps, const QString& timeLeft) {
     m_progressBar->setValue(percent);
     
@@ -465,6 +1232,14 @@ void MainWindow::onWriteProgress(int percent, const QString& status, double spee
     }
 }
 
+void MainWindow::onWriteThroughput(double sourceMBps, double deviceMBps) {
+    m_sourceMBps = sourceMBps;
+    m_deviceMBps = deviceMBps;
+    // Меньшая из скоростей показывает, что ограничивает запись
+    m_speedLabel->setToolTip(QString("Чтение образа: %1 МБ/с\nЗапись на устройство: %2 МБ/с")
+        .arg(sourceMBps, 0, 'f', 1).arg(deviceMBps, 0, 'f', 1));
+}
+
 void MainWindow::onWriteFinished(bool success, const QString& message) {
     ImageWriter* finishedWriter = qobject_cast<ImageWriter*>(sender());
     
@@ -487,6 +1262,9 @@ void MainWindow::onWriteFinished(bool success, const QString& message) {
         m_writer->deleteLater();
         m_writer = nullptr;
     }
+    // Содержимое носителя изменилось: повторная проверка ФС
+    reprobeDevices(m_activeDevices);
+    setActiveDevice(QString());
     
     if (success) {
         logMessage("SUCCESS", message);
@@ -508,6 +1286,10 @@ void MainWindow::onWriteFinished(bool success, const QString& message) {
         
         // Обновляем финальную скорость
         m_speedLabel->setText(QString("Средняя скорость: %1 МБ/с").arg(speedMBps, 0, 'f', 1));
+        if (m_sourceMBps > 0 && m_deviceMBps > 0) {
+            logMessage("INFO", QString("Чтение образа: %1 МБ/с, запись на устройство: %2 МБ/с")
+                .arg(m_sourceMBps, 0, 'f', 1).arg(m_deviceMBps, 0, 'f', 1));
+        }
         m_timeLeftLabel->setText(QString("Время записи: %1").arg(timeStr));
         
         QMessageBox::information(this, "Успех", 
@@ -548,7 +1330,7 @@ void MainWindow::onWriteFinished(bool success, const QString& message) {
 
 bool MainWindow::validateWriteSettings() {
     // Проверка размера образа относительно устройства
-    if (!Utils::checkImageFitsDevice(m_selectedImage.path, m_selectedDevice.path)) {
+    if (!Utils::checkImageFitsDevice(imageSizeInfo(m_selectedImage.path), m_selectedDevice.path)) {
         logMessage("ERROR", "Размер образа превышает размер устройства!");
         return false;
     }
@@ -603,7 +1385,7 @@ void MainWindow::showFormatDialog() {
     infoLayout->addRow("Размер:", new QLabel(m_selectedDevice.sizeStr));
     infoLayout->addRow("Модель:", new QLabel(m_selectedDevice.model.isEmpty() ? "Неизвестно" : m_selectedDevice.model));
     
-    QString fsType = Utils::getFilesystemType(m_selectedDevice.path);
+    QString fsType = deviceFilesystem(m_selectedDevice);
     infoLayout->addRow("Текущая ФС:", new QLabel(fsType));
     
     QString mounts = m_selectedDevice.mountPoints.isEmpty() ? 
@@ -809,6 +1591,7 @@ void MainWindow::showFormatDialog() {
 void MainWindow::formatDeviceIntelligently(const QString& devicePath, qint64 sizeBytes,
                                           const QString& filesystem, int clusterSize,
                                           const QString& label, bool quickFormat) {
+    if (m_formatJob || isDeviceQueued(devicePath)) return;
     m_currentFormatDevice = devicePath;
     
     // Создаем диалог прогресса
@@ -820,64 +1603,32 @@ void MainWindow::formatDeviceIntelligently(const QString& devicePath, qint64 siz
     m_formatProgressDialog->setCancelButtonText("Отмена");
     m_formatProgressDialog->setMinimumDuration(0);
     
-    // Запускаем форматирование в отдельном потоке
-    QFuture<void> future = QtConcurrent::run([this, devicePath, sizeBytes, filesystem, clusterSize, label, quickFormat]() {
-        updateFormatProgress("Размонтирование устройства...", 10);
-        
-        // Размонтируем устройство
-        auto [success, message] = DeviceManager::unmountAll(devicePath);
-        if (!success && !m_selectedDevice.mountPoints.isEmpty()) {
-            updateFormatProgress("Ошибка: не удалось размонтировать устройство", -1);
-            return;
-        }
-        
-        updateFormatProgress("Начало форматирования...", 20);
-        
-        // Форматируем устройство
-        bool formatSuccess = m_formatManager->formatDevice(devicePath, filesystem, 
-                                                          clusterSize, label, quickFormat);
-        
-        if (formatSuccess) {
-            updateFormatProgress("Форматирование успешно завершено!", 100);
-            QThread::msleep(1000);
-            
-            QMetaObject::invokeMethod(this, [this, devicePath]() {
-                if (m_formatProgressDialog) {
-                    m_formatProgressDialog->close();
-                    m_formatProgressDialog->deleteLater();
-                    m_formatProgressDialog = nullptr;
-                }
-                
-                QMessageBox::information(this, "Успех", 
-                    QString("Устройство %1 успешно отформатировано!").arg(devicePath));
-                
-                // Обновляем информацию об устройстве
-                refreshDevices();
-            }, Qt::QueuedConnection);
-        } else {
-            updateFormatProgress("Ошибка форматирования", -1);
-            
-            QMetaObject::invokeMethod(this, [this]() {
-                if (m_formatProgressDialog) {
-                    m_formatProgressDialog->close();
-                    m_formatProgressDialog->deleteLater();
-                    m_formatProgressDialog = nullptr;
-                }
-                
-                QMessageBox::critical(this, "Ошибка", "Не удалось отформатировать устройство");
-            }, Qt::QueuedConnection);
-        }
+    FormatJob::Config cfg;
+    cfg.devicePath = devicePath;
+    cfg.sizeBytes = sizeBytes;
+    cfg.filesystem = filesystem;
+    cfg.clusterSize = clusterSize;
+    cfg.label = label;
+    cfg.quickFormat = quickFormat;
+
+    m_scheduler->setReserved(devicePath, true);
+    m_formatJob = new FormatJob(cfg, this);
+    connect(m_formatJob, &FormatJob::progress, this,
+            [this](int percent, const QString& status, double, const QString& timeLeft) {
+        updateFormatProgress(timeLeft == "-" ? status : QString("%1 (осталось %2)").arg(status).arg(timeLeft), percent);
     });
-    
-    // Явно игнорируем возвращаемое значение, чтобы избежать предупреждения
-    (void)future;
-    
-    // Обработка отмены
-    connect(m_formatProgressDialog, &QProgressDialog::canceled, [this]() {
-        // Можно добавить логику отмены форматирования
-        QMessageBox::information(this, "Отмена", "Операция форматирования отменена");
+    connect(m_formatJob, &FormatJob::finished, this, &MainWindow::onFormatFinished);
+
+    // Отмена останавливает встроенный форматер или процесс mkfs
+    connect(m_formatProgressDialog, &QProgressDialog::canceled, this, [this]() {
+        if (m_formatJob && m_formatJob->isRunning()) {
+            logMessage("WARNING", "Отмена форматирования...");
+            m_formatJob->cancel();
+        }
     });
-    
+
+    logMessage("INFO", QString("Форматирование %1 в %2").arg(devicePath).arg(filesystem));
+    m_formatJob->start();
     m_formatProgressDialog->show();
 }
 
@@ -920,6 +1671,16 @@ void MainWindow::onFormatFinished(bool success, const QString& message) {
             QString("Не удалось отформатировать устройство:\n\n%1").arg(message));
     }
     
+    if (m_formatJob) {
+        m_formatJob->deleteLater();
+        m_formatJob = nullptr;
+        m_scheduler->setReserved(m_currentFormatDevice, false);
+    }
+    const int formatted = findDeviceIndex(m_currentFormatDevice);
+    if (formatted >= 0) {
+        m_prober->invalidate(m_devices[formatted]);
+    }
+    
     // Обновляем список устройств
     refreshDevices();
     
@@ -967,6 +1728,33 @@ MainWindow::~MainWindow() {
         m_writer = nullptr;
     }
     
+    if (m_wipeJob) {
+        m_wipeJob->cancel();
+        m_wipeJob->wait();
+        delete m_wipeJob;
+        m_wipeJob = nullptr;
+    }
+    
+    if (m_backupJob) {
+        m_backupJob->cancel();
+        m_backupJob->wait();
+        delete m_backupJob;
+        m_backupJob = nullptr;
+    }
+    
+    if (m_cloneJob) {
+        m_cloneJob->cancel();
+        m_cloneJob->wait();
+        delete m_cloneJob;
+        m_cloneJob = nullptr;
+    }
+    
+    if (m_formatJob) {
+        m_formatJob->cancel();
+        delete m_formatJob;
+        m_formatJob = nullptr;
+    }
+    
     if (m_refreshTimer) {
         delete m_refreshTimer;
         m_refreshTimer = nullptr;
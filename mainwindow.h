@@ -11,10 +11,19 @@
 #include <QTimer>
 #include <QElapsedTimer>
 #include <QProgressDialog>
+#include <QSet>
+#include <QTableWidget>
 
 #include "devicemanager.h"
 #include "imagewriter.h"
 #include "formatmanager.h"
+#include "deviceprober.h"
+#include "wipejob.h"
+#include "formatjob.h"
+#include "jobscheduler.h"
+#include "backupjob.h"
+#include "clonejob.h"
+#include "imagecatalog.h"
 
 class MainWindow : public QMainWindow {
     Q_OBJECT
@@ -26,18 +35,32 @@ public:
 private slots:
     void refreshDevices();
     void browseImage();
+    void populateImages();
+    void onManageCatalog();
     void onStartWrite();
     void onCancelWrite();
     void onImageSelected(int index);
     void onDeviceSelected(int index);
     void onWriteProgress(int percent, const QString& status, double speedMBps, const QString& timeLeft);
     void onWriteFinished(bool success, const QString& message);
+    void onWriteThroughput(double sourceMBps, double deviceMBps);
     void logMessage(const QString& level, const QString& msg);
 
     void onFormatDevice();
     void onShowFormatDialog();
     void onFormatProgress(const QString& message, int percent);
     void onFormatFinished(bool success, const QString& message);
+    void onDeviceProbed(const QString& devicePath, const QString& fsType, bool timedOut);
+    void onStartWipe();
+    void onWipeFinished(bool success, const QString& message);
+    void onEnqueueJob();
+    void onCancelJob();
+    void onStartBackup();
+    void onBackupFinished(bool success, const QString& message);
+    void onStartClone();
+    void onCloneFinished(bool success, const QString& message);
+    void onJobChanged(int id);
+    void onJobFinished(int id, bool success, const QString& message);
 
 private:
     void setupUi();
@@ -46,6 +69,14 @@ private:
     bool validateWriteSettings();
     qint64 parseBlockSize(const QString& sizeStr);
     void updateSpeedInfo(double speedMBps, const QString& timeLeft);
+    QString deviceFilesystem(const DeviceInfo& dev) const;
+    QString deviceDisplayText(const DeviceInfo& dev) const;
+    int findDeviceIndex(const QString& devicePath) const;
+    bool isDeviceQueued(const QString& devicePath);
+    void setActiveDevice(const QString& devicePath);
+    void setActiveDevices(const QStringList& devicePaths);
+    void reprobeDevices(const QStringList& devicePaths);
+    ImageSource::SizeInfo imageSizeInfo(const QString& imagePath) const;
 
     void showFormatDialog();
     void formatDeviceIntelligently(const QString& devicePath, qint64 sizeBytes,
@@ -60,6 +91,9 @@ private:
     QComboBox* m_clusterSizeCombo = nullptr;  // Добавили размер кластера
     QCheckBox* m_verifyCheckbox = nullptr;
     QCheckBox* m_forceCheckbox = nullptr;
+    QCheckBox* m_capacityCheckbox = nullptr;
+    QComboBox* m_verifyModeCombo = nullptr;
+    QComboBox* m_imageCacheCombo = nullptr;
 
     QLabel* m_deviceInfoLabel = nullptr;
     QLabel* m_imageInfoLabel = nullptr;
@@ -73,22 +107,42 @@ private:
     QPushButton* m_cancelBtn = nullptr;
     QPushButton* m_refreshBtn = nullptr;
     QPushButton* m_browseBtn = nullptr;
+    QPushButton* m_catalogBtn = nullptr;
 
     // State
     QList<DeviceInfo> m_devices;
+    DeviceProber* m_prober = nullptr;
+    QSet<QString> m_probeTimeouts;  // устройства, не ответившие вовремя
 
     DeviceInfo m_selectedDevice;
     ImageInfo m_selectedImage;
 
     ImageWriter* m_writer = nullptr;
+    ImageCatalog* m_catalog = nullptr;
     QTimer* m_refreshTimer = nullptr;
     QElapsedTimer* m_writeTimer = nullptr;
 
     bool m_cancelled = false;
     qint64 m_totalImageSize = 0;
+    double m_sourceMBps = 0;
+    double m_deviceMBps = 0;
     QString m_lastProgressMessage;
 
     QPushButton* m_formatBtn = nullptr;
+    QPushButton* m_wipeBtn = nullptr;
+    WipeJob* m_wipeJob = nullptr;
+    FormatJob* m_formatJob = nullptr;
+    QPushButton* m_backupBtn = nullptr;
+    BackupJob* m_backupJob = nullptr;
+    QPushButton* m_cloneBtn = nullptr;
+    CloneJob* m_cloneJob = nullptr;
+    QStringList m_activeDevices;  // устройства текущей операции вне очереди
+
+    JobScheduler* m_scheduler = nullptr;
+    QTableWidget* m_jobTable = nullptr;
+    QPushButton* m_enqueueBtn = nullptr;
+    QPushButton* m_cancelJobBtn = nullptr;
+    QPushButton* m_clearJobsBtn = nullptr;
     FormatManager* m_formatManager = nullptr;
     QProgressDialog* m_formatProgressDialog = nullptr;
     QString m_currentFormatDevice;
@@ -0,0 +1,162 @@
+// mounttable.cpp
+#include "mounttable.h"
+#include <QFile>
+#include <QFileInfo>
+#include <QStringList>
+#include <QDebug>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <cerrno>
+#include <cstring>
+
+MountTable& MountTable::instance() {
+    static MountTable instance;
+    return instance;
+}
+
+MountTable::MountTable() {
+    m_fd = ::open("/proc/self/mountinfo", O_RDONLY | O_CLOEXEC);
+    if (m_fd < 0) {
+        qWarning() << "Не удалось открыть /proc/self/mountinfo:" << strerror(errno);
+    }
+}
+
+MountTable::~MountTable() {
+    if (m_fd >= 0) ::close(m_fd);
+}
+
+bool MountTable::refreshIfChanged() {
+    QMutexLocker locker(&m_mutex);
+
+    if (!m_loaded) {
+        reload();
+        return true;
+    }
+    if (m_fd < 0) return false;
+
+    // Ядро выставляет POLLPRI|POLLERR на файле таблицы монтирования
+    // после каждого mount/umount; чтение файла сбрасывает событие
+    struct pollfd pfd;
+    pfd.fd = m_fd;
+    pfd.events = POLLPRI;
+    pfd.revents = 0;
+    if (::poll(&pfd, 1, 0) > 0 && (pfd.revents & (POLLPRI | POLLERR))) {
+        reload();
+        return true;
+    }
+    return false;
+}
+
+QList<MountEntry> MountTable::mountsFor(const QString& devicePath, bool includePartitions) {
+    refreshIfChanged();
+
+    struct stat st;
+    if (::stat(devicePath.toLocal8Bit().constData(), &st) != 0 || !S_ISBLK(st.st_mode)) {
+        return QList<MountEntry>();
+    }
+
+    quint64 key = devKey(major(st.st_rdev), minor(st.st_rdev));
+
+    QMutexLocker locker(&m_mutex);
+    return includePartitions ? m_byDisk.value(key) : m_byDevice.value(key);
+}
+
+void MountTable::reload() {
+    m_byDevice.clear();
+    m_byDisk.clear();
+    m_loaded = true;
+
+    QByteArray data;
+    if (m_fd >= 0 && ::lseek(m_fd, 0, SEEK_SET) == 0) {
+        char buffer[16 * 1024];
+        ssize_t n;
+        while ((n = ::read(m_fd, buffer, sizeof(buffer))) > 0) {
+            data.append(buffer, n);
+        }
+    }
+
+    QHash<quint64, quint64> parents;  // раздел -> диск, один запрос к sysfs на устройство
+
+    // Формат строки: id parent major:minor root mountpoint options [optional...] - fstype source superopts
+    for (const QByteArray& rawLine : data.split('\n')) {
+        if (rawLine.isEmpty()) continue;
+        QStringList fields = QString::fromLocal8Bit(rawLine).split(' ');
+
+        int sep = fields.indexOf("-", 6);
+        if (fields.size() < 6 || sep < 0 || sep + 2 >= fields.size()) continue;
+
+        QStringList devParts = fields[2].split(':');
+        if (devParts.size() != 2) continue;
+
+        MountEntry entry;
+        entry.major = devParts[0].toUInt();
+        entry.minor = devParts[1].toUInt();
+        entry.mountPoint = unescape(fields[4]);
+        entry.options = fields[5];
+        entry.fsType = fields[sep + 1];
+        entry.source = unescape(fields[sep + 2]);
+
+        // btrfs и часть overlay сообщают анонимный st_dev (0:N): устройство
+        // такой ФС - узел из поля source
+        if (entry.major == 0 && entry.source.startsWith("/dev/")) {
+            struct stat st;
+            if (::stat(entry.source.toLocal8Bit().constData(), &st) == 0 && S_ISBLK(st.st_mode)) {
+                entry.major = major(st.st_rdev);
+                entry.minor = minor(st.st_rdev);
+            }
+        }
+
+        quint64 key = devKey(entry.major, entry.minor);
+        m_byDevice[key].append(entry);
+        m_byDisk[key].append(entry);
+
+        if (entry.major == 0) continue;  // виртуальные ФС
+        if (!parents.contains(key)) {
+            parents.insert(key, parentDisk(key));
+        }
+        quint64 parent = parents.value(key);
+        if (parent != 0 && parent != key) {
+            m_byDisk[parent].append(entry);
+        }
+    }
+}
+
+quint64 MountTable::parentDisk(quint64 key) const {
+    // /sys/dev/block/8:17 -> .../block/sdb/sdb1; у раздела есть файл partition
+    QString sysPath = QString("/sys/dev/block/%1:%2").arg(key >> 32).arg(key & 0xFFFFFFFFu);
+    if (!QFile::exists(sysPath + "/partition")) return 0;
+
+    QString partDir = QFileInfo(sysPath).canonicalFilePath();
+    if (partDir.isEmpty()) return 0;
+
+    QFile devFile(QFileInfo(partDir).path() + "/dev");
+    if (!devFile.open(QIODevice::ReadOnly)) return 0;
+
+    QList<QByteArray> parts = devFile.readAll().trimmed().split(':');
+    if (parts.size() != 2) return 0;
+    return devKey(parts[0].toUInt(), parts[1].toUInt());
+}
+
+QString MountTable::unescape(const QString& field) {
+    // Пробелы и спецсимволы экранируются как \040, \011, \012, \134
+    if (!field.contains('\\')) return field;
+
+    QByteArray in = field.toLocal8Bit();
+    QByteArray out;
+    out.reserve(in.size());
+    for (int i = 0; i < in.size(); ++i) {
+        if (in[i] == '\\' && i + 3 < in.size() &&
+            in[i + 1] >= '0' && in[i + 1] <= '7' &&
+            in[i + 2] >= '0' && in[i + 2] <= '7' &&
+            in[i + 3] >= '0' && in[i + 3] <= '7') {
+            out.append(static_cast<char>(((in[i + 1] - '0') << 6) | ((in[i + 2] - '0') << 3) | (in[i + 3] - '0')));
+            i += 3;
+        } else {
+            out.append(in[i]);
+        }
+    }
+    return QString::fromLocal8Bit(out);
+}
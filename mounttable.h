@@ -0,0 +1,50 @@
+// mounttable.h
+#pragma once
+
+#include <QString>
+#include <QList>
+#include <QHash>
+#include <QMutex>
+
+struct MountEntry {
+    QString source;      // /dev/sdb1
+    QString mountPoint;  // /media/user/DISK
+    QString fsType;      // vfat
+    QString options;     // rw,nosuid,...
+    quint32 major = 0;
+    quint32 minor = 0;
+};
+
+// Кэш таблицы монтирования. /proc/self/mountinfo разбирается один раз
+// в индекс по major:minor (разделы дополнительно учитываются у родительского
+// диска) и перечитывается только когда poll() сообщает об изменении.
+class MountTable {
+public:
+    static MountTable& instance();
+
+    // Все точки монтирования устройства; для диска - включая его разделы
+    QList<MountEntry> mountsFor(const QString& devicePath, bool includePartitions = true);
+
+    // Перечитать таблицу, если ядро сообщило об изменении. true - перечитана
+    bool refreshIfChanged();
+
+private:
+    MountTable();
+    ~MountTable();
+    MountTable(const MountTable&) = delete;
+    MountTable& operator=(const MountTable&) = delete;
+
+    void reload();
+    quint64 parentDisk(quint64 devKey) const;
+
+    static quint64 devKey(quint32 major, quint32 minor) {
+        return (static_cast<quint64>(major) << 32) | minor;
+    }
+    static QString unescape(const QString& field);
+
+    QMutex m_mutex;
+    int m_fd = -1;
+    bool m_loaded = false;
+    QHash<quint64, QList<MountEntry>> m_byDevice;  // точное устройство
+    QHash<quint64, QList<MountEntry>> m_byDisk;    // диск + все его разделы
+};
@@ -0,0 +1,405 @@
+// partitiontable.cpp
+#include "partitiontable.h"
+#include "devicemanager.h"
+#include "utils.h"
+#include <QFileInfo>
+#include <QElapsedTimer>
+#include <QSet>
+#include <QRandomGenerator>
+#include <QDebug>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <linux/fs.h>
+#include <linux/blkpg.h>
+#include <linux/netlink.h>
+#include <cerrno>
+#include <cstring>
+
+namespace {
+
+const quint64 MinAlignment = 1024 * 1024;
+const quint32 GptEntryCount = 128;
+const quint32 GptEntrySize = 128;
+
+void put16(uchar* p, quint16 v) { p[0] = v & 0xFF; p[1] = v >> 8; }
+void put32(uchar* p, quint32 v) { put16(p, v & 0xFFFF); put16(p + 2, v >> 16); }
+void put64(uchar* p, quint64 v) { put32(p, v & 0xFFFFFFFFu); put32(p + 4, v >> 32); }
+
+// "EBD0A0A2-B9E5-4433-87C0-68B6B72699C7" -> 16 байт в смешанном порядке GPT
+void putGuid(uchar* p, const QString& guid) {
+    QByteArray hex = guid.toLatin1();
+    hex.replace("-", "");
+    QByteArray raw = QByteArray::fromHex(hex);
+    if (raw.size() != 16) return;
+    const uchar* r = reinterpret_cast<const uchar*>(raw.constData());
+    const int order[16] = {3, 2, 1, 0, 5, 4, 7, 6, 8, 9, 10, 11, 12, 13, 14, 15};
+    for (int i = 0; i < 16; ++i) p[i] = r[order[i]];
+}
+
+// Случайный GUID версии 4
+void putRandomGuid(uchar* p) {
+    for (int i = 0; i < 16; i += 4) put32(p + i, QRandomGenerator::global()->generate());
+    p[7] = (p[7] & 0x0F) | 0x40;
+    p[8] = (p[8] & 0x3F) | 0x80;
+}
+
+QString gptTypeFor(const QString& filesystem) {
+    if (filesystem.startsWith("ext") || filesystem == "btrfs" || filesystem == "XFS") {
+        return "0FC63DAF-8483-4772-8E79-3D69D8477DE4";   // Linux filesystem
+    }
+    if (filesystem == "swap") return "0657FD6D-A4AB-43C4-84E5-0933C84B4F4F";
+    if (filesystem == "EFI") return "C12A7328-F81F-11D2-BA4B-00A0C93EC93B";
+    return "EBD0A0A2-B9E5-4433-87C0-68B6B72699C7";       // Microsoft basic data
+}
+
+quint8 mbrTypeFor(const QString& filesystem) {
+    if (filesystem == "FAT32" || filesystem == "FAT") return 0x0C;  // FAT32 LBA
+    if (filesystem == "FAT16") return 0x0E;
+    if (filesystem == "NTFS" || filesystem == "exFAT") return 0x07;
+    if (filesystem == "swap") return 0x82;
+    if (filesystem == "EFI") return 0xEF;
+    return 0x83;
+}
+
+struct Layout {
+    quint64 firstLba = 0;
+    quint64 lastLba = 0;     // включительно
+};
+
+// Подписка на uevent ядра (группа 1) и udev (группа 2). Открывается до
+// перечитывания таблицы, чтобы события не были потеряны.
+class UeventMonitor {
+public:
+    UeventMonitor() {
+        m_fd = ::socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_KOBJECT_UEVENT);
+        if (m_fd < 0) return;
+        struct sockaddr_nl addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.nl_family = AF_NETLINK;
+        addr.nl_groups = 1 | 2;
+        if (::bind(m_fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0) {
+            addr.nl_groups = 1;
+            if (::bind(m_fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0) {
+                ::close(m_fd);
+                m_fd = -1;
+            }
+        }
+    }
+
+    ~UeventMonitor() {
+        if (m_fd >= 0) ::close(m_fd);
+    }
+
+    // Ждем добавления всех узлов. Событие udev означает, что правила
+    // отработали; если udev не запущен, достаточно события ядра.
+    bool waitForNodes(const QStringList& nodes, int timeoutMs) {
+        QSet<QString> pending;
+        for (const QString& node : nodes) pending.insert(QFileInfo(node).fileName());
+        QSet<QString> kernelSeen;
+
+        QElapsedTimer timer;
+        timer.start();
+        qint64 kernelDoneAt = -1;
+        const int udevGraceMs = 1500;
+
+        while (!pending.isEmpty() && m_fd >= 0) {
+            qint64 left = timeoutMs - timer.elapsed();
+            if (kernelDoneAt >= 0) left = qMin(left, kernelDoneAt + udevGraceMs - timer.elapsed());
+            if (left <= 0) break;
+
+            struct pollfd pfd = { m_fd, POLLIN, 0 };
+            int rc = ::poll(&pfd, 1, static_cast<int>(left));
+            if (rc < 0 && errno == EINTR) continue;
+            if (rc <= 0) break;
+
+            char buffer[8192];
+            ssize_t n;
+            while ((n = ::recv(m_fd, buffer, sizeof(buffer) - 1, 0)) > 0) {
+                buffer[n] = '\0';
+                const bool fromUdev = memcmp(buffer, "libudev", 8) == 0;
+                // Оба формата - последовательность строк KEY=VALUE через '\0'.
+                // У udev перед ними двоичный заголовок: свойства начинаются
+                // с properties_off (после "libudev\0", magic и header_size)
+                ssize_t start = 0;
+                if (fromUdev) {
+                    quint32 propertiesOff = 0;
+                    if (n < 20) continue;
+                    memcpy(&propertiesOff, buffer + 16, sizeof(propertiesOff));
+                    if (propertiesOff >= static_cast<quint32>(n)) continue;
+                    start = propertiesOff;
+                }
+                QString action, devName;
+                for (ssize_t i = start; i < n; i += strlen(buffer + i) + 1) {
+                    const char* s = buffer + i;
+                    if (strncmp(s, "ACTION=", 7) == 0) action = QString::fromLatin1(s + 7);
+                    else if (strncmp(s, "DEVNAME=", 8) == 0) devName = QFileInfo(QString::fromLatin1(s + 8)).fileName();
+                }
+                if ((action != "add" && action != "change") || !pending.contains(devName)) continue;
+                if (fromUdev) {
+                    pending.remove(devName);
+                } else {
+                    kernelSeen.insert(devName);
+                }
+            }
+            bool allKernel = true;
+            for (const QString& name : pending) {
+                if (!kernelSeen.contains(name)) allKernel = false;
+            }
+            if (allKernel && kernelDoneAt < 0) kernelDoneAt = timer.elapsed();
+        }
+
+        // Проверка по факту: узлы могли появиться до открытия сокета
+        for (const QString& node : nodes) {
+            struct stat st;
+            if (::stat(node.toLocal8Bit().constData(), &st) != 0 || !S_ISBLK(st.st_mode)) return false;
+        }
+        return true;
+    }
+
+private:
+    int m_fd = -1;
+};
+
+std::pair<bool, QString> writeAll(int fd, qint64 offset, const QByteArray& data) {
+    qint64 done = 0;
+    while (done < data.size()) {
+        ssize_t n = ::pwrite(fd, data.constData() + done, data.size() - done, offset + done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            return {false, QString("Ошибка записи по смещению %1: %2").arg(offset + done).arg(strerror(errno))};
+        }
+        done += n;
+    }
+    return {true, QString()};
+}
+
+} // namespace
+
+std::pair<bool, QString> PartitionTable::write(const QString& devicePath,
+                                               Scheme scheme,
+                                               const QList<PartitionSpec>& partitions,
+                                               QStringList* partitionNodes,
+                                               int timeoutMs) {
+    if (partitions.isEmpty()) return {false, "Не заданы разделы"};
+    if (scheme == Mbr && partitions.size() > 4) return {false, "MBR поддерживает не более 4 основных разделов"};
+    if (partitions.size() > static_cast<int>(GptEntryCount)) return {false, "Слишком много разделов"};
+
+    QByteArray path = devicePath.toLocal8Bit();
+    struct stat st;
+    if (::stat(path.constData(), &st) != 0) {
+        return {false, QString("Устройство недоступно: %1").arg(strerror(errno))};
+    }
+    const bool block = S_ISBLK(st.st_mode);
+
+    int fd = ::open(path.constData(), O_RDWR | O_CLOEXEC | (block ? O_EXCL : 0));
+    if (fd < 0) {
+        return {false, errno == EBUSY ? QString("Устройство занято (смонтировано или используется)")
+                                      : QString("Не удалось открыть устройство: %1").arg(strerror(errno))};
+    }
+
+    quint64 sizeBytes = static_cast<quint64>(st.st_size);
+    quint32 sector = 512;
+    quint64 alignment = MinAlignment;
+    if (block) {
+        if (::ioctl(fd, BLKGETSIZE64, &sizeBytes) != 0) sizeBytes = 0;
+        int lbs = 0;
+        if (::ioctl(fd, BLKSSZGET, &lbs) == 0 && lbs >= 512) sector = static_cast<quint32>(lbs);
+        const DeviceTopology topo = DeviceManager::readTopology(devicePath);
+        if (topo.optimalIoSize > alignment && topo.optimalIoSize % sector == 0) alignment = topo.optimalIoSize;
+    }
+
+    const quint64 totalSectors = sizeBytes / sector;
+    const quint64 entrySectors = (GptEntryCount * GptEntrySize + sector - 1) / sector;
+    const quint64 alignSectors = alignment / sector;
+    if (totalSectors < alignSectors * 2 + 2 * entrySectors + 2) {
+        ::close(fd);
+        return {false, "Устройство слишком мало"};
+    }
+    if (scheme == Mbr && totalSectors > 0xFFFFFFFFULL) {
+        ::close(fd);
+        return {false, "Устройство слишком велико для MBR, используйте GPT"};
+    }
+
+    // Последний сектор, доступный разделам
+    const quint64 lastUsable = scheme == Gpt ? totalSectors - entrySectors - 2 : totalSectors - 1;
+
+    // Раскладка: начало каждого раздела на границе выравнивания,
+    // конец - на границе (кроме последнего раздела до конца диска)
+    QList<Layout> layout;
+    quint64 next = alignSectors;
+    for (int i = 0; i < partitions.size(); ++i) {
+        const PartitionSpec& spec = partitions[i];
+        Layout part;
+        part.firstLba = (next + alignSectors - 1) / alignSectors * alignSectors;
+        if (part.firstLba > lastUsable) {
+            ::close(fd);
+            return {false, QString("Раздел %1 не помещается на устройство").arg(i + 1)};
+        }
+        if (spec.sizeBytes == 0) {
+            part.lastLba = lastUsable;
+        } else {
+            quint64 count = (spec.sizeBytes + sector - 1) / sector;
+            count = (count + alignSectors - 1) / alignSectors * alignSectors;
+            part.lastLba = qMin(lastUsable, part.firstLba + count - 1);
+        }
+        layout.append(part);
+        next = part.lastLba + 1;
+    }
+
+    // Первые сектора: MBR + (для GPT) заголовок и массив записей.
+    // Для MBR область GPT обнуляется, чтобы старая GPT не перекрывала новую таблицу.
+    QByteArray head(static_cast<int>((2 + entrySectors) * sector), '\0');
+    QByteArray tail(static_cast<int>((1 + entrySectors) * sector), '\0');
+    uchar* mbr = reinterpret_cast<uchar*>(head.data());
+    put32(mbr + 440, QRandomGenerator::global()->generate());   // подпись диска
+    mbr[510] = 0x55;
+    mbr[511] = 0xAA;
+
+    if (scheme == Gpt) {
+        // Защитный MBR: один раздел 0xEE на весь диск
+        uchar* pe = mbr + 446;
+        pe[1] = 0x00; pe[2] = 0x02; pe[3] = 0x00;
+        pe[4] = 0xEE;
+        pe[5] = 0xFF; pe[6] = 0xFF; pe[7] = 0xFF;
+        put32(pe + 8, 1);
+        put32(pe + 12, static_cast<quint32>(qMin<quint64>(totalSectors - 1, 0xFFFFFFFFULL)));
+
+        uchar* entries = mbr + 2 * sector;
+        for (int i = 0; i < partitions.size(); ++i) {
+            uchar* e = entries + i * GptEntrySize;
+            putGuid(e, gptTypeFor(partitions[i].filesystem));
+            putRandomGuid(e + 16);
+            put64(e + 32, layout[i].firstLba);
+            put64(e + 40, layout[i].lastLba);
+            const QString name = partitions[i].name.left(36);
+            for (int c = 0; c < name.size(); ++c) put16(e + 56 + c * 2, name.at(c).unicode());
+        }
+        const quint32 entriesCrc = Utils::crc32(entries, GptEntryCount * GptEntrySize);
+
+        uchar diskGuid[16];
+        putRandomGuid(diskGuid);
+
+        auto buildHeader = [&](uchar* h, quint64 myLba, quint64 altLba, quint64 entriesLba) {
+            memcpy(h, "EFI PART", 8);
+            put32(h + 8, 0x00010000);
+            put32(h + 12, 92);
+            put64(h + 24, myLba);
+            put64(h + 32, altLba);
+            put64(h + 40, 2 + entrySectors);
+            put64(h + 48, lastUsable);
+            memcpy(h + 56, diskGuid, 16);
+            put64(h + 72, entriesLba);
+            put32(h + 80, GptEntryCount);
+            put32(h + 84, GptEntrySize);
+            put32(h + 88, entriesCrc);
+            put32(h + 16, Utils::crc32(h, 92));
+        };
+
+        const quint64 lastLba = totalSectors - 1;
+        buildHeader(mbr + sector, 1, lastLba, 2);
+
+        // Резервная копия: массив записей, затем заголовок в последнем секторе
+        uchar* backup = reinterpret_cast<uchar*>(tail.data());
+        memcpy(backup, entries, entrySectors * sector);
+        buildHeader(backup + entrySectors * sector, lastLba, 1, lastLba - entrySectors);
+    } else {
+        for (int i = 0; i < partitions.size(); ++i) {
+            uchar* pe = mbr + 446 + i * 16;
+            // CHS не используется: LBA-адресация (0xFE/0xFF/0xFF)
+            pe[1] = 0xFE; pe[2] = 0xFF; pe[3] = 0xFF;
+            pe[4] = mbrTypeFor(partitions[i].filesystem);
+            pe[5] = 0xFE; pe[6] = 0xFF; pe[7] = 0xFF;
+            put32(pe + 8, static_cast<quint32>(layout[i].firstLba));
+            put32(pe + 12, static_cast<quint32>(layout[i].lastLba - layout[i].firstLba + 1));
+        }
+    }
+
+    // Сначала резервная область в конце, последним - начало диска
+    const qint64 tailOffset = static_cast<qint64>((totalSectors - entrySectors - 1) * sector);
+    auto result = writeAll(fd, tailOffset, tail);
+    if (result.first) result = writeAll(fd, 0, head);
+    if (result.first && ::fsync(fd) != 0) {
+        result = {false, QString("Ошибка синхронизации: %1").arg(strerror(errno))};
+    }
+    if (!result.first) {
+        ::close(fd);
+        return result;
+    }
+
+    qDebug() << "Таблица разделов" << (scheme == Gpt ? "GPT" : "MBR") << "записана на" << devicePath;
+
+    if (!block) {
+        ::close(fd);
+        return {true, QString()};
+    }
+
+    QStringList nodes;
+    QList<std::pair<quint64, quint64>> ranges;
+    for (int i = 0; i < layout.size(); ++i) {
+        nodes << DeviceManager::partitionPath(devicePath, i + 1);
+        ranges.append({layout[i].firstLba * sector, (layout[i].lastLba - layout[i].firstLba + 1) * sector});
+    }
+
+    // Закрытие записанного устройства запускает у udev пересканирование
+    // (правило watch): узлы удалились бы и появились снова посреди ожидания.
+    // Поэтому fd открыт, пока узлы не появятся
+    UeventMonitor monitor;
+    result = rereadPartitions(fd, devicePath, ranges);
+    if (!result.first) {
+        ::close(fd);
+        return result;
+    }
+
+    const bool nodesReady = monitor.waitForNodes(nodes, timeoutMs);
+    ::close(fd);
+    if (!nodesReady) {
+        return {false, QString("Узлы разделов не появились за %1 мс").arg(timeoutMs)};
+    }
+    if (partitionNodes) *partitionNodes = nodes;
+    return {true, QString()};
+}
+
+std::pair<bool, QString> PartitionTable::rereadPartitions(int fd, const QString& devicePath,
+                                                          const QList<std::pair<quint64, quint64>>& ranges) {
+    ::ioctl(fd, BLKFLSBUF, 0);
+    if (::ioctl(fd, BLKRRPART, 0) == 0) return {true, QString()};
+    if (errno != EBUSY) {
+        return {false, QString("BLKRRPART: %1").arg(strerror(errno))};
+    }
+
+    // Диск занят (например, открыт раздел): обновляем разделы по одному
+    qWarning() << "BLKRRPART занят, обновление разделов через BLKPG";
+    for (const PartitionInfo& old : DeviceManager::getPartitions(QFileInfo(devicePath).fileName())) {
+        struct blkpg_partition part;
+        memset(&part, 0, sizeof(part));
+        part.pno = old.number;
+        struct blkpg_ioctl_arg arg;
+        memset(&arg, 0, sizeof(arg));
+        arg.op = BLKPG_DEL_PARTITION;
+        arg.datalen = sizeof(part);
+        arg.data = &part;
+        if (::ioctl(fd, BLKPG, &arg) != 0) {
+            return {false, QString("Не удалось удалить раздел %1: %2").arg(old.number).arg(strerror(errno))};
+        }
+    }
+    for (int i = 0; i < ranges.size(); ++i) {
+        struct blkpg_partition part;
+        memset(&part, 0, sizeof(part));
+        part.start = static_cast<long long>(ranges[i].first);
+        part.length = static_cast<long long>(ranges[i].second);
+        part.pno = i + 1;
+        struct blkpg_ioctl_arg arg;
+        memset(&arg, 0, sizeof(arg));
+        arg.op = BLKPG_ADD_PARTITION;
+        arg.datalen = sizeof(part);
+        arg.data = &part;
+        if (::ioctl(fd, BLKPG, &arg) != 0) {
+            return {false, QString("Не удалось добавить раздел %1: %2").arg(i + 1).arg(strerror(errno))};
+        }
+    }
+    return {true, QString()};
+}
@@ -0,0 +1,34 @@
+// partitiontable.h
+#pragma once
+
+#include <QString>
+#include <QStringList>
+#include <QList>
+#include <utility>
+
+struct PartitionSpec {
+    quint64 sizeBytes = 0;   // 0 - до конца диска
+    QString filesystem;      // по нему выбирается тип раздела
+    QString name;            // имя раздела GPT
+};
+
+// Запись таблицы разделов без parted. Таблица (GPT с защитным MBR и
+// резервной копией или MBR) собирается в памяти, разделы выравниваются
+// по optimal I/O устройства (не меньше 1 MB). После записи ядро
+// перечитывает таблицу (BLKRRPART, при занятости - BLKPG), а появление
+// узлов разделов ожидается по uevent.
+class PartitionTable {
+public:
+    enum Scheme { Mbr, Gpt };
+
+    // partitionNodes - пути созданных разделов (/dev/sdb1, /dev/mmcblk0p1)
+    static std::pair<bool, QString> write(const QString& devicePath,
+                                          Scheme scheme,
+                                          const QList<PartitionSpec>& partitions,
+                                          QStringList* partitionNodes = nullptr,
+                                          int timeoutMs = 10000);
+
+private:
+    static std::pair<bool, QString> rereadPartitions(int fd, const QString& devicePath,
+                                                     const QList<std::pair<quint64, quint64>>& ranges);
+};
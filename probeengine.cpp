@@ -0,0 +1,734 @@
+// probeengine.cpp
+#include "probeengine.h"
+#include "devicemanager.h"
+#include "utils.h"
+#include <QStringList>
+#include <QDebug>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <cstring>
+#include <cerrno>
+
+namespace {
+
+quint16 le16(const uchar* p) { return static_cast<quint16>(p[0] | (p[1] << 8)); }
+quint32 le32(const uchar* p) { return static_cast<quint32>(le16(p)) | (static_cast<quint32>(le16(p + 2)) << 16); }
+quint64 le64(const uchar* p) { return static_cast<quint64>(le32(p)) | (static_cast<quint64>(le32(p + 4)) << 32); }
+quint16 be16(const uchar* p) { return static_cast<quint16>((p[0] << 8) | p[1]); }
+quint32 be32(const uchar* p) { return (static_cast<quint32>(be16(p)) << 16) | be16(p + 2); }
+
+// Строка фиксированной длины с хвостовыми пробелами/нулями
+QString fixedString(const uchar* p, int length) {
+    QByteArray raw(reinterpret_cast<const char*>(p), length);
+    int end = raw.indexOf('\0');
+    if (end >= 0) raw.truncate(end);
+    return QString::fromUtf8(raw).trimmed();
+}
+
+QString hexUuid(const uchar* p, int length) {
+    return QString::fromLatin1(QByteArray(reinterpret_cast<const char*>(p), length).toHex());
+}
+
+// GUID в смешанном порядке байт (GPT, Microsoft)
+QString guidString(const uchar* p) {
+    return QString("%1-%2-%3-%4-%5")
+    .arg(le32(p), 8, 16, QChar('0'))
+    .arg(le16(p + 4), 4, 16, QChar('0'))
+    .arg(le16(p + 6), 4, 16, QChar('0'))
+    .arg(hexUuid(p + 8, 2))
+    .arg(hexUuid(p + 10, 6))
+    .toUpper();
+}
+
+// Окно данных, прочитанное с начала ФС; base - его абсолютное смещение
+struct Window {
+    const uchar* data;
+    qint64 size;
+    qint64 base;
+
+    bool has(qint64 offset, qint64 length) const { return offset >= 0 && offset + length <= size; }
+};
+
+struct Hit {
+    QString type;
+    QString label;
+    QString uuid;
+    QList<ProbeSignature> extra;  // дополнительные магии (резервные копии и т.п.)
+
+    void addSignature(const QString& sigType, qint64 offset, int length) {
+        ProbeSignature sig;
+        sig.type = sigType;
+        sig.offset = offset;
+        sig.length = length;
+        extra.append(sig);
+    }
+};
+
+typedef bool (*Detector)(const Window& w, Hit& hit);
+
+struct SignatureRule {
+    qint64 offset;      // смещение магии от начала ФС
+    const char* magic;
+    int magicLength;
+    const char* type;   // тип, если детектор не уточнил
+    Detector detect;    // nullptr - достаточно совпадения магии
+};
+
+bool detectFat(const Window& w, Hit& hit) {
+    const uchar* b = w.data;
+    quint16 bytesPerSector = le16(b + 11);
+    quint8 sectorsPerCluster = b[13];
+    quint16 reserved = le16(b + 14);
+    quint8 fats = b[16];
+    quint8 media = b[21];
+
+    if (bytesPerSector != 512 && bytesPerSector != 1024 && bytesPerSector != 2048 && bytesPerSector != 4096)
+        return false;
+    if (sectorsPerCluster == 0 || (sectorsPerCluster & (sectorsPerCluster - 1)) != 0) return false;
+    if (reserved == 0 || fats == 0 || fats > 2) return false;
+    if (media != 0xF0 && media < 0xF8) return false;
+
+    quint32 rootEntries = le16(b + 17);
+    quint32 totalSectors = le16(b + 19) ? le16(b + 19) : le32(b + 32);
+    quint32 fatSize = le16(b + 22) ? le16(b + 22) : le32(b + 36);
+    if (totalSectors == 0 || fatSize == 0) return false;
+
+    quint32 rootDirSectors = (rootEntries * 32 + bytesPerSector - 1) / bytesPerSector;
+    quint64 meta = reserved + static_cast<quint64>(fats) * fatSize + rootDirSectors;
+    if (meta >= totalSectors) return false;
+    quint64 clusters = (totalSectors - meta) / sectorsPerCluster;
+
+    // Тип FAT определяется только числом кластеров
+    bool fat32 = le16(b + 22) == 0;
+    if (fat32) {
+        hit.type = "FAT32";
+    } else {
+        hit.type = clusters < 4085 ? "FAT12" : "FAT16";
+    }
+
+    int extOffset = fat32 ? 0x40 : 0x24;
+    if (b[extOffset + 2] == 0x29) {
+        quint32 serial = le32(b + extOffset + 3);
+        hit.uuid = QString("%1-%2").arg(serial >> 16, 4, 16, QChar('0')).arg(serial & 0xFFFF, 4, 16, QChar('0')).toUpper();
+        QString label = fixedString(b + extOffset + 7, 11);
+        if (label != "NO NAME") hit.label = label;
+        hit.addSignature(hit.type, w.base + extOffset + 0x12, 8);  // "FAT32   "
+    }
+
+    if (fat32) {
+        quint16 backup = le16(b + 50);
+        if (backup != 0 && backup != 0xFFFF && backup < reserved) {
+            hit.addSignature(hit.type, w.base + static_cast<qint64>(backup) * bytesPerSector + 0x1FE, 2);
+        }
+    }
+    return true;
+}
+
+bool detectExfat(const Window& w, Hit& hit) {
+    const uchar* b = w.data;
+    quint8 sectorShift = b[0x6C];
+    if (sectorShift < 9 || sectorShift > 12) return false;
+    hit.type = "exFAT";
+    quint32 serial = le32(b + 0x64);
+    hit.uuid = QString("%1-%2").arg(serial >> 16, 4, 16, QChar('0')).arg(serial & 0xFFFF, 4, 16, QChar('0')).toUpper();
+    // Резервная загрузочная область начинается с сектора 12
+    hit.addSignature("exFAT", w.base + (12LL << sectorShift) + 3, 8);
+    return true;
+}
+
+bool detectNtfs(const Window& w, Hit& hit) {
+    const uchar* b = w.data;
+    quint16 bytesPerSector = le16(b + 11);
+    if (bytesPerSector < 256 || bytesPerSector > 4096) return false;
+    hit.type = "NTFS";
+    hit.uuid = QString::number(le64(b + 0x48), 16).toUpper();
+    // Копия загрузочного сектора лежит в последнем секторе тома
+    quint64 totalSectors = le64(b + 0x28);
+    if (totalSectors > 0) {
+        hit.addSignature("NTFS", w.base + static_cast<qint64>(totalSectors * bytesPerSector) + 3, 8);
+    }
+    return true;
+}
+
+bool detectExt(const Window& w, Hit& hit) {
+    if (!w.has(1024, 1024)) return false;
+    const uchar* sb = w.data + 1024;
+    quint32 compat = le32(sb + 0x5C);
+    quint32 incompat = le32(sb + 0x60);
+    quint32 roCompat = le32(sb + 0x64);
+
+    if (incompat & 0x0008) {
+        hit.type = "jbd";           // внешний журнал
+    } else if ((incompat & (0x0040 | 0x0080 | 0x0100 | 0x0200 | 0x8000)) ||
+               (roCompat & (0x0008 | 0x0010 | 0x0020 | 0x0040 | 0x0400))) {
+        hit.type = "ext4";          // extents, 64bit, flex_bg, huge_file, metadata_csum...
+    } else if (compat & 0x0004) {
+        hit.type = "ext3";          // has_journal
+    } else {
+        hit.type = "ext2";
+    }
+    hit.uuid = hexUuid(sb + 0x68, 16);
+    hit.label = fixedString(sb + 0x78, 16);
+
+    // Резервные суперблоки в группах 1, 3, 5, 7, 9, 25, 27, 49, ... (sparse_super)
+    quint32 logBlockSize = le32(sb + 0x18);
+    quint32 blocksPerGroup = le32(sb + 0x20);
+    quint64 blocksCount = le32(sb + 0x04);
+    if (incompat & 0x0080) blocksCount |= static_cast<quint64>(le32(sb + 0x150)) << 32;
+    if (logBlockSize <= 6 && blocksPerGroup > 0) {
+        quint64 blockSize = 1024ULL << logBlockSize;
+        quint32 firstDataBlock = le32(sb + 0x14);
+        quint64 groups = (blocksCount + blocksPerGroup - 1) / blocksPerGroup;
+        bool sparse = roCompat & 0x0001;
+        for (quint64 g = 1; g < groups; ++g) {
+            bool backup = !sparse || g == 1;
+            for (quint64 base : {3ULL, 5ULL, 7ULL}) {
+                for (quint64 p = base; p <= g && !backup; p *= base) {
+                    if (p == g) backup = true;
+                }
+            }
+            if (!backup) continue;
+            quint64 block = firstDataBlock + g * blocksPerGroup;
+            // Суперблок лежит в начале блока группы (при 1K блоках - сам блок)
+            hit.addSignature(hit.type, w.base + static_cast<qint64>(block * blockSize) + 0x38, 2);
+        }
+    }
+    return true;
+}
+
+bool detectIso(const Window& w, Hit& hit) {
+    hit.type = "ISO9660";
+    hit.label = fixedString(w.data + 0x8028, 32);
+
+    // Дескрипторы томов идут по 2 KB до терминатора; NSR02/NSR03 - мост UDF
+    for (qint64 off = 0x8800; w.has(off, 6); off += 0x800) {
+        const char* id = reinterpret_cast<const char*>(w.data + off + 1);
+        if (memcmp(id, "CD001", 5) == 0 || memcmp(id, "BEA01", 5) == 0 ||
+            memcmp(id, "NSR02", 5) == 0 || memcmp(id, "NSR03", 5) == 0 ||
+            memcmp(id, "TEA01", 5) == 0 || memcmp(id, "BOOT2", 5) == 0 ||
+            memcmp(id, "CDW02", 5) == 0) {
+            if (memcmp(id, "NSR0", 4) == 0) hit.type = "UDF";
+            hit.addSignature(hit.type, w.base + off + 1, 5);
+        } else {
+            break;
+        }
+    }
+    return true;
+}
+
+bool detectUdf(const Window& w, Hit& hit) {
+    for (qint64 off = 0x8800; w.has(off, 6); off += 0x800) {
+        const char* id = reinterpret_cast<const char*>(w.data + off + 1);
+        if (memcmp(id, "NSR02", 5) == 0 || memcmp(id, "NSR03", 5) == 0) {
+            hit.type = "UDF";
+            hit.addSignature("UDF", w.base + off + 1, 5);
+            return true;
+        }
+        if (memcmp(id, "TEA01", 5) == 0) break;
+    }
+    return false;
+}
+
+bool detectHfsPlus(const Window& w, Hit& hit) {
+    quint16 version = be16(w.data + 0x402);
+    if (version != 4 && version != 5) return false;
+    hit.type = "HFS+";
+    return true;
+}
+
+bool detectHfs(const Window& w, Hit& hit) {
+    // "BD" слишком короткая магия: проверяем размер блока выделения
+    if (!w.has(0x400, 0x80)) return false;
+    quint32 blockSize = be32(w.data + 0x414);
+    if (blockSize == 0 || blockSize % 512 != 0) return false;
+    hit.type = "HFS";
+    hit.label = fixedString(w.data + 0x425, qMin<int>(w.data[0x424], 27));
+    return true;
+}
+
+bool detectXfs(const Window& w, Hit& hit) {
+    hit.type = "XFS";
+    hit.uuid = hexUuid(w.data + 0x20, 16);
+    hit.label = fixedString(w.data + 0x6C, 12);
+    return true;
+}
+
+bool detectBtrfs(const Window& w, Hit& hit) {
+    hit.type = "btrfs";
+    hit.uuid = hexUuid(w.data + 0x10020, 16);
+    if (w.has(0x1012B, 256)) hit.label = fixedString(w.data + 0x1012B, 256);
+    // Зеркала суперблока на 64 MB и 256 GB (за пределами тома отбрасываются)
+    hit.addSignature("btrfs", w.base + 0x4000000LL + 0x40, 8);
+    hit.addSignature("btrfs", w.base + 0x4000000000LL + 0x40, 8);
+    return true;
+}
+
+bool detectLvm(const Window& w, Hit& hit) {
+    // LABELONE может лежать в любом из первых четырех секторов
+    if (!w.has(0, 4 * 512)) return false;
+    for (qint64 off = 0; off < 4 * 512; off += 512) {
+        if (memcmp(w.data + off, "LABELONE", 8) == 0 && memcmp(w.data + off + 0x18, "LVM2 001", 8) == 0) {
+            hit.type = "LVM2";
+            hit.addSignature("LVM2", w.base + off, 8);
+            hit.addSignature("LVM2", w.base + off + 0x18, 8);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool detectSwap(const Window& w, Hit& hit) {
+    hit.type = "swap";
+    if (w.has(0x400 + 0x1C, 16)) {
+        hit.label = fixedString(w.data + 0x400 + 0x1C, 16);
+        hit.uuid = hexUuid(w.data + 0x400 + 0x0C, 16);
+    }
+    return true;
+}
+
+// Порядок важен: более строгие сигнатуры раньше слабых
+const SignatureRule kRules[] = {
+    { 0,        "LUKS\xBA\xBE",       6, "LUKS",       nullptr },
+    { 3,        "-FVE-FS-",           8, "BitLocker",  nullptr },
+    { 3,        "EXFAT   ",           8, "exFAT",      detectExfat },
+    { 3,        "NTFS    ",           8, "NTFS",       detectNtfs },
+    { 0x1FE,    "\x55\xAA",           2, "FAT",        detectFat },
+    { 0x438,    "\x53\xEF",           2, "ext",        detectExt },
+    { 0,        "XFSB",               4, "XFS",        detectXfs },
+    { 0x10040,  "_BHRfS_M",           8, "btrfs",      detectBtrfs },
+    { 0x400,    "\x10\x20\xF5\xF2",   4, "F2FS",       nullptr },
+    { 0,        "hsqs",               4, "squashfs",   nullptr },
+    { 0x8001,   "CD001",              5, "ISO9660",    detectIso },
+    { 0x8001,   "BEA01",              5, "UDF",        detectUdf },
+    { 0x400,    "H+",                 2, "HFS+",       detectHfsPlus },
+    { 0x400,    "HX",                 2, "HFS+",       detectHfsPlus },
+    { 0x400,    "BD",                 2, "HFS",        detectHfs },
+    { 0,        "\xFC\x4E\x2B\xA9",   4, "linux_raid", nullptr },   // md 1.1
+    { 0x1000,   "\xFC\x4E\x2B\xA9",   4, "linux_raid", nullptr },   // md 1.2
+    { 0x18,     "LVM2 001",           8, "LVM2",       detectLvm },
+    { 0x218,    "LVM2 001",           8, "LVM2",       detectLvm },
+    { 0x418,    "LVM2 001",           8, "LVM2",       detectLvm },
+    { 0x618,    "LVM2 001",           8, "LVM2",       detectLvm },
+    { 0xFF6,    "SWAPSPACE2",        10, "swap",       detectSwap },
+    { 0x1FF6,   "SWAPSPACE2",        10, "swap",       detectSwap },
+    { 0x3FF6,   "SWAPSPACE2",        10, "swap",       detectSwap },
+    { 0xFFF6,   "SWAPSPACE2",        10, "swap",       detectSwap },
+};
+
+struct GptTypeName {
+    const char* guid;
+    const char* name;
+};
+
+const GptTypeName kGptTypes[] = {
+    { "C12A7328-F81F-11D2-BA4B-00A0C93EC93B", "EFI System" },
+    { "21686148-6449-6E6F-744E-656564454649", "BIOS boot" },
+    { "E3C9E316-0B5C-4DB8-817D-F92DF00215AE", "Microsoft reserved" },
+    { "EBD0A0A2-B9E5-4433-87C0-68B6B72699C7", "Microsoft basic data" },
+    { "DE94BBA4-06D1-4D40-A16A-BFD50179D6AC", "Windows recovery" },
+    { "0FC63DAF-8483-4772-8E79-3D69D8477DE4", "Linux filesystem" },
+    { "4F68BCE3-E8CD-4DB1-96E7-FBCAF984B709", "Linux root (x86-64)" },
+    { "B921B045-1DF0-41C3-AF44-4C6F280D3FAE", "Linux root (ARM64)" },
+    { "0657FD6D-A4AB-43C4-84E5-0933C84B4F4F", "Linux swap" },
+    { "E6D6D379-F507-44C2-A23C-238F2A3DF928", "Linux LVM" },
+    { "A19D880F-05FC-4D3B-A006-743F0F84911E", "Linux RAID" },
+    { "BC13C2FF-59E6-4262-A352-B275FD6F7172", "Linux extended boot" },
+    { "933AC7E1-2EB4-4F13-B844-0E14E2AEF915", "Linux home" },
+    { "48465300-0000-11AA-AA11-00306543ECAC", "Apple HFS+" },
+    { "7C3457EF-0000-11AA-AA11-00306543ECAC", "Apple APFS" },
+    { "426F6F74-0000-11AA-AA11-00306543ECAC", "Apple boot" },
+    { "516E7CB4-6ECF-11D6-8FF8-00022D09712B", "FreeBSD" },
+    { "FE3A2A5D-4F32-41A7-B725-ACCC3285A309", "ChromeOS kernel" },
+    { "3CB8E202-3B7E-47DD-8A3C-7FF2A13CFCEC", "ChromeOS root" },
+};
+
+QString gptTypeName(const QString& guid) {
+    for (const GptTypeName& t : kGptTypes) {
+        if (guid == t.guid) return t.name;
+    }
+    return QString();
+}
+
+QString mbrTypeName(quint8 type) {
+    switch (type) {
+        case 0x01: return "FAT12";
+        case 0x04: case 0x06: case 0x0E: return "FAT16";
+        case 0x05: case 0x0F: case 0x85: return "Extended";
+        case 0x07: return "NTFS/exFAT/HPFS";
+        case 0x0B: case 0x0C: return "W95 FAT32";
+        case 0x82: return "Linux swap";
+        case 0x83: return "Linux";
+        case 0x8E: return "Linux LVM";
+        case 0xA5: return "FreeBSD";
+        case 0xAF: return "macOS HFS";
+        case 0xEE: return "GPT protective";
+        case 0xEF: return "EFI System";
+        case 0xFD: return "Linux RAID";
+        default: return "MBR partition";
+    }
+}
+
+bool isExtendedType(quint8 type) {
+    return type == 0x05 || type == 0x0F || type == 0x85;
+}
+
+// Чтение устройства выровненными окнами. O_DIRECT не засоряет page cache
+// и не возвращает устаревшие данные после записи мимо кэша.
+class WindowReader {
+public:
+    explicit WindowReader(const QString& path) {
+        QByteArray p = path.toLocal8Bit();
+        m_fd = ::open(p.constData(), O_RDONLY | O_CLOEXEC | O_DIRECT);
+        if (m_fd < 0) {
+            m_fd = ::open(p.constData(), O_RDONLY | O_CLOEXEC);
+            m_direct = false;
+        }
+        if (m_fd < 0) {
+            m_error = strerror(errno);
+            return;
+        }
+        if (posix_memalign(&m_buffer, 4096, ProbeEngine::WindowSize) != 0) {
+            m_buffer = nullptr;
+            m_error = "нет памяти";
+            return;
+        }
+
+        struct stat st;
+        if (::fstat(m_fd, &st) == 0) {
+            if (S_ISBLK(st.st_mode)) {
+                quint64 size = 0;
+                if (::ioctl(m_fd, BLKGETSIZE64, &size) == 0) m_size = size;
+                int sector = 0;
+                if (::ioctl(m_fd, BLKSSZGET, &sector) == 0 && sector > 0) m_sectorSize = sector;
+            } else {
+                m_size = static_cast<quint64>(st.st_size);
+            }
+        }
+    }
+
+    ~WindowReader() {
+        free(m_buffer);
+        if (m_fd >= 0) ::close(m_fd);
+    }
+
+    bool isOpen() const { return m_fd >= 0 && m_buffer; }
+    QString error() const { return m_error; }
+    quint64 size() const { return m_size; }
+    quint32 sectorSize() const { return m_sectorSize; }
+
+    // Окно не больше WindowSize; возвращает число прочитанных байт
+    qint64 read(qint64 offset, qint64 length, const uchar** data) {
+        length = qMin(length, ProbeEngine::WindowSize);
+        if (m_size > 0 && static_cast<quint64>(offset) >= m_size) return 0;
+
+        qint64 aligned = offset & ~static_cast<qint64>(4095);
+        qint64 skip = offset - aligned;
+        qint64 span = qMin<qint64>(ProbeEngine::WindowSize, ((skip + length + 4095) / 4096) * 4096);
+
+        ssize_t n = preadFull(aligned, span);
+        if (n < 0 && m_direct && errno == EINVAL) {
+            // Файл на ФС без поддержки O_DIRECT: переоткрываем буферизированно
+            reopenBuffered();
+            n = preadFull(aligned, span);
+        }
+        if (n <= skip) return 0;
+        *data = static_cast<const uchar*>(m_buffer) + skip;
+        return qMin<qint64>(n - skip, length);
+    }
+
+private:
+    ssize_t preadFull(qint64 offset, qint64 length) {
+        ssize_t total = 0;
+        while (total < length) {
+            ssize_t n = ::pread(m_fd, static_cast<char*>(m_buffer) + total, length - total, offset + total);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) return total > 0 ? total : -1;
+            if (n == 0) break;
+            total += n;
+        }
+        return total;
+    }
+
+    void reopenBuffered() {
+        int flags = ::fcntl(m_fd, F_GETFL);
+        if (flags >= 0 && ::fcntl(m_fd, F_SETFL, flags & ~O_DIRECT) == 0) {
+            m_direct = false;
+        }
+    }
+
+    int m_fd = -1;
+    bool m_direct = true;
+    void* m_buffer = nullptr;
+    quint64 m_size = 0;
+    quint32 m_sectorSize = 512;
+    QString m_error;
+};
+
+void appendSignature(QList<ProbeSignature>* list, const QString& type, qint64 offset, int length) {
+    if (!list) return;
+    ProbeSignature sig;
+    sig.type = type;
+    sig.offset = offset;
+    sig.length = length;
+    list->append(sig);
+}
+
+bool parseGpt(WindowReader& reader, const uchar* head, qint64 headSize, quint32 sector, ProbeResult& result) {
+    if (headSize < static_cast<qint64>(sector) * 2) return false;
+    const uchar* hdr = head + sector;
+    if (memcmp(hdr, "EFI PART", 8) != 0) return false;
+
+    quint32 headerSize = le32(hdr + 12);
+    if (headerSize < 92 || headerSize > sector) return false;
+
+    QByteArray header(reinterpret_cast<const char*>(hdr), headerSize);
+    memset(header.data() + 16, 0, 4);
+    if (Utils::crc32(header.constData(), headerSize) != le32(hdr + 16)) {
+        qWarning() << "GPT: неверная контрольная сумма заголовка";
+        return false;
+    }
+
+    quint64 alternateLba = le64(hdr + 32);
+    quint64 entriesLba = le64(hdr + 72);
+    quint32 entryCount = le32(hdr + 80);
+    quint32 entrySize = le32(hdr + 84);
+    quint32 entriesCrc = le32(hdr + 88);
+    if (entrySize < 128 || entryCount == 0 || entryCount > 1024) return false;
+
+    // Массив записей обычно внутри первого окна; иначе дочитываем
+    qint64 entriesOffset = static_cast<qint64>(entriesLba) * sector;
+    qint64 entriesBytes = static_cast<qint64>(entryCount) * entrySize;
+    QByteArray entries;
+    if (entriesOffset + entriesBytes <= headSize) {
+        entries = QByteArray(reinterpret_cast<const char*>(head + entriesOffset), entriesBytes);
+    } else {
+        for (qint64 done = 0; done < entriesBytes;) {
+            const uchar* chunk = nullptr;
+            qint64 n = reader.read(entriesOffset + done, entriesBytes - done, &chunk);
+            if (n <= 0) return false;
+            entries.append(reinterpret_cast<const char*>(chunk), n);
+            done += n;
+        }
+    }
+    if (Utils::crc32(entries.constData(), entries.size()) != entriesCrc) {
+        qWarning() << "GPT: неверная контрольная сумма записей разделов";
+        return false;
+    }
+
+    result.tableType = "gpt";
+    appendSignature(&result.signatures, "gpt", sector, 8);
+    if (alternateLba > 1) {
+        appendSignature(&result.signatures, "gpt", static_cast<qint64>(alternateLba) * sector, 8);
+    }
+
+    const uchar* e = reinterpret_cast<const uchar*>(entries.constData());
+    for (quint32 i = 0; i < entryCount; ++i, e += entrySize) {
+        static const uchar zero[16] = {0};
+        if (memcmp(e, zero, 16) == 0) continue;
+
+        quint64 first = le64(e + 32);
+        quint64 last = le64(e + 40);
+        if (last < first) continue;
+
+        ProbePartition part;
+        part.number = static_cast<int>(i) + 1;
+        part.startBytes = first * sector;
+        part.sizeBytes = (last - first + 1) * sector;
+        part.typeCode = guidString(e);
+        part.typeName = gptTypeName(part.typeCode);
+        part.name = QString::fromUtf16(reinterpret_cast<const char16_t*>(e + 56), 36);
+        int nul = part.name.indexOf(QChar(0));
+        if (nul >= 0) part.name.truncate(nul);
+        result.partitions.append(part);
+    }
+    return true;
+}
+
+bool parseMbr(WindowReader& reader, const uchar* head, quint32 sector, ProbeResult& result) {
+    if (head[510] != 0x55 || head[511] != 0xAA) return false;
+
+    const uchar* table = head + 0x1BE;
+    bool anyPartition = false;
+    for (int i = 0; i < 4; ++i) {
+        const uchar* entry = table + i * 16;
+        if (entry[0] != 0x00 && entry[0] != 0x80) return false;
+        if (entry[4] != 0) anyPartition = true;
+    }
+    if (!anyPartition) return false;
+
+    result.tableType = "dos";
+    appendSignature(&result.signatures, "dos", 510, 2);
+
+    for (int i = 0; i < 4; ++i) {
+        const uchar* entry = table + i * 16;
+        quint8 type = entry[4];
+        quint32 start = le32(entry + 8);
+        quint32 count = le32(entry + 12);
+        if (type == 0 || count == 0) continue;
+
+        ProbePartition part;
+        part.number = i + 1;
+        part.startBytes = static_cast<quint64>(start) * sector;
+        part.sizeBytes = static_cast<quint64>(count) * sector;
+        part.typeCode = QString("0x%1").arg(type, 2, 16, QChar('0'));
+        part.typeName = mbrTypeName(type);
+        part.bootable = entry[0] == 0x80;
+        result.partitions.append(part);
+
+        if (!isExtendedType(type)) continue;
+
+        // Цепочка EBR: первая запись - логический раздел относительно EBR,
+        // вторая - следующий EBR относительно начала расширенного раздела
+        quint64 extStart = start;
+        quint64 ebr = start;
+        int logical = 5;
+        for (int guard = 0; guard < 128; ++guard) {
+            const uchar* ebrData = nullptr;
+            qint64 n = reader.read(static_cast<qint64>(ebr) * sector, 512, &ebrData);
+            if (n < 512 || ebrData[510] != 0x55 || ebrData[511] != 0xAA) break;
+            QByteArray copy(reinterpret_cast<const char*>(ebrData), 512);
+            const uchar* ebrTable = reinterpret_cast<const uchar*>(copy.constData()) + 0x1BE;
+
+            if (ebrTable[4] != 0 && le32(ebrTable + 12) != 0) {
+                ProbePartition lp;
+                lp.number = logical++;
+                lp.startBytes = (ebr + le32(ebrTable + 8)) * sector;
+                lp.sizeBytes = static_cast<quint64>(le32(ebrTable + 12)) * sector;
+                lp.typeCode = QString("0x%1").arg(ebrTable[4], 2, 16, QChar('0'));
+                lp.typeName = mbrTypeName(ebrTable[4]);
+                lp.bootable = ebrTable[0] == 0x80;
+                result.partitions.append(lp);
+            }
+
+            const uchar* next = ebrTable + 16;
+            if (!isExtendedType(next[4]) || le32(next + 8) == 0) break;
+            ebr = extStart + le32(next + 8);
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+bool ProbeEngine::probeFilesystem(const uchar* data, qint64 size, qint64 base,
+                                  QString* fsType, QString* label, QString* uuid,
+                                  QList<ProbeSignature>* signatures) {
+    Window w{data, size, base};
+
+    for (const SignatureRule& rule : kRules) {
+        if (!w.has(rule.offset, rule.magicLength)) continue;
+        if (memcmp(data + rule.offset, rule.magic, rule.magicLength) != 0) continue;
+
+        Hit hit;
+        hit.type = rule.type;
+        if (rule.detect && !rule.detect(w, hit)) continue;
+
+        if (fsType) *fsType = hit.type;
+        if (label) *label = hit.label;
+        if (uuid) *uuid = hit.uuid;
+        appendSignature(signatures, hit.type, base + rule.offset, rule.magicLength);
+        if (signatures) signatures->append(hit.extra);
+        return true;
+    }
+    return false;
+}
+
+ProbeResult ProbeEngine::probe(const QString& path) {
+    ProbeResult result;
+
+    WindowReader reader(path);
+    if (!reader.isOpen()) {
+        result.error = reader.error();
+        return result;
+    }
+    result.deviceSize = reader.size();
+    result.sectorSize = reader.sectorSize();
+
+    // Одно выровненное окно с начала устройства
+    const uchar* data = nullptr;
+    qint64 size = reader.read(0, WindowSize, &data);
+    if (size < 512) {
+        result.error = "не удалось прочитать начало устройства";
+        return result;
+    }
+    QByteArray head(reinterpret_cast<const char*>(data), size);
+    const uchar* h = reinterpret_cast<const uchar*>(head.constData());
+    result.ok = true;
+
+    // ФС на всем устройстве (в том числе гибридный ISO с MBR)
+    probeFilesystem(h, size, 0, &result.fsType, &result.label, &result.uuid, &result.signatures);
+
+    // Таблица разделов; FAT без разделов (суперфлоппи) тоже имеет 55AA
+    bool superfloppy = result.fsType.startsWith("FAT") || result.fsType == "NTFS" || result.fsType == "exFAT";
+    if (!superfloppy) {
+        bool gpt = parseGpt(reader, h, size, result.sectorSize, result);
+        if (!gpt && result.sectorSize != 4096) {
+            // Образ с 4K-секторами, записанный на 512-байтное устройство или в файл
+            gpt = parseGpt(reader, h, size, 4096, result);
+            if (gpt) result.sectorSize = 4096;
+        }
+        if (!gpt) {
+            parseMbr(reader, h, result.sectorSize, result);
+        }
+    }
+
+    // Окно в начале каждого раздела
+    for (ProbePartition& part : result.partitions) {
+        if (part.typeName == "Extended" || part.sizeBytes == 0) continue;
+        if (result.deviceSize > 0 && part.startBytes >= result.deviceSize) continue;
+
+        const uchar* partData = nullptr;
+        qint64 partSize = reader.read(static_cast<qint64>(part.startBytes), WindowSize, &partData);
+        if (partSize < 512) continue;
+        const int first = result.signatures.size();
+        probeFilesystem(partData, partSize, static_cast<qint64>(part.startBytes),
+                        &part.fsType, &part.label, &part.uuid, &result.signatures);
+
+        // Резервные копии за концом раздела (зеркала btrfs на 64 MB и 256 GB)
+        // принадлежат уже соседу - их не трогаем
+        const quint64 partEnd = part.startBytes + part.sizeBytes;
+        for (int i = result.signatures.size() - 1; i >= first; --i) {
+            const ProbeSignature& sig = result.signatures.at(i);
+            if (static_cast<quint64>(sig.offset) + static_cast<quint64>(sig.length) > partEnd) {
+                result.signatures.removeAt(i);
+            }
+        }
+    }
+
+    if (result.fsType.isEmpty() && result.tableType.isEmpty()) {
+        result.empty = true;
+        for (int i = 0; i < 512; ++i) {
+            if (h[i] != 0) {
+                result.empty = false;
+                break;
+            }
+        }
+    }
+    return result;
+}
+
+QString ProbeResult::summary() const {
+    if (!ok) return "unknown";
+
+    QString table;
+    if (tableType == "gpt") table = "GPT";
+    else if (tableType == "dos") table = "MBR";
+
+    if (!table.isEmpty()) {
+        QStringList parts;
+        for (const ProbePartition& part : partitions) {
+            if (part.typeName == "Extended") continue;
+            parts << (part.fsType.isEmpty() ? part.typeName : part.fsType);
+        }
+        if (!fsType.isEmpty()) {
+            return QString("%1 (%2)").arg(fsType).arg(table);  // гибридный образ
+        }
+        return parts.isEmpty() ? table : QString("%1: %2").arg(table).arg(parts.join(", "));
+    }
+
+    if (!fsType.isEmpty()) return fsType;
+    return empty ? "empty" : "unknown";
+}
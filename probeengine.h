@@ -0,0 +1,64 @@
+// probeengine.h
+#pragma once
+
+#include <QString>
+#include <QList>
+#include <QVariant>
+
+// Найденная сигнатура: где лежит магия и что она означает.
+// Смещения абсолютные (от начала устройства или файла образа).
+struct ProbeSignature {
+    QString type;         // FAT32, ext4, gpt, dos, LVM2, ...
+    qint64 offset = 0;    // смещение магии
+    int length = 0;       // длина магии
+};
+
+struct ProbePartition {
+    int number = 0;               // 1..N, логические MBR-разделы с 5
+    quint64 startBytes = 0;
+    quint64 sizeBytes = 0;
+    QString typeCode;             // "0x0c" для MBR, GUID для GPT
+    QString typeName;             // "EFI System", "W95 FAT32 (LBA)", ...
+    QString name;                 // имя раздела GPT
+    bool bootable = false;        // флаг 0x80 в MBR
+    QString fsType;               // ФС внутри раздела
+    QString label;
+    QString uuid;
+};
+
+// Результат проверки устройства/образа. Копируемый, пригоден для кэша.
+struct ProbeResult {
+    bool ok = false;              // устройство удалось прочитать
+    QString error;
+    quint64 deviceSize = 0;
+    quint32 sectorSize = 512;     // логический сектор, по которому разобрана таблица
+
+    QString tableType;            // "gpt", "dos" или пусто
+    QString fsType;               // ФС на всем устройстве (суперфлоппи, ISO)
+    QString label;
+    QString uuid;
+    bool empty = false;           // первые сектора заполнены нулями
+
+    QList<ProbePartition> partitions;
+    QList<ProbeSignature> signatures;  // все найденные магии (для быстрой очистки)
+
+    // Краткое описание для интерфейса: "FAT32", "GPT: FAT32, ext4", "empty", "unknown"
+    QString summary() const;
+};
+
+Q_DECLARE_METATYPE(ProbeResult)
+
+// Табличный определитель файловых систем и таблиц разделов.
+// Начало устройства читается одним выровненным окном; для каждого
+// раздела читается окно в его начале.
+class ProbeEngine {
+public:
+    static const qint64 WindowSize = 128 * 1024;
+
+    static ProbeResult probe(const QString& path);
+
+    // Проверка окна, уже прочитанного с начала ФС (base - абсолютное смещение)
+    static bool probeFilesystem(const uchar* data, qint64 size, qint64 base,
+                                QString* fsType, QString* label, QString* uuid,
+                                QList<ProbeSignature>* signatures);
+};
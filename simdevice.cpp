@@ -0,0 +1,276 @@
+// simdevice.cpp
+#include "simdevice.h"
+#include <QThread>
+#include <QStringList>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+
+namespace {
+
+const QString SpecPrefix = "sim:";
+
+// "4K", "1G", "512" -> байты
+bool parseBytes(const QString& text, quint64* bytes) {
+    QString number = text.trimmed().toUpper();
+    quint64 multiplier = 1;
+    if (number.endsWith('B')) number.chop(1);
+    const QString units = "KMGT";
+    if (!number.isEmpty() && units.contains(number.back())) {
+        for (int i = 0; i <= units.indexOf(number.back()); ++i) multiplier *= 1024;
+        number.chop(1);
+    }
+    bool ok = false;
+    const double value = number.toDouble(&ok);
+    if (!ok || value < 0) return false;
+    *bytes = static_cast<quint64>(value * multiplier);
+    return true;
+}
+
+// Время передачи length байт на скорости mbps; 0 - без ограничения
+qint64 transferNs(quint64 length, double mbps) {
+    return mbps > 0 ? static_cast<qint64>(length / (mbps * 1024 * 1024) * 1e9) : 0;
+}
+
+} // namespace
+
+bool SimDevice::isSpec(const QString& devicePath) {
+    return devicePath.startsWith(SpecPrefix);
+}
+
+bool SimDevice::parse(const QString& spec, Config* cfg, QString* error) {
+    auto fail = [error](const QString& message) {
+        if (error) *error = message;
+        return false;
+    };
+    if (!isSpec(spec)) return fail("Не модель устройства: " + spec);
+
+    const QString body = spec.mid(SpecPrefix.size());
+    const int query = body.indexOf('?');
+    *cfg = Config();
+    cfg->backingPath = query < 0 ? body : body.left(query);
+    if (cfg->backingPath.isEmpty()) return fail("Модель устройства: не указан файл");
+    if (query < 0) return true;
+
+    for (const QString& pair : body.mid(query + 1).split('&', Qt::SkipEmptyParts)) {
+        const int eq = pair.indexOf('=');
+        const QString key = pair.left(eq);
+        const QString value = eq < 0 ? QString() : pair.mid(eq + 1);
+        bool ok = true;
+        if (key == "size") {
+            ok = parseBytes(value, &cfg->claimedBytes);
+        } else if (key == "real") {
+            ok = parseBytes(value, &cfg->realBytes);
+        } else if (key == "wrap") {
+            cfg->wraps = value != "0";
+        } else if (key == "bw") {
+            cfg->writeMBps = value.toDouble(&ok);
+        } else if (key == "rbw") {
+            cfg->readMBps = value.toDouble(&ok);
+        } else if (key == "slc") {
+            ok = parseBytes(value, &cfg->slcBytes);
+        } else if (key == "cliff") {
+            cfg->cliffMBps = value.toDouble(&ok);
+        } else if (key == "lat") {
+            cfg->latencyMs = value.toDouble(&ok);
+        } else if (key == "sigma") {
+            cfg->latencySigma = value.toDouble(&ok);
+        } else if (key == "seed") {
+            cfg->seed = value.toULongLong(&ok);
+        } else if (key == "eio") {
+            for (const QString& item : value.split(',', Qt::SkipEmptyParts)) {
+                Fault fault;
+                QString range = item;
+                const int star = range.indexOf('*');
+                if (star >= 0) {
+                    fault.failures = range.mid(star + 1).toInt(&ok);
+                    range = range.left(star);
+                }
+                const int plus = range.indexOf('+');
+                ok = ok && plus > 0 && parseBytes(range.left(plus), &fault.offset) &&
+                     parseBytes(range.mid(plus + 1), &fault.length) && fault.length > 0;
+                if (!ok) break;
+                cfg->faults << fault;
+            }
+        } else {
+            return fail("Модель устройства: неизвестный параметр " + key);
+        }
+        if (!ok) return fail(QString("Модель устройства: неверное значение %1=%2").arg(key, value));
+    }
+    return true;
+}
+
+SimDevice::~SimDevice() {
+    close();
+}
+
+bool SimDevice::open(const Config& cfg, QString* error) {
+    close();
+    m_cfg = cfg;
+    m_fd = ::open(cfg.backingPath.toLocal8Bit().constData(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (m_fd < 0) {
+        if (error) *error = QString("Модель устройства: %1: %2").arg(cfg.backingPath, strerror(errno));
+        return false;
+    }
+
+    struct stat st;
+    if (::fstat(m_fd, &st) != 0) st.st_size = 0;
+    if (m_cfg.realBytes == 0) m_cfg.realBytes = static_cast<quint64>(st.st_size);
+    if (m_cfg.realBytes == 0) m_cfg.realBytes = m_cfg.claimedBytes;
+    if (m_cfg.realBytes == 0) {
+        close();
+        if (error) *error = "Модель устройства: пустой файл, размер не задан (size= или real=)";
+        return false;
+    }
+    if (m_cfg.claimedBytes == 0) m_cfg.claimedBytes = m_cfg.realBytes;
+    if (static_cast<quint64>(st.st_size) < m_cfg.realBytes &&
+        ::ftruncate(m_fd, static_cast<off_t>(m_cfg.realBytes)) != 0) {
+        if (error) *error = QString("Модель устройства: %1").arg(strerror(errno));
+        close();
+        return false;
+    }
+
+    m_slcUsed = 0;
+    m_busyUntilNs = 0;
+    m_simulatedNs = 0;
+    m_injectedFaults = 0;
+    m_random.seed(m_cfg.seed);
+    m_clock.start();
+    return true;
+}
+
+void SimDevice::close() {
+    if (m_fd >= 0) ::close(m_fd);
+    m_fd = -1;
+}
+
+bool SimDevice::takeFault(quint64 offset, size_t length) {
+    // Сбой - на весь запрос, как у настоящего устройства: найти сектор
+    // должен тот, кто пишет (дроблением запроса)
+    for (Fault& fault : m_cfg.faults) {
+        if (fault.offset >= offset + length || fault.offset + fault.length <= offset) continue;
+        if (fault.failures < 0) continue;           // разовый сбой уже исчерпан
+        if (fault.failures > 0 && --fault.failures == 0) fault.failures = -1;
+        ++m_injectedFaults;
+        return true;
+    }
+    return false;
+}
+
+qint64 SimDevice::latencyNs() {
+    if (m_cfg.latencyMs <= 0) return 0;
+    double factor = 1.0;
+    if (m_cfg.latencySigma > 0) {
+        std::normal_distribution<double> normal(0.0, m_cfg.latencySigma);
+        factor = std::exp(normal(m_random));
+    }
+    return static_cast<qint64>(m_cfg.latencyMs * factor * 1e6);
+}
+
+void SimDevice::complete(qint64 durationNs) {
+    // Очередь из одного запроса: следующий начинается, когда закончен предыдущий
+    const qint64 now = m_clock.nsecsElapsed();
+    m_busyUntilNs = qMax(m_busyUntilNs, now) + durationNs;
+    m_simulatedNs += durationNs;
+    const qint64 waitNs = m_busyUntilNs - now;
+    if (waitNs > 0) QThread::usleep(static_cast<unsigned long>(waitNs / 1000));
+}
+
+ssize_t SimDevice::pwrite(const char* data, size_t length, quint64 offset) {
+    if (m_fd < 0) {
+        errno = EBADF;
+        return -1;
+    }
+    if (offset >= m_cfg.claimedBytes) return 0;
+    length = static_cast<size_t>(qMin<quint64>(length, m_cfg.claimedBytes - offset));
+
+    qint64 duration = latencyNs();
+    if (takeFault(offset, length)) {
+        complete(duration);
+        errno = EIO;
+        return -1;
+    }
+
+    // Кэш SLC на полной скорости, остаток - на скорости после обрыва
+    const quint64 fast = m_cfg.slcBytes > 0 ? qMin<quint64>(length, m_cfg.slcBytes - qMin(m_slcUsed, m_cfg.slcBytes))
+                                            : length;
+    m_slcUsed += length;
+    duration += transferNs(fast, m_cfg.writeMBps);
+    duration += transferNs(length - fast, m_cfg.cliffMBps > 0 ? m_cfg.cliffMBps : m_cfg.writeMBps);
+
+    size_t done = 0;
+    while (done < length) {
+        const quint64 position = offset + done;
+        size_t piece = length - done;
+        quint64 target = position;
+        if (position >= m_cfg.realBytes) {
+            if (!m_cfg.wraps) {
+                // Запись за реальной емкостью молча пропадает
+                done = length;
+                break;
+            }
+            target = position % m_cfg.realBytes;
+        }
+        piece = static_cast<size_t>(qMin<quint64>(piece, m_cfg.realBytes - target));
+        const ssize_t n = ::pwrite(m_fd, data + done, piece, static_cast<off_t>(target));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return done > 0 ? static_cast<ssize_t>(done) : -1;
+        done += static_cast<size_t>(n);
+    }
+    complete(duration);
+    return static_cast<ssize_t>(done);
+}
+
+ssize_t SimDevice::pread(char* data, size_t length, quint64 offset) {
+    if (m_fd < 0) {
+        errno = EBADF;
+        return -1;
+    }
+    if (offset >= m_cfg.claimedBytes) return 0;
+    length = static_cast<size_t>(qMin<quint64>(length, m_cfg.claimedBytes - offset));
+
+    const qint64 duration = latencyNs() + transferNs(length, m_cfg.readMBps);
+    // Постоянная сбойная область не читается, разовый сбой касается только записи
+    for (const Fault& fault : m_cfg.faults) {
+        if (fault.failures == 0 && fault.offset < offset + length && fault.offset + fault.length > offset) {
+            complete(duration);
+            errno = EIO;
+            return -1;
+        }
+    }
+
+    size_t done = 0;
+    while (done < length) {
+        const quint64 position = offset + done;
+        size_t piece = length - done;
+        quint64 target = position;
+        if (position >= m_cfg.realBytes) {
+            if (!m_cfg.wraps) {
+                memset(data + done, 0, piece);
+                done = length;
+                break;
+            }
+            target = position % m_cfg.realBytes;
+        }
+        piece = static_cast<size_t>(qMin<quint64>(piece, m_cfg.realBytes - target));
+        const ssize_t n = ::pread(m_fd, data + done, piece, static_cast<off_t>(target));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return done > 0 ? static_cast<ssize_t>(done) : -1;
+        done += static_cast<size_t>(n);
+    }
+    complete(duration);
+    return static_cast<ssize_t>(done);
+}
+
+int SimDevice::fsync() {
+    // Файл модели на диск не сбрасывается: время сброса - одна задержка запроса
+    if (m_fd < 0) {
+        errno = EBADF;
+        return -1;
+    }
+    complete(latencyNs());
+    return 0;
+}
@@ -0,0 +1,81 @@
+// simdevice.h
+#pragma once
+
+#include <QString>
+#include <QList>
+#include <QElapsedTimer>
+#include <sys/types.h>
+#include <random>
+
+// Модель блочного устройства поверх обычного файла - для проверки записи,
+// повторов, очереди и прогноза времени без настоящих носителей. Задаются
+// скорость, задержка запроса (логнормальная, воспроизводимая по зерну),
+// кэш SLC с падением скорости после заполнения, сбои EIO по смещениям и
+// поддельная емкость (адреса за реальной емкостью замкнуты на начало или
+// теряются). Запросы выполняются в реальном времени модели: pwrite
+// возвращается, когда "устройство" закончило бы его.
+//
+// ImageWriter и cmile-bench принимают модель вместо устройства по пути
+// "sim:<файл>?параметры" (см. parse).
+class SimDevice {
+public:
+    struct Fault {
+        quint64 offset = 0;
+        quint64 length = 0;
+        int failures = 0;           // сколько запросов отклонить; 0 - всегда (сбойная область)
+    };
+
+    struct Config {
+        QString backingPath;
+        quint64 claimedBytes = 0;   // сообщаемый размер; 0 - равен realBytes
+        quint64 realBytes = 0;      // емкость файла; 0 - размер существующего файла
+        bool wraps = true;          // за realBytes: замыкание на начало, иначе запись теряется
+        double writeMBps = 0;       // 0 - без ограничения
+        double readMBps = 0;
+        quint64 slcBytes = 0;       // объем кэша SLC; 0 - нет
+        double cliffMBps = 0;       // запись после заполнения кэша SLC
+        double latencyMs = 0;       // медиана задержки запроса
+        double latencySigma = 0;    // разброс логнормальной задержки
+        QList<Fault> faults;
+        quint64 seed = 1;
+    };
+
+    // sim:/tmp/card.img?size=16G&real=8G&wrap=1&bw=40&rbw=90&slc=2G&cliff=6
+    //     &lat=0.5&sigma=0.4&eio=1G+4K*3,3G+1M&seed=7
+    // Размеры - байты с суффиксами K/M/G/T, скорости - МБ/с, задержка - мс;
+    // eio - смещение+длина[*число отказов]
+    static bool isSpec(const QString& devicePath);
+    static bool parse(const QString& spec, Config* cfg, QString* error);
+
+    SimDevice() = default;
+    ~SimDevice();
+    SimDevice(const SimDevice&) = delete;
+    SimDevice& operator=(const SimDevice&) = delete;
+
+    bool open(const Config& cfg, QString* error);
+    void close();
+    bool isOpen() const { return m_fd >= 0; }
+    quint64 size() const { return m_cfg.claimedBytes; }
+
+    // Как pwrite/pread: -1 и errno (EIO у сбойной области), 0 - конец устройства
+    ssize_t pwrite(const char* data, size_t length, quint64 offset);
+    ssize_t pread(char* data, size_t length, quint64 offset);
+    int fsync();
+
+    qint64 simulatedNs() const { return m_simulatedNs; }   // сумма времени запросов по модели
+    int injectedFaults() const { return m_injectedFaults; }
+
+private:
+    Config m_cfg;
+    int m_fd = -1;
+    quint64 m_slcUsed = 0;
+    qint64 m_busyUntilNs = 0;       // когда устройство освободится (по m_clock)
+    qint64 m_simulatedNs = 0;
+    int m_injectedFaults = 0;
+    QElapsedTimer m_clock;
+    std::mt19937_64 m_random;
+
+    bool takeFault(quint64 offset, size_t length);
+    qint64 latencyNs();
+    void complete(qint64 durationNs);
+};
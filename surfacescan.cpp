@@ -0,0 +1,445 @@
+// surfacescan.cpp
+#include "surfacescan.h"
+#include "devicemanager.h"
+#include "bufferpool.h"
+#include "capacityprobe.h"
+#include "utils.h"
+#include <QElapsedTimer>
+#include <QRandomGenerator>
+#include <QList>
+#include <QDebug>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <cerrno>
+#include <cstring>
+#include <vector>
+
+namespace {
+
+// Образец задается посекторно: сектор в 512 байт - наименьшая единица
+// адресации любого устройства, длина любого запроса ей кратна
+const size_t PatternSector = 512;
+const size_t WordsPerSector = PatternSector / sizeof(quint32);
+
+// Наборы инструкций выбираются при загрузке (ifunc): AVX2 обрабатывает
+// восемь слов за операцию, прочие процессоры x86-64 - SSE2
+#if defined(__x86_64__) && defined(__has_attribute)
+#if __has_attribute(target_clones)
+#define CMILE_VECTOR_CLONES __attribute__((target_clones("avx2", "default")))
+#endif
+#endif
+#ifndef CMILE_VECTOR_CLONES
+#define CMILE_VECTOR_CLONES
+#endif
+
+inline quint64 mix64(quint64 x) {
+    x ^= x >> 30;
+    x *= 0xBF58476D1CE4E5B9ULL;
+    x ^= x >> 27;
+    x *= 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+inline quint32 mix32(quint32 h) {
+    h ^= h >> 16;
+    h *= 0x85EBCA6Bu;
+    h ^= h >> 13;
+    h *= 0xC2B2AE35u;
+    return h ^ (h >> 16);
+}
+
+inline quint32 sectorKey(quint64 seed, quint64 sector) {
+    return static_cast<quint32>(mix64(seed ^ sector));
+}
+
+// Внутренние циклы - постоянной длины (сектор) с независимыми итерациями:
+// компилятор векторизует их уже при -O2, без ручных интринсиков
+CMILE_VECTOR_CLONES
+void fillSectors(quint32* words, quint64 firstSector, size_t sectors, quint64 seed) {
+    for (size_t s = 0; s < sectors; ++s) {
+        const quint32 key = sectorKey(seed, firstSector + s);
+        quint32* sector = words + s * WordsPerSector;
+        for (size_t i = 0; i < WordsPerSector; ++i) {
+            sector[i] = mix32(key + static_cast<quint32>(i) * 0x9E3779B9u);
+        }
+    }
+}
+
+// Индекс первого сектора с расхождением; sectors - расхождений нет
+CMILE_VECTOR_CLONES
+size_t firstMismatch(const quint32* words, quint64 firstSector, size_t sectors, quint64 seed) {
+    for (size_t s = 0; s < sectors; ++s) {
+        const quint32 key = sectorKey(seed, firstSector + s);
+        const quint32* sector = words + s * WordsPerSector;
+        quint32 diff = 0;
+        for (size_t i = 0; i < WordsPerSector; ++i) {
+            diff |= sector[i] ^ mix32(key + static_cast<quint32>(i) * 0x9E3779B9u);
+        }
+        if (diff != 0) return s;
+    }
+    return sectors;
+}
+
+bool preadFull(int fd, char* buffer, size_t length, quint64 offset) {
+    size_t done = 0;
+    while (done < length) {
+        ssize_t n = ::pread(fd, buffer + done, length - done, static_cast<off_t>(offset + done));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        done += n;
+    }
+    return true;
+}
+
+bool pwriteFull(int fd, const char* buffer, size_t length, quint64 offset) {
+    size_t done = 0;
+    while (done < length) {
+        ssize_t n = ::pwrite(fd, buffer + done, length - done, static_cast<off_t>(offset + done));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        done += n;
+    }
+    return true;
+}
+
+} // namespace
+
+SurfaceScanJob::SurfaceScanJob(const Config& cfg, QObject* parent)
+: QThread(parent), m_cfg(cfg) {}
+
+void SurfaceScanJob::cancel() {
+    m_cancelled.store(true, std::memory_order_release);
+}
+
+QString SurfaceScanJob::modeName(Mode mode) {
+    switch (mode) {
+        case NonDestructive: return "с сохранением данных";
+        case Destructive: return "с уничтожением данных";
+        case Capacity: return "емкость";
+    }
+    return QString();
+}
+
+BadRangeMap SurfaceScanJob::badRanges() const {
+    QMutexLocker locker(&m_badMutex);
+    return m_bad;
+}
+
+void SurfaceScanJob::run() {
+    m_cancelled.store(false, std::memory_order_release);
+    m_rejected.store(false);
+    m_restoreFailures.store(0);
+    {
+        QMutexLocker locker(&m_badMutex);
+        m_bad = BadRangeMap();
+    }
+    emit progress(0, "Проверка устройства...", 0, "-");
+
+    auto [unmountSuccess, unmountMessage] = DeviceManager::unmountAll(m_cfg.devicePath);
+    if (!unmountSuccess) {
+        emit finished(false, QString("Ошибка размонтирования:\n%1").arg(unmountMessage));
+        return;
+    }
+    if (m_cfg.mode == Capacity) {
+        runCapacity();
+        return;
+    }
+
+    // Через страничный кэш сверка читала бы только что записанную память,
+    // а не носитель, - без O_DIRECT проверка не имеет смысла
+    const DeviceTopology topo = DeviceManager::readTopology(m_cfg.devicePath);
+    const QByteArray path = m_cfg.devicePath.toLocal8Bit();
+    int fd = ::open(path.constData(), O_RDWR | O_CLOEXEC | O_EXCL | O_DIRECT);
+    if (fd < 0) {
+        emit finished(false, errno == EINVAL
+                      ? QString("Устройство не поддерживает прямой доступ (O_DIRECT)")
+                      : QString("Ошибка открытия устройства: %1").arg(strerror(errno)));
+        return;
+    }
+
+    quint64 size = 0;
+    if (::ioctl(fd, BLKGETSIZE64, &size) != 0 || size == 0) {
+        ::close(fd);
+        emit finished(false, QString("Не удалось определить размер устройства: %1").arg(strerror(errno)));
+        return;
+    }
+
+    m_sector = qMax<size_t>(PatternSector, topo.logicalBlockSize);
+    size = size / m_sector * m_sector;
+    m_seed = m_cfg.seed != 0 ? m_cfg.seed : QRandomGenerator::global()->generate64();
+
+    // Флеш-контроллеры раскладывают параллельные запросы по каналам,
+    // HDD от них только чаще перемещает головку
+    const int workers = m_cfg.queueDepth > 0 ? m_cfg.queueDepth : (topo.rotational ? 1 : 8);
+    const quint64 granule = topo.ioGranularity();
+    quint64 chunk = m_cfg.chunkSize > 0 ? static_cast<quint64>(m_cfg.chunkSize) : 0;
+    if (chunk == 0) {
+        quint64 maxRequest = topo.maxSectorsKb > 0 ? topo.maxSectorsKb * 1024ULL : 512 * 1024ULL;
+        chunk = qBound<quint64>(1024 * 1024, maxRequest * 2, 4 * 1024 * 1024);
+    }
+    chunk = (chunk + granule - 1) / granule * granule;
+
+    emit progress(2, QString("Проверка поверхности %1: %2 запросов по %3")
+                  .arg(modeName(m_cfg.mode)).arg(workers).arg(Utils::formatSize(chunk)), 0, "-");
+
+    QElapsedTimer timer;
+    timer.start();
+    QString error;
+    bool ok = false;
+
+    if (m_cfg.mode == Destructive) {
+        // Сначала образец на все устройство, потом сверка: к сверке кэш
+        // контроллера давно вытеснен, и читается сама флеш-память
+        ok = runPass(size, chunk, workers,
+                     [this, fd](quint64 offset, size_t length, char* primary, char*) {
+                         writePattern(fd, offset, length, primary);
+                     }, 5, 45, "Запись образца...", &error);
+        if (ok && ::fsync(fd) != 0) {
+            ok = false;
+            error = QString("Ошибка синхронизации: %1").arg(strerror(errno));
+        }
+        ok = ok && runPass(size, chunk, workers,
+                           [this, fd](quint64 offset, size_t length, char* primary, char*) {
+                               verifyPattern(fd, offset, length, primary);
+                           }, 50, 45, "Сверка...", &error);
+    } else {
+        ok = runPass(size, chunk, workers,
+                     [this, fd](quint64 offset, size_t length, char* primary, char* spare) {
+                         testPreserving(fd, offset, length, primary, spare);
+                     }, 5, 90, "Проверка с сохранением данных...", &error);
+        // Возвращенные данные должны дойти до носителя и при отмене
+        if (::fsync(fd) != 0 && ok) {
+            ok = false;
+            error = QString("Ошибка синхронизации: %1").arg(strerror(errno));
+        }
+    }
+    ::close(fd);
+
+    const bool cancelled = m_cancelled.load(std::memory_order_acquire);
+    const bool rejected = m_rejected.load();
+    const BadRangeMap bad = badRanges();
+
+    // Полная проверка заменяет прежнюю карту, прерванная только дополняет ее
+    QString saveError;
+    bool saved = true;
+    if (ok && !cancelled && !rejected) {
+        saved = bad.save(m_cfg.devicePath, &saveError);
+    } else if (!bad.isEmpty()) {
+        BadRangeMap merged = BadRangeMap::load(m_cfg.devicePath);
+        merged.merge(bad);
+        saved = merged.save(m_cfg.devicePath, &saveError);
+    }
+    if (!saved && !bad.isEmpty()) qWarning() << "Карта сбойных областей не сохранена:" << saveError;
+
+    QString notes;
+    if (m_restoreFailures.load() > 0) {
+        notes += QString("\nНе удалось вернуть данные секторов: %1").arg(m_restoreFailures.load());
+    }
+    if (!saved && !bad.isEmpty()) notes += QString("\nКарта не сохранена: %1").arg(saveError);
+
+    if (rejected) {
+        emit finished(false, QString("Носитель забракован: сбойных областей больше %1 (%2)%3")
+                      .arg(m_cfg.maxBadRanges).arg(bad.describe()).arg(notes));
+        return;
+    }
+    if (cancelled) {
+        emit finished(false, QString("Проверка отменена%1%2")
+                      .arg(bad.isEmpty() ? QString() : ", найдено: " + bad.describe()).arg(notes));
+        return;
+    }
+    if (!ok) {
+        emit finished(false, error + notes);
+        return;
+    }
+    if (!bad.isEmpty()) {
+        emit finished(false, QString("Найдены сбойные области: %1%2").arg(bad.describe()).arg(notes));
+        return;
+    }
+
+    emit finished(true, QString("Проверка поверхности завершена (%1): %2 за %3 сек, сбоев нет%4")
+                  .arg(modeName(m_cfg.mode))
+                  .arg(Utils::formatSize(static_cast<qint64>(size)))
+                  .arg(timer.elapsed() / 1000.0, 0, 'f', 1)
+                  .arg(notes));
+}
+
+void SurfaceScanJob::runCapacity() {
+    const CapacityProbe::Result result = CapacityProbe::run(m_cfg.devicePath, &m_cancelled,
+        [this](int percent, const QString& status) {
+            emit progress(5 + percent * 90 / 100, status, 0, "-");
+        });
+    if (!result.ok) {
+        emit finished(false, result.error);
+        return;
+    }
+    CapacityProbe::remember(m_cfg.devicePath, result);
+
+    // Все, что за реальной емкостью, - одна сбойная область: запись образа
+    // и форматирование по карте откажут и без флажка проверки емкости
+    if (!result.genuine()) {
+        QMutexLocker locker(&m_badMutex);
+        m_bad.add(result.realBytes, result.claimedBytes - result.realBytes);
+    }
+    const BadRangeMap bad = badRanges();
+    BadRangeMap merged = BadRangeMap::load(m_cfg.devicePath);
+    merged.merge(bad);
+    if (!bad.isEmpty()) merged.save(m_cfg.devicePath);
+
+    const QString notes = result.error.isEmpty() ? QString() : "\n" + result.error;
+    emit finished(result.genuine(), QString("Проверка емкости: %1 (%2 контрольных блоков)%3")
+                  .arg(result.describe()).arg(result.probes).arg(notes));
+}
+
+bool SurfaceScanJob::runPass(quint64 size, quint64 chunk, int workers, const ChunkTest& test,
+                             int basePercent, int spanPercent, const QString& status, QString* error) {
+    // Два буфера на поток: в режиме с сохранением - исходные данные и образец
+    std::vector<BufferPool::Buffer> buffers =
+        BufferPool::instance().acquireMany(static_cast<qint64>(chunk), workers * 2, &m_cancelled);
+    if (m_cancelled.load(std::memory_order_acquire)) return false;
+    if (buffers.empty() || static_cast<quint64>(buffers.front().size()) < m_sector) {
+        *error = QString("Не удалось выделить %1 выровненной памяти").arg(Utils::formatSize(chunk * workers * 2));
+        return false;
+    }
+    chunk = qMin<quint64>(chunk, static_cast<quint64>(buffers.front().size()) / m_sector * m_sector);
+
+    // Потоки разбирают блоки по общему счетчику: в полете workers запросов,
+    // а устройство видит почти последовательный поток адресов
+    std::atomic<quint64> nextChunk{0};
+    std::atomic<quint64> done{0};
+
+    QList<QThread*> threads;
+    for (int i = 0; i < workers; ++i) {
+        char* primary = buffers[static_cast<size_t>(i) * 2].data();
+        char* spare = buffers[static_cast<size_t>(i) * 2 + 1].data();
+        QThread* thread = QThread::create([&, primary, spare]() {
+            for (;;) {
+                if (m_cancelled.load(std::memory_order_acquire) || m_rejected.load()) return;
+                const quint64 offset = nextChunk.fetch_add(1) * chunk;
+                if (offset >= size) return;
+                const size_t length = static_cast<size_t>(qMin(chunk, size - offset));
+                test(offset, length, primary, spare);
+                done.fetch_add(length);
+            }
+        });
+        threads.append(thread);
+        thread->start();
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    auto report = [&]() {
+        const quint64 current = done.load();
+        const qint64 elapsedMs = timer.elapsed();
+        const int percent = basePercent + static_cast<int>(current * spanPercent / qMax<quint64>(size, 1));
+        const double speed = elapsedMs > 0 ? (current / 1024.0 / 1024.0) / (elapsedMs / 1000.0) : 0;
+        QString timeLeft = "-";
+        if (speed > 0.1) {
+            timeLeft = Utils::formatTimeLeft(static_cast<qint64>((size - current) / (speed * 1024 * 1024)));
+        }
+        QString text = QString("%1 %2 из %3").arg(status)
+            .arg(Utils::formatSize(static_cast<qint64>(current)))
+            .arg(Utils::formatSize(static_cast<qint64>(size)));
+        const int badCount = badRanges().count();
+        if (badCount > 0) text += QString(", сбойных областей: %1").arg(badCount);
+        emit progress(percent, text, speed, timeLeft);
+    };
+    for (QThread* thread : threads) {
+        while (!thread->wait(250)) report();
+        delete thread;
+    }
+    report();
+
+    return !m_cancelled.load(std::memory_order_acquire) && !m_rejected.load();
+}
+
+void SurfaceScanJob::writePattern(int fd, quint64 offset, size_t length, char* buffer) {
+    fillPattern(buffer, offset, length);
+    if (pwriteFull(fd, buffer, length, offset)) return;
+
+    // Ошибка где-то в блоке: какие именно сектора, выясняется по одному
+    for (size_t at = 0; at < length; at += m_sector) {
+        if (!pwriteFull(fd, buffer + at, m_sector, offset + at)) markBad(offset + at, m_sector);
+    }
+}
+
+void SurfaceScanJob::verifyPattern(int fd, quint64 offset, size_t length, char* buffer) {
+    if (preadFull(fd, buffer, length, offset)) {
+        if (!matchesPattern(buffer, offset, length)) markMismatches(offset, length, buffer);
+        return;
+    }
+    for (size_t at = 0; at < length; at += m_sector) {
+        if (!preadFull(fd, buffer + at, m_sector, offset + at) ||
+            !matchesPattern(buffer + at, offset + at, m_sector)) {
+            markBad(offset + at, m_sector);
+        }
+    }
+}
+
+void SurfaceScanJob::testPreserving(int fd, quint64 offset, size_t length, char* original, char* work) {
+    // Блок обрабатывается одним потоком от чтения до возврата данных,
+    // а отмена проверяется только между блоками: прерванная проверка
+    // не оставляет образец вместо данных
+    if (!preadFull(fd, original, length, offset)) {
+        testSectorsPreserving(fd, offset, length, original, work, false);
+        return;
+    }
+    fillPattern(work, offset, length);
+    if (!pwriteFull(fd, work, length, offset) || !preadFull(fd, work, length, offset)) {
+        testSectorsPreserving(fd, offset, length, original, work, true);
+        return;
+    }
+    if (!matchesPattern(work, offset, length)) markMismatches(offset, length, work);
+
+    if (pwriteFull(fd, original, length, offset)) return;
+    for (size_t at = 0; at < length; at += m_sector) {
+        if (!pwriteFull(fd, original + at, m_sector, offset + at)) {
+            m_restoreFailures.fetch_add(1);
+            markBad(offset + at, m_sector);
+        }
+    }
+}
+
+void SurfaceScanJob::testSectorsPreserving(int fd, quint64 offset, size_t length,
+                                           char* original, char* work, bool haveOriginal) {
+    for (size_t at = 0; at < length; at += m_sector) {
+        const quint64 position = offset + at;
+        // Нечитаемый сектор не трогаем: вернуть в него было бы нечего
+        if (!haveOriginal && !preadFull(fd, original + at, m_sector, position)) {
+            markBad(position, m_sector);
+            continue;
+        }
+        fillPattern(work + at, position, m_sector);
+        bool good = pwriteFull(fd, work + at, m_sector, position) &&
+                    preadFull(fd, work + at, m_sector, position) &&
+                    matchesPattern(work + at, position, m_sector);
+        if (!pwriteFull(fd, original + at, m_sector, position)) {
+            m_restoreFailures.fetch_add(1);
+            good = false;
+        }
+        if (!good) markBad(position, m_sector);
+    }
+}
+
+void SurfaceScanJob::markMismatches(quint64 offset, size_t length, const char* buffer) {
+    for (size_t at = 0; at < length; at += m_sector) {
+        if (!matchesPattern(buffer + at, offset + at, m_sector)) markBad(offset + at, m_sector);
+    }
+}
+
+void SurfaceScanJob::markBad(quint64 offset, quint64 length) {
+    QMutexLocker locker(&m_badMutex);
+    m_bad.add(offset, length);
+    if (m_bad.count() > m_cfg.maxBadRanges) m_rejected.store(true);
+}
+
+void SurfaceScanJob::fillPattern(char* buffer, quint64 offset, size_t length) const {
+    // Буферы пула выровнены по странице, смещения и длины кратны сектору
+    fillSectors(reinterpret_cast<quint32*>(buffer), offset / PatternSector, length / PatternSector, m_seed);
+}
+
+bool SurfaceScanJob::matchesPattern(const char* buffer, quint64 offset, size_t length) const {
+    const size_t sectors = length / PatternSector;
+    return firstMismatch(reinterpret_cast<const quint32*>(buffer), offset / PatternSector, sectors, m_seed) == sectors;
+}
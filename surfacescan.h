@@ -0,0 +1,79 @@
+// surfacescan.h
+#pragma once
+
+#include <QThread>
+#include <QString>
+#include <QMutex>
+#include <atomic>
+#include <functional>
+
+#include "badrangemap.h"
+
+// Проверка поверхности носителя (аналог badblocks -w и -n). Каждый сектор
+// получает псевдослучайный образец, зерно которого зависит от номера сектора:
+// подделанная емкость (адреса, замкнутые на одну и ту же флеш-память) дает
+// чужой образец и тоже считается сбоем. Запросы идут с O_DIRECT несколькими
+// потоками, ошибочный запрос перепроверяется по секторам. Итог - карта
+// сбойных областей, которая сохраняется для последующих записи и форматирования.
+class SurfaceScanJob : public QThread {
+    Q_OBJECT
+
+public:
+    enum Mode {
+        NonDestructive,     // чтение, образец, сверка, возврат данных (badblocks -n)
+        Destructive,        // образец на все устройство, затем сверка (badblocks -w)
+        Capacity            // только реальная емкость (CapacityProbe), за секунды
+    };
+
+    struct Config {
+        QString devicePath;
+        Mode mode = NonDestructive;
+        int queueDepth = 0;         // запросов в полете; 0 - по топологии (1 для HDD, 8 для флеш)
+        qint64 chunkSize = 0;       // 0 - по топологии устройства
+        quint64 seed = 0;           // 0 - случайное
+        int maxBadRanges = 256;     // больше - носитель бракуется без проверки остатка
+    };
+
+    explicit SurfaceScanJob(const Config& cfg, QObject* parent = nullptr);
+    void cancel();
+
+    static QString modeName(Mode mode);
+
+    // Найденные области; полны после finished
+    BadRangeMap badRanges() const;
+
+signals:
+    void progress(int percent, const QString& status, double speedMBps, const QString& timeLeft);
+    void finished(bool success, const QString& message);
+
+protected:
+    void run() override;
+
+private:
+    // Обработка блока [offset, offset + length) двумя буферами по length
+    using ChunkTest = std::function<void(quint64 offset, size_t length, char* primary, char* spare)>;
+
+    Config m_cfg;
+    std::atomic<bool> m_cancelled{false};
+    std::atomic<bool> m_rejected{false};        // превышен maxBadRanges
+    std::atomic<int> m_restoreFailures{0};      // сектора, данные которых не вернуть
+    quint64 m_seed = 0;
+    size_t m_sector = 512;                      // единица перепроверки
+
+    mutable QMutex m_badMutex;
+    BadRangeMap m_bad;
+
+    void runCapacity();
+    bool runPass(quint64 size, quint64 chunk, int workers, const ChunkTest& test,
+                 int basePercent, int spanPercent, const QString& status, QString* error);
+
+    void writePattern(int fd, quint64 offset, size_t length, char* buffer);
+    void verifyPattern(int fd, quint64 offset, size_t length, char* buffer);
+    void testPreserving(int fd, quint64 offset, size_t length, char* original, char* work);
+    void testSectorsPreserving(int fd, quint64 offset, size_t length, char* original, char* work, bool haveOriginal);
+    void markMismatches(quint64 offset, size_t length, const char* buffer);
+
+    void markBad(quint64 offset, quint64 length);
+    void fillPattern(char* buffer, quint64 offset, size_t length) const;
+    bool matchesPattern(const char* buffer, quint64 offset, size_t length) const;
+};
@@ -0,0 +1,155 @@
+// throughputestimator.cpp
+#include "throughputestimator.h"
+#include <QFile>
+#include <QFileInfo>
+#include <QStringList>
+#include <cmath>
+
+namespace {
+
+const double MB = 1024.0 * 1024.0;
+const double RegimeFactor = 2.0;    // смена режима - скорость вдвое ниже или выше
+
+} // namespace
+
+ThroughputEstimator::ThroughputEstimator(qint64 windowMs)
+: m_windowMs(qMax<qint64>(windowMs, 500)) {}
+
+void ThroughputEstimator::start() {
+    m_samples.clear();
+    m_smoothed = 0;
+    m_regimeRate = 0;
+    m_deviationMs = -1;
+    m_regimeChanges = 0;
+    m_changePending = false;
+    m_timer.start();
+    m_samples.push_back({0, 0});
+}
+
+void ThroughputEstimator::update(qint64 bytesDone) {
+    if (!m_timer.isValid()) start();
+    const qint64 now = m_timer.elapsed();
+    const Sample& last = m_samples.back();
+    if (now <= last.ms) {
+        // Несколько вызовов за миллисекунду - накопить в одном замере
+        m_samples.back().bytes = qMax(last.bytes, bytesDone);
+        return;
+    }
+
+    // EWMA с постоянной времени в полокна, независимо от частоты вызовов
+    const double instant = (bytesDone - last.bytes) / MB / ((now - last.ms) / 1000.0);
+    const double alpha = 1.0 - std::exp(-static_cast<double>(now - last.ms) / (m_windowMs / 2.0));
+    m_smoothed = m_samples.size() == 1 && m_smoothed == 0 ? instant : m_smoothed + alpha * (instant - m_smoothed);
+
+    m_samples.push_back({now, bytesDone});
+    while (m_samples.size() > 2 && m_samples[1].ms <= now - m_windowMs) m_samples.pop_front();
+
+    if (!windowFull()) return;
+    const double window = windowMBps();
+    if (m_regimeRate <= 0) {
+        m_regimeRate = window;
+        return;
+    }
+
+    if (window * RegimeFactor < m_regimeRate || window > m_regimeRate * RegimeFactor) {
+        if (m_deviationMs < 0) {
+            // Отклонение стало видно в окне - началось оно раньше, с начала окна
+            m_deviationMs = now;
+            m_deviationBytes = m_samples.front().bytes;
+        } else if (now - m_deviationMs >= m_windowMs) {
+            m_changePending = true;
+            m_changeBytes = m_deviationBytes;
+            m_changeFrom = m_regimeRate;
+            m_changeTo = window;
+            m_regimeRate = window;
+            m_deviationMs = -1;
+            ++m_regimeChanges;
+        }
+    } else {
+        // В коридоре: устоявшаяся скорость плавно следует за окном
+        m_deviationMs = -1;
+        m_regimeRate += 0.1 * (window - m_regimeRate);
+    }
+}
+
+bool ThroughputEstimator::windowFull() const {
+    return m_samples.size() >= 2 && m_samples.back().ms - m_samples.front().ms >= m_windowMs;
+}
+
+double ThroughputEstimator::averageMBps() const {
+    if (m_samples.empty() || m_samples.back().ms <= 0) return 0;
+    return m_samples.back().bytes / MB / (m_samples.back().ms / 1000.0);
+}
+
+double ThroughputEstimator::windowMBps() const {
+    if (m_samples.size() < 2) return 0;
+    const Sample& first = m_samples.front();
+    const Sample& last = m_samples.back();
+    if (last.ms <= first.ms) return 0;
+    return (last.bytes - first.bytes) / MB / ((last.ms - first.ms) / 1000.0);
+}
+
+double ThroughputEstimator::smoothedMBps() const {
+    return m_smoothed;
+}
+
+double ThroughputEstimator::rateMBps() const {
+    return windowFull() ? windowMBps() : m_smoothed;
+}
+
+bool ThroughputEstimator::takeRegimeChange(qint64* atBytes, double* fromMBps, double* toMBps) {
+    if (!m_changePending) return false;
+    m_changePending = false;
+    if (atBytes) *atBytes = m_changeBytes;
+    if (fromMBps) *fromMBps = m_changeFrom;
+    if (toMBps) *toMBps = m_changeTo;
+    return true;
+}
+
+qint64 ThroughputEstimator::secondsLeft(qint64 bytesLeft, qint64 pendingBytes) const {
+    const double rate = rateMBps();
+    if (rate < 0.01) return -1;
+    return static_cast<qint64>(std::ceil((qMax<qint64>(0, bytesLeft) + qMax<qint64>(0, pendingBytes)) / MB / rate));
+}
+
+WriteBacklog::WriteBacklog(const QString& devicePath)
+: m_sysDir("/sys/class/block/" + QFileInfo(devicePath).fileName()) {
+    quint64 ios = 0;
+    m_available = readStat(&ios, &m_baseSectors);
+}
+
+bool WriteBacklog::readStat(quint64* writeIos, quint64* writeSectors) const {
+    // stat: чтения (4 поля), затем записи: запросы, слияния, секторы по 512 Б, мс
+    QFile file(m_sysDir + "/stat");
+    if (!file.open(QIODevice::ReadOnly)) return false;
+    const QStringList fields = QString::fromLatin1(file.readAll()).split(' ', Qt::SkipEmptyParts);
+    if (fields.size() < 7) return false;
+    *writeIos = fields[4].toULongLong();
+    *writeSectors = fields[6].toULongLong();
+    return true;
+}
+
+qint64 WriteBacklog::completedBytes() const {
+    quint64 ios = 0, sectors = 0;
+    if (!m_available || !readStat(&ios, &sectors) || sectors < m_baseSectors) return 0;
+    return static_cast<qint64>((sectors - m_baseSectors) * 512);
+}
+
+int WriteBacklog::inflightWrites() const {
+    // inflight: "чтения записи"
+    QFile file(m_sysDir + "/inflight");
+    if (!file.open(QIODevice::ReadOnly)) return 0;
+    const QStringList fields = QString::fromLatin1(file.readAll()).split(' ', Qt::SkipEmptyParts);
+    return fields.size() >= 2 ? fields[1].trimmed().toInt() : 0;
+}
+
+qint64 WriteBacklog::pendingBytes(qint64 submittedBytes) const {
+    if (!m_available) return 0;
+    quint64 ios = 0, sectors = 0;
+    if (!readStat(&ios, &sectors)) return 0;
+    const qint64 completed = sectors > m_baseSectors ? static_cast<qint64>((sectors - m_baseSectors) * 512) : 0;
+
+    // Запросы в очереди устройства - по среднему размеру запроса записи
+    const qint64 inflight = ios > 0 ? static_cast<qint64>(inflightWrites() * (sectors * 512 / ios)) : 0;
+    return qMax<qint64>(0, qMax(submittedBytes - completed, inflight));
+}
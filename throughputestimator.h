@@ -0,0 +1,78 @@
+// throughputestimator.h
+#pragma once
+
+#include <QString>
+#include <QElapsedTimer>
+#include <deque>
+
+// Скорость записи для прогресса и оставшегося времени. Средняя от начала
+// для флеш-памяти не годится: когда заполняется кэш SLC, скорость падает в
+// разы, а средняя еще долго помнит быстрое начало. Здесь скорость считается
+// за скользящее окно и сглаживается экспоненциально (EWMA). Если скорость за
+// окно дольше окна держится вдвое ниже (или выше) прежней, это смена режима:
+// дальше прогноз строится только по новой скорости.
+class ThroughputEstimator {
+public:
+    explicit ThroughputEstimator(qint64 windowMs = 5000);
+
+    void start();
+    // bytesDone - всего обработано с начала, не убывает
+    void update(qint64 bytesDone);
+
+    double averageMBps() const;     // от начала
+    double windowMBps() const;      // за последнее окно
+    double smoothedMBps() const;    // EWMA мгновенной скорости
+    // Скорость для прогноза: за окно, когда оно набрано, иначе EWMA
+    double rateMBps() const;
+
+    int regimeChanges() const { return m_regimeChanges; }
+    // Смена режима с прошлого вызова: к какому объему она произошла
+    // и скорость до и после; false - новых нет
+    bool takeRegimeChange(qint64* atBytes, double* fromMBps, double* toMBps);
+
+    // Секунд до конца: bytesLeft записи и pendingBytes сброса по текущей
+    // скорости; -1 - скорость еще неизвестна
+    qint64 secondsLeft(qint64 bytesLeft, qint64 pendingBytes = 0) const;
+
+private:
+    struct Sample {
+        qint64 ms;
+        qint64 bytes;
+    };
+
+    qint64 m_windowMs;
+    QElapsedTimer m_timer;
+    std::deque<Sample> m_samples;   // первый - не позже начала окна
+    double m_smoothed = 0;
+    double m_regimeRate = 0;        // устоявшаяся скорость, МБ/с
+    qint64 m_deviationMs = -1;      // с какого момента скорость вне коридора
+    qint64 m_deviationBytes = 0;
+    int m_regimeChanges = 0;
+    bool m_changePending = false;
+    qint64 m_changeBytes = 0;
+    double m_changeFrom = 0;
+    double m_changeTo = 0;
+
+    bool windowFull() const;
+};
+
+// Незавершенная запись устройства по счетчикам блочного уровня
+// (/sys/class/block/<dev>/stat и inflight): отправлено приложением минус
+// завершено устройством. Кэш внутри самого носителя отсюда не виден.
+class WriteBacklog {
+public:
+    explicit WriteBacklog(const QString& devicePath);
+
+    bool isAvailable() const { return m_available; }
+    qint64 completedBytes() const;      // записано устройством с момента создания
+    int inflightWrites() const;
+    // Сколько из submittedBytes устройство еще не записало
+    qint64 pendingBytes(qint64 submittedBytes) const;
+
+private:
+    QString m_sysDir;
+    bool m_available = false;
+    quint64 m_baseSectors = 0;
+
+    bool readStat(quint64* writeIos, quint64* writeSectors) const;
+};
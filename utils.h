@@ -11,7 +11,11 @@
 #include <QStorageInfo>
 #include <QThread>
 #include <memory>
-#include <QTemporaryFile>
+#include <array>
+
+#include "mounttable.h"
+#include "probeengine.h"
+#include "imagesource.h"
 
 #include <fcntl.h>     // для open, O_WRONLY, O_SYNC
 #include <unistd.h>    // для close, write, fsync, fstat
@@ -33,6 +37,14 @@ namespace Utils {
         return QString::number(size, 'f', 2) + " " + suffixes[i];
     }
 
+    /// Оставшееся время: "42 сек", "3 мин 5 сек", "1 ч 2 мин 3 сек"
+    inline QString formatTimeLeft(qint64 seconds) {
+        if (seconds < 0) return "-";
+        if (seconds < 60) return QString("%1 сек").arg(seconds);
+        if (seconds < 3600) return QString("%1 мин %2 сек").arg(seconds / 60).arg(seconds % 60);
+        return QString("%1 ч %2 мин %3 сек").arg(seconds / 3600).arg((seconds % 3600) / 60).arg(seconds % 60);
+    }
+
     /// Определение типа файла по сигнатуре (магическим числам)
     inline QString detectFileType(const QString& path) {
         QFile file(path);
@@ -47,6 +59,7 @@ namespace Utils {
         if (header.startsWith("7z\xBC\xAF\x27\x1C")) return "7-Zip Archive";
         if (header.startsWith("BZh")) return "BZIP2 Compressed";
         if (header.startsWith("\xFD\x37\x7A\x58\x5A\x00")) return "XZ Compressed";
+        if (header.startsWith("\x28\xB5\x2F\xFD")) return "ZSTD Compressed";
         if (header.startsWith("ISO")) return "ISO Image";
         if (header.startsWith("\x53\x70\x69\x66\x66")) return "Apple Disk Image (DMG)";
         if (header.startsWith("\x45\x52\x01\x00")) return "Raw Disk Image (ERD)";
@@ -59,6 +72,7 @@ namespace Utils {
         if (ext == "iso") return "ISO Image";
         if (ext == "gz") return "GZIP Compressed";
         if (ext == "xz") return "XZ Compressed";
+        if (ext == "zst") return "ZSTD Compressed";
         if (ext == "bz2") return "BZIP2 Compressed";
         if (ext == "zip") return "ZIP Archive";
         if (ext == "7z") return "7-Zip Archive";
@@ -95,6 +109,28 @@ namespace Utils {
         return hash.result();
     }
 
+    /// CRC32 (IEEE 802.3, как в GPT и zlib); crc - значение от предыдущего фрагмента
+    inline quint32 crc32(const void* data, size_t length, quint32 crc = 0) {
+        static const auto table = []() {
+            std::array<quint32, 256> t{};
+            for (quint32 i = 0; i < 256; ++i) {
+                quint32 c = i;
+                for (int k = 0; k < 8; ++k) {
+                    c = (c & 1) ? (0xEDB88320u ^ (c >> 1)) : (c >> 1);
+                }
+                t[i] = c;
+            }
+            return t;
+        }();
+
+        const uchar* p = static_cast<const uchar*>(data);
+        crc = ~crc;
+        for (size_t i = 0; i < length; ++i) {
+            crc = table[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+        }
+        return ~crc;
+    }
+
     /// Форматирование хэша в строку HEX
     inline QString hashToHex(const QByteArray& hash) {
         return hash.toHex().toUpper();
@@ -143,47 +179,13 @@ namespace Utils {
         return -1;
     }
 
-    /// Безопасное заполнение нулями (один проход)
-    inline bool zeroFillDevice(const QString& devicePath, qint64 size = -1) {
-        int fd = ::open(devicePath.toLocal8Bit().constData(), O_WRONLY | O_SYNC);
-        if (fd < 0) return false;
-
-        // Определяем размер устройства, если не указан
-        if (size < 0) {
-            struct stat st;
-            if (::fstat(fd, &st) != 0) {
-                ::close(fd);
-                return false;
-            }
-            size = st.st_size;
-        }
-
-        const size_t bufferSize = 4 * 1024 * 1024; // 4MB
-        std::unique_ptr<char[]> zeroBuffer(new char[bufferSize]()); // Инициализируем нулями
-
-        qint64 written = 0;
-        while (written < size) {
-            size_t toWrite = qMin<size_t>(bufferSize, size - written);
-            ssize_t result = ::write(fd, zeroBuffer.get(), toWrite);
-            if (result < 0) {
-                ::close(fd);
-                return false;
-            }
-            written += result;
-        }
-
-        ::fsync(fd);
-        ::close(fd);
-        return written == size;
-    }
-
-    /// Проверка размера образа относительно устройства
-    inline bool checkImageFitsDevice(const QString& imagePath, const QString& devicePath) {
-        QFileInfo imageInfo(imagePath);
-        if (!imageInfo.exists()) return false;
+    /// Проверка размера образа (после распаковки) относительно устройства
+    inline bool checkImageFitsDevice(const ImageSource::SizeInfo& size, const QString& devicePath) {
+        if (size.fileSize <= 0) return false;
 
-        // Получаем размер образа
-        qint64 imageSize = imageInfo.size();
+        // Оценка gzip (ISIZE по модулю 4 GB) может быть занижена - такой размер
+        // неизвестен, сравнивается только размер файла, как для неизвестного
+        qint64 imageSize = size.exact ? size.imageSize : size.fileSize;
 
         // Получаем размер устройства из /sys/block
         QFileInfo devInfo(devicePath);
@@ -195,7 +197,7 @@ namespace Utils {
             quint64 sectors = sizeFile.readAll().trimmed().toULongLong(&ok);
             if (ok) {
                 quint64 deviceSizeBytes = sectors * 512;
-                return imageSize <= deviceSizeBytes;
+                return static_cast<quint64>(imageSize) <= deviceSizeBytes;
             }
         }
 
@@ -203,161 +205,16 @@ namespace Utils {
         return true; // Временно разрешаем запись
     }
 
-    /// Создание временного файла для тестирования записи
-    inline QString createTestPatternFile(qint64 sizeMB) {
-        QTemporaryFile tempFile;
-        if (tempFile.open()) {
-            QString path = tempFile.fileName();
-            tempFile.close();
-
-            QFile file(path);
-            if (file.open(QIODevice::WriteOnly)) {
-                // Создаем паттерн данных для тестирования
-                const int patternSize = 1024 * 1024; // 1MB
-                QByteArray pattern(patternSize, 0);
-
-                // Заполняем паттерн данными
-                for (int i = 0; i < patternSize; i++) {
-                    pattern[i] = static_cast<char>(i % 256);
-                }
-
-                for (qint64 i = 0; i < sizeMB; i++) {
-                    if (file.write(pattern) != patternSize) {
-                        return QString();
-                    }
-                }
-
-                file.close();
-                return path;
-            }
-        }
-        return QString();
-    }
-
     /// Получение информации о файловой системе устройства
     inline QString getFilesystemType(const QString& devicePath) {
-        QFile mountsFile("/proc/mounts");
-        if (!mountsFile.open(QIODevice::ReadOnly)) return "unknown";
-
-        QTextStream in(&mountsFile);
-        while (!in.atEnd()) {
-            QString line = in.readLine();
-            if (line.startsWith(devicePath + " ")) {
-                QStringList parts = line.split(' ', Qt::SkipEmptyParts);
-                if (parts.size() >= 3) {
-                    return parts[2]; // Тип файловой системы
-                }
-            }
-        }
-
-        // Проверяем через чтение суперблока
-        QFile devFile(devicePath);
-        if (!devFile.open(QIODevice::ReadOnly)) {
-            return "unknown";
-        }
-
-        // Читаем первые 2048 байт (где обычно находится суперблок)
-        const int BUFFER_SIZE = 2048;
-        char buffer[BUFFER_SIZE];
-        qint64 bytesRead = devFile.read(buffer, BUFFER_SIZE);
-        devFile.close();
-
-        if (bytesRead < 512) {
-            return "unknown";
-        }
-
-        // Вспомогательная функция для безопасной проверки памяти
-        auto safeMemcmp = [&](int offset, const char* pattern, int length) -> bool {
-            if (offset + length > bytesRead) return false;
-            return memcmp(buffer + offset, pattern, length) == 0;
-        };
-
-        // Проверяем сигнатуры файловых систем
-        // FAT32
-        if (safeMemcmp(0x52, "FAT32", 5)) {
-            return "FAT32";
-        }
-        // FAT16
-        if (safeMemcmp(0x36, "FAT16", 5)) {
-            return "FAT16";
-        }
-        // FAT12
-        if (safeMemcmp(0x36, "FAT12", 5)) {
-            return "FAT12";
-        }
-        // NTFS
-        if (safeMemcmp(0x03, "NTFS", 4)) {
-            return "NTFS";
-        }
-        // ext2/3/4 (сигнатура 0x53 0xEF)
-        if (safeMemcmp(0x438, "\x53\xEF", 2)) {
-            // Проверяем версию ext (только если есть достаточно данных)
-            if (bytesRead >= 0x458 + 4) {
-                quint32 sRevLevel = *reinterpret_cast<quint32*>(buffer + 0x458);
-                if (sRevLevel == 0 || sRevLevel == 1) return "ext2/3";
-                if (sRevLevel == 2) return "ext4";
-            }
-            return "ext";
-        }
-        // exFAT
-        if (safeMemcmp(0x03, "EXFAT", 5)) {
-            return "exFAT";
-        }
-        // HFS/HFS+
-        if (safeMemcmp(0x400, "BD", 2)) {
-            return "HFS/HFS+";
-        }
-        // ISO9660 (CD/DVD)
-        if (safeMemcmp(0x8001, "CD001", 5)) {
-            return "ISO9660";
-        }
-        // UDF
-        if (safeMemcmp(0x8001, "BEA01", 5)) {
-            return "UDF";
-        }
-
-        // Проверяем таблицу разделов
-        // MBR signature
-        if (safeMemcmp(0x1FE, "\x55\xAA", 2)) {
-            // Проверяем тип раздела (только если есть достаточно данных)
-            if (bytesRead >= 0x1C2 + 1) {
-                unsigned char partitionType = buffer[0x1C2];
-                switch (partitionType) {
-                    case 0x01: return "FAT12";
-                    case 0x04: case 0x06: case 0x0E: return "FAT16";
-                    case 0x0B: case 0x0C: return "FAT32";
-                    case 0x07: return "NTFS/exFAT/HPFS";
-                    case 0x83: return "Linux";
-                    case 0x82: return "Linux swap";
-                    case 0x8E: return "Linux LVM";
-                    case 0xAF: return "macOS HFS";
-                    case 0xEE: return "GPT protective";
-                    default: return "MBR partition";
-                }
-            }
-            return "MBR";
-        }
-
-        // GPT signature
-        if (safeMemcmp(0x200, "EFI PART", 8)) {
-            return "GPT partition";
-        }
-
-        // Проверяем, пустое ли устройство (все нули)
-        bool allZeros = true;
-        qint64 checkSize = qMin<qint64>(512, bytesRead);
-        for (int i = 0; i < checkSize; i++) {
-            if (buffer[i] != 0) {
-                allZeros = false;
-                break;
-            }
-        }
-
-        if (allZeros) {
-            return "empty";
+        // Смонтированное устройство: тип берем из кэша таблицы монтирования
+        QList<MountEntry> mounts = MountTable::instance().mountsFor(devicePath, false);
+        if (!mounts.isEmpty()) {
+            return mounts.first().fsType;
         }
 
-        return "unknown";
+        // Таблица разделов и ФС определяются движком сигнатур
+        return ProbeEngine::probe(devicePath).summary();
     }
 
     /// Проверка, является ли файл сжатым архивом
@@ -0,0 +1,371 @@
+// wipejob.cpp
+#include "wipejob.h"
+#include "utils.h"
+#include "bufferpool.h"
+#include <QElapsedTimer>
+#include <QList>
+#include <QDebug>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+
+namespace {
+
+// Диапазон для одного ioctl: достаточно крупный, чтобы не дробить
+// запросы устройства, и достаточно мелкий для прогресса и отмены
+const quint64 IoctlStep = 256ULL * 1024 * 1024;
+
+// Начало устройства и каждого раздела очищается целиком: загрузочный код,
+// таблица разделов, метки LVM/RAID, дескрипторы ISO укладываются в одну запись
+const quint64 HeadWipeSize = 1024 * 1024;
+
+// Соседние диапазоны ближе этого зазора сливаются в одну запись
+const quint64 MergeGap = 64 * 1024;
+
+} // namespace
+
+WipeJob::WipeJob(const Config& cfg, QObject* parent)
+: QThread(parent), m_cfg(cfg) {}
+
+void WipeJob::cancel() {
+    m_cancelled.store(true, std::memory_order_release);
+}
+
+QString WipeJob::modeName(Mode mode) {
+    switch (mode) {
+        case Auto: return "Авто";
+        case Discard: return "Discard (TRIM)";
+        case ZeroOut: return "Обнуление";
+        case SecureDiscard: return "Безопасный discard";
+        case Overwrite: return "Перезапись нулями";
+        case Signatures: return "Быстрая (только сигнатуры)";
+    }
+    return QString();
+}
+
+WipeJob::Mode WipeJob::resolveMode(const DeviceTopology& topo) {
+    // Discard быстрее, но не гарантирует чтение нулей после очистки,
+    // поэтому автоматически выбирается только аппаратное обнуление
+    if (topo.writeZeroesMaxBytes > 0) return ZeroOut;
+    return Overwrite;
+}
+
+void WipeJob::run() {
+    m_cancelled.store(false, std::memory_order_release);
+    emit progress(0, "Проверка устройства...", 0, "-");
+
+    auto [unmountSuccess, unmountMessage] = DeviceManager::unmountAll(m_cfg.devicePath);
+    if (!unmountSuccess) {
+        emit finished(false, QString("Ошибка размонтирования:\n%1").arg(unmountMessage));
+        return;
+    }
+
+    const DeviceTopology topo = DeviceManager::readTopology(m_cfg.devicePath);
+    Mode mode = m_cfg.mode == Auto ? resolveMode(topo) : m_cfg.mode;
+
+    // O_EXCL: устройство не должно использоваться никем другим
+    const QByteArray path = m_cfg.devicePath.toLocal8Bit();
+    int flags = O_RDWR | O_CLOEXEC | O_EXCL;
+    const bool direct = mode == Overwrite || mode == Signatures;
+    int fd = ::open(path.constData(), flags | (direct ? O_DIRECT : 0));
+    if (fd < 0 && direct && errno == EINVAL) {
+        fd = ::open(path.constData(), flags);
+    }
+    if (fd < 0) {
+        emit finished(false, QString("Ошибка открытия устройства: %1").arg(strerror(errno)));
+        return;
+    }
+
+    quint64 size = 0;
+    if (::ioctl(fd, BLKGETSIZE64, &size) != 0 || size == 0) {
+        ::close(fd);
+        emit finished(false, QString("Не удалось определить размер устройства: %1").arg(strerror(errno)));
+        return;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    QString error;
+    bool ok = false;
+
+    if (mode == Discard || mode == ZeroOut || mode == SecureDiscard) {
+        emit progress(5, QString("Очистка: %1").arg(modeName(mode)), 0, "-");
+        unsigned long request = mode == Discard ? BLKDISCARD : mode == ZeroOut ? BLKZEROOUT : BLKSECDISCARD;
+        quint64 step = IoctlStep;
+        if (mode != ZeroOut && topo.discardMaxBytes > 0) {
+            step = qMax<quint64>(topo.discardMaxBytes, IoctlStep / 4);
+        }
+        ok = wipeWithIoctl(fd, request, size, step, &error);
+        // Отмена тоже возвращает false без текста ошибки - это не отказ устройства
+        const bool refused = !ok && error.isEmpty() && !m_cancelled.load(std::memory_order_acquire);
+
+        // Авторежим без поддержки на деле (sysfs обещал, устройство отказало)
+        if (refused && m_cfg.mode == Auto) {
+            qWarning() << "Аппаратное обнуление недоступно, перезапись нулями";
+            mode = Overwrite;
+            ::close(fd);
+            fd = ::open(path.constData(), flags | O_DIRECT);
+            if (fd < 0) fd = ::open(path.constData(), flags);
+            if (fd < 0) {
+                emit finished(false, QString("Ошибка открытия устройства: %1").arg(strerror(errno)));
+                return;
+            }
+        } else if (refused) {
+            error = QString("Устройство не поддерживает режим \"%1\"").arg(modeName(mode));
+        }
+    }
+
+    if (mode == Signatures) {
+        emit progress(5, QString("Очистка: %1").arg(modeName(mode)), 0, "-");
+        ok = wipeSignatures(fd, size, topo, &error);
+    }
+
+    if (mode == Overwrite) {
+        emit progress(5, QString("Очистка: %1").arg(modeName(mode)), 0, "-");
+        ok = overwrite(fd, size, topo, &error);
+    }
+
+    if (ok && ::fsync(fd) != 0) {
+        ok = false;
+        error = QString("Ошибка синхронизации: %1").arg(strerror(errno));
+    }
+    ::close(fd);
+
+    if (m_cancelled.load(std::memory_order_acquire)) {
+        emit finished(false, "Операция отменена");
+        return;
+    }
+    if (!ok) {
+        emit finished(false, error);
+        return;
+    }
+
+    const double seconds = timer.elapsed() / 1000.0;
+    emit finished(true, QString("Очистка завершена (%1): %2 за %3 сек")
+                  .arg(modeName(mode))
+                  .arg(Utils::formatSize(static_cast<qint64>(size)))
+                  .arg(seconds, 0, 'f', 1));
+}
+
+bool WipeJob::wipeWithIoctl(int fd, unsigned long request, quint64 size, quint64 step, QString* error) {
+    QElapsedTimer timer;
+    timer.start();
+
+    for (quint64 offset = 0; offset < size; offset += step) {
+        if (m_cancelled.load(std::memory_order_acquire)) return false;
+
+        uint64_t range[2] = { offset, qMin(step, size - offset) };
+        if (::ioctl(fd, request, range) != 0) {
+            // EOPNOTSUPP на первом диапазоне - режим не поддерживается (error пуст)
+            if (offset == 0 && (errno == EOPNOTSUPP || errno == ENOTTY || errno == EINVAL)) return false;
+            *error = QString("Ошибка очистки по смещению %1: %2").arg(offset).arg(strerror(errno));
+            return false;
+        }
+        reportProgress(offset + range[1], size, timer.elapsed(), "Очистка...");
+    }
+    return true;
+}
+
+bool WipeJob::overwrite(int fd, quint64 size, const DeviceTopology& topo, QString* error) {
+    // Несколько запросов в полете: флеш-контроллеры распараллеливают запись
+    // по каналам, для HDD параллелизм только добавляет перемещения головки
+    int workers = m_cfg.parallelRequests > 0 ? m_cfg.parallelRequests : (topo.rotational ? 1 : 4);
+
+    const quint64 granule = topo.ioGranularity();
+    quint64 chunk = m_cfg.chunkSize > 0 ? static_cast<quint64>(m_cfg.chunkSize) : 0;
+    if (chunk == 0) {
+        quint64 maxRequest = topo.maxSectorsKb > 0 ? topo.maxSectorsKb * 1024ULL : 512 * 1024ULL;
+        chunk = qBound<quint64>(1024 * 1024, maxRequest * 4, 8 * 1024 * 1024);
+    }
+    chunk = (chunk + granule - 1) / granule * granule;
+
+    // Буфер пула выровнен по странице; при тесном бюджете он меньше запрошенного
+    BufferPool::Buffer buffer = BufferPool::instance().acquire(static_cast<qint64>(chunk), &m_cancelled);
+    if (m_cancelled.load(std::memory_order_acquire)) return false;
+    if (static_cast<quint64>(buffer.size()) < granule) {
+        *error = QString("Не удалось выделить %1 выровненной памяти").arg(Utils::formatSize(chunk));
+        return false;
+    }
+    chunk = qMin<quint64>(chunk, static_cast<quint64>(buffer.size()) / granule * granule);
+    char* zeros = buffer.data();
+    memset(zeros, 0, chunk);
+
+    emit progress(5, QString("Перезапись: %1 запроса по %2").arg(workers).arg(Utils::formatSize(chunk)), 0, "-");
+
+    // Потоки разбирают блоки по общему счетчику, поэтому запись идет
+    // почти последовательно независимо от числа потоков
+    std::atomic<quint64> nextChunk{0};
+    std::atomic<quint64> written{0};
+    std::atomic<int> failedErrno{0};
+    std::atomic<quint64> failedOffset{0};
+
+    QList<QThread*> threads;
+    for (int i = 0; i < workers; ++i) {
+        QThread* thread = QThread::create([&]() {
+            for (;;) {
+                if (m_cancelled.load(std::memory_order_acquire) || failedErrno.load() != 0) return;
+                const quint64 offset = nextChunk.fetch_add(1) * chunk;
+                if (offset >= size) return;
+                const size_t length = static_cast<size_t>(qMin(chunk, size - offset));
+
+                size_t done = 0;
+                while (done < length) {
+                    ssize_t n = ::pwrite(fd, static_cast<const char*>(zeros) + done, length - done, offset + done);
+                    if (n < 0 && errno == EINTR) continue;
+                    if (n <= 0) {
+                        failedOffset.store(offset + done);
+                        failedErrno.store(n < 0 ? errno : EIO);
+                        return;
+                    }
+                    done += n;
+                }
+                written.fetch_add(length);
+            }
+        });
+        threads.append(thread);
+        thread->start();
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    for (QThread* thread : threads) {
+        while (!thread->wait(250)) {
+            reportProgress(written.load(), size, timer.elapsed(), "Перезапись нулями...");
+        }
+        delete thread;
+    }
+    buffer.reset();
+
+    if (failedErrno.load() != 0) {
+        *error = QString("Ошибка записи по смещению %1: %2").arg(failedOffset.load()).arg(strerror(failedErrno.load()));
+        return false;
+    }
+    if (m_cancelled.load(std::memory_order_acquire)) return false;
+
+    reportProgress(size, size, timer.elapsed(), "Перезапись нулями...");
+    return true;
+}
+
+QList<std::pair<quint64, quint64>> WipeJob::signatureRanges(const ProbeResult& probe,
+                                                           quint64 deviceSize,
+                                                           quint64 align) {
+    QList<std::pair<quint64, quint64>> raw;
+    auto add = [&](quint64 offset, quint64 length) {
+        if (offset >= deviceSize || length == 0) return;
+        quint64 start = offset / align * align;
+        quint64 end = qMin(deviceSize, (offset + length + align - 1) / align * align);
+        raw.append({start, end - start});
+    };
+
+    // Начало устройства и разделов
+    add(0, HeadWipeSize);
+    for (const ProbePartition& part : probe.partitions) {
+        add(part.startBytes, qMin<quint64>(HeadWipeSize, part.sizeBytes));
+    }
+
+    for (const ProbeSignature& sig : probe.signatures) {
+        if (sig.offset >= 0) add(static_cast<quint64>(sig.offset), static_cast<quint64>(sig.length));
+    }
+
+    // Конец устройства: резервная GPT (заголовок + 16 KB записей при любом
+    // размере сектора) и суперблоки md 0.90/1.0, которые проверка не читает
+    const quint64 tail = 64 * 1024;
+    add(deviceSize > tail ? deviceSize - tail : 0, tail);
+    if (deviceSize >= 128 * 1024) {
+        add((deviceSize & ~0xFFFFULL) - 0x10000, 4096);   // md 0.90
+    }
+
+    std::sort(raw.begin(), raw.end());
+    QList<std::pair<quint64, quint64>> merged;
+    for (const auto& range : raw) {
+        if (!merged.isEmpty()) {
+            auto& last = merged.last();
+            const quint64 lastEnd = last.first + last.second;
+            if (range.first <= lastEnd + MergeGap) {
+                last.second = qMax(lastEnd, range.first + range.second) - last.first;
+                continue;
+            }
+        }
+        merged.append(range);
+    }
+    return merged;
+}
+
+bool WipeJob::wipeSignatures(int fd, quint64 size, const DeviceTopology& topo, QString* error) {
+    // Проверка читает устройство сама; O_EXCL другого читателя не блокирует
+    const ProbeResult probe = ProbeEngine::probe(m_cfg.devicePath);
+    if (!probe.ok) {
+        *error = QString("Не удалось прочитать устройство: %1").arg(probe.error);
+        return false;
+    }
+
+    const quint64 align = qMax<quint64>(topo.alignment(), 4096);
+    const auto ranges = signatureRanges(probe, size, align);
+
+    quint64 maxLength = 0, total = 0;
+    for (const auto& range : ranges) {
+        maxLength = qMax(maxLength, range.second);
+        total += range.second;
+    }
+
+    BufferPool::Buffer buffer = BufferPool::instance().acquire(static_cast<qint64>(maxLength), &m_cancelled);
+    if (static_cast<quint64>(buffer.size()) < maxLength) {
+        *error = QString("Не удалось выделить %1 выровненной памяти").arg(Utils::formatSize(maxLength));
+        return false;
+    }
+    char* zeros = buffer.data();
+    memset(zeros, 0, maxLength);
+
+    emit progress(10, QString("Найдено сигнатур: %1, запросов записи: %2 (%3)")
+                  .arg(probe.signatures.size()).arg(ranges.size())
+                  .arg(Utils::formatSize(static_cast<qint64>(total))), 0, "-");
+
+    QElapsedTimer timer;
+    timer.start();
+    quint64 done = 0;
+    bool ok = true;
+    for (const auto& range : ranges) {
+        size_t written = 0;
+        while (written < range.second) {
+            ssize_t n = ::pwrite(fd, static_cast<const char*>(zeros) + written,
+                                 range.second - written, range.first + written);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                *error = QString("Ошибка записи по смещению %1: %2").arg(range.first + written).arg(strerror(errno));
+                ok = false;
+                break;
+            }
+            written += n;
+        }
+        if (!ok) break;
+        done += range.second;
+        reportProgress(done, total, timer.elapsed(), "Очистка сигнатур...");
+    }
+    buffer.reset();
+    if (!ok) return false;
+
+    // Ядро должно забыть старые разделы; занятый диск не ошибка
+    ::fsync(fd);
+    if (::ioctl(fd, BLKRRPART, 0) != 0 && errno != EINVAL) {
+        qWarning() << "BLKRRPART после очистки сигнатур:" << strerror(errno);
+    }
+    return true;
+}
+
+void WipeJob::reportProgress(quint64 done, quint64 total, qint64 elapsedMs, const QString& status) {
+    int percent = 5 + static_cast<int>(done * 90 / qMax<quint64>(total, 1));
+    double speed = elapsedMs > 0 ? (done / 1024.0 / 1024.0) / (elapsedMs / 1000.0) : 0;
+    QString timeLeft = "-";
+    if (speed > 0.1) {
+        timeLeft = Utils::formatTimeLeft(static_cast<qint64>((total - done) / (speed * 1024 * 1024)));
+    }
+    emit progress(percent, QString("%1 %2 из %3").arg(status)
+                  .arg(Utils::formatSize(static_cast<qint64>(done)))
+                  .arg(Utils::formatSize(static_cast<qint64>(total))), speed, timeLeft);
+}
@@ -0,0 +1,66 @@
+// wipejob.h
+#pragma once
+
+#include <QThread>
+#include <QString>
+#include <QList>
+#include <atomic>
+#include <utility>
+
+#include "devicemanager.h"
+#include "probeengine.h"
+
+// Очистка устройства. Режимы, которые выполняет само устройство
+// (discard, write zeroes, secure discard), отдаются ядру диапазонами;
+// перезапись нулями выполняется несколькими параллельными запросами.
+// Быстрая очистка затирает только найденные ProbeEngine сигнатуры.
+class WipeJob : public QThread {
+    Q_OBJECT
+
+public:
+    enum Mode {
+        Auto,           // самый быстрый режим, гарантирующий чтение нулей
+        Discard,        // BLKDISCARD: освободить блоки (содержимое не гарантируется)
+        ZeroOut,        // BLKZEROOUT: обнуление (аппаратное, если поддерживается)
+        SecureDiscard,  // BLKSECDISCARD: безопасное удаление (eMMC/SD)
+        Overwrite,      // запись нулей с хоста
+        Signatures      // только известные сигнатуры (аналог wipefs -a)
+    };
+
+    struct Config {
+        QString devicePath;
+        Mode mode = Auto;
+        int parallelRequests = 0;   // 0 - по топологии (1 для HDD, 4 для флеш)
+        qint64 chunkSize = 0;       // 0 - по топологии устройства
+    };
+
+    explicit WipeJob(const Config& cfg, QObject* parent = nullptr);
+    void cancel();
+
+    static QString modeName(Mode mode);
+
+    // Режим, который будет выбран для Auto
+    static Mode resolveMode(const DeviceTopology& topo);
+
+    // Диапазоны (смещение, длина), покрывающие все сигнатуры результата
+    // проверки, выровненные по align и объединенные в минимум запросов
+    static QList<std::pair<quint64, quint64>> signatureRanges(const ProbeResult& probe,
+                                                             quint64 deviceSize,
+                                                             quint64 align);
+
+signals:
+    void progress(int percent, const QString& status, double speedMBps, const QString& timeLeft);
+    void finished(bool success, const QString& message);
+
+protected:
+    void run() override;
+
+private:
+    Config m_cfg;
+    std::atomic<bool> m_cancelled{false};
+
+    bool wipeWithIoctl(int fd, unsigned long request, quint64 size, quint64 step, QString* error);
+    bool overwrite(int fd, quint64 size, const DeviceTopology& topo, QString* error);
+    bool wipeSignatures(int fd, quint64 size, const DeviceTopology& topo, QString* error);
+    void reportProgress(quint64 done, quint64 total, qint64 elapsedMs, const QString& status);
+};